@@ -0,0 +1,488 @@
+/********************************************************************
+
+ The aio module moves file I/O onto threads of its own, so that reading
+ and writing overlap with the coding instead of adding to it.
+
+ An AioReader owns a ring of chunks.  Its thread fills them in order, as
+ far ahead of the user as the ring allows, and the user takes them in the
+ same order and gives each back once done with it.  Every chunk is filled
+ completely, as fread would, so only the last one of the file is short;
+ that keeps the chunks the same no matter how the input trickles in.  The
+ thread reads a duplicate of the descriptor with read(), so it never
+ touches the FILE.  A read on a pipe may wait for as long as the writer at
+ the other end likes, so the thread is detached and shares its state with
+ the AioReader through a count of references: whichever of the two lets
+ go last frees it, and freeing an AioReader never waits.
+
+ An AioWriter works the other way around: the user fills a chunk, submits
+ it and goes on filling the next, while the thread writes the submitted
+ chunks in order with fwrite.  The user only waits when every chunk of the
+ ring is still queued, or when it asks for everything to be written
+ (aio_writer_drain).  An error writing is kept and reported on the next
+ call, as a FILE does.
+
+ Plain threads are used rather than io_uring or POSIX AIO: a thread that
+ waits in read() or fwrite() overlaps just as well with chunks this large,
+ works on pipes and terminals as well as on files, and needs nothing
+ beyond what the thread pool already uses.
+
+ *******************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include "aio.h"
+#include "stats.h"
+
+
+struct AioReader {
+    pthread_mutex_t lock;    // Protects everything below
+    pthread_cond_t  filled;  // Signalled when a chunk is filled
+    pthread_cond_t  space;   // Signalled when a chunk is given back or on quit
+    unsigned char **bufs;    // The chunks
+    long           *lens;    // Bytes in each chunk
+    size_t          chunk;   // Size of a chunk
+    int             depth;   // Number of chunks
+    int             fd;      // The descriptor the thread reads
+    unsigned long   nfilled; // Chunks filled so far
+    unsigned long   ntaken;  // Chunks handed to the user so far
+    unsigned long   nfreed;  // Chunks given back so far
+    int             done;    // Set once the last chunk is filled
+    long            end;     // What comes after it: 0, or -1 on an error
+    int             quit;    // Set when the thread should stop
+    int             refs;    // The user and the thread, while they hold on
+};
+
+struct AioWriter {
+    pthread_t       thread;  // Writes the queued chunks
+    pthread_mutex_t lock;    // Protects everything below
+    pthread_cond_t  queued;  // Signalled when a chunk is submitted or on quit
+    pthread_cond_t  written; // Signalled when a chunk has been written
+    unsigned char **bufs;    // The chunks
+    size_t         *lens;    // Bytes to write from each chunk
+    size_t          chunk;   // Size of a chunk
+    int             depth;   // Number of chunks
+    FILE           *fp;      // The file written
+    size_t          used;    // Bytes aio_writer_write put in the next chunk
+    unsigned long   nqueued; // Chunks submitted so far
+    unsigned long   nwritten;// Chunks written so far
+    int             error;   // Set once a write failed
+    int             quit;    // Set when the thread should stop
+};
+
+
+/**
+ * Frees `depth` chunks and the array holding them.
+ */
+static void free_bufs (unsigned char **bufs, int depth)
+{
+    if (bufs == NULL)
+        return;
+    for (int i = 0; i < depth; i++)
+        free(bufs[i]);
+    free(bufs);
+}
+
+
+/**
+ * Returns an array of `depth` chunks of `chunk` bytes or NULL if there is
+ * an error.
+ */
+static unsigned char **new_bufs (size_t chunk, int depth)
+{
+    unsigned char **bufs = (unsigned char **)(calloc(depth,
+                                                     sizeof(unsigned char *)));
+    if (bufs == NULL)
+        return NULL;
+    for (int i = 0; i < depth; i++)
+    {
+        bufs[i] = (unsigned char *)(malloc(chunk));
+        if (bufs[i] == NULL)
+        {
+            free_bufs(bufs, depth);
+            return NULL;
+        }
+    }
+    return bufs;
+}
+
+
+/**
+ * Drops one reference to the state of an AioReader, freeing it with the
+ * last one.  Called with the lock held; releases it.
+ */
+static void reader_unref (AioReader *reader)
+{
+    int last = --reader->refs == 0;
+    pthread_mutex_unlock(&reader->lock);
+    if (!last)
+        return;
+
+    close(reader->fd);
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->filled);
+    pthread_cond_destroy(&reader->space);
+    free_bufs(reader->bufs, reader->depth);
+    free(reader->lens);
+    free(reader);
+}
+
+
+/**
+ * Fills the `chunk` bytes at `buf` from `fd`, stopping early only at the
+ * end of the file.  Returns the number of bytes read or -1 on an error.
+ */
+static long read_chunk (int fd, unsigned char *buf, size_t chunk)
+{
+    size_t n = 0;
+    while (n < chunk)
+    {
+        stats_add(STATS_READ_CALLS, 1);
+        ssize_t got = read(fd, buf + n, chunk - n);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            break;
+        n += (size_t)got;
+    }
+    return (long)n;
+}
+
+
+/**
+ * The main loop of the thread of an AioReader.
+ */
+static void *reader_main (void *arg)
+{
+    AioReader *reader = (AioReader *)arg;
+
+    pthread_mutex_lock(&reader->lock);
+    for (;;)
+    {
+        while (reader->nfilled - reader->nfreed == (unsigned long)reader->depth
+               && !reader->quit)
+            pthread_cond_wait(&reader->space, &reader->lock);
+        if (reader->quit)
+            break;
+
+        // Fill the next chunk without holding the lock; the user does not
+        // look at it until nfilled says it is there:
+        int slot = (int)(reader->nfilled % reader->depth);
+        pthread_mutex_unlock(&reader->lock);
+        long len = read_chunk(reader->fd, reader->bufs[slot], reader->chunk);
+        pthread_mutex_lock(&reader->lock);
+
+        // A short chunk is the last one; an empty one is none at all:
+        if (len > 0)
+        {
+            reader->lens[slot] = len;
+            reader->nfilled++;
+        }
+        if (len < (long)reader->chunk)
+        {
+            reader->done = 1;
+            reader->end  = len < 0 ? -1 : 0;
+        }
+        pthread_cond_signal(&reader->filled);
+        if (reader->done)
+            break;
+    }
+    reader_unref(reader);
+    return NULL;
+}
+
+
+/**
+ * Returns a new AioReader that reads `fp` in chunks of `chunk` bytes,
+ * keeping up to `depth` of them filled or held, or NULL if there is an
+ * error.
+ */
+AioReader *aio_reader_new (FILE *fp, size_t chunk, int depth)
+{
+    if (chunk == 0 || chunk > (size_t)LONG_MAX || depth < 1)
+        return NULL;
+    AioReader *reader = (AioReader *)(calloc(1, sizeof(AioReader)));
+    if (reader == NULL)
+        return NULL;
+    reader->bufs  = new_bufs(chunk, depth);
+    reader->lens  = (long *)(calloc(depth, sizeof(long)));
+    reader->chunk = chunk;
+    reader->depth = depth;
+    reader->fd    = dup(fileno(fp));
+    if (reader->bufs == NULL || reader->lens == NULL || reader->fd < 0)
+    {
+        if (reader->fd >= 0)
+            close(reader->fd);
+        free_bufs(reader->bufs, depth);
+        free(reader->lens);
+        free(reader);
+        return NULL;
+    }
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->filled, NULL);
+    pthread_cond_init(&reader->space, NULL);
+    reader->refs = 2;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int res = pthread_create(&thread, &attr, reader_main, reader);
+    pthread_attr_destroy(&attr);
+    if (res != 0)
+    {
+        pthread_mutex_lock(&reader->lock);
+        reader->refs = 1;
+        reader_unref(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+
+/**
+ * Points `data` at the next chunk of the file and returns its length.
+ * Returns 0 at the end of the file and -1 if reading failed.
+ */
+long aio_reader_next (AioReader *reader, const unsigned char **data)
+{
+    pthread_mutex_lock(&reader->lock);
+    while (reader->ntaken == reader->nfilled && !reader->done)
+        pthread_cond_wait(&reader->filled, &reader->lock);
+
+    // Once all chunks are taken the end or the error is seen every time:
+    long len = reader->end;
+    if (reader->ntaken < reader->nfilled)
+    {
+        int slot = (int)(reader->ntaken % reader->depth);
+        len = reader->lens[slot];
+        *data = reader->bufs[slot];
+        reader->ntaken++;
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return len;
+}
+
+
+/**
+ * Gives back the oldest chunk held.
+ */
+void aio_reader_release (AioReader *reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    if (reader->nfreed < reader->ntaken)
+    {
+        reader->nfreed++;
+        pthread_cond_signal(&reader->space);
+    }
+    pthread_mutex_unlock(&reader->lock);
+}
+
+
+/**
+ * Stops the AioReader and frees it without waiting for its thread.
+ */
+void aio_reader_free (AioReader *reader)
+{
+    if (reader == NULL)
+        return;
+    pthread_mutex_lock(&reader->lock);
+    reader->quit = 1;
+    pthread_cond_signal(&reader->space);
+    reader_unref(reader);
+}
+
+
+/**
+ * The main loop of the thread of an AioWriter.
+ */
+static void *writer_main (void *arg)
+{
+    AioWriter *writer = (AioWriter *)arg;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;)
+    {
+        while (writer->nwritten == writer->nqueued && !writer->quit)
+            pthread_cond_wait(&writer->queued, &writer->lock);
+        if (writer->nwritten == writer->nqueued)
+            break;
+
+        // Write the oldest chunk without holding the lock; the user does
+        // not touch it again until nwritten says it is done:
+        int slot = (int)(writer->nwritten % writer->depth);
+        size_t len = writer->lens[slot];
+        int failed = writer->error;
+        pthread_mutex_unlock(&writer->lock);
+        if (!failed)
+            stats_add(STATS_WRITE_CALLS, 1);
+        if (!failed && fwrite(writer->bufs[slot], 1, len, writer->fp) < len)
+            failed = 1;
+        pthread_mutex_lock(&writer->lock);
+
+        writer->error |= failed;
+        writer->nwritten++;
+        pthread_cond_broadcast(&writer->written);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+
+/**
+ * Returns a new AioWriter that writes to `fp` with `depth` chunks of `chunk`
+ * bytes, or NULL if there is an error.
+ */
+AioWriter *aio_writer_new (FILE *fp, size_t chunk, int depth)
+{
+    if (chunk == 0 || depth < 1)
+        return NULL;
+    AioWriter *writer = (AioWriter *)(calloc(1, sizeof(AioWriter)));
+    if (writer == NULL)
+        return NULL;
+    writer->bufs  = new_bufs(chunk, depth);
+    writer->lens  = (size_t *)(calloc(depth, sizeof(size_t)));
+    writer->chunk = chunk;
+    writer->depth = depth;
+    writer->fp    = fp;
+    if (writer->bufs == NULL || writer->lens == NULL)
+    {
+        free_bufs(writer->bufs, depth);
+        free(writer->lens);
+        free(writer);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->queued, NULL);
+    pthread_cond_init(&writer->written, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_main, writer) != 0)
+    {
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->queued);
+        pthread_cond_destroy(&writer->written);
+        free_bufs(writer->bufs, depth);
+        free(writer->lens);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+
+/**
+ * Returns the chunk to fill next, waiting until it has been written out.
+ */
+unsigned char *aio_writer_buffer (AioWriter *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    while (writer->nqueued - writer->nwritten == (unsigned long)writer->depth)
+        pthread_cond_wait(&writer->written, &writer->lock);
+    unsigned char *buf = writer->bufs[writer->nqueued % writer->depth];
+    pthread_mutex_unlock(&writer->lock);
+    return buf;
+}
+
+
+/**
+ * Queues the first `len` bytes of the chunk from aio_writer_buffer.
+ * Returns EOF if an earlier write failed.
+ */
+int aio_writer_submit (AioWriter *writer, size_t len)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->lens[writer->nqueued % writer->depth] = len;
+    writer->nqueued++;
+    writer->used = 0;
+    int error = writer->error;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+    return error ? EOF : 0;
+}
+
+
+/**
+ * Copies the `n` bytes at `src` into chunks, queueing each one that fills
+ * up.  Returns EOF if an earlier write failed.
+ */
+int aio_writer_write (AioWriter *writer, const void *src, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)src;
+    while (n > 0)
+    {
+        unsigned char *buf = aio_writer_buffer(writer);
+        size_t len = writer->chunk - writer->used;
+        if (len > n)
+            len = n;
+        memcpy(buf + writer->used, p, len);
+        writer->used += len;
+        p += len;
+        n -= len;
+        if (writer->used == writer->chunk &&
+            aio_writer_submit(writer, writer->chunk) == EOF)
+            return EOF;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    int error = writer->error;
+    pthread_mutex_unlock(&writer->lock);
+    return error ? EOF : 0;
+}
+
+
+/**
+ * Waits until everything queued has been written and flushed.  Returns EOF
+ * if a write failed.
+ */
+int aio_writer_drain (AioWriter *writer)
+{
+    if (writer->used > 0)
+        aio_writer_submit(writer, writer->used);
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->nwritten != writer->nqueued)
+        pthread_cond_wait(&writer->written, &writer->lock);
+    int error = writer->error;
+    pthread_mutex_unlock(&writer->lock);
+
+    // The thread is idle now, so the FILE is ours for the moment:
+    if (!error && fflush(writer->fp) == EOF)
+        error = 1;
+    return error ? EOF : 0;
+}
+
+
+/**
+ * Writes what is queued, stops the AioWriter and frees it.  Returns EOF if
+ * a write failed.
+ */
+int aio_writer_free (AioWriter *writer)
+{
+    if (writer == NULL)
+        return 0;
+    if (writer->used > 0)
+        aio_writer_submit(writer, writer->used);
+
+    pthread_mutex_lock(&writer->lock);
+    writer->quit = 1;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    int error = writer->error;
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->queued);
+    pthread_cond_destroy(&writer->written);
+    free_bufs(writer->bufs, writer->depth);
+    free(writer->lens);
+    free(writer);
+    return error ? EOF : 0;
+}
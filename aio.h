@@ -0,0 +1,96 @@
+#ifndef __AIO_H
+#define __AIO_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * The number of chunks bits-io keeps in flight for a file it reads or
+ * writes through an AioReader or AioWriter.
+ */
+#define AIO_DEPTH 4
+
+
+/**
+ * An AioReader reads a file ahead of its user on a thread of its own, into
+ * a ring of chunks.  The user takes the chunks in order and gives each back
+ * when done with it, which frees it for the reader to fill again.
+ */
+typedef struct AioReader AioReader;
+
+/**
+ * An AioWriter writes a file behind its user on a thread of its own.  The
+ * user fills one chunk of a ring at a time and submits it; the writer
+ * writes submitted chunks in order and hands them back empty.
+ */
+typedef struct AioWriter AioWriter;
+
+
+/**
+ * Returns a new AioReader that reads `fp` in chunks of `chunk` bytes,
+ * keeping up to `depth` of them filled or held, or NULL if there is an
+ * error.  Nothing else may read `fp` while the AioReader exists, and
+ * nothing may have been read from it through stdio before, as that would
+ * still be in the buffer of the FILE.
+ */
+AioReader *aio_reader_new (FILE *fp, size_t chunk, int depth);
+
+/**
+ * Points `data` at the next chunk of the file and returns its length,
+ * waiting for it if needed.  Only the last chunk is shorter than `chunk`.
+ * Returns 0 at the end of the file and -1 if reading failed.  The chunk
+ * stays valid until it is given back with aio_reader_release; at most
+ * `depth` chunks may be held at once.
+ */
+long aio_reader_next (AioReader *reader, const unsigned char **data);
+
+/**
+ * Gives back the oldest chunk held, so the reader can fill it again.
+ */
+void aio_reader_release (AioReader *reader);
+
+/**
+ * Stops the AioReader and frees it.  A read in progress is left to finish
+ * on its own, so this does not wait for more input to arrive on a pipe.
+ */
+void aio_reader_free (AioReader *reader);
+
+
+/**
+ * Returns a new AioWriter that writes to `fp` with `depth` chunks of `chunk`
+ * bytes, or NULL if there is an error.  Nothing else may write `fp` while
+ * the AioWriter exists.
+ */
+AioWriter *aio_writer_new (FILE *fp, size_t chunk, int depth);
+
+/**
+ * Returns the chunk to fill next, waiting until the writer is done with it
+ * if needed.  The same chunk is returned until it is submitted.
+ */
+unsigned char *aio_writer_buffer (AioWriter *writer);
+
+/**
+ * Queues the first `len` bytes of the chunk from aio_writer_buffer to be
+ * written.  Returns EOF if an earlier write failed.
+ */
+int aio_writer_submit (AioWriter *writer, size_t len);
+
+/**
+ * Copies the `n` bytes at `src` into chunks and queues them.  Returns EOF if
+ * an earlier write failed.
+ */
+int aio_writer_write (AioWriter *writer, const void *src, size_t n);
+
+/**
+ * Waits until everything queued has been written and flushed to the file.
+ * Returns EOF if a write failed.
+ */
+int aio_writer_drain (AioWriter *writer);
+
+/**
+ * Writes what is queued, stops the AioWriter and frees it.  Returns EOF if
+ * a write failed.
+ */
+int aio_writer_free (AioWriter *writer);
+
+#endif
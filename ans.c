@@ -0,0 +1,436 @@
+/********************************************************************
+
+ The ans module implements tabled asymmetric numeral systems (tANS), an
+ entropy coder that gets much closer to the entropy than Huffman codes
+ when some characters are very likely: a Huffman code spends at least one
+ bit on every character, while tANS can spend a fraction of one.
+
+ The coder keeps a state between L and 2L - 1, where L = 2^log is the size
+ of the table.  The character counts are scaled so that they add up to L
+ (the normalized counts), and every character owns as many entries of the
+ table as its normalized count.  Coding a character moves the state to one
+ of the entries that character owns, after first writing out the low bits
+ of the state to bring it into range; the likelier the character, the more
+ entries it owns and the fewer bits that takes.  The decoder reverses each
+ step with a single lookup: the entry of the state gives the character,
+ how many bits to read and what to add them to.
+
+ The decoder undoes the steps in the opposite order from the encoder, so
+ the encoder goes through the characters from the last to the first and
+ builds the bitstream from its end, and the decoder reads it from the
+ start like any other.  The stream is
+
+   PAD ZEROS STATE BITS
+
+ where PAD (3 bits) is the number of ZEROS, which make the stream a whole
+ number of bytes, and STATE (log bits) is the state the decoder starts in.
+
+ The normalized counts are stored as
+
+   LOG FIRST LAST COUNT(FIRST) ... COUNT(LAST)
+
+ where LOG takes 4 bits, FIRST and LAST (8 bits each) are the lowest and
+ highest characters that occur, and every COUNT is the normalized count
+ plus one as an Elias gamma code (see canon.c).
+
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ans.h"
+#include "stats.h"
+
+#define ANS_SIZE (1 << ANS_MAX_LOG)
+
+
+/**
+ * An AnsSymbol tells the encoder how to code one character.
+ */
+typedef struct AnsSymbol AnsSymbol;
+struct AnsSymbol {
+    uint32_t nbits;  // (state + nbits) >> 16 is the number of bits to write
+    int32_t  find;   // Added to the shifted state to find the next one
+};
+
+/**
+ * An AnsEntry tells the decoder what to do in one state.
+ */
+typedef struct AnsEntry AnsEntry;
+struct AnsEntry {
+    uint16_t      base;   // The next state, before adding the bits read
+    unsigned char sym;    // The character decoded
+    unsigned char nbits;  // Number of bits to read
+};
+
+struct AnsTable {
+    int       log;               // The table has 2^log states
+    uint16_t  state[ANS_SIZE];   // Encoder states, grouped by character
+    AnsSymbol sym[256];          // How to encode each character
+    AnsEntry  dec[ANS_SIZE];     // How to decode each state
+};
+
+
+/**
+ * Returns a new AnsTable or NULL if there is an error.
+ */
+AnsTable *ans_table_new (void)
+{
+    return (AnsTable *)(calloc(1, sizeof(AnsTable)));
+}
+
+
+/**
+ * Frees an AnsTable.
+ */
+void ans_table_free (AnsTable *tab)
+{
+    free(tab);
+}
+
+
+/**
+ * Returns the position of the highest bit set in `x`, which must not be 0.
+ */
+static int high_bit (uint32_t x)
+{
+    int bit = 0;
+    while (x >>= 1)
+        bit++;
+    return bit;
+}
+
+
+/**
+ * Returns the base 2 logarithm of the table size to use for `n`
+ * characters.
+ */
+int ans_table_log (size_t n)
+{
+    int log = 5;
+    while (log < ANS_DEFAULT_LOG && ((size_t)1 << log) < n)
+        log++;
+    return log;
+}
+
+
+/**
+ * Scales the character counts so that they add up to 2^`log`.  Returns -1
+ * if that cannot be done.
+ */
+int ans_normalize (const uint64_t counts[256], int log, uint16_t norm[256])
+{
+    uint64_t total = 0;
+    int used = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        total += counts[c];
+        used  += counts[c] != 0;
+    }
+    int size = 1 << log;
+    if (total == 0 || used > size || log < 1 || log > ANS_MAX_LOG)
+        return -1;
+
+    // Round down, keeping every character that occurs:
+    uint64_t rest[256];
+    int sum = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        uint64_t scaled = counts[c] * (uint64_t)size;
+        norm[c] = (uint16_t)(scaled / total);
+        rest[c] = scaled % total;
+        if (counts[c] != 0 && norm[c] == 0)
+        {
+            norm[c] = 1;
+            rest[c] = 0;
+        }
+        sum += norm[c];
+    }
+
+    // Hand out what is missing to the largest remainders, or take what is
+    // too much from the largest counts, where it matters least:
+    for (; sum < size; sum++)
+    {
+        int best = -1;
+        for (int c = 0; c < 256; c++)
+        {
+            if (counts[c] != 0 && (best < 0 || rest[c] > rest[best]))
+                best = c;
+        }
+        norm[best]++;
+        rest[best] = 0;
+    }
+    for (; sum > size; sum--)
+    {
+        int best = -1;
+        for (int c = 0; c < 256; c++)
+        {
+            if (norm[c] > 1 && (best < 0 || norm[c] > norm[best]))
+                best = c;
+        }
+        norm[best]--;
+    }
+    return 0;
+}
+
+
+/**
+ * Writes `v`, which must not be 0, as an Elias gamma code.  Returns EOF if
+ * there was an error.
+ */
+static int write_gamma (BitsIOFile *bfile, uint32_t v)
+{
+    int k = high_bit(v);
+    if (bits_io_write_bits(bfile, 0, k) == EOF)
+        return EOF;
+    return bits_io_write_bits(bfile, v, k + 1);
+}
+
+
+/**
+ * Reads an Elias gamma code of at most `bits` bits after its leading 1 into
+ * `v`.  Returns EOF if there was an error.
+ */
+static int read_gamma (BitsIOFile *bfile, int bits, uint32_t *v)
+{
+    int k = 0;
+    for (;;)
+    {
+        int bit = bits_io_read_bit(bfile);
+        if (bit == EOF || (bit == 0 && ++k > bits))
+            return EOF;
+        if (bit == 1)
+            break;
+    }
+    *v = 1;
+    if (k > 0)
+    {
+        *v = (1u << k) | bits_io_peek_bits(bfile, k);
+        if (bits_io_skip_bits(bfile, k) == EOF)
+            return EOF;
+    }
+    return 0;
+}
+
+
+/**
+ * Writes `log` and the normalized counts in their packed form.  Returns EOF
+ * if there was an error.
+ */
+int ans_write_counts (BitsIOFile *bfile, int log, const uint16_t norm[256])
+{
+    int first = -1, last = -1;
+    for (int c = 0; c < 256; c++)
+    {
+        if (norm[c] == 0)
+            continue;
+        if (first < 0)
+            first = c;
+        last = c;
+    }
+    if (first < 0 ||
+        bits_io_write_bits(bfile, log, 4) == EOF ||
+        bits_io_write_bits(bfile, first, 8) == EOF ||
+        bits_io_write_bits(bfile, last, 8) == EOF)
+    {
+        return EOF;
+    }
+    for (int c = first; c <= last; c++)
+    {
+        if (write_gamma(bfile, norm[c] + 1u) == EOF)
+            return EOF;
+    }
+    return 0;
+}
+
+
+/**
+ * Reads normalized counts written by ans_write_counts.  Returns EOF if
+ * there was an error or the counts are not valid.
+ */
+int ans_read_counts (BitsIOFile *bfile, int *log, uint16_t norm[256])
+{
+    *log = (int)bits_io_peek_bits(bfile, 4);
+    int first = (int)(bits_io_peek_bits(bfile, 20) >> 8) & 0xFF;
+    int last  = (int)bits_io_peek_bits(bfile, 20) & 0xFF;
+    if (bits_io_skip_bits(bfile, 20) == EOF ||
+        *log < 1 || *log > ANS_MAX_LOG || first > last)
+    {
+        return EOF;
+    }
+
+    memset(norm, 0, 256 * sizeof(uint16_t));
+    uint32_t sum = 0;
+    for (int c = first; c <= last; c++)
+    {
+        uint32_t v;
+        if (read_gamma(bfile, ANS_MAX_LOG + 1, &v) == EOF)
+            return EOF;
+        norm[c] = (uint16_t)(v - 1);
+        sum += norm[c];
+    }
+    return sum == (1u << *log) ? 0 : EOF;
+}
+
+
+/**
+ * Fills in the AnsTable for the normalized counts in `norm`.  Returns -1 if
+ * there is an error.
+ */
+int ans_table_fill (AnsTable *tab, int log, const uint16_t norm[256])
+{
+    if (log < 1 || log > ANS_MAX_LOG)
+        return -1;
+    uint32_t size = 1u << log, sum = 0;
+    for (int c = 0; c < 256; c++)
+        sum += norm[c];
+    if (sum != size)
+        return -1;
+    tab->log = log;
+
+    StatsTimer timer;
+    stats_start(&timer);
+
+    // Spread the characters over the table, each one's entries as far
+    // apart as they can be, by stepping through it with a stride that
+    // visits every entry once:
+    unsigned char spread[ANS_SIZE];
+    uint32_t step = (size >> 1) + (size >> 3) + 3, pos = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        for (int i = 0; i < norm[c]; i++)
+        {
+            spread[pos] = (unsigned char)c;
+            pos = (pos + step) & (size - 1);
+        }
+    }
+
+    // The encoder states of each character, in the order of the table:
+    uint32_t next[256], start = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        next[c] = start;
+        start  += norm[c];
+    }
+    for (uint32_t u = 0; u < size; u++)
+        tab->state[next[spread[u]]++] = (uint16_t)(size + u);
+
+    start = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        AnsSymbol *s = &tab->sym[c];
+        if (norm[c] == 0)
+        {
+            s->nbits = 0;
+            s->find  = 0;
+            continue;
+        }
+        int bits = norm[c] == 1 ? log : log - high_bit(norm[c] - 1u);
+        s->nbits = ((uint32_t)bits << 16) - ((uint32_t)norm[c] << bits);
+        s->find  = (int32_t)start - norm[c];
+        start   += norm[c];
+    }
+
+    // Each state of the decoder leads back to the state the encoder was in
+    // before it, less the bits it wrote:
+    for (int c = 0; c < 256; c++)
+        next[c] = norm[c];
+    for (uint32_t u = 0; u < size; u++)
+    {
+        AnsEntry *e = &tab->dec[u];
+        uint32_t x = next[spread[u]]++;
+        e->sym   = spread[u];
+        e->nbits = (unsigned char)(log - high_bit(x));
+        e->base  = (uint16_t)((x << e->nbits) - size);
+    }
+    stats_stop(&timer, STATS_TABLE);
+    return 0;
+}
+
+
+/**
+ * Puts the low `len` bits of `v` in front of the ones put so far, the
+ * whole bytes of which go into `dst` from the end back.  Returns -1 if
+ * `dst` is full.
+ */
+static int put_bits (uint64_t *acc, int *count, unsigned char *dst,
+                     size_t *pos, uint32_t v, int len)
+{
+    *acc   |= (uint64_t)v << *count;
+    *count += len;
+    while (*count >= 8)
+    {
+        if (*pos == 0)
+            return -1;
+        dst[--*pos] = (unsigned char)*acc;
+        *acc  >>= 8;
+        *count -= 8;
+    }
+    return 0;
+}
+
+
+/**
+ * Encodes the `n` characters at `src` into the `cap` bytes at `dst`.
+ * Returns the number of bytes written or -1 if they do not fit.
+ */
+long ans_encode (const AnsTable *tab, const unsigned char *src, size_t n,
+                 unsigned char *dst, size_t cap)
+{
+    uint32_t size = 1u << tab->log, state = size;
+    uint64_t acc = 0;
+    int count = 0;
+    size_t pos = cap;
+
+    for (size_t i = n; i-- > 0; )
+    {
+        const AnsSymbol *s = &tab->sym[src[i]];
+        int bits = (int)((state + s->nbits) >> 16);
+        if (put_bits(&acc, &count, dst, &pos,
+                     state & ((1u << bits) - 1), bits) == -1)
+        {
+            return -1;
+        }
+        state = tab->state[(int32_t)(state >> bits) + s->find];
+    }
+
+    int pad = (8 - (count + tab->log + 3) % 8) % 8;
+    if (put_bits(&acc, &count, dst, &pos, state - size, tab->log) == -1 ||
+        put_bits(&acc, &count, dst, &pos, 0, pad) == -1 ||
+        put_bits(&acc, &count, dst, &pos, pad, 3) == -1)
+    {
+        return -1;
+    }
+
+    memmove(dst, dst + pos, cap - pos);
+    return (long)(cap - pos);
+}
+
+
+/**
+ * Decodes `n` characters from the BitsIOFile into `out`.  Returns the
+ * number of characters decoded.
+ */
+size_t ans_decode (const AnsTable *tab, BitsIOFile *bfile,
+                   unsigned char *out, size_t n)
+{
+    int pad = (int)bits_io_peek_bits(bfile, 3);
+    if (bits_io_skip_bits(bfile, 3 + pad) == EOF)
+        return 0;
+    uint32_t state = bits_io_peek_bits(bfile, tab->log);
+    if (bits_io_skip_bits(bfile, tab->log) == EOF)
+        return 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const AnsEntry *e = &tab->dec[state];
+        out[i] = e->sym;
+        state  = e->base;
+        if (e->nbits > 0)
+        {
+            state += bits_io_peek_bits(bfile, e->nbits);
+            if (bits_io_skip_bits(bfile, e->nbits) == EOF)
+                return i;
+        }
+    }
+    return n;
+}
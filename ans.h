@@ -0,0 +1,94 @@
+#ifndef __ANS_H
+#define __ANS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bits-io.h"
+
+/**
+ * The largest table an AnsTable can hold is 2^ANS_MAX_LOG states.
+ */
+#define ANS_MAX_LOG 12
+
+/**
+ * The table size ans_table_log picks for large inputs.
+ */
+#define ANS_DEFAULT_LOG 11
+
+
+/**
+ * An AnsTable holds the tables that encode and decode characters with
+ * tANS (see ans.c) for one set of normalized counts.  It can be refilled
+ * for other counts without allocating.
+ */
+typedef struct AnsTable AnsTable;
+
+
+/**
+ * Returns a new AnsTable or NULL if there is an error.
+ */
+AnsTable *ans_table_new (void);
+
+
+/**
+ * Frees an AnsTable.
+ */
+void ans_table_free (AnsTable *tab);
+
+
+/**
+ * Returns the base 2 logarithm of the table size to use for `n`
+ * characters: smaller tables for short inputs, where the counts would cost
+ * more to store than they save.
+ */
+int ans_table_log (size_t n);
+
+
+/**
+ * Scales the character counts in `counts` so that they add up to 2^`log`
+ * and stores them in `norm`.  Every character that occurs keeps a count of
+ * at least 1.  Returns -1 if nothing was counted or there are more
+ * characters than the table has states.
+ */
+int ans_normalize (const uint64_t counts[256], int log, uint16_t norm[256]);
+
+
+/**
+ * Writes `log` and the normalized counts in `norm` in their packed form.
+ * Returns EOF if there was an error.
+ */
+int ans_write_counts (BitsIOFile *bfile, int log, const uint16_t norm[256]);
+
+
+/**
+ * Reads normalized counts written by ans_write_counts into `log` and
+ * `norm`.  Returns EOF if there was an error or the counts are not valid.
+ */
+int ans_read_counts (BitsIOFile *bfile, int *log, uint16_t norm[256]);
+
+
+/**
+ * Fills in the AnsTable for the normalized counts in `norm`, which must add
+ * up to 2^`log`.  Returns -1 if there is an error.
+ */
+int ans_table_fill (AnsTable *tab, int log, const uint16_t norm[256]);
+
+
+/**
+ * Encodes the `n` characters at `src` into the `cap` bytes at `dst`.  Every
+ * character must have a normalized count.  Returns the number of bytes
+ * written or -1 if they do not fit.
+ */
+long ans_encode (const AnsTable *tab, const unsigned char *src, size_t n,
+                 unsigned char *dst, size_t cap);
+
+
+/**
+ * Decodes `n` characters from the BitsIOFile into `out`, which must be at a
+ * byte boundary where ans_encode started.  Returns the number of characters
+ * decoded, which is less than `n` only if the input ran out.
+ */
+size_t ans_decode (const AnsTable *tab, BitsIOFile *bfile,
+                   unsigned char *out, size_t n);
+
+#endif
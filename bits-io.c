@@ -159,15 +159,97 @@
    EOF_VALUE.  Note that, as previously mentioned, you should not comapre
    against EOF!  Compare against EOF_VALUE!
 
+ READ-AHEAD WINDOW
+
+   The reader keeps up to 64 bits of the input in a left-aligned window so
+   that callers can peek at several bits at once (bits_io_peek_bits) and
+   then consume however many of them they actually used (bits_io_skip_bits).
+   The decoder uses this to resolve whole codes with a single table lookup
+   instead of reading one bit at a time.  bits_io_read_bit takes its bit
+   from the same window, so the two styles can be mixed freely.
+
+ WRITE ACCUMULATOR
+
+   Writing works the other way around: bits_io_write_bits appends a whole
+   code (up to 64 bits) to the low end of the window, and as soon as the
+   window holds 32 bits they are stored in the buffer as one big endian
+   word.  The byte layout in the file is the same as writing the bits one
+   at a time with bits_io_write_bit: first bit in the high bit of the first
+   byte, with the last byte padded with 0 bits on close.
+
+ MEMORY BUFFERS
+
+   bits_io_open_mem gives the same interface over a caller supplied block of
+   memory instead of a file.  The buffer then simply is that memory: reads
+   see all of it at once and writes fail once it is full.  The block coder
+   uses this to encode and decode blocks of the framed format in memory, so
+   that several of them can be worked on at the same time.  With
+   bits_io_reset_mem and bits_io_flush one BitsIOFile can be pointed at one
+   block after another, so coding a block allocates nothing.
+
+ BYTES
+
+   Everything that is not a bitstream (the sizes, the serialized tree and
+   the headers of the framed format) is read and written with
+   bits_io_read_bytes and bits_io_write_bytes, which go through the same
+   buffer.  They must only be used while no partial byte is pending.
+
+ MAPPED FILES
+
+   bits_io_open maps a regular file that is read into memory, and
+   bits_io_open_sized does the same for one that is written, given how
+   large it may get.  The mapping then is the buffer, as for memory, so the
+   bytes are not copied through stdio and a buffer of our own on the way;
+   bits_io_view_bytes even hands them out where they are.  A file that is
+   written gets all its room allocated up front, so a full disk shows as an
+   error rather than a signal, and is cut to size when closed.  Pipes and
+   the standard input and output still go through the buffer.
+
+ READ-AHEAD AND WRITE-BEHIND
+
+   A file that goes through the buffer is read or written on a thread of
+   its own (see aio.c).  For writing, the buffer is a chunk of an
+   AioWriter: once it is full it is queued and the next chunk becomes the
+   buffer, so the coding goes on while the thread writes.  For reading,
+   which only goes through the buffer for pipes and the like, the buffer is
+   the chunk of an AioReader that is being read, given back when the next
+   one is taken.  The rare caller that needs more bytes in a row than are
+   left of a chunk (fill_at_least) gets them copied into a buffer of our
+   own, twice the size of a chunk so that the rest of one chunk and all of
+   the next fit.  Without a thread the buffer is filled and written out
+   with fread and fwrite as before.
+
+ SEEKING
+
+   A BitsIOFile that reads a regular file or memory can be moved to any
+   byte with bits_io_seek, which drops whatever was read ahead; the decoder
+   uses this to jump to the blocks a byte range needs.
+
+ CODES
+
+   bits_io_write_codes writes the codes of a whole run of characters at
+   once, keeping the window in registers instead of going through the
+   BitsIOFile for every code.  It has a version compiled for BMI2, picked
+   at run time when the CPU has it (see cpu.c), that writes the same bits.
+
  *******************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include "bits-io.h"
+#include "cpu.h"
+#include "aio.h"
 #include "tree.h"
+#include "stats.h"
+#include "probe.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /**
  * This structure is used to maintain the writing/reading of a
@@ -177,15 +259,22 @@
 #define BUF_SIZE (1<<20)
 struct BitsIOFile
 {
-    FILE *fp;            // The output/input file
+    FILE *fp;            // The output/input file, NULL for memory
     int count;           // Number of bytes read/written
     char mode;           // The mode 'w' for write and 'r' for read
-    unsigned char byte;  // The byte buffer to hold the bits we are
-    // reading/writing
-    unsigned int index; //index into the buffer
-    unsigned int read;  //number of bytes stored in buffer, if less than buffer size
-    unsigned char buf[BUF_SIZE];//The buffer
-    int nbits;          //number of bits wrote to current byte, range [0, 8]
+    size_t index;       //index into the buffer
+    size_t read;        //bytes stored in buffer, if less than buffer size
+    size_t size;        //size of the buffer
+    unsigned char *buf; //The buffer, or the caller's memory
+    uint64_t window;    //'r': bits read ahead of the caller, left aligned
+                        //'w': bits not yet stored in buf, right aligned
+    int avail;          //number of valid bits in window
+    uint64_t consumed;  //number of bits handed out/taken from the caller so far
+    int mapped;         //1 if buf is a mapping of the file rather than a copy
+    AioWriter *writer;  //'w': writes the buffers behind us, or NULL
+    AioReader *reader;  //'r': reads the buffers ahead of us, or NULL
+    int held;           //1 if buf is a chunk taken from reader
+    unsigned char *spare; //'r': where fill_at_least joins chunks
 };
 
 #define NO_BITS_WRITTEN ((unsigned char)(0xFE))
@@ -195,6 +284,71 @@ struct BitsIOFile
 static int fill_buf(BitsIOFile *bfile);
 static int flush_buf(BitsIOFile *bfile);
 
+/**
+ * Maps the file of the BitsIOFile into memory and makes the mapping its
+ * buffer: all of the file for reading, or `size` bytes of room, allocated
+ * on disk up front, for writing.  Returns -1 if the file cannot be mapped,
+ * leaving the BitsIOFile as it was.
+ */
+static int map_file (BitsIOFile *bfile, uint64_t size)
+{
+    int fd = fileno(bfile->fp);
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+    if(bfile->mode == 'r')
+        size = (uint64_t)st.st_size;
+    if(size == 0 || size > SIZE_MAX || size > INT64_MAX)
+        return -1;
+    
+    //allocating the room now means running out of disk space is an
+    //error here instead of a signal when the mapping is written
+    void *map = MAP_FAILED;
+    int prot = bfile->mode == 'r' ? PROT_READ : PROT_READ | PROT_WRITE;
+    if(bfile->mode == 'r' || posix_fallocate(fd, 0, (off_t)size) == 0)
+        map = mmap(NULL, (size_t)size, prot, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        //the buffered writer starts from an empty file again
+        if(bfile->mode == 'w')
+            ftruncate(fd, 0);
+        return -1;
+    }
+    posix_madvise(map, (size_t)size, POSIX_MADV_SEQUENTIAL);
+    
+    bfile->buf = (unsigned char *)map;
+    bfile->size = (size_t)size;
+    bfile->mapped = 1;
+    if(bfile->mode == 'r')
+        bfile->read = bfile->size;
+    return 0;
+}
+
+
+/**
+ * Makes the mapping of a BitsIOFile that is written twice as large.
+ * Returns EOF if there was an error.
+ */
+static int grow_map (BitsIOFile *bfile)
+{
+    int fd = fileno(bfile->fp);
+    size_t size = bfile->size * 2;
+    if(size < bfile->size || size > INT64_MAX ||
+       posix_fallocate(fd, 0, (off_t)size) != 0)
+        return EOF;
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+        return EOF;
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    
+    //what was written is in the file, so the old mapping can just go
+    munmap(bfile->buf, bfile->size);
+    bfile->buf = (unsigned char *)map;
+    bfile->size = size;
+    return 0;
+}
+
+
 /**
  * Opens a new BitsIOFile. Returns NULL if there is a failure.
  *
@@ -203,7 +357,20 @@ static int flush_buf(BitsIOFile *bfile);
  */
 BitsIOFile *bits_io_open (const char *name, const char *mode)
 {
-    FILE *fp = fopen(name, mode);
+    return bits_io_open_sized(name, mode, 0);
+}
+
+
+/**
+ * Opens a new BitsIOFile, mapping the file when it can.  Returns NULL if
+ * there is a failure.
+ */
+BitsIOFile *bits_io_open_sized (const char *name, const char *mode,
+                                uint64_t size)
+{
+    //a mapping that is written has to be readable as well
+    int map = strcmp(name, "-") != 0 && (mode[0] == 'r' || size > 0);
+    FILE *fp = fopen_stream(name, map && mode[0] == 'w' ? "w+" : mode);
     
     if (fp == NULL)
         return NULL;
@@ -211,133 +378,483 @@ BitsIOFile *bits_io_open (const char *name, const char *mode)
     char mode_letter = mode[0];
     
     BitsIOFile *bfile = (BitsIOFile*)(calloc(1, sizeof(BitsIOFile)));
+    if (bfile == NULL)
+    {
+        fclose_stream(fp);
+        return NULL;
+    }
     bfile->fp    = fp;
     bfile->count = 0;
     bfile->mode  = mode_letter;
-    bfile->byte  = 0;
+    if (map && map_file(bfile, size) == 0)
+        return bfile;
     
-    bfile->nbits = 0;
-    bfile->index = 0;
-    if(mode_letter == 'r')
+    //otherwise go through a buffer, on a thread of its own if we can;
+    //a regular file that is read was mapped above if it could be
+    struct stat st;
+    bfile->size = BUF_SIZE;
+    if (mode_letter == 'w')
     {
-        //assume no more bits to read from current byte
-        bfile->nbits = 8;
-        
-        //assume no more bytes to read from current buffer
-        //this way the next call to bit_io_read will cause
-        //the program to read in data
-        bfile->index = BUF_SIZE;
+        bfile->writer = aio_writer_new(fp, BUF_SIZE, AIO_DEPTH);
+        if (bfile->writer != NULL)
+        {
+            bfile->buf = aio_writer_buffer(bfile->writer);
+            return bfile;
+        }
+    } else if (fstat(fileno(fp), &st) == 0 && !S_ISREG(st.st_mode))
+    {
+        bfile->reader = aio_reader_new(fp, BUF_SIZE, AIO_DEPTH);
+        if (bfile->reader != NULL)
+            return bfile;
     }
     
+    unsigned char *buf = (unsigned char *)(malloc(BUF_SIZE));
+    if (buf == NULL)
+    {
+        free(bfile);
+        fclose_stream(fp);
+        return NULL;
+    }
+    bfile->buf   = buf;
+    
+    //for reading, the buffer starts out empty (read is 0), so
+    //the first call to bit_io_read will cause the program to
+    //read in data
+    bfile->index = 0;
+    
     return bfile;
 }
 
 
+/**
+ * Opens a BitsIOFile on the `size` bytes of memory at `mem`. Returns NULL
+ * if there is a failure.
+ *
+ * The `mode` is "w" to write into the memory and "r" to read from it.
+ */
+BitsIOFile *bits_io_open_mem (void *mem, size_t size, const char *mode)
+{
+    BitsIOFile *bfile = (BitsIOFile*)(malloc(sizeof(BitsIOFile)));
+    if (bfile == NULL)
+        return NULL;
+    
+    bits_io_reset_mem(bfile, mem, size, mode);
+    return bfile;
+}
+
+
+/**
+ * Points a BitsIOFile opened with bits_io_open_mem at the `size` bytes of
+ * memory at `mem`, as if it had just been opened on them.
+ */
+void bits_io_reset_mem (BitsIOFile *bfile, void *mem, size_t size,
+                        const char *mode)
+{
+    memset(bfile, 0, sizeof(BitsIOFile));
+    bfile->fp    = NULL;
+    bfile->mode  = mode[0];
+    bfile->buf   = (unsigned char *)mem;
+    bfile->size  = size;
+    bfile->index = 0;
+    
+    //everything there is to read is in the buffer already
+    if(bfile->mode == 'r')
+        bfile->read = size;
+}
+
+
 /**
  * return the number of bytes read/written so far
  */
 int bits_io_num_bytes (BitsIOFile *bfile)
 {
     assert(bfile != NULL);
+    //a byte counts as read as soon as one of its bits was handed out,
+    //but only counts as written once all of its bits are in
+    if(bfile->mode == 'r')
+        bfile->count = (int)((bfile->consumed + 7) >> 3);
+    else
+        bfile->count = (int)(bfile->consumed >> 3);
     return bfile->count;
 }
 
 
-static int fill_buf(BitsIOFile *bfile)
+/**
+ * Returns the number of bits read/written so far.
+ */
+uint64_t bits_io_num_bits (BitsIOFile *bfile)
+{
+    assert(bfile != NULL);
+    return bfile->consumed;
+}
+
+
+/**
+ * Returns the size in bytes of what the BitsIOFile reads, or -1 if it is
+ * not known.
+ */
+int64_t bits_io_size (BitsIOFile *bfile)
+{
+    assert(bfile != NULL && bfile->mode == 'r');
+    if(bfile->fp == NULL || bfile->mapped)
+        return (int64_t)bfile->size;
+    
+    //only a regular file has a size to seek within
+    struct stat st;
+    if(fstat(fileno(bfile->fp), &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+    return (int64_t)st.st_size;
+}
+
+
+/**
+ * Moves the BitsIOFile to the byte `offset` bytes from the start.  Returns
+ * EOF if it cannot seek there.
+ */
+int bits_io_seek (BitsIOFile *bfile, uint64_t offset)
 {
-    int read = (int)fread(bfile->buf, 1, BUF_SIZE, bfile->fp);
+    assert(bfile != NULL && bfile->mode == 'r');
+    
+    if(bfile->fp == NULL || bfile->mapped)
+    {
+        if(offset > bfile->size)
+            return EOF;
+        bfile->index = (size_t)offset;
+    } else
+    {
+        if(offset > INT64_MAX || bfile->reader != NULL ||
+           fseeko(bfile->fp, (off_t)offset, SEEK_SET) != 0)
+            return EOF;
+        //whatever was read ahead belongs to the old position
+        bfile->index = 0;
+        bfile->read = 0;
+    }
+    bfile->window = 0;
+    bfile->avail = 0;
+    bfile->consumed = offset << 3;
+    return 0;
+}
+
+
+static int read_buf(BitsIOFile *bfile)
+{
+    if(bfile->reader != NULL)
+    {
+        //the chunk we are done with goes back to be read into again
+        if(bfile->held)
+            aio_reader_release(bfile->reader);
+        bfile->held = 0;
+        const unsigned char *chunk;
+        long len = aio_reader_next(bfile->reader, &chunk);
+        if(len <= 0)
+            return EOF;
+        bfile->buf = (unsigned char *)chunk;
+        bfile->read = (size_t)len;
+        bfile->index = 0;
+        bfile->held = 1;
+        return 0;
+    }
+    
+    stats_add(STATS_READ_CALLS, 1);
+    size_t read = fread(bfile->buf, 1, bfile->size, bfile->fp);
     //If we encounter an error, return EOF
     if(read == 0)
         return EOF;
-    bfile->read = (int)read;
+    bfile->read = read;
     
     //reset the pointer to beginning of the buffer
     bfile->index = 0;
     return 0;
 }
 
+static int fill_buf(BitsIOFile *bfile)
+{
+    //memory has nothing more to offer than what is in the buffer
+    if(bfile->fp == NULL || bfile->mapped)
+        return EOF;
+    
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = read_buf(bfile);
+    stats_stop(&timer, STATS_READ);
+    PROBE2(fill_buf, res == 0 ? bfile->read : 0, probe_now() - started);
+    return res;
+}
+
+
 /**
- * Close the BitsIOFile. Returns EOF if there was an error.
+ * Makes sure at least `want` unread bytes are in the buffer, moving the
+ * unread bytes to the front of the buffer and reading more behind them.
+ * Returns the number of unread bytes in the buffer, which is less than
+ * `want` only at the end of the file.
  */
-int bits_io_close (BitsIOFile *bfile)
+static size_t fill_at_least(BitsIOFile *bfile, size_t want)
 {
-    assert(bfile != NULL);
+    //memory and mapped files hold all there is already, whatever their size
+    size_t left = bfile->read - bfile->index;
+    if(left >= want || bfile->fp == NULL || bfile->mapped)
+        return left;
+    assert(want <= bfile->size);
     
-    if(bfile->mode == 'w')
+    StatsTimer timer;
+    stats_start(&timer);
+    if(bfile->reader != NULL)
     {
-        flush_buf(bfile);
-        //if we have some remaining bits
-        if(bfile->nbits > 0)
+        //join the rest of this chunk and the next one, which is all of
+        //the file that is left if it is short, so there is no need for more
+        if(bfile->spare == NULL)
+            bfile->spare = (unsigned char *)(malloc(2 * BUF_SIZE));
+        if(bfile->spare == NULL)
+            return left;
+        if(left > 0)
+            memmove(bfile->spare, bfile->buf + bfile->index, left);
+        bfile->buf = bfile->spare;
+        bfile->index = 0;
+        bfile->read = left;
+        if(bfile->held)
+            aio_reader_release(bfile->reader);
+        bfile->held = 0;
+        const unsigned char *chunk;
+        long len = aio_reader_next(bfile->reader, &chunk);
+        if(len > 0)
         {
-            int c = bfile->byte;
-            //pad remaining bits with 0
-            c = c << (8 - bfile->nbits);
-            fputc(c, bfile->fp);
+            memcpy(bfile->spare + left, chunk, (size_t)len);
+            bfile->read += (size_t)len;
+            aio_reader_release(bfile->reader);
         }
+        stats_stop(&timer, STATS_READ);
+        return bfile->read;
     }
-    fclose(bfile->fp);
-    free(bfile);
     
+    memmove(bfile->buf, bfile->buf + bfile->index, left);
+    bfile->index = 0;
+    bfile->read = left;
+    while(bfile->read < want)
+    {
+        stats_add(STATS_READ_CALLS, 1);
+        size_t read = fread(bfile->buf + bfile->read, 1,
+                            bfile->size - bfile->read, bfile->fp);
+        if(read == 0)
+            break;
+        bfile->read += read;
+    }
+    stats_stop(&timer, STATS_READ);
+    return bfile->read;
+}
+
+/**
+ * Writes out everything that is still buffered, padding the last byte with
+ * 0 bits, but leaves the BitsIOFile open.  Returns EOF if there was an
+ * error.
+ */
+int bits_io_flush (BitsIOFile *bfile)
+{
+    assert(bfile != NULL);
+    
+    if(bfile->mode != 'w')
+        return 0;
+    
+    //move the whole bytes left in the window to the buffer
+    while(bfile->avail >= 8)
+    {
+        if(bfile->index >= bfile->size && flush_buf(bfile) == EOF)
+            return EOF;
+        bfile->avail -= 8;
+        bfile->buf[bfile->index++] =
+            (unsigned char)(bfile->window >> bfile->avail);
+    }
+    //if we have some remaining bits
+    if(bfile->avail > 0)
+    {
+        if(bfile->index >= bfile->size && flush_buf(bfile) == EOF)
+            return EOF;
+        //pad remaining bits with 0
+        bfile->buf[bfile->index++] =
+            (unsigned char)(bfile->window << (8 - bfile->avail));
+        bfile->avail = 0;
+    }
+    if(bfile->fp != NULL && !bfile->mapped && flush_buf(bfile) == EOF)
+        return EOF;
     return 0;
 }
 
 
 /**
- * Read a bit from the BitsIOFile.
- * Returns 0 or 1 for a bit read,
- * or EOF (-1) if there are no more bits to read
+ * Writes out everything that is still buffered and hands it to the system.
+ * Returns EOF if there was an error.
  */
-int bits_io_read_bit (BitsIOFile *bfile)
+int bits_io_sync (BitsIOFile *bfile)
+{
+    assert(bfile != NULL && bfile->avail % 8 == 0);
+    
+    if(bits_io_flush(bfile) == EOF)
+        return EOF;
+    if(bfile->writer != NULL)
+        return aio_writer_drain(bfile->writer);
+    if(bfile->fp != NULL && fflush(bfile->fp) == EOF)
+        return EOF;
+    return 0;
+}
+
+
+/**
+ * Close the BitsIOFile. Returns EOF if there was an error.
+ */
+int bits_io_close (BitsIOFile *bfile)
+{
+    assert(bfile != NULL);
+    
+    int result = bits_io_flush(bfile);
+    if(bits_io_discard(bfile) == EOF)
+        result = EOF;
+    
+    return result;
+}
+
+
+/**
+ * Close the BitsIOFile without writing out anything that is still
+ * buffered. Returns EOF if there was an error.
+ */
+int bits_io_discard (BitsIOFile *bfile)
 {
     assert(bfile != NULL);
     
-    // TODO:
-    
-    // First, we need to check whether we need to read a byte from the file.
-    // The clue for this case is that `bfile->byte` equals `ALL_BITS_READ`.  If
-    // the value read was EOF (that is, EOF_VALUE if you are looking at its
-    // value in bfile->byte), then return EOF since there are no more bits to
-    // read.
-    
-    // After reading a new byte successfully, increment the count of bytes read.
-    // Then you need to shift the byte value left repeatedly until the high bit
-    // is 0, and then shift once more to get rid of that 0.  Remember: when
-    // shifting a byte the first time, insert a 1 in the low bit and all later
-    // times, shift in a 1.  (We found it easy to have a variable indicating the
-    // value to shift in.  Initialize it to 1 after reading a byte and after any
-    // shift, set it to 0.)
-    
-    // If the value on entry was not `ALL_BITS_READ`, or if we have completed
-    // the preparations after reading a fresh byte, we can proceed to extract
-    // one bit and return it.  The bit to return is the high order bit of the
-    // byte.  Perform the shift left operation before returning (shifting in a
-    // 0), to leave the byte ready for the next call.
-    unsigned char byte = bfile->byte;
-    int nbits = bfile->nbits;
-    if(nbits >= 8)
+    int result = 0;
+    if(bfile->mapped)
+    {
+        //cut the room that was not used off the end of the file
+        if(munmap(bfile->buf, bfile->size) != 0)
+            result = EOF;
+        if(bfile->mode == 'w' &&
+           ftruncate(fileno(bfile->fp), (off_t)bfile->index) != 0)
+            result = EOF;
+    } else if(bfile->writer != NULL)
+    {
+        //the chunks queued are still written out, the one being filled not
+        if(aio_writer_free(bfile->writer) == EOF)
+            result = EOF;
+    } else if(bfile->reader != NULL)
+    {
+        aio_reader_free(bfile->reader);
+        free(bfile->spare);
+    } else if(bfile->fp != NULL)
+        free(bfile->buf);
+    if(bfile->fp != NULL && fclose_stream(bfile->fp) == EOF)
+        result = EOF;
+    free(bfile);
+    return result;
+}
+
+/**
+ * Top up the read-ahead window with whole bytes from the buffer, refilling
+ * the buffer from the file as needed.  Once this returns the window holds at
+ * least 57 bits unless the end of the file was reached.
+ */
+static void refill(BitsIOFile *bfile)
+{
+    while(bfile->avail <= 56)
     {
         //If we reached the end of the buffer
         if(bfile->index >= bfile->read)
             if(fill_buf(bfile) == EOF)
-                return EOF;
+                return;
         
-        //read a byte from buffer
-        byte = bfile->buf[bfile->index++];
-        bfile->count++;
-        nbits = 0;
+        uint64_t byte = bfile->buf[bfile->index++];
+        bfile->window |= byte << (56 - bfile->avail);
+        bfile->avail += 8;
+    }
+}
+
+
+/**
+ * Read a bit from the BitsIOFile.
+ * Returns 0 or 1 for a bit read,
+ * or EOF (-1) if there are no more bits to read
+ */
+int bits_io_read_bit (BitsIOFile *bfile)
+{
+    assert(bfile != NULL);
+    
+    //Bits come out of the high end of the read-ahead window
+    if(bfile->avail == 0)
+    {
+        refill(bfile);
+        if(bfile->avail == 0)
+            return EOF;
     }
-    nbits++;
-    int b = (byte >> 7);
-    byte <<= 1;
-    bfile->byte = byte;
-    bfile->nbits = nbits;
+    int b = (int)(bfile->window >> 63);
+    bfile->window <<= 1;
+    bfile->avail--;
+    bfile->consumed++;
     return b;
 }
 
-static int flush_buf(BitsIOFile *bfile)
+
+/**
+ * Returns the next n bits (1 <= n <= 32) without consuming them.  The first
+ * bit in the file ends up in the most significant position of the result.
+ * Past the end of the file the missing bits read as 0.
+ */
+uint32_t bits_io_peek_bits (BitsIOFile *bfile, int n)
+{
+    assert(bfile != NULL);
+    assert(n > 0 && n <= 32);
+    
+    if(bfile->avail < n)
+        refill(bfile);
+    return (uint32_t)(bfile->window >> (64 - n));
+}
+
+
+/**
+ * Consumes n bits (0 <= n <= 32).  Returns EOF if fewer than n bits were
+ * left in the file.
+ */
+int bits_io_skip_bits (BitsIOFile *bfile, int n)
 {
+    assert(bfile != NULL);
+    assert(n >= 0 && n <= 32);
+    
+    if(bfile->avail < n)
+    {
+        refill(bfile);
+        if(bfile->avail < n)
+        {
+            bfile->consumed += bfile->avail;
+            bfile->window = 0;
+            bfile->avail = 0;
+            return EOF;
+        }
+    }
+    bfile->window <<= n;
+    bfile->avail -= n;
+    bfile->consumed += n;
+    return 0;
+}
+
+static int write_buf(BitsIOFile *bfile)
+{
+    if(bfile->mapped)
+        return grow_map(bfile);
+    
+    stats_add(STATS_FLUSHES, 1);
+    
+    //hand the buffer to the writer and go on with the next one
+    if(bfile->writer != NULL)
+    {
+        if(bfile->index > 0 &&
+           aio_writer_submit(bfile->writer, bfile->index) == EOF)
+            return EOF;
+        bfile->buf = aio_writer_buffer(bfile->writer);
+        bfile->index = 0;
+        return 0;
+    }
+    
     //if we failed to write all bytes
-    if(fwrite(bfile->buf, 1, bfile->index, bfile->fp) < BUF_SIZE)
+    stats_add(STATS_WRITE_CALLS, 1);
+    if(fwrite(bfile->buf, 1, bfile->index, bfile->fp) < bfile->index)
         return EOF;
     
     //reset the pointer
@@ -345,40 +862,299 @@ static int flush_buf(BitsIOFile *bfile)
     return 0;
 }
 
+static int flush_buf(BitsIOFile *bfile)
+{
+    //memory cannot be written out to make room
+    if(bfile->fp == NULL)
+        return EOF;
+    
+    size_t bytes = bfile->index;
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = write_buf(bfile);
+    stats_stop(&timer, STATS_WRITE);
+    PROBE2(flush_buf, bytes, probe_now() - started);
+    return res;
+}
+
 /**
- * Writes the given bit (1 or 0) to the BitsIOFile.
+ * Writes the low `len` bits of `bits` (0 <= len <= 64) to the BitsIOFile,
+ * most significant bit first.  Returns EOF if there was an error.
  */
-int bits_io_write_bit (BitsIOFile *bfile, int bit)
+int bits_io_write_bits (BitsIOFile *bfile, uint64_t bits, int len)
 {
     assert(bfile != NULL);
-    assert((bit & 1) == bit);
+    assert(len >= 0 && len <= 64);
     
-    // Write the bit into the byte:
-    bfile->byte = (bfile->byte << 1) | bit;
-    bfile->nbits++;
+    //The window holds fewer than 32 bits between calls, so anything longer
+    //than 32 bits has to go in two pieces to fit.
+    if(len > 32)
+    {
+        if(bits_io_write_bits(bfile, bits >> 32, len - 32) == EOF)
+            return EOF;
+        bits &= 0xFFFFFFFF;
+        len = 32;
+    }
+    
+    bfile->window = (bfile->window << len) | bits;
+    bfile->avail += len;
+    bfile->consumed += len;
     
-    // Check if the byte is full and write if it is.
-    // A byte is full if its left-most bit is 0:
-    if (bfile->nbits >= 8)
+    //Move a whole 32 bit word to the buffer once we have one
+    if(bfile->avail >= 32)
     {
-        bfile->count++;
         //if we reached the end of the buffer, write buffer to disk
-        if(bfile->index >= BUF_SIZE)
+        if(bfile->index + 4 > bfile->size)
             if(flush_buf(bfile) == EOF)
                 return EOF;
         
-        //write the byte to buffer
-        bfile->buf[bfile->index++] = bfile->byte;
-        
-        // Reset the byte:
-        bfile->byte = 0;
-        bfile->nbits = 0;
+        bfile->avail -= 32;
+        uint32_t word = (uint32_t)(bfile->window >> bfile->avail);
+        unsigned char *p = bfile->buf + bfile->index;
+        p[0] = (unsigned char)(word >> 24);
+        p[1] = (unsigned char)(word >> 16);
+        p[2] = (unsigned char)(word >> 8);
+        p[3] = (unsigned char)word;
+        bfile->index += 4;
     }
+    return 0;
+}
+
+/**
+ * Writes the given bit (1 or 0) to the BitsIOFile.
+ */
+int bits_io_write_bit (BitsIOFile *bfile, int bit)
+{
+    assert(bfile != NULL);
+    assert((bit & 1) == bit);
     
+    if(bits_io_write_bits(bfile, bit, 1) == EOF)
+        return EOF;
     return bit;
 }
 
 
+/**
+ * Writes the codes of the `n` characters at `src` as bits_io_write_bits
+ * would, but with the window kept in locals.  Inlined into a portable and
+ * a BMI2 version below.
+ */
+static inline __attribute__((always_inline))
+int write_codes (BitsIOFile *bfile, const unsigned char *src, size_t n,
+                 const BitCode codes[256])
+{
+    uint64_t window = bfile->window;
+    int avail = bfile->avail;
+    size_t index = bfile->index;
+    uint64_t consumed = 0;
+    
+    for(size_t i = 0; i < n; i++)
+    {
+        const BitCode *c = &codes[src[i]];
+        int len = c->len;
+        if(len > 32)
+        {
+            //a code too long for the window goes the slow way
+            bfile->window = window;
+            bfile->avail = avail;
+            bfile->index = index;
+            bfile->consumed += consumed;
+            consumed = 0;
+            if(bits_io_write_bits(bfile, c->bits, len) == EOF)
+                return EOF;
+            window = bfile->window;
+            avail = bfile->avail;
+            index = bfile->index;
+            continue;
+        }
+        
+        window = (window << len) | c->bits;
+        avail += len;
+        consumed += (uint64_t)len;
+        if(avail >= 32)
+        {
+            if(index + 4 > bfile->size)
+            {
+                bfile->index = index;
+                if(flush_buf(bfile) == EOF)
+                    return EOF;
+                index = bfile->index;
+            }
+            avail -= 32;
+            uint32_t word = (uint32_t)(window >> avail);
+            unsigned char *p = bfile->buf + index;
+            p[0] = (unsigned char)(word >> 24);
+            p[1] = (unsigned char)(word >> 16);
+            p[2] = (unsigned char)(word >> 8);
+            p[3] = (unsigned char)word;
+            index += 4;
+        }
+    }
+    
+    bfile->window = window;
+    bfile->avail = avail;
+    bfile->index = index;
+    bfile->consumed += consumed;
+    return 0;
+}
+
+#ifdef CPU_X86
+/**
+ * write_codes compiled for BMI2, whose shifts by a variable amount (shlx,
+ * shrx) take any register and leave the flags alone.
+ */
+__attribute__((target("bmi2")))
+static int write_codes_bmi2 (BitsIOFile *bfile, const unsigned char *src,
+                             size_t n, const BitCode codes[256])
+{
+    return write_codes(bfile, src, n, codes);
+}
+#endif
+
+
+/**
+ * Writes the codes in `codes` of the `n` characters at `src`.  Returns EOF
+ * if there was an error.
+ */
+int bits_io_write_codes (BitsIOFile *bfile, const unsigned char *src,
+                         size_t n, const BitCode codes[256])
+{
+    assert(bfile != NULL && bfile->mode == 'w');
+    
+    uint64_t start = bfile->consumed;
+    int res;
+#ifdef CPU_X86
+    if(cpu_features() & CPU_BMI2)
+        res = write_codes_bmi2(bfile, src, n, codes);
+    else
+#endif
+        res = write_codes(bfile, src, n, codes);
+    
+    stats_add(STATS_SYMBOLS, n);
+    stats_add(STATS_CODE_BITS, bfile->consumed - start);
+    return res;
+}
+
+/**
+ * Writes the `n` bytes at `src` to the BitsIOFile.  Returns EOF if there was
+ * an error.
+ */
+int bits_io_write_bytes (BitsIOFile *bfile, const void *src, size_t n)
+{
+    assert(bfile != NULL && bfile->mode == 'w');
+    assert(bfile->avail % 8 == 0);
+    
+    //whole bytes still in the window go first
+    while(bfile->avail > 0)
+    {
+        if(bfile->index >= bfile->size && flush_buf(bfile) == EOF)
+            return EOF;
+        bfile->avail -= 8;
+        bfile->buf[bfile->index++] =
+            (unsigned char)(bfile->window >> bfile->avail);
+    }
+    
+    const unsigned char *p = (const unsigned char *)src;
+    while(n > 0)
+    {
+        if(bfile->index >= bfile->size && flush_buf(bfile) == EOF)
+            return EOF;
+        size_t room = bfile->size - bfile->index;
+        size_t len = n < room ? n : room;
+        memcpy(bfile->buf + bfile->index, p, len);
+        bfile->index += len;
+        bfile->consumed += (uint64_t)len << 3;
+        p += len;
+        n -= len;
+    }
+    return 0;
+}
+
+
+/**
+ * Returns the next `n` bytes of a BitsIOFile read from memory and consumes
+ * them, or NULL if they are not all in memory.
+ */
+const unsigned char *bits_io_view_bytes (BitsIOFile *bfile, size_t n)
+{
+    assert(bfile != NULL && bfile->mode == 'r');
+    assert(bfile->avail % 8 == 0);
+    
+    if(bfile->fp != NULL && !bfile->mapped)
+        return NULL;
+    
+    //the bytes read ahead into the window are still right in front of
+    //index, so they can simply be put back
+    size_t ahead = (size_t)(bfile->avail >> 3);
+    if(n > bfile->read - bfile->index + ahead)
+        return NULL;
+    bfile->index -= ahead;
+    bfile->window = 0;
+    bfile->avail = 0;
+    
+    const unsigned char *p = bfile->buf + bfile->index;
+    bfile->index += n;
+    bfile->consumed += (uint64_t)n << 3;
+    return p;
+}
+
+
+/**
+ * Reads `n` bytes from the BitsIOFile into `dst`.  Returns EOF if the file
+ * ended before `n` bytes were read.
+ */
+int bits_io_read_bytes (BitsIOFile *bfile, void *dst, size_t n)
+{
+    assert(bfile != NULL && bfile->mode == 'r');
+    assert(bfile->avail % 8 == 0);
+    
+    unsigned char *p = (unsigned char *)dst;
+    
+    //whole bytes already in the read-ahead window go first
+    while(bfile->avail > 0 && n > 0)
+    {
+        *p++ = (unsigned char)(bfile->window >> 56);
+        bfile->window <<= 8;
+        bfile->avail -= 8;
+        bfile->consumed += 8;
+        n--;
+    }
+    
+    while(n > 0)
+    {
+        if(bfile->index >= bfile->read && fill_buf(bfile) == EOF)
+            return EOF;
+        size_t left = bfile->read - bfile->index;
+        size_t len = n < left ? n : left;
+        memcpy(p, bfile->buf + bfile->index, len);
+        bfile->index += len;
+        bfile->consumed += (uint64_t)len << 3;
+        p += len;
+        n -= len;
+    }
+    return 0;
+}
+
+
+/**
+ * Copies up to `n` of the next bytes into `dst` without consuming them.
+ * Returns the number of bytes copied, which is less than `n` only at the
+ * end of the file.
+ */
+size_t bits_io_peek_bytes (BitsIOFile *bfile, void *dst, size_t n)
+{
+    assert(bfile != NULL && bfile->mode == 'r');
+    assert(bfile->avail == 0);
+    
+    size_t left = fill_at_least(bfile, n);
+    if(left > n)
+        left = n;
+    memcpy(dst, bfile->buf + bfile->index, left);
+    return left;
+}
+
+
 /**
  * Writes the Huffman tree to the BitsIOFile.
  *
@@ -391,7 +1167,14 @@ int bits_io_write_tree (BitsIOFile *bfile, TreeNode *tree)
     if (bfile->mode != 'w')
         return -1;
     
-    tree_serialize(tree, bfile->fp);
+    StatsTimer timer;
+    stats_start(&timer);
+    char text[TREE_TEXT_MAX];
+    int len = tree_serialize_mem(tree, text, sizeof(text));
+    int res = len < 0 ? EOF : bits_io_write_bytes(bfile, text, len);
+    stats_stop(&timer, STATS_HEADER);
+    if (res == EOF)
+        return -1;
     return tree_size(tree);
 }
 
@@ -408,7 +1191,72 @@ TreeNode *bits_io_read_tree (BitsIOFile *bfile)
     if (bfile->mode != 'r')
         return NULL;
     
-    return tree_deserialize(bfile->fp);
+    // The serialized tree is never longer than TREE_TEXT_MAX, so once that
+    // much is in the buffer we can parse it right there.
+    assert(bfile->avail == 0);
+    StatsTimer timer;
+    stats_start(&timer);
+    size_t left = fill_at_least(bfile, TREE_TEXT_MAX);
+    size_t used;
+    TreeNode *tree = tree_deserialize_mem((char *)bfile->buf + bfile->index,
+                                          left, &used);
+    if (tree != NULL)
+    {
+        bfile->index += used;
+        bfile->consumed += (uint64_t)used << 3;
+    }
+    stats_stop(&timer, STATS_HEADER);
+    return tree;
+}
+
+
+/**
+ * Reads the Huffman tree from the BitsIOFile into the FlatTree, without
+ * making its nodes.  Returns -1 if there is an error.
+ */
+int bits_io_read_flat_tree (BitsIOFile *bfile, FlatTree *flat)
+{
+    if (bfile->mode != 'r')
+        return -1;
+    
+    assert(bfile->avail == 0);
+    StatsTimer timer;
+    stats_start(&timer);
+    size_t left = fill_at_least(bfile, TREE_TEXT_MAX);
+    size_t used;
+    int res = tree_deserialize_flat((char *)bfile->buf + bfile->index, left,
+                                    &used, flat);
+    if (res == 0)
+    {
+        bfile->index += used;
+        bfile->consumed += (uint64_t)used << 3;
+    }
+    stats_stop(&timer, STATS_HEADER);
+    return res;
+}
+
+/**
+ * Opens the file `name` like fopen, except that a name of "-" stands for
+ * the standard input or output, depending on `mode`.
+ */
+FILE *fopen_stream(const char *name, const char *mode)
+{
+    if (strcmp(name, "-") == 0)
+        return mode[0] == 'r' ? stdin : stdout;
+    return fopen(name, mode);
+}
+
+/**
+ * Closes a file opened with fopen_stream.  The standard input and output
+ * are only flushed, not closed.
+ */
+int fclose_stream(FILE *fp)
+{
+    if (fp == stdin)
+        return 0;
+    if (fp == stdout)
+        return fflush(fp);
+    return fclose(fp);
 }
 
 /**
@@ -431,15 +1279,14 @@ int write_offset(BitsIOFile *bfile, uint64_t size)
     if(bfile->mode != 'w')
         return EOF;
     
+    unsigned char bytes[sizeof(uint64_t)];
     for(int i = sizeof(uint64_t) - 1; i >= 0; i --)
     {
         //get the ith byte
         //big endian style
-        unsigned char c = (size >> (i << 3)) & 0xFF;
-        if(fputc(c, bfile->fp) == EOF)
-            return EOF;
+        bytes[sizeof(uint64_t) - 1 - i] = (size >> (i << 3)) & 0xFF;
     }
-    return 0;
+    return bits_io_write_bytes(bfile, bytes, sizeof(bytes));
 }
 
 /**
@@ -453,15 +1300,15 @@ uint64_t read_offset(BitsIOFile *bfile)
     
     //we can't just use fread to fill this variable
     //because we might have endianess problem
+    unsigned char bytes[sizeof(uint64_t)];
+    if(bits_io_read_bytes(bfile, bytes, sizeof(bytes)) == EOF)
+        return -1L;
+    
     uint64_t size = 0;
     for(int i = 0; i < sizeof(uint64_t); i ++)
     {
-        int c = fgetc(bfile->fp);
-        if(c == EOF)
-            return -1L;
-        
         //big endian style
-        size = (size << 8) | c;
+        size = (size << 8) | bytes[i];
     }
     return size;
 }
@@ -2,6 +2,8 @@
 #define __BITSTR_H
 
 #include "tree.h"
+#include "table.h"
+#include <stddef.h>
 #include <stdint.h>
 /**
  * This structure is used to maintain the writing/reading of a
@@ -12,31 +14,156 @@ typedef struct BitsIOFile BitsIOFile;
 /**
  * Opens a new BitsIOFile. Returns NULL if there is a failure.
  *
- * The `name` is the name of the file.
- * The `mode` is "w" for write and "r" for read.
+ * The `name` is the name of the file, or "-" for the standard input or
+ * output.  The `mode` is "w" for write and "r" for read.
  */
 BitsIOFile *bits_io_open (const char *name, const char *mode);
 
+/**
+ * Opens a new BitsIOFile like bits_io_open, but maps a regular file into
+ * memory instead of copying it through a buffer: a file that is read is
+ * mapped whole, and one that is written gets `size` bytes of room, the
+ * most it is expected to take, which grows if that was too little and is
+ * cut to what was written when it is closed.  With a `size` of 0, or for a
+ * file that cannot be mapped, a file that is written goes through a buffer
+ * as with bits_io_open.  Returns NULL if there is a failure.
+ */
+BitsIOFile *bits_io_open_sized (const char *name, const char *mode,
+                                uint64_t size);
+
+/**
+ * Opens a BitsIOFile on the `size` bytes of memory at `mem` instead of a
+ * file. Returns NULL if there is a failure.
+ *
+ * The `mode` is "w" to write into the memory and "r" to read from it.
+ * Writing fails with EOF once the memory is full.  The memory still belongs
+ * to the caller after the BitsIOFile is closed.
+ */
+BitsIOFile *bits_io_open_mem (void *mem, size_t size, const char *mode);
+
+/**
+ * Points a BitsIOFile opened with bits_io_open_mem at the `size` bytes of
+ * memory at `mem`, as if it had just been opened on them.  Anything not
+ * flushed from before is dropped.  This lets one BitsIOFile be used for
+ * many buffers without allocating it again.
+ */
+void bits_io_reset_mem (BitsIOFile *bfile, void *mem, size_t size,
+                        const char *mode);
+
 /**
  * Returns the number of bytes read/written so far
  */
 int bits_io_num_bytes (BitsIOFile *bfile);
 
+/**
+ * Returns the number of bits read/written so far
+ */
+uint64_t bits_io_num_bits (BitsIOFile *bfile);
+
+/**
+ * Returns the size in bytes of the file or memory the BitsIOFile reads, or
+ * -1 if it cannot be known, e.g. for a pipe.
+ */
+int64_t bits_io_size (BitsIOFile *bfile);
+
+/**
+ * Moves a BitsIOFile opened for reading to the byte `offset` bytes from the
+ * start, dropping anything read ahead, so the next read starts there.
+ * Returns EOF if it cannot seek there, e.g. on a pipe.
+ */
+int bits_io_seek (BitsIOFile *bfile, uint64_t offset);
+
+/**
+ * Writes out everything that is still buffered, padding the last byte with
+ * 0 bits, but leaves the BitsIOFile open.  Nothing should be written after
+ * this.  Returns EOF if there was an error.
+ */
+int bits_io_flush (BitsIOFile *bfile);
+
+/**
+ * Writes out everything that is still buffered and hands it to the system,
+ * so a reader on the other end of a pipe sees it right away.  Must be called
+ * between whole bytes; writing can go on afterwards.  Returns EOF if there
+ * was an error.
+ */
+int bits_io_sync (BitsIOFile *bfile);
+
 /**
  * Close the BitsIOFile. Returns EOF if there was an error.
  */
 int bits_io_close (BitsIOFile *bfile);
 
+/**
+ * Close the BitsIOFile without writing out what is still buffered, e.g.
+ * after an error. Returns EOF if there was an error.
+ */
+int bits_io_discard (BitsIOFile *bfile);
+
 /**
  * Read a bit from the BitsIOFile.  Returns EOF if there are no more bits.
  */
 int bits_io_read_bit (BitsIOFile *bfile);
 
+/**
+ * Returns the next n bits (1 <= n <= 32) without consuming them, first bit
+ * in the most significant position.  Missing bits past the end read as 0.
+ */
+uint32_t bits_io_peek_bits (BitsIOFile *bfile, int n);
+
+/**
+ * Consumes n bits (0 <= n <= 32).  Returns EOF if fewer than n bits were
+ * left in the file.
+ */
+int bits_io_skip_bits (BitsIOFile *bfile, int n);
+
 /**
  * Writes the given bit (1 or 0) to the BitsIOFile.
  */
 int bits_io_write_bit (BitsIOFile *bfile, int bit);
 
+/**
+ * Writes the low `len` bits of `bits` (0 <= len <= 64) to the BitsIOFile,
+ * most significant bit first.  Returns EOF if there was an error.
+ */
+int bits_io_write_bits (BitsIOFile *bfile, uint64_t bits, int len);
+
+/**
+ * Writes the codes in `codes` of the `n` characters at `src`, as calling
+ * bits_io_write_bits for each of them would.  Returns EOF if there was an
+ * error.
+ */
+int bits_io_write_codes (BitsIOFile *bfile, const unsigned char *src,
+                         size_t n, const BitCode codes[256]);
+
+/**
+ * Writes the `n` bytes at `src` to the BitsIOFile.  Must not be called while
+ * a partial byte is pending.  Returns EOF if there was an error.
+ */
+int bits_io_write_bytes (BitsIOFile *bfile, const void *src, size_t n);
+
+/**
+ * Reads `n` bytes from the BitsIOFile into `dst`.  Must not be called while
+ * part of a byte has been read.  Returns EOF if the file ended first.
+ */
+int bits_io_read_bytes (BitsIOFile *bfile, void *dst, size_t n);
+
+/**
+ * Returns the next `n` bytes of a BitsIOFile that is read from memory or a
+ * mapped file and consumes them, without copying.  They stay valid until
+ * the BitsIOFile is closed.  Returns NULL if the bytes are not all in
+ * memory, which does not consume anything, so the caller can fall back to
+ * bits_io_read_bytes.  Must not be called while part of a byte has been
+ * read.
+ */
+const unsigned char *bits_io_view_bytes (BitsIOFile *bfile, size_t n);
+
+/**
+ * Copies up to `n` (at most 1 MB) of the next bytes into `dst` without
+ * consuming them.  Returns the number of bytes copied, which is less than
+ * `n` only at the end of the file.  Only valid before any bits were read.
+ */
+size_t bits_io_peek_bytes (BitsIOFile *bfile, void *dst, size_t n);
+
 /**
  * Writes the Huffman tree to the BitsIOFile.
  *
@@ -53,6 +180,24 @@ int bits_io_write_tree (BitsIOFile *bfile, TreeNode *tree);
  */
 TreeNode *bits_io_read_tree (BitsIOFile *bfile);
 
+/**
+ * Same as bits_io_read_tree, into the FlatTree.  Returns -1 if there is an
+ * error.
+ */
+int bits_io_read_flat_tree (BitsIOFile *bfile, FlatTree *flat);
+
+/**
+ * Opens the file `name` like fopen, except that a name of "-" stands for
+ * the standard input or output, depending on `mode`.
+ */
+FILE *fopen_stream(const char *name, const char *mode);
+
+/**
+ * Closes a file opened with fopen_stream.  The standard input and output
+ * are only flushed, not closed.
+ */
+int fclose_stream(FILE *fp);
+
 /**
  * Return the size of file specified by filename, in bytes.
  */
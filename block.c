@@ -0,0 +1,1207 @@
+/********************************************************************
+
+ The block module encodes and decodes one block of the framed format (see
+ frame.c) entirely in memory.  An encoded block is:
+
+   TYPE PAYLOAD
+
+ where TYPE is one byte.  For BLOCK_CANONICAL the payload is a bitstream
+ holding the packed code lengths of the block (see canon.c) followed by the
+ encoded characters, and for BLOCK_STORED it is the characters themselves.
+ A block is stored whenever Huffman coding would not make it smaller, so an
+ encoded block is never more than one byte larger than the input.
+
+ BLOCK_WORDS is BLOCK_CANONICAL with an alphabet of 16 bit little endian
+ words, so each pair of characters is coded as one symbol.  A block with an
+ odd number of characters has its last one appended to the bitstream as 8
+ plain bits.
+
+ BLOCK_ORDER1 is BLOCK_CANONICAL with an order-1 model (see context.c) in
+ place of the code lengths: each character is coded with the table of the
+ character before it, the first one with the table of a 0.  A block only
+ gets an order-1 model when that makes it smaller than one table would.
+
+ BLOCK_ADAPTIVE stores no code at all, so a block is coded in a single pass.
+ The payload is
+
+   LOG LIMIT BITSTREAM
+
+ where LOG (5 bits) is the base 2 logarithm of the rebuild interval and
+ LIMIT (4 bits) the longest code allowed.  Both sides start with every
+ character counted once and rebuild the code from the counts (see
+ adapt_step for when), coding the characters in between with the code they
+ have.  Once the counts get large they are halved, so the code follows the
+ recent characters more than the old ones.
+
+ For BLOCK_ANS the payload is the normalized counts of the block (see
+ ans.c), padded to a whole byte, followed by the tANS stream.
+
+ BLOCK_LZ77 codes the block as the tokens of lz77.c, with two canonical
+ codes as in deflate: one for the characters and the match lengths, the
+ other for the distances.  The payload is
+
+   LENGTHS(LITLEN) LENGTHS(DIST) SYMBOLS
+
+ where the LENGTHS are packed as for BLOCK_WORDS and every length or
+ distance symbol is followed by its extra bits.
+
+ BLOCK_STREAMS is BLOCK_CANONICAL with the characters cut into COUNT
+ pieces of equal size (the last one maybe shorter), each coded as a stream
+ of its own so that the decoder can work on all of them at once (see
+ dtable.c).  The payload is
+
+   LENGTHS COUNT JUMP(0) ... JUMP(COUNT - 2) STREAM(0) ... STREAM(COUNT - 1)
+
+ where COUNT (4 bits) is the number of streams less one, padded to a whole
+ byte, and every JUMP is the number of bytes of a stream as a 4 byte big
+ endian number.  The last stream takes the rest of the block.
+
+ Blocks of type BLOCK_HUFFMAN, which carry the serialized Huffman tree (see
+ tree.c) in place of the code lengths, are no longer written but can still
+ be decoded.
+
+ All the memory needed to code a block (the nodes of the trees, the decode
+ table, the bit reader and writer) lives in a BlockCtx.  The much larger
+ tables for words, order-1 models, tANS and LZ77 are only allocated the
+ first time they are needed.  Keeping a BlockCtx around and passing it to
+ every call means that coding a canonical block allocates nothing, which
+ matters when there are many small blocks.  Apart from the BlockCtx nothing
+ in here touches any shared state, so any number of blocks can be encoded or
+ decoded at the same time on different threads, each with its own BlockCtx.
+
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "huffman.h"
+#include "table.h"
+#include "dtable.h"
+#include "canon.h"
+#include "histogram.h"
+#include "context.h"
+#include "ans.h"
+#include "lz77.h"
+#include "bits-io.h"
+#include "block.h"
+#include "stats.h"
+
+/**
+ * An adaptive code is first rebuilt after this many characters, and then
+ * every time the number of characters coded has doubled, until it is
+ * rebuilt every interval.
+ */
+#define BLOCK_ADAPT_FIRST 256
+
+/**
+ * The adaptive counts are halved once they add up to more than this many
+ * intervals.
+ */
+#define BLOCK_ADAPT_HISTORY 16
+
+
+/**
+ * The BlockWords structure holds the tables for coding 16 bit words.
+ */
+typedef struct BlockWords BlockWords;
+struct BlockWords {
+    uint64_t      counts[HIST_WORDS];  // How often each word occurs
+    unsigned char lens[HIST_WORDS];    // The code length of each word
+    BitCode       codes[HIST_WORDS];   // The code of each word
+    CanonTable   *table;               // Decodes the words
+};
+
+
+/**
+ * The BlockOrder1 structure holds the tables for order-1 coding.
+ */
+typedef struct BlockOrder1 BlockOrder1;
+struct BlockOrder1 {
+    ContextModel    model;                          // The model of the block
+    ContextScratch *scratch;                        // For building it
+    BitCode         codes[CONTEXT_CLUSTERS][256];   // The codes of each table
+    DecodeTable    *dtab[CONTEXT_CLUSTERS];         // Decodes each table
+};
+
+
+/**
+ * The BlockLz structure holds the tables for LZ77 coding.
+ */
+typedef struct BlockLz BlockLz;
+struct BlockLz {
+    Lz77          *finder;                            // Finds the matches
+    uint64_t       litlen_counts[LZ77_LITLEN_SYMBOLS];
+    uint64_t       dist_counts[LZ77_DIST_SYMBOLS];
+    unsigned char  litlen_lens[LZ77_LITLEN_SYMBOLS];
+    unsigned char  dist_lens[LZ77_DIST_SYMBOLS];
+    BitCode        litlen_codes[LZ77_LITLEN_SYMBOLS];
+    BitCode        dist_codes[LZ77_DIST_SYMBOLS];
+    CanonTable    *litlen;                            // Decodes each code
+    CanonTable    *dist;
+};
+
+
+/**
+ * The BlockCtx holds the memory reused from one block to the next.
+ */
+struct BlockCtx {
+    HuffmanScratch *scratch;  // For computing the code lengths
+    DecodeTable    *dtab;     // The decode table of the block
+    BitsIOFile     *bits;     // Reads or writes the bitstream
+    FlatTree        tree;     // The decode tree of the block
+    BlockWords     *words;    // NULL until words are first coded
+    BlockOrder1    *order1;   // NULL until order-1 is first used
+    AnsTable       *ans;      // NULL until tANS is first used
+    BlockLz        *lz;       // NULL until LZ77 is first used
+};
+
+
+/**
+ * Fills in the default BlockOptions.
+ */
+void block_options_init (BlockOptions *opts)
+{
+    opts->max_code_len = 0;
+    opts->symbol_bits  = 8;
+    opts->order        = 0;
+    opts->adapt_interval = 0;
+    opts->coder          = BLOCK_CODER_HUFF;
+    opts->lz_level       = 0;
+    opts->lz_window      = LZ77_DEFAULT_WINDOW;
+    opts->streams        = 1;
+}
+
+
+/**
+ * Returns a new BlockCtx or NULL if there is an error.
+ */
+BlockCtx *block_ctx_new (void)
+{
+    BlockCtx *ctx = (BlockCtx *)(calloc(1, sizeof(BlockCtx)));
+    if (ctx == NULL)
+        return NULL;
+
+    ctx->scratch = huffman_scratch_new();
+    ctx->dtab    = dtable_new();
+    ctx->bits    = bits_io_open_mem(NULL, 0, "r");
+    if (ctx->scratch == NULL || ctx->dtab == NULL || ctx->bits == NULL)
+    {
+        block_ctx_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+
+/**
+ * Frees a BlockCtx.
+ */
+void block_ctx_free (BlockCtx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    huffman_scratch_free(ctx->scratch);
+    if (ctx->dtab != NULL)
+        dtable_free(ctx->dtab);
+    if (ctx->bits != NULL)
+        bits_io_discard(ctx->bits);
+    if (ctx->words != NULL)
+        canon_table_free(ctx->words->table);
+    free(ctx->words);
+    if (ctx->order1 != NULL)
+    {
+        context_scratch_free(ctx->order1->scratch);
+        for (int k = 0; k < CONTEXT_CLUSTERS; k++)
+        {
+            if (ctx->order1->dtab[k] != NULL)
+                dtable_free(ctx->order1->dtab[k]);
+        }
+    }
+    free(ctx->order1);
+    ans_table_free(ctx->ans);
+    if (ctx->lz != NULL)
+    {
+        lz77_free(ctx->lz->finder);
+        canon_table_free(ctx->lz->litlen);
+        canon_table_free(ctx->lz->dist);
+    }
+    free(ctx->lz);
+    free(ctx);
+}
+
+
+/**
+ * Returns the tables for coding words, allocating them the first time, or
+ * NULL if there is an error.
+ */
+static BlockWords *block_words (BlockCtx *ctx)
+{
+    if (ctx->words != NULL)
+        return ctx->words;
+
+    BlockWords *words = (BlockWords *)(malloc(sizeof(BlockWords)));
+    if (words == NULL)
+        return NULL;
+    words->table = canon_table_new(HIST_WORDS);
+    if (words->table == NULL)
+    {
+        free(words);
+        return NULL;
+    }
+    ctx->words = words;
+    return words;
+}
+
+
+/**
+ * Returns the tables for order-1 coding, allocating them the first time, or
+ * NULL if there is an error.  The decode tables are allocated only when a
+ * block is decoded.
+ */
+static BlockOrder1 *block_order1 (BlockCtx *ctx)
+{
+    if (ctx->order1 != NULL)
+        return ctx->order1;
+
+    BlockOrder1 *o = (BlockOrder1 *)(calloc(1, sizeof(BlockOrder1)));
+    if (o == NULL)
+        return NULL;
+    o->scratch = context_scratch_new();
+    if (o->scratch == NULL)
+    {
+        free(o);
+        return NULL;
+    }
+    ctx->order1 = o;
+    return o;
+}
+
+
+/**
+ * Returns the tANS tables, allocating them the first time, or NULL if there
+ * is an error.
+ */
+static AnsTable *block_ans (BlockCtx *ctx)
+{
+    if (ctx->ans == NULL)
+        ctx->ans = ans_table_new();
+    return ctx->ans;
+}
+
+
+/**
+ * Returns the tables for LZ77 coding, allocating them the first time, or
+ * NULL if there is an error.
+ */
+static BlockLz *block_lz (BlockCtx *ctx)
+{
+    if (ctx->lz != NULL)
+        return ctx->lz;
+
+    BlockLz *lz = (BlockLz *)(calloc(1, sizeof(BlockLz)));
+    if (lz == NULL)
+        return NULL;
+    lz->finder = lz77_new();
+    lz->litlen = canon_table_new(LZ77_LITLEN_SYMBOLS);
+    lz->dist   = canon_table_new(LZ77_DIST_SYMBOLS);
+    if (lz->finder == NULL || lz->litlen == NULL || lz->dist == NULL)
+    {
+        lz77_free(lz->finder);
+        canon_table_free(lz->litlen);
+        canon_table_free(lz->dist);
+        free(lz);
+        return NULL;
+    }
+    ctx->lz = lz;
+    return lz;
+}
+
+
+/**
+ * Returns the largest number of bytes block_encode can produce for a block
+ * of `n` characters.
+ */
+size_t block_bound (size_t n)
+{
+    return n + 1;
+}
+
+
+/**
+ * Writes the `n` characters at `src` as a stored block.
+ */
+static long store (const unsigned char *src, size_t n, unsigned char *dst)
+{
+    dst[0] = BLOCK_STORED;
+    memcpy(dst + 1, src, n);
+    return (long)(n + 1);
+}
+
+
+/**
+ * Tries to encode the `n` characters at `src` as a canonical Huffman block
+ * in at most `n` bytes.  Returns the number of bytes written or -1 if it
+ * does not fit.
+ */
+static long encode_canonical (BlockCtx *ctx, const unsigned char *src,
+                              size_t n, unsigned char *dst,
+                              const BlockOptions *opts)
+{
+    unsigned char lens[CANON_SYMBOLS];
+    BitCode codes[CANON_SYMBOLS];
+    if (n < 2 ||
+        huffman_build_lengths(src, n, opts->max_code_len, lens,
+                              ctx->scratch) == -1 ||
+        canon_codes(lens, codes) == -1)
+    {
+        return -1;
+    }
+
+    // The bitstream gets whatever room is left below n bytes; running out
+    // of it means the block does not compress.
+    dst[0] = BLOCK_CANONICAL;
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, dst + 1, n - 1, "w");
+
+    if (canon_write_lengths(bits, lens) == EOF)
+        return -1;
+    if (bits_io_write_codes(bits, src, n, codes) == EOF)
+        return -1;
+
+    uint64_t nbits = bits_io_num_bits(bits);
+    if (bits_io_flush(bits) == EOF)
+        return -1;
+    return (long)(1 + ((nbits + 7) >> 3));
+}
+
+
+/**
+ * Returns the number of characters in each stream but the last when `n`
+ * characters are split into `k` streams.
+ */
+static size_t stream_size (size_t n, int k)
+{
+    return (n + k - 1) / k;
+}
+
+
+/**
+ * Tries to encode the `n` characters at `src` as a block of `k` streams in
+ * at most `n` bytes.  Returns the number of bytes written or -1 if it does
+ * not fit.
+ */
+static long encode_streams (BlockCtx *ctx, const unsigned char *src,
+                            size_t n, unsigned char *dst, int k,
+                            const BlockOptions *opts)
+{
+    unsigned char lens[CANON_SYMBOLS];
+    BitCode codes[CANON_SYMBOLS];
+    if (n < 2 ||
+        huffman_build_lengths(src, n, opts->max_code_len, lens,
+                              ctx->scratch) == -1 ||
+        canon_codes(lens, codes) == -1)
+    {
+        return -1;
+    }
+
+    dst[0] = BLOCK_STREAMS;
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, dst + 1, n - 1, "w");
+    if (canon_write_lengths(bits, lens) == EOF ||
+        bits_io_write_bits(bits, k - 1, 4) == EOF)
+    {
+        return -1;
+    }
+    size_t pos = 1 + (size_t)((bits_io_num_bits(bits) + 7) >> 3);
+    if (bits_io_flush(bits) == EOF)
+        return -1;
+
+    // Leave room for the jump table and fill it in once the streams are
+    // written:
+    unsigned char *jump = dst + pos;
+    pos += 4 * (size_t)(k - 1);
+    size_t seg = stream_size(n, k);
+    for (int s = 0; s < k; s++)
+    {
+        if (pos >= n)
+            return -1;
+        bits_io_reset_mem(bits, dst + pos, n - pos, "w");
+
+        size_t start = (size_t)s * seg;
+        size_t end = start + seg < n ? start + seg : n;
+        if (bits_io_write_codes(bits, src + start, end - start, codes) == EOF)
+            return -1;
+
+        size_t len = (size_t)((bits_io_num_bits(bits) + 7) >> 3);
+        if (bits_io_flush(bits) == EOF)
+            return -1;
+        if (s < k - 1)
+        {
+            unsigned char *p = jump + 4 * s;
+            p[0] = (unsigned char)(len >> 24);
+            p[1] = (unsigned char)(len >> 16);
+            p[2] = (unsigned char)(len >> 8);
+            p[3] = (unsigned char)len;
+        }
+        pos += len;
+    }
+    return (long)pos;
+}
+
+
+/**
+ * Tries to encode the `n` characters at `src` with a single code, in as
+ * many streams as the options ask for.  Returns the number of bytes
+ * written or -1 if it does not fit.
+ */
+static long encode_order0 (BlockCtx *ctx, const unsigned char *src,
+                           size_t n, unsigned char *dst,
+                           const BlockOptions *opts)
+{
+    if (opts->streams > 1 && n >= 2 * (size_t)opts->streams)
+        return encode_streams(ctx, src, n, dst, opts->streams, opts);
+    return encode_canonical(ctx, src, n, dst, opts);
+}
+
+
+/**
+ * Tries to encode the `n` characters at `src` as a block of words in at
+ * most `n` bytes.  Returns the number of bytes written or -1 if it does not
+ * fit.
+ */
+static long encode_words (BlockCtx *ctx, const unsigned char *src,
+                          size_t n, unsigned char *dst)
+{
+    BlockWords *words;
+    if (n < 4 || (words = block_words(ctx)) == NULL)
+        return -1;
+
+    StatsTimer timer;
+    stats_start(&timer);
+    memset(words->counts, 0, sizeof(words->counts));
+    histogram_count16(src, n, words->counts);
+    stats_stop(&timer, STATS_HISTOGRAM);
+    if (huffman_lengths(words->counts, HIST_WORDS, 0, words->lens,
+                        ctx->scratch) == -1 ||
+        canon_codes_n(words->lens, HIST_WORDS, words->codes) == -1)
+    {
+        return -1;
+    }
+
+    dst[0] = BLOCK_WORDS;
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, dst + 1, n - 1, "w");
+
+    if (canon_write_lengths_n(bits, words->lens, HIST_WORDS) == EOF)
+        return -1;
+    for (size_t i = 0; i + 1 < n; i += 2)
+    {
+        const BitCode *b = &words->codes[src[i] | (src[i + 1] << 8)];
+        if (bits_io_write_bits(bits, b->bits, b->len) == EOF)
+            return -1;
+    }
+    if (n % 2 != 0 && bits_io_write_bits(bits, src[n - 1], 8) == EOF)
+        return -1;
+
+    uint64_t nbits = bits_io_num_bits(bits);
+    if (bits_io_flush(bits) == EOF)
+        return -1;
+    return (long)(1 + ((nbits + 7) >> 3));
+}
+
+
+/**
+ * Tries to encode the `n` characters at `src` as an order-1 block in at
+ * most `n` bytes, or with a single code if one table is better.  Returns
+ * the number of bytes written or -1 if it does not fit.
+ */
+static long encode_order1 (BlockCtx *ctx, const unsigned char *src,
+                           size_t n, unsigned char *dst,
+                           const BlockOptions *opts)
+{
+    BlockOrder1 *o;
+    if (n < 2 || (o = block_order1(ctx)) == NULL)
+        return -1;
+
+    // The size context_build works out is only used to give up early, the
+    // writer below still stops at the end of `dst`:
+    int64_t estimate = context_build(src, n, opts->max_code_len, &o->model,
+                                     o->scratch, ctx->scratch);
+    if (estimate < 0 || estimate >= (int64_t)(n - 1) * 8)
+        return -1;
+    if (o->model.nclusters == 1)
+        return encode_order0(ctx, src, n, dst, opts);
+
+    const BitCode *table[256];
+    for (int k = 0; k < o->model.nclusters; k++)
+    {
+        if (canon_codes(o->model.lens[k], o->codes[k]) == -1)
+            return -1;
+    }
+    for (int c = 0; c < 256; c++)
+        table[c] = o->codes[o->model.map[c]];
+
+    dst[0] = BLOCK_ORDER1;
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, dst + 1, n - 1, "w");
+
+    if (context_write(bits, &o->model) == EOF)
+        return -1;
+    unsigned char prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char ch = src[i];
+        const BitCode *b = &table[prev][ch];
+        if (bits_io_write_bits(bits, b->bits, b->len) == EOF)
+            return -1;
+        prev = ch;
+    }
+
+    uint64_t nbits = bits_io_num_bits(bits);
+    if (bits_io_flush(bits) == EOF)
+        return -1;
+    return (long)(1 + ((nbits + 7) >> 3));
+}
+
+
+/**
+ * Tries to encode the `n` characters at `src` as a tANS block in at most
+ * `n` bytes.  Returns the number of bytes written or -1 if it does not fit.
+ */
+static long encode_ans (BlockCtx *ctx, const unsigned char *src, size_t n,
+                        unsigned char *dst)
+{
+    AnsTable *tab;
+    if (n < 2 || (tab = block_ans(ctx)) == NULL)
+        return -1;
+
+    uint64_t counts[HIST_SYMBOLS] = { 0 };
+    uint16_t norm[HIST_SYMBOLS];
+    int log = ans_table_log(n);
+    StatsTimer timer;
+    stats_start(&timer);
+    histogram_count(src, n, counts);
+    stats_stop(&timer, STATS_HISTOGRAM);
+    if (ans_normalize(counts, log, norm) == -1 ||
+        ans_table_fill(tab, log, norm) == -1)
+    {
+        return -1;
+    }
+
+    dst[0] = BLOCK_ANS;
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, dst + 1, n - 1, "w");
+    if (ans_write_counts(bits, log, norm) == EOF)
+        return -1;
+    size_t head = (size_t)((bits_io_num_bits(bits) + 7) >> 3);
+    if (bits_io_flush(bits) == EOF)
+        return -1;
+
+    long len = ans_encode(tab, src, n, dst + 1 + head, n - 1 - head);
+    return len < 0 ? -1 : (long)(1 + head) + len;
+}
+
+
+/**
+ * Writes the code of symbol `sym` from `codes` followed by the `extra` low
+ * bits of `v`.  Returns EOF if there was an error.
+ */
+static int write_symbol (BitsIOFile *bits, const BitCode *codes, int sym,
+                         uint32_t v, int extra)
+{
+    if (bits_io_write_bits(bits, codes[sym].bits, codes[sym].len) == EOF)
+        return EOF;
+    return bits_io_write_bits(bits, v & ((1u << extra) - 1), extra);
+}
+
+
+/**
+ * Tries to encode the `n` characters at `src` as an LZ77 block in at most
+ * `n` bytes, or with a single code if there are no matches.  Returns the
+ * number of bytes written or -1 if it does not fit.
+ */
+static long encode_lz77 (BlockCtx *ctx, const unsigned char *src, size_t n,
+                         unsigned char *dst, const BlockOptions *opts)
+{
+    BlockLz *lz;
+    if (n < 2 || (lz = block_lz(ctx)) == NULL)
+        return -1;
+
+    const Lz77Token *tokens;
+    long ntokens = lz77_parse(lz->finder, src, n, opts->lz_level,
+                              opts->lz_window, &tokens);
+    if (ntokens < 0)
+        return -1;
+
+    memset(lz->litlen_counts, 0, sizeof(lz->litlen_counts));
+    memset(lz->dist_counts, 0, sizeof(lz->dist_counts));
+    long matches = 0;
+    for (long t = 0; t < ntokens; t++)
+    {
+        int extra;
+        if (!LZ77_IS_MATCH(tokens[t]))
+        {
+            lz->litlen_counts[LZ77_LITERAL(tokens[t])]++;
+            continue;
+        }
+        matches++;
+        lz->litlen_counts[256 + lz77_symbol(LZ77_LEN(tokens[t]) -
+                                            LZ77_MIN_MATCH, &extra)]++;
+        lz->dist_counts[lz77_symbol(LZ77_DIST(tokens[t]) - 1, &extra)]++;
+    }
+    if (matches == 0)
+        return encode_order0(ctx, src, n, dst, opts);
+
+    int limit = opts->max_code_len;
+    if (huffman_lengths(lz->litlen_counts, LZ77_LITLEN_SYMBOLS, limit,
+                        lz->litlen_lens, ctx->scratch) == -1 ||
+        huffman_lengths(lz->dist_counts, LZ77_DIST_SYMBOLS, limit,
+                        lz->dist_lens, ctx->scratch) == -1 ||
+        canon_codes_n(lz->litlen_lens, LZ77_LITLEN_SYMBOLS,
+                      lz->litlen_codes) == -1 ||
+        canon_codes_n(lz->dist_lens, LZ77_DIST_SYMBOLS, lz->dist_codes) == -1)
+    {
+        return -1;
+    }
+
+    dst[0] = BLOCK_LZ77;
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, dst + 1, n - 1, "w");
+    if (canon_write_lengths_n(bits, lz->litlen_lens,
+                              LZ77_LITLEN_SYMBOLS) == EOF ||
+        canon_write_lengths_n(bits, lz->dist_lens, LZ77_DIST_SYMBOLS) == EOF)
+    {
+        return -1;
+    }
+    for (long t = 0; t < ntokens; t++)
+    {
+        Lz77Token tok = tokens[t];
+        if (!LZ77_IS_MATCH(tok))
+        {
+            const BitCode *b = &lz->litlen_codes[LZ77_LITERAL(tok)];
+            if (bits_io_write_bits(bits, b->bits, b->len) == EOF)
+                return -1;
+            continue;
+        }
+
+        uint32_t len = LZ77_LEN(tok) - LZ77_MIN_MATCH;
+        uint32_t dist = LZ77_DIST(tok) - 1;
+        int lsym, dsym, lextra, dextra;
+        lsym = 256 + lz77_symbol(len, &lextra);
+        dsym = lz77_symbol(dist, &dextra);
+        if (write_symbol(bits, lz->litlen_codes, lsym, len, lextra) == EOF ||
+            write_symbol(bits, lz->dist_codes, dsym, dist, dextra) == EOF)
+        {
+            return -1;
+        }
+    }
+
+    uint64_t nbits = bits_io_num_bits(bits);
+    if (bits_io_flush(bits) == EOF)
+        return -1;
+    return (long)(1 + ((nbits + 7) >> 3));
+}
+
+
+/**
+ * Returns how many characters, from position `pos` of an adaptive block, are
+ * coded before the code is rebuilt.
+ */
+static size_t adapt_step (size_t pos, size_t interval)
+{
+    size_t step = pos < BLOCK_ADAPT_FIRST ? BLOCK_ADAPT_FIRST : pos;
+    return step < interval ? step : interval;
+}
+
+
+/**
+ * Adds the `n` characters at `buf` to the adaptive counts, halving them if
+ * they have grown too large.
+ */
+static void adapt_update (uint64_t counts[HIST_SYMBOLS],
+                          const unsigned char *buf, size_t n,
+                          size_t interval)
+{
+    StatsTimer timer;
+    stats_start(&timer);
+    histogram_count(buf, n, counts);
+    stats_stop(&timer, STATS_HISTOGRAM);
+
+    uint64_t total = 0;
+    for (int c = 0; c < HIST_SYMBOLS; c++)
+        total += counts[c];
+    if (total <= BLOCK_ADAPT_HISTORY * (uint64_t)interval)
+        return;
+    for (int c = 0; c < HIST_SYMBOLS; c++)
+        counts[c] = (counts[c] + 1) / 2;
+}
+
+
+/**
+ * Tries to encode the `n` characters at `src` as an adaptive block in at
+ * most `n` bytes.  Returns the number of bytes written or -1 if it does not
+ * fit.
+ */
+static long encode_adaptive (BlockCtx *ctx, const unsigned char *src,
+                             size_t n, unsigned char *dst,
+                             const BlockOptions *opts)
+{
+    if (n < 2)
+        return -1;
+
+    int log = 0;
+    while (((size_t)1 << log) < (size_t)opts->adapt_interval)
+        log++;
+    size_t interval = (size_t)1 << log;
+    int limit = opts->max_code_len != 0 ? opts->max_code_len
+                                        : HUFFMAN_LIMIT_MAX;
+
+    dst[0] = BLOCK_ADAPTIVE;
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, dst + 1, n - 1, "w");
+    if (bits_io_write_bits(bits, log, 5) == EOF ||
+        bits_io_write_bits(bits, limit, 4) == EOF)
+    {
+        return -1;
+    }
+
+    uint64_t counts[HIST_SYMBOLS];
+    unsigned char lens[CANON_SYMBOLS];
+    BitCode codes[CANON_SYMBOLS];
+    for (int c = 0; c < HIST_SYMBOLS; c++)
+        counts[c] = 1;
+
+    for (size_t pos = 0; pos < n; )
+    {
+        size_t step = adapt_step(pos, interval);
+        if (step > n - pos)
+            step = n - pos;
+        if (huffman_lengths(counts, CANON_SYMBOLS, limit, lens,
+                            ctx->scratch) == -1 ||
+            canon_codes(lens, codes) == -1)
+        {
+            return -1;
+        }
+        if (bits_io_write_codes(bits, src + pos, step, codes) == EOF)
+            return -1;
+        adapt_update(counts, src + pos, step, interval);
+        pos += step;
+    }
+
+    uint64_t nbits = bits_io_num_bits(bits);
+    if (bits_io_flush(bits) == EOF)
+        return -1;
+    return (long)(1 + ((nbits + 7) >> 3));
+}
+
+
+/**
+ * Encodes the `n` characters at `src` into `dst` using the given options.
+ * Returns the number of bytes written or -1 if there is an error.
+ */
+long block_encode (BlockCtx *ctx, const unsigned char *src, size_t n,
+                   unsigned char *dst, size_t cap, const BlockOptions *opts)
+{
+    if (cap < block_bound(n))
+        return -1;
+
+    BlockCtx *own = NULL;
+    if (ctx == NULL && (ctx = own = block_ctx_new()) == NULL)
+        return -1;
+
+    long len;
+    if (opts->symbol_bits == 16)
+        len = encode_words(ctx, src, n, dst);
+    else if (opts->adapt_interval != 0)
+        len = encode_adaptive(ctx, src, n, dst, opts);
+    else if (opts->order == 1)
+        len = encode_order1(ctx, src, n, dst, opts);
+    else if (opts->coder == BLOCK_CODER_ANS)
+        len = encode_ans(ctx, src, n, dst);
+    else if (opts->lz_level != 0)
+        len = encode_lz77(ctx, src, n, dst, opts);
+    else
+        len = encode_order0(ctx, src, n, dst, opts);
+    if (len < 0)
+        len = store(src, n, dst);
+
+    block_ctx_free(own);
+    return len;
+}
+
+
+/**
+ * Decodes a Huffman block whose payload is the `len` bytes at `src`.
+ */
+static int decode_huffman (BlockCtx *ctx, const unsigned char *src,
+                           size_t len, unsigned char *dst, size_t n)
+{
+    size_t used;
+    if (tree_deserialize_flat((const char *)src, len, &used,
+                              &ctx->tree) == -1 ||
+        dtable_fill(ctx->dtab, &ctx->tree) == -1)
+    {
+        return -1;
+    }
+
+    bits_io_reset_mem(ctx->bits, (void *)(src + used), len - used, "r");
+    return dtable_decode(ctx->dtab, ctx->bits, dst, n) == n ? 0 : -1;
+}
+
+
+/**
+ * Decodes a canonical Huffman block whose payload is the `len` bytes at
+ * `src`.
+ */
+static int decode_canonical (BlockCtx *ctx, const unsigned char *src,
+                             size_t len, unsigned char *dst, size_t n)
+{
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, (void *)src, len, "r");
+
+    unsigned char lens[CANON_SYMBOLS];
+    if (canon_read_lengths(bits, lens) == EOF ||
+        canon_tree(lens, &ctx->tree) == -1 ||
+        dtable_fill(ctx->dtab, &ctx->tree) == -1)
+    {
+        return -1;
+    }
+    return dtable_decode(ctx->dtab, bits, dst, n) == n ? 0 : -1;
+}
+
+
+/**
+ * Decodes a block of streams whose payload is the `len` bytes at `src`.
+ */
+static int decode_streams (BlockCtx *ctx, const unsigned char *src,
+                           size_t len, unsigned char *dst, size_t n)
+{
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, (void *)src, len, "r");
+
+    unsigned char lens[CANON_SYMBOLS];
+    if (canon_read_lengths(bits, lens) == EOF)
+        return -1;
+    int k = (int)bits_io_peek_bits(bits, 4) + 1;
+    if (bits_io_skip_bits(bits, 4) == EOF ||
+        canon_tree(lens, &ctx->tree) == -1 ||
+        dtable_fill(ctx->dtab, &ctx->tree) == -1)
+    {
+        return -1;
+    }
+
+    size_t pos = (size_t)((bits_io_num_bits(bits) + 7) >> 3);
+    size_t jump = pos;
+    pos += 4 * (size_t)(k - 1);
+    if (pos > len || n < (size_t)k)
+        return -1;
+
+    const unsigned char *in[DTABLE_STREAMS_MAX];
+    unsigned char *out[DTABLE_STREAMS_MAX];
+    size_t size[DTABLE_STREAMS_MAX], count[DTABLE_STREAMS_MAX];
+    size_t seg = stream_size(n, k);
+    for (int s = 0; s < k; s++)
+    {
+        size_t bytes = len - pos;
+        if (s < k - 1)
+        {
+            const unsigned char *p = src + jump + 4 * s;
+            bytes = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) |
+                    ((size_t)p[2] << 8)  |  (size_t)p[3];
+            if (bytes > len - pos)
+                return -1;
+        }
+        size_t first = (size_t)s * seg;
+        if (first > n)
+            return -1;
+        in[s]    = src + pos;
+        size[s]  = bytes;
+        out[s]   = dst + first;
+        count[s] = n - first < seg ? n - first : seg;
+        pos     += bytes;
+    }
+    return dtable_decode_streams(ctx->dtab, k, in, size, out, count);
+}
+
+
+/**
+ * Decodes a block of words whose payload is the `len` bytes at `src`.
+ */
+static int decode_words (BlockCtx *ctx, const unsigned char *src,
+                         size_t len, unsigned char *dst, size_t n)
+{
+    BlockWords *words = block_words(ctx);
+    if (words == NULL)
+        return -1;
+
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, (void *)src, len, "r");
+    if (canon_read_lengths_n(bits, words->lens, HIST_WORDS) == EOF ||
+        canon_table_fill(words->table, words->lens) == -1 ||
+        canon_table_decode16(words->table, bits, dst, n / 2) != n / 2)
+    {
+        return -1;
+    }
+    if (n % 2 != 0)
+    {
+        dst[n - 1] = (unsigned char)bits_io_peek_bits(bits, 8);
+        if (bits_io_skip_bits(bits, 8) == EOF)
+            return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Decodes an order-1 block whose payload is the `len` bytes at `src`.
+ */
+static int decode_order1 (BlockCtx *ctx, const unsigned char *src,
+                          size_t len, unsigned char *dst, size_t n)
+{
+    BlockOrder1 *o = block_order1(ctx);
+    if (o == NULL)
+        return -1;
+
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, (void *)src, len, "r");
+    if (context_read(bits, &o->model) == EOF)
+        return -1;
+
+    const DecodeTable *table[256];
+    for (int k = 0; k < o->model.nclusters; k++)
+    {
+        if (o->dtab[k] == NULL && (o->dtab[k] = dtable_new()) == NULL)
+            return -1;
+        if (canon_tree(o->model.lens[k], &ctx->tree) == -1 ||
+            dtable_fill(o->dtab[k], &ctx->tree) == -1)
+        {
+            return -1;
+        }
+    }
+    for (int c = 0; c < 256; c++)
+        table[c] = o->dtab[o->model.map[c]];
+
+    int prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        int c = dtable_decode_symbol(table[prev], bits);
+        if (c == EOF)
+            return -1;
+        dst[i] = (unsigned char)c;
+        prev = c;
+    }
+    return 0;
+}
+
+
+/**
+ * Decodes an adaptive block whose payload is the `len` bytes at `src`.
+ */
+static int decode_adaptive (BlockCtx *ctx, const unsigned char *src,
+                            size_t len, unsigned char *dst, size_t n)
+{
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, (void *)src, len, "r");
+
+    int log   = (int)bits_io_peek_bits(bits, 5);
+    int limit = (int)(bits_io_peek_bits(bits, 9) & 0xF);
+    if (bits_io_skip_bits(bits, 9) == EOF ||
+        ((size_t)1 << log) < BLOCK_ADAPT_MIN ||
+        ((size_t)1 << log) > BLOCK_ADAPT_MAX ||
+        limit < HUFFMAN_LIMIT_MIN || limit > HUFFMAN_LIMIT_MAX)
+    {
+        return -1;
+    }
+    size_t interval = (size_t)1 << log;
+
+    uint64_t counts[HIST_SYMBOLS];
+    unsigned char lens[CANON_SYMBOLS];
+    for (int c = 0; c < HIST_SYMBOLS; c++)
+        counts[c] = 1;
+
+    for (size_t pos = 0; pos < n; )
+    {
+        size_t step = adapt_step(pos, interval);
+        if (step > n - pos)
+            step = n - pos;
+        if (huffman_lengths(counts, CANON_SYMBOLS, limit, lens,
+                            ctx->scratch) == -1 ||
+            canon_tree(lens, &ctx->tree) == -1 ||
+            dtable_fill(ctx->dtab, &ctx->tree) == -1 ||
+            dtable_decode(ctx->dtab, bits, dst + pos, step) != step)
+        {
+            return -1;
+        }
+        adapt_update(counts, dst + pos, step, interval);
+        pos += step;
+    }
+    return 0;
+}
+
+
+/**
+ * Decodes a tANS block whose payload is the `len` bytes at `src`.
+ */
+static int decode_ans (BlockCtx *ctx, const unsigned char *src, size_t len,
+                       unsigned char *dst, size_t n)
+{
+    AnsTable *tab = block_ans(ctx);
+    if (tab == NULL)
+        return -1;
+
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, (void *)src, len, "r");
+
+    int log;
+    uint16_t norm[HIST_SYMBOLS];
+    if (ans_read_counts(bits, &log, norm) == EOF ||
+        bits_io_skip_bits(bits, (int)(-bits_io_num_bits(bits) & 7)) == EOF ||
+        ans_table_fill(tab, log, norm) == -1)
+    {
+        return -1;
+    }
+    return ans_decode(tab, bits, dst, n) == n ? 0 : -1;
+}
+
+
+/**
+ * Reads the extra bits that follow length or distance symbol `sym` and
+ * stores the number they code together in `v`.  Returns EOF if there was an
+ * error.
+ */
+static int read_extra (BitsIOFile *bits, int sym, uint32_t *v)
+{
+    int extra;
+    *v = lz77_base(sym, &extra);
+    if (extra == 0)
+        return 0;
+    *v += bits_io_peek_bits(bits, extra);
+    return bits_io_skip_bits(bits, extra);
+}
+
+
+/**
+ * Decodes an LZ77 block whose payload is the `len` bytes at `src`.
+ */
+static int decode_lz77 (BlockCtx *ctx, const unsigned char *src, size_t len,
+                        unsigned char *dst, size_t n)
+{
+    BlockLz *lz = block_lz(ctx);
+    if (lz == NULL)
+        return -1;
+
+    BitsIOFile *bits = ctx->bits;
+    bits_io_reset_mem(bits, (void *)src, len, "r");
+    if (canon_read_lengths_n(bits, lz->litlen_lens,
+                             LZ77_LITLEN_SYMBOLS) == EOF ||
+        canon_read_lengths_n(bits, lz->dist_lens, LZ77_DIST_SYMBOLS) == EOF ||
+        canon_table_fill(lz->litlen, lz->litlen_lens) == -1 ||
+        canon_table_fill(lz->dist, lz->dist_lens) == -1)
+    {
+        return -1;
+    }
+
+    size_t pos = 0;
+    while (pos < n)
+    {
+        int sym = canon_table_decode_symbol(lz->litlen, bits);
+        if (sym == EOF)
+            return -1;
+        if (sym < 256)
+        {
+            dst[pos++] = (unsigned char)sym;
+            continue;
+        }
+
+        // A match: its length, then its distance.
+        uint32_t mlen, dist;
+        if (read_extra(bits, sym - 256, &mlen) == EOF ||
+            (sym = canon_table_decode_symbol(lz->dist, bits)) == EOF ||
+            read_extra(bits, sym, &dist) == EOF)
+        {
+            return -1;
+        }
+        mlen += LZ77_MIN_MATCH;
+        if (++dist > pos || mlen > n - pos)
+            return -1;
+
+        // The copy may overlap what it is copying, repeating it:
+        const unsigned char *from = dst + pos - dist;
+        if (dist >= mlen)
+            memcpy(dst + pos, from, mlen);
+        else
+        {
+            for (uint32_t i = 0; i < mlen; i++)
+                dst[pos + i] = from[i];
+        }
+        pos += mlen;
+    }
+    return 0;
+}
+
+
+/**
+ * Decodes the encoded block of `len` bytes at `src` into the `n` characters
+ * at `dst`.  Returns 0, or -1 if the block is corrupt.
+ */
+int block_decode (BlockCtx *ctx, const unsigned char *src, size_t len,
+                  unsigned char *dst, size_t n)
+{
+    if (len < 1)
+        return -1;
+
+    if (src[0] == BLOCK_STORED)
+    {
+        if (len - 1 != n)
+            return -1;
+        memcpy(dst, src + 1, n);
+        return 0;
+    }
+
+    BlockCtx *own = NULL;
+    if (ctx == NULL && (ctx = own = block_ctx_new()) == NULL)
+        return -1;
+
+    int res;
+    switch (src[0])
+    {
+        case BLOCK_HUFFMAN:
+            res = decode_huffman(ctx, src + 1, len - 1, dst, n);
+            break;
+
+        case BLOCK_CANONICAL:
+            res = decode_canonical(ctx, src + 1, len - 1, dst, n);
+            break;
+
+        case BLOCK_WORDS:
+            res = decode_words(ctx, src + 1, len - 1, dst, n);
+            break;
+
+        case BLOCK_STREAMS:
+            res = decode_streams(ctx, src + 1, len - 1, dst, n);
+            break;
+
+        case BLOCK_ORDER1:
+            res = decode_order1(ctx, src + 1, len - 1, dst, n);
+            break;
+
+        case BLOCK_ADAPTIVE:
+            res = decode_adaptive(ctx, src + 1, len - 1, dst, n);
+            break;
+
+        case BLOCK_ANS:
+            res = decode_ans(ctx, src + 1, len - 1, dst, n);
+            break;
+
+        case BLOCK_LZ77:
+            res = decode_lz77(ctx, src + 1, len - 1, dst, n);
+            break;
+
+        default:
+            res = -1;
+            break;
+    }
+
+    block_ctx_free(own);
+    return res;
+}
@@ -0,0 +1,137 @@
+#ifndef __BLOCK_H
+#define __BLOCK_H
+
+#include <stddef.h>
+
+/**
+ * The first byte of every encoded block says how the rest of it is coded.
+ */
+#define BLOCK_STORED    0   // The characters themselves, not compressed
+#define BLOCK_HUFFMAN   1   // A serialized tree followed by the bitstream
+#define BLOCK_CANONICAL 2   // Packed code lengths followed by the bitstream
+#define BLOCK_WORDS     3   // The same for 16 bit words instead of bytes
+#define BLOCK_ORDER1    4   // A table for each preceding character
+#define BLOCK_ADAPTIVE  5   // Codes rebuilt as the block goes, none stored
+#define BLOCK_ANS       6   // Normalized counts followed by a tANS stream
+#define BLOCK_LZ77      7   // Matches and characters, Huffman coded
+#define BLOCK_STREAMS   8   // BLOCK_CANONICAL split into several streams
+
+/**
+ * The entropy coders BlockOptions.coder can pick.
+ */
+#define BLOCK_CODER_HUFF 0  // Huffman codes
+#define BLOCK_CODER_ANS  1  // Tabled asymmetric numeral systems (see ans.c)
+
+/**
+ * The range of intervals BlockOptions.adapt_interval accepts.
+ */
+#define BLOCK_ADAPT_MIN (1<<10)
+#define BLOCK_ADAPT_MAX (1<<24)
+
+
+/**
+ * The BlockOptions structure holds the settings that control how blocks are
+ * encoded.  Use block_options_init to get the defaults.
+ */
+typedef struct BlockOptions BlockOptions;
+struct BlockOptions {
+    // 0 for plain Huffman code lengths, otherwise no code is longer than
+    // this many bits (between HUFFMAN_LIMIT_MIN and HUFFMAN_LIMIT_MAX).
+    // Only applies to 8 bit symbols.
+    int max_code_len;
+
+    // 8 to code each character on its own, or 16 to code the input as 16
+    // bit little endian words, which suits streams of 16 bit samples.
+    int symbol_bits;
+
+    // 0 to code every character with the same table, or 1 to choose the
+    // table by the character before it (see context.c).  Only applies to 8
+    // bit symbols.
+    int order;
+
+    // 0 to store the code lengths in every block, otherwise a power of two
+    // between BLOCK_ADAPT_MIN and BLOCK_ADAPT_MAX: the code is rebuilt from
+    // the characters coded so far at least every this many characters, the
+    // same way by the encoder and the decoder, so no code is stored.  Only
+    // applies to 8 bit symbols with an order of 0.
+    int adapt_interval;
+
+    // BLOCK_CODER_HUFF or BLOCK_CODER_ANS.  tANS comes closer to the entropy
+    // when a few characters are very likely.  Only applies to 8 bit symbols
+    // with an order of 0, and not to adaptive blocks or limited codes.
+    int coder;
+
+    // 0 to code the characters as they are, or the level (1 to
+    // LZ77_LEVEL_MAX) of effort spent on first replacing repeated strings
+    // with matches (see lz77.c).  Only applies to 8 bit symbols with an
+    // order of 0, Huffman codes and no adaptive blocks.
+    int lz_level;
+
+    // How far back matches may reach, as a base 2 logarithm between
+    // LZ77_WINDOW_MIN and LZ77_WINDOW_MAX.
+    int lz_window;
+
+    // 1 for a single bitstream, or the number of streams (up to
+    // DTABLE_STREAMS_MAX) the characters are split into so they can be
+    // decoded side by side.  Only applies to blocks that would otherwise
+    // be BLOCK_CANONICAL, so to 8 bit symbols with an order of 0, Huffman
+    // codes, no adaptive blocks and no LZ77.
+    int streams;
+};
+
+
+/**
+ * Fills in the default BlockOptions.
+ */
+void block_options_init (BlockOptions *opts);
+
+
+/**
+ * A BlockCtx holds the memory used to encode and decode blocks, so it can
+ * be reused from one block to the next.  A BlockCtx must not be used by two
+ * threads at the same time.
+ */
+typedef struct BlockCtx BlockCtx;
+
+
+/**
+ * Returns a new BlockCtx or NULL if there is an error.
+ */
+BlockCtx *block_ctx_new (void);
+
+
+/**
+ * Frees a BlockCtx.
+ */
+void block_ctx_free (BlockCtx *ctx);
+
+
+/**
+ * Returns the largest number of bytes block_encode can produce for a block
+ * of `n` characters.
+ */
+size_t block_bound (size_t n);
+
+
+/**
+ * Encodes the `n` characters at `src` into `dst`, which must have room for
+ * block_bound(n) bytes, using the given options.  Returns the number of
+ * bytes written or -1 if there is an error.  The work is done in `ctx`,
+ * which may be NULL to allocate the memory just for this call.
+ *
+ * Each block carries its own code lengths, so blocks can be decoded
+ * independently of each other and in any order.
+ */
+long block_encode (BlockCtx *ctx, const unsigned char *src, size_t n,
+                   unsigned char *dst, size_t cap, const BlockOptions *opts);
+
+
+/**
+ * Decodes the encoded block of `len` bytes at `src` into the `n` characters
+ * at `dst`.  Returns 0, or -1 if the block is corrupt.  The work is done in
+ * `ctx`, which may be NULL as for block_encode.
+ */
+int block_decode (BlockCtx *ctx, const unsigned char *src, size_t len,
+                  unsigned char *dst, size_t n);
+
+#endif
@@ -0,0 +1,569 @@
+/********************************************************************
+
+ The canon module implements canonical Huffman codes.
+
+ A Huffman tree is only one of many trees that give each character the same
+ code length, and any of them compresses equally well.  The canonical one
+ hands out codes in order: shorter codes first and, among codes of the same
+ length, in character order, each code being the previous one plus one
+ (shifted left whenever the length grows).  The codes then follow from the
+ lengths alone, so the lengths are all the encoder needs to store and all
+ the decoder needs to read.
+
+ The lengths are stored packed into bits as
+
+   FIRST LAST WIDTH LEN(FIRST) ... LEN(LAST)
+
+ where FIRST and LAST (8 bits each) are the lowest and highest characters
+ that have a code, WIDTH (3 bits) is the number of bits of each length, and
+ every LEN is a code length of WIDTH bits, 0 for characters without a code.
+ Plain text rarely uses more than a hundred consecutive characters with
+ codes of up to 15 bits, so this takes about 50 bytes.
+
+ Larger alphabets, such as 16 bit words, work the same way with FIRST and
+ LAST taking as many bits as the largest symbol does.  Their symbols with
+ codes are often spread thinly over a wide range, so there every LEN of 0
+ is followed by the number of symbols after it that have no code either,
+ plus one, as an Elias gamma code: as many 0 bits as the number has bits
+ after its leading 1, then the number itself.
+
+ Decoding such an alphabet with a tree (see dtable.c) would take far too
+ many nodes, so a CanonTable decodes it from the lengths directly: a table
+ indexed by the next CANON_FAST_BITS bits resolves the short codes, and
+ longer ones are found by counting, using that the codes of each length
+ are consecutive numbers following the codes of the length before.
+
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "canon.h"
+#include "stats.h"
+#include "probe.h"
+
+
+/**
+ * The CanonTable structure decodes the canonical codes of large alphabets.
+ */
+struct CanonTable {
+    int            nsyms;                         // Size of the alphabet
+    int            maxlen;                        // Longest code
+    int            count[CANON_MAX_LEN + 1];      // Codes of each length
+    uint16_t       fast[1 << CANON_FAST_BITS];    // Symbol of a short code
+    unsigned char  fastlen[1 << CANON_FAST_BITS]; // Its length, 0 for none
+    uint16_t      *sorted;                        // Symbols in code order
+};
+
+
+/**
+ * Counts the codes of each length in the `nsyms` lengths at `lens` and
+ * finds the first code of each length.  Returns -1 if the lengths do not
+ * describe a prefix code.
+ */
+static int first_codes (const unsigned char *lens, int nsyms,
+                        int count[CANON_MAX_LEN + 1],
+                        uint64_t next[CANON_MAX_LEN + 1])
+{
+    // Count the codes of each length:
+    memset(count, 0, (CANON_MAX_LEN + 1) * sizeof(int));
+    for (int c = 0; c < nsyms; c++)
+    {
+        if (lens[c] > CANON_MAX_LEN)
+            return -1;
+        count[lens[c]]++;
+    }
+    count[0] = 0;
+
+    // Find the first code of each length, checking that the codes of each
+    // length still fit next to the shorter ones:
+    uint64_t code = 0;
+    for (int len = 1; len <= CANON_MAX_LEN; len++)
+    {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+        if (count[len] > 0 && (code + count[len] - 1) >> len != 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Fills in the canonical codes for the code lengths in `lens`, indexed by
+ * character.  Returns -1 if the lengths do not describe a prefix code.
+ */
+int canon_codes (const unsigned char lens[CANON_SYMBOLS],
+                 BitCode codes[CANON_SYMBOLS])
+{
+    return canon_codes_n(lens, CANON_SYMBOLS, codes);
+}
+
+
+/**
+ * Fills in the canonical codes for the `nsyms` code lengths in `lens`,
+ * indexed by symbol.  Returns -1 if the lengths do not describe a prefix
+ * code.
+ */
+static int codes_n (const unsigned char *lens, int nsyms, BitCode *codes)
+{
+    int count[CANON_MAX_LEN + 1];
+    uint64_t next[CANON_MAX_LEN + 1];
+    if (first_codes(lens, nsyms, count, next) == -1)
+        return -1;
+
+    for (int c = 0; c < nsyms; c++)
+    {
+        codes[c].len  = lens[c];
+        codes[c].bits = lens[c] > 0 ? next[lens[c]]++ : 0;
+    }
+    return 0;
+}
+
+
+/**
+ * Fills in the canonical codes with codes_n, timing it and noting the
+ * longest code while the stats are on.
+ */
+int canon_codes_n (const unsigned char *lens, int nsyms, BitCode *codes)
+{
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = codes_n(lens, nsyms, codes);
+    stats_stop(&timer, STATS_TABLE);
+    PROBE2(table, nsyms, probe_now() - started);
+
+    if (stats_active && res == 0)
+    {
+        int maxlen = 0;
+        for (int c = 0; c < nsyms; c++)
+            if (lens[c] > maxlen)
+                maxlen = lens[c];
+        stats_code_len(maxlen);
+    }
+    return res;
+}
+
+
+/**
+ * Adds a leaf for character `c` with the code `b` to the FlatTree (a 1 bit
+ * goes left and a 0 bit goes right, see table.c).  Returns -1 if the nodes
+ * run out.
+ *
+ * The codes come from canon_codes, so they never clash: every node on the
+ * way is either new or an internal node of a longer code.
+ */
+static int insert_code (FlatTree *flat, const BitCode *b, unsigned char c)
+{
+    NodeRef node = flat->root;
+    for (int i = b->len - 1; i > 0; i--)
+    {
+        NodeRef *child = &flat->kid[node][(b->bits >> i) & 1];
+        if (*child == FLAT_NONE && (*child = flat_add(flat)) == FLAT_NONE)
+            return -1;
+        node = *child;
+    }
+    flat->kid[node][b->bits & 1] = FLAT_LEAF | c;
+    return 0;
+}
+
+
+/**
+ * Builds the tree holding the canonical codes for the code lengths in `lens`
+ * in the FlatTree.  Returns -1 if there is an error.
+ */
+static int build_tree (const unsigned char lens[CANON_SYMBOLS],
+                       FlatTree *flat)
+{
+    BitCode codes[CANON_SYMBOLS];
+    if (canon_codes(lens, codes) == -1)
+        return -1;
+
+    flat_init(flat);
+    flat->root = flat_add(flat);
+    int any = 0;
+    for (int c = 0; c < CANON_SYMBOLS; c++)
+    {
+        if (codes[c].len == 0)
+            continue;
+        if (insert_code(flat, &codes[c], (unsigned char)c) == -1)
+            return -1;
+        any = 1;
+    }
+
+    // Without any codes there is only the root:
+    return any ? 0 : -1;
+}
+
+
+/**
+ * Builds the FlatTree with build_tree, timing it while the stats are on.
+ */
+int canon_tree (const unsigned char lens[CANON_SYMBOLS], FlatTree *flat)
+{
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = build_tree(lens, flat);
+    stats_stop(&timer, STATS_TABLE);
+    return res;
+}
+
+
+/**
+ * Returns the number of bits FIRST and LAST take for an alphabet of `nsyms`
+ * symbols.
+ */
+static int symbol_bits (int nsyms)
+{
+    int bits = 1;
+    while (((nsyms - 1) >> bits) != 0)
+        bits++;
+    return bits;
+}
+
+
+/**
+ * Writes `v`, which must be at least 1, as an Elias gamma code.  Returns
+ * EOF if there was an error.
+ */
+static int write_gamma (BitsIOFile *bfile, uint32_t v)
+{
+    int k = 0;
+    while ((v >> (k + 1)) != 0)
+        k++;
+    if (k > 0 && bits_io_write_bits(bfile, 0, k) == EOF)
+        return EOF;
+    return bits_io_write_bits(bfile, v, k + 1);
+}
+
+
+/**
+ * Writes the code lengths in `lens` in their packed form.  Returns EOF if
+ * there was an error or no character has a code.
+ */
+int canon_write_lengths (BitsIOFile *bfile,
+                         const unsigned char lens[CANON_SYMBOLS])
+{
+    return canon_write_lengths_n(bfile, lens, CANON_SYMBOLS);
+}
+
+
+/**
+ * Writes the `nsyms` code lengths in `lens` in their packed form.  Returns
+ * EOF if there was an error or no symbol has a code.
+ */
+static int write_lengths (BitsIOFile *bfile, const unsigned char *lens,
+                          int nsyms)
+{
+    int first = -1, last = -1, maxlen = 0;
+    for (int c = 0; c < nsyms; c++)
+    {
+        if (lens[c] == 0)
+            continue;
+        if (first < 0)
+            first = c;
+        last = c;
+        if (lens[c] > maxlen)
+            maxlen = lens[c];
+    }
+    if (first < 0 || maxlen > CANON_MAX_LEN)
+        return EOF;
+
+    int width = 1;
+    while ((maxlen >> width) != 0)
+        width++;
+
+    int sbits = symbol_bits(nsyms);
+    if (bits_io_write_bits(bfile, first, sbits) == EOF ||
+        bits_io_write_bits(bfile, last, sbits) == EOF ||
+        bits_io_write_bits(bfile, width, 3) == EOF)
+    {
+        return EOF;
+    }
+    for (int c = first; c <= last; c++)
+    {
+        if (bits_io_write_bits(bfile, lens[c], width) == EOF)
+            return EOF;
+        if (lens[c] != 0 || nsyms <= CANON_SYMBOLS)
+            continue;
+
+        // The run of symbols without a code:
+        int run = 1;
+        while (lens[c + run] == 0)
+            run++;
+        if (write_gamma(bfile, run) == EOF)
+            return EOF;
+        c += run - 1;
+    }
+    return 0;
+}
+
+
+/**
+ * Writes the code lengths with write_lengths, timing it while the stats are
+ * on.
+ */
+int canon_write_lengths_n (BitsIOFile *bfile, const unsigned char *lens,
+                           int nsyms)
+{
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = write_lengths(bfile, lens, nsyms);
+    stats_stop(&timer, STATS_HEADER);
+    return res;
+}
+
+
+/**
+ * Reads the next `n` bits of the BitsIOFile into `v`.  Returns EOF if there
+ * are not enough bits left.
+ */
+static int read_bits (BitsIOFile *bfile, int n, int *v)
+{
+    *v = (int)bits_io_peek_bits(bfile, n);
+    return bits_io_skip_bits(bfile, n);
+}
+
+
+/**
+ * Reads an Elias gamma code of at most `bits` bits after its leading 1 into
+ * `v`.  Returns EOF if there was an error.
+ */
+static int read_gamma (BitsIOFile *bfile, int bits, int *v)
+{
+    int k = 0;
+    for (;;)
+    {
+        int bit = bits_io_read_bit(bfile);
+        if (bit == EOF || (bit == 0 && ++k > bits))
+            return EOF;
+        if (bit == 1)
+            break;
+    }
+    *v = 0;
+    if (k > 0 && read_bits(bfile, k, v) == EOF)
+        return EOF;
+    *v |= 1 << k;
+    return 0;
+}
+
+
+/**
+ * Reads code lengths written by canon_write_lengths into `lens`.  Returns
+ * EOF if there was an error or the lengths are not valid.
+ */
+int canon_read_lengths (BitsIOFile *bfile, unsigned char lens[CANON_SYMBOLS])
+{
+    return canon_read_lengths_n(bfile, lens, CANON_SYMBOLS);
+}
+
+
+/**
+ * Reads `nsyms` code lengths written by canon_write_lengths_n into `lens`.
+ * Returns EOF if there was an error or the lengths are not valid.
+ */
+static int read_lengths (BitsIOFile *bfile, unsigned char *lens, int nsyms)
+{
+    int first, last, width;
+    int sbits = symbol_bits(nsyms);
+    if (read_bits(bfile, sbits, &first) == EOF ||
+        read_bits(bfile, sbits, &last) == EOF ||
+        read_bits(bfile, 3, &width) == EOF)
+    {
+        return EOF;
+    }
+    if (first > last || last >= nsyms || width < 1 ||
+        width > CANON_WIDTH_MAX)
+    {
+        return EOF;
+    }
+
+    memset(lens, 0, nsyms);
+    for (int c = first; c <= last; c++)
+    {
+        int len;
+        if (read_bits(bfile, width, &len) == EOF)
+            return EOF;
+        lens[c] = (unsigned char)len;
+        if (len != 0 || nsyms <= CANON_SYMBOLS)
+            continue;
+
+        int run;
+        if (read_gamma(bfile, sbits, &run) == EOF || run > last - c)
+            return EOF;
+        c += run - 1;
+    }
+    return 0;
+}
+
+
+/**
+ * Reads the code lengths with read_lengths, timing it while the stats are
+ * on.
+ */
+int canon_read_lengths_n (BitsIOFile *bfile, unsigned char *lens, int nsyms)
+{
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = read_lengths(bfile, lens, nsyms);
+    stats_stop(&timer, STATS_HEADER);
+    return res;
+}
+
+
+/**
+ * Returns a new CanonTable for alphabets of up to `nsyms` symbols, at most
+ * 2^16, or NULL if there is an error.
+ */
+CanonTable *canon_table_new (int nsyms)
+{
+    if (nsyms < 1 || nsyms > (1 << 16))
+        return NULL;
+    CanonTable *tab = (CanonTable *)(calloc(1, sizeof(CanonTable) +
+                                               nsyms * sizeof(uint16_t)));
+    if (tab == NULL)
+        return NULL;
+    tab->nsyms  = nsyms;
+    tab->sorted = (uint16_t *)(tab + 1);
+    return tab;
+}
+
+
+/**
+ * Frees a CanonTable.
+ */
+void canon_table_free (CanonTable *tab)
+{
+    free(tab);
+}
+
+
+/**
+ * Fills in the CanonTable for the code lengths in `lens`, one for each
+ * symbol of its alphabet.  Returns -1 if the lengths do not describe a
+ * prefix code.
+ */
+static int table_fill (CanonTable *tab, const unsigned char *lens)
+{
+    uint64_t next[CANON_MAX_LEN + 1];
+    if (first_codes(lens, tab->nsyms, tab->count, next) == -1)
+        return -1;
+
+    // Where the symbols of each length start in code order:
+    int offset[CANON_MAX_LEN + 1];
+    int total = 0;
+    tab->maxlen = 0;
+    for (int len = 1; len <= CANON_MAX_LEN; len++)
+    {
+        offset[len] = total;
+        total += tab->count[len];
+        if (tab->count[len] > 0)
+            tab->maxlen = len;
+    }
+    if (total == 0)
+        return -1;
+
+    memset(tab->fastlen, 0, sizeof(tab->fastlen));
+    for (int c = 0; c < tab->nsyms; c++)
+    {
+        int len = lens[c];
+        if (len == 0)
+            continue;
+        tab->sorted[offset[len]++] = (uint16_t)c;
+
+        uint64_t code = next[len]++;
+        if (len > CANON_FAST_BITS)
+            continue;
+        unsigned int first = (unsigned int)code << (CANON_FAST_BITS - len);
+        unsigned int count = 1u << (CANON_FAST_BITS - len);
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            tab->fast[i]    = (uint16_t)c;
+            tab->fastlen[i] = (unsigned char)len;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Fills in the CanonTable with table_fill, timing it and noting the longest
+ * code while the stats are on.
+ */
+int canon_table_fill (CanonTable *tab, const unsigned char *lens)
+{
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = table_fill(tab, lens);
+    stats_stop(&timer, STATS_TABLE);
+    PROBE2(table, tab->nsyms, probe_now() - started);
+
+    if (stats_active && res == 0)
+        stats_code_len(tab->maxlen);
+    return res;
+}
+
+
+/**
+ * Decodes the next code longer than CANON_FAST_BITS one bit at a time.
+ * Returns its symbol or EOF if the input ran out or the code is invalid.
+ */
+static int decode_slow (const CanonTable *tab, BitsIOFile *bfile)
+{
+    // `code` holds the bits read so far, and `first` and `index` the first
+    // code of the current length and where its symbol is in `sorted`:
+    int64_t code = 0, first = 0;
+    int index = 0;
+    for (int len = 1; len <= tab->maxlen; len++)
+    {
+        int bit = bits_io_read_bit(bfile);
+        if (bit == EOF)
+            return EOF;
+        code |= bit;
+        int count = tab->count[len];
+        if (code - first < count)
+            return tab->sorted[index + (int)(code - first)];
+        index += count;
+        first  = (first + count) << 1;
+        code <<= 1;
+    }
+    return EOF;
+}
+
+
+/**
+ * Decodes a single symbol from the BitsIOFile.  Returns the symbol or EOF if
+ * the input ran out or contained an invalid code.
+ */
+int canon_table_decode_symbol (const CanonTable *tab, BitsIOFile *bfile)
+{
+    unsigned int bits = (unsigned int)bits_io_peek_bits(bfile,
+                                                        CANON_FAST_BITS);
+    int len = tab->fastlen[bits];
+    if (len == 0)
+        return decode_slow(tab, bfile);
+    if (bits_io_skip_bits(bfile, len) == EOF)
+        return EOF;
+    return tab->fast[bits];
+}
+
+
+/**
+ * Decodes up to `n` symbols from the BitsIOFile and stores them as 16 bit
+ * little endian words at `out`.  Returns the number of symbols decoded.
+ */
+size_t canon_table_decode16 (const CanonTable *tab, BitsIOFile *bfile,
+                             unsigned char *out, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+    {
+        int sym = canon_table_decode_symbol(tab, bfile);
+        if (sym == EOF)
+            break;
+        out[2 * i]     = (unsigned char)sym;
+        out[2 * i + 1] = (unsigned char)(sym >> 8);
+    }
+    return i;
+}
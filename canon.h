@@ -0,0 +1,119 @@
+#ifndef __CANON_H
+#define __CANON_H
+
+#include "tree.h"
+#include "table.h"
+#include "bits-io.h"
+
+#define CANON_SYMBOLS 256
+
+/**
+ * Code lengths are stored with at most this many bits each, so no code may
+ * be longer than 2^CANON_WIDTH_MAX - 1 bits.
+ */
+#define CANON_WIDTH_MAX 6
+#define CANON_MAX_LEN   ((1 << CANON_WIDTH_MAX) - 1)
+
+/**
+ * Fills in the canonical codes for the code lengths in `lens`, indexed by
+ * character.  A length of 0 means the character has no code.  Returns -1 if
+ * the lengths do not describe a prefix code.
+ */
+int canon_codes (const unsigned char lens[CANON_SYMBOLS],
+                 BitCode codes[CANON_SYMBOLS]);
+
+
+/**
+ * Same as canon_codes, for an alphabet of `nsyms` symbols.
+ */
+int canon_codes_n (const unsigned char *lens, int nsyms, BitCode *codes);
+
+
+/**
+ * Builds a tree holding the canonical codes for the code lengths in `lens`
+ * in the FlatTree (see tree.h).  Returns -1 if there is an error.  The tree
+ * is meant for decoding (see dtable.h).  FLAT_NODES internal nodes are
+ * enough for any complete code and for a single character; lengths that
+ * need more are not accepted.
+ */
+int canon_tree (const unsigned char lens[CANON_SYMBOLS], FlatTree *flat);
+
+
+/**
+ * Writes the code lengths in `lens` in their packed form.  Returns EOF if
+ * there was an error or no character has a code.
+ */
+int canon_write_lengths (BitsIOFile *bfile,
+                         const unsigned char lens[CANON_SYMBOLS]);
+
+
+/**
+ * Same as canon_write_lengths, for an alphabet of `nsyms` symbols, which
+ * must be a power of two.  Alphabets larger than CANON_SYMBOLS store runs
+ * of symbols without a code in a few bits (see canon.c).
+ */
+int canon_write_lengths_n (BitsIOFile *bfile, const unsigned char *lens,
+                           int nsyms);
+
+
+/**
+ * Reads code lengths written by canon_write_lengths into `lens`.  Returns
+ * EOF if there was an error or the lengths are not valid.
+ */
+int canon_read_lengths (BitsIOFile *bfile, unsigned char lens[CANON_SYMBOLS]);
+
+
+/**
+ * Same as canon_read_lengths, for an alphabet of `nsyms` symbols.
+ */
+int canon_read_lengths_n (BitsIOFile *bfile, unsigned char *lens, int nsyms);
+
+
+/**
+ * A CanonTable decodes canonical codes straight from their lengths, without
+ * a tree, which is how alphabets of more than CANON_SYMBOLS symbols are
+ * decoded.  Codes of up to CANON_FAST_BITS bits take one lookup.
+ */
+typedef struct CanonTable CanonTable;
+
+#define CANON_FAST_BITS 11
+
+
+/**
+ * Returns a new CanonTable for alphabets of `nsyms` symbols, at most 2^16,
+ * or NULL if there is an error.
+ */
+CanonTable *canon_table_new (int nsyms);
+
+
+/**
+ * Frees a CanonTable.
+ */
+void canon_table_free (CanonTable *tab);
+
+
+/**
+ * Fills in the CanonTable for the code lengths in `lens`, one for each
+ * symbol of its alphabet, replacing what it held before.  Returns -1 if the
+ * lengths do not describe a prefix code.
+ */
+int canon_table_fill (CanonTable *tab, const unsigned char *lens);
+
+
+/**
+ * Decodes a single symbol from the BitsIOFile.  Returns the symbol or EOF if
+ * the input ran out or contained an invalid code.
+ */
+int canon_table_decode_symbol (const CanonTable *tab, BitsIOFile *bfile);
+
+
+/**
+ * Decodes up to `n` symbols from the BitsIOFile and stores them as 16 bit
+ * little endian words at `out`, which must have room for 2n characters.
+ * Returns the number of symbols decoded, which is less than `n` only if
+ * the input ran out or contained an invalid code.
+ */
+size_t canon_table_decode16 (const CanonTable *tab, BitsIOFile *bfile,
+                             unsigned char *out, size_t n);
+
+#endif
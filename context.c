@@ -0,0 +1,398 @@
+/********************************************************************
+
+ The context module builds order-1 models: instead of one code table for a
+ whole block, each character is coded with a table chosen by the character
+ before it.  In text a 'q' is nearly always followed by a 'u' and a '.' by
+ a space, so the table used after a character can give the characters
+ likely to come next much shorter codes than one table for everything.
+
+ One table for each of the 256 preceding characters would cost more to
+ store than it saves on all but the largest blocks, and most of them would
+ look alike anyway (after any lower case letter, say).  So the preceding
+ characters are grouped into clusters of similar ones and each cluster gets
+ one table.  The clusters are found with k-means:
+
+ - the most frequent preceding characters are the first clusters,
+
+ - every preceding character joins the cluster whose table codes the
+   characters that follow it in the fewest bits,
+
+ - the tables are rebuilt from the characters that follow the members of
+   each cluster, and the last two steps repeat until nothing moves.
+
+ This is done for 1, 2, 4, ... CONTEXT_CLUSTERS clusters and the one that
+ codes the block in the fewest bits, counting the model itself, is kept.  A
+ single cluster is plain order-0 coding, so a block never gets larger than
+ it would be with one table.
+
+ A model is stored packed into bits as
+
+   COUNT MAP(0) ... MAP(255) LENGTHS(0) ... LENGTHS(COUNT)
+
+ where COUNT (5 bits) is the number of tables minus one, every MAP is the
+ table used after that character in as few bits as it takes to number the
+ tables, and the LENGTHS are the code lengths of each table, packed as
+ canon_write_lengths does.
+
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "canon.h"
+#include "context.h"
+
+/**
+ * Most rounds of k-means for one number of clusters.  It nearly always
+ * settles well before this.
+ */
+#define CONTEXT_ROUNDS 8
+
+/**
+ * How much more a character that follows a cluster weighs than one that
+ * does not, when choosing clusters.  Every character of the block gets a
+ * code in every table while choosing, so that any preceding character can
+ * join any cluster, but the ones that do not occur get long codes.
+ */
+#define CONTEXT_SMOOTH 16
+
+
+/**
+ * The ContextScratch structure holds the counts and clusters of a block.
+ */
+struct ContextScratch {
+    uint32_t      counts[256][256];   // Characters after each character
+    uint64_t      total[256];         // How many characters follow each
+    unsigned char next[256][256];     // The characters that follow each
+    int           nnext[256];         // How many different ones there are
+    int           used[256];          // Characters followed by something,
+    int           nused;              // most frequent first
+    uint64_t      hist[CONTEXT_CLUSTERS][256];  // Counts of each cluster
+    uint64_t      all[256];           // Counts of the whole block
+    ContextModel  trial;              // The model being tried
+};
+
+
+/**
+ * Returns a new ContextScratch or NULL if there is an error.
+ */
+ContextScratch *context_scratch_new (void)
+{
+    return (ContextScratch *)(malloc(sizeof(ContextScratch)));
+}
+
+
+/**
+ * Frees a ContextScratch.
+ */
+void context_scratch_free (ContextScratch *cs)
+{
+    free(cs);
+}
+
+
+/**
+ * Returns the number of bits it takes to number `n` things.
+ */
+static int index_bits (int n)
+{
+    int bits = 0;
+    while ((1 << bits) < n)
+        bits++;
+    return bits;
+}
+
+
+/**
+ * Returns the number of bits canon_write_lengths takes for `lens`.
+ */
+static int64_t lengths_bits (const unsigned char lens[256])
+{
+    int first = -1, last = -1, maxlen = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        if (lens[c] == 0)
+            continue;
+        if (first < 0)
+            first = c;
+        last = c;
+        if (lens[c] > maxlen)
+            maxlen = lens[c];
+    }
+    int width = index_bits(maxlen + 1);
+    return 8 + 8 + 3 + (int64_t)(last - first + 1) * width;
+}
+
+
+/**
+ * Returns the number of bits the ContextModel takes to store with
+ * context_write, including the code lengths.
+ */
+int64_t context_model_bits (const ContextModel *model)
+{
+    int64_t bits = 5 + 256 * index_bits(model->nclusters);
+    for (int k = 0; k < model->nclusters; k++)
+        bits += lengths_bits(model->lens[k]);
+    return bits;
+}
+
+
+/**
+ * Returns the number of bits the characters that follow `c` take with the
+ * code lengths in `lens`.
+ */
+static uint64_t cost_after (const ContextScratch *cs, int c,
+                            const unsigned char lens[256])
+{
+    uint64_t bits = 0;
+    for (int i = 0; i < cs->nnext[c]; i++)
+    {
+        int s = cs->next[c][i];
+        bits += (uint64_t)cs->counts[c][s] * lens[s];
+    }
+    return bits;
+}
+
+
+/**
+ * Counts the characters that follow each character of the `n` at `buf` and
+ * orders the characters by how often they are followed by something.
+ */
+static void count_pairs (ContextScratch *cs, const unsigned char *buf,
+                         size_t n)
+{
+    memset(cs->counts, 0, sizeof(cs->counts));
+    unsigned int prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        cs->counts[prev][buf[i]]++;
+        prev = buf[i];
+    }
+
+    memset(cs->all, 0, sizeof(cs->all));
+    cs->nused = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        cs->total[c] = 0;
+        cs->nnext[c] = 0;
+        for (int s = 0; s < 256; s++)
+        {
+            if (cs->counts[c][s] == 0)
+                continue;
+            cs->next[c][cs->nnext[c]++] = (unsigned char)s;
+            cs->total[c] += cs->counts[c][s];
+            cs->all[s]   += cs->counts[c][s];
+        }
+        if (cs->total[c] == 0)
+            continue;
+
+        // Insert it among the ones seen so far, most frequent first:
+        int i = cs->nused++;
+        while (i > 0 && cs->total[cs->used[i - 1]] < cs->total[c])
+        {
+            cs->used[i] = cs->used[i - 1];
+            i--;
+        }
+        cs->used[i] = c;
+    }
+}
+
+
+/**
+ * Adds up the counts of the characters that follow the members of each of
+ * the `k` clusters of the trial model into `hist`.
+ */
+static void cluster_counts (ContextScratch *cs, int k)
+{
+    memset(cs->hist, 0, k * sizeof(cs->hist[0]));
+    for (int i = 0; i < cs->nused; i++)
+    {
+        int c = cs->used[i];
+        uint64_t *hist = cs->hist[cs->trial.map[c]];
+        for (int j = 0; j < cs->nnext[c]; j++)
+        {
+            int s = cs->next[c][j];
+            hist[s] += cs->counts[c][s];
+        }
+    }
+}
+
+
+/**
+ * Groups the preceding characters into `k` clusters in the trial model and
+ * computes the code lengths of each.  Returns the number of bits the block
+ * takes with the model, or -1 if there is an error.
+ */
+static int64_t cluster (ContextScratch *cs, int k, int max_len,
+                        HuffmanScratch *scratch)
+{
+    ContextModel *m = &cs->trial;
+    memset(m->map, 0, sizeof(m->map));
+    for (int i = 0; i < k; i++)
+        m->map[cs->used[i]] = (unsigned char)i;
+
+    uint64_t smooth[256];
+    int moved = 1;
+    for (int round = 0; round < CONTEXT_ROUNDS && moved; round++)
+    {
+        // Rebuild the tables, giving every character of the block a code:
+        if (round == 0)
+        {
+            memset(cs->hist, 0, k * sizeof(cs->hist[0]));
+            for (int i = 0; i < k; i++)
+            {
+                int c = cs->used[i];
+                for (int s = 0; s < 256; s++)
+                    cs->hist[i][s] = cs->counts[c][s];
+            }
+        } else
+            cluster_counts(cs, k);
+
+        for (int i = 0; i < k; i++)
+        {
+            for (int s = 0; s < 256; s++)
+                smooth[s] = cs->all[s] == 0 ? 0 :
+                            cs->hist[i][s] * CONTEXT_SMOOTH + 1;
+            if (huffman_lengths(smooth, 256, 0, m->lens[i], scratch) == -1)
+                return -1;
+        }
+
+        // Move every preceding character to the cluster that suits it best:
+        moved = 0;
+        for (int i = 0; i < cs->nused; i++)
+        {
+            int c = cs->used[i], best = m->map[c];
+            uint64_t best_bits = cost_after(cs, c, m->lens[best]);
+            for (int j = 0; j < k; j++)
+            {
+                uint64_t bits = cost_after(cs, c, m->lens[j]);
+                if (bits < best_bits)
+                {
+                    best = j;
+                    best_bits = bits;
+                }
+            }
+            if (best != m->map[c])
+            {
+                m->map[c] = (unsigned char)best;
+                moved = 1;
+            }
+        }
+    }
+
+    // Drop the clusters nothing joined, then build the real tables:
+    int renumber[CONTEXT_CLUSTERS], count = 0;
+    cluster_counts(cs, k);
+    for (int i = 0; i < k; i++)
+    {
+        int empty = 1;
+        for (int s = 0; s < 256 && empty; s++)
+            empty = cs->hist[i][s] == 0;
+        renumber[i] = empty ? -1 : count;
+        if (!empty)
+            memmove(cs->hist[count++], cs->hist[i], sizeof(cs->hist[0]));
+    }
+    for (int c = 0; c < 256; c++)
+        m->map[c] = renumber[m->map[c]] < 0 ? 0 : renumber[m->map[c]];
+    m->nclusters = count;
+
+    int64_t bits = count > 1 ? context_model_bits(m) : 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (huffman_lengths(cs->hist[i], 256, max_len, m->lens[i],
+                            scratch) == -1)
+        {
+            return -1;
+        }
+        if (count == 1)
+            bits += lengths_bits(m->lens[i]);
+        for (int s = 0; s < 256; s++)
+            bits += (int64_t)cs->hist[i][s] * m->lens[i][s];
+    }
+    return bits;
+}
+
+
+/**
+ * Finds the order-1 model that codes the `n` characters at `buf` in the
+ * fewest bits.  Returns the number of bits or -1 if there is an error.
+ */
+int64_t context_build (const unsigned char *buf, size_t n, int max_len,
+                       ContextModel *model, ContextScratch *cs,
+                       HuffmanScratch *scratch)
+{
+    if (n == 0)
+        return -1;
+
+    count_pairs(cs, buf, n);
+    int64_t best = -1;
+    for (int k = 1; k <= CONTEXT_CLUSTERS && k <= cs->nused; k *= 2)
+    {
+        int64_t bits = cluster(cs, k, max_len, scratch);
+        if (bits < 0)
+            return -1;
+        if (best < 0 || bits < best)
+        {
+            best = bits;
+            *model = cs->trial;
+        }
+    }
+    return best;
+}
+
+
+/**
+ * Writes the ContextModel in its packed form.  Returns EOF if there was an
+ * error.
+ */
+int context_write (BitsIOFile *bfile, const ContextModel *model)
+{
+    int bits = index_bits(model->nclusters);
+    if (model->nclusters < 1 || model->nclusters > CONTEXT_CLUSTERS ||
+        bits_io_write_bits(bfile, model->nclusters - 1, 5) == EOF)
+    {
+        return EOF;
+    }
+    for (int c = 0; c < 256; c++)
+    {
+        if (bits > 0 && bits_io_write_bits(bfile, model->map[c], bits) == EOF)
+            return EOF;
+    }
+    for (int k = 0; k < model->nclusters; k++)
+    {
+        if (canon_write_lengths(bfile, model->lens[k]) == EOF)
+            return EOF;
+    }
+    return 0;
+}
+
+
+/**
+ * Reads a ContextModel written by context_write.  Returns EOF if there was
+ * an error or the model is not valid.
+ */
+int context_read (BitsIOFile *bfile, ContextModel *model)
+{
+    model->nclusters = (int)bits_io_peek_bits(bfile, 5) + 1;
+    if (bits_io_skip_bits(bfile, 5) == EOF)
+        return EOF;
+
+    int bits = index_bits(model->nclusters);
+    for (int c = 0; c < 256; c++)
+    {
+        model->map[c] = 0;
+        if (bits == 0)
+            continue;
+        model->map[c] = (unsigned char)bits_io_peek_bits(bfile, bits);
+        if (bits_io_skip_bits(bfile, bits) == EOF ||
+            model->map[c] >= model->nclusters)
+        {
+            return EOF;
+        }
+    }
+    for (int k = 0; k < model->nclusters; k++)
+    {
+        if (canon_read_lengths(bfile, model->lens[k]) == EOF)
+            return EOF;
+    }
+    return 0;
+}
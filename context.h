@@ -0,0 +1,84 @@
+#ifndef __CONTEXT_H
+#define __CONTEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "huffman.h"
+#include "bits-io.h"
+
+/**
+ * Most code tables an order-1 model may have.  The preceding characters are
+ * grouped into at most this many clusters, each with its own table.
+ */
+#define CONTEXT_CLUSTERS 32
+
+
+/**
+ * A ContextModel says which code table to use for each character, given the
+ * character before it.
+ */
+typedef struct ContextModel ContextModel;
+struct ContextModel {
+    int           nclusters;                   // Number of code tables
+    unsigned char map[256];                    // Table after each character
+    unsigned char lens[CONTEXT_CLUSTERS][256]; // Code lengths of each table
+};
+
+
+/**
+ * A ContextScratch holds the memory context_build works in.  Keeping one
+ * around saves allocating it on every call.  A ContextScratch must not be
+ * used by two threads at the same time.
+ */
+typedef struct ContextScratch ContextScratch;
+
+
+/**
+ * Returns a new ContextScratch or NULL if there is an error.
+ */
+ContextScratch *context_scratch_new (void);
+
+
+/**
+ * Frees a ContextScratch.
+ */
+void context_scratch_free (ContextScratch *cs);
+
+
+/**
+ * Finds the order-1 model that codes the `n` characters at `buf` in the
+ * fewest bits, counting the bits it takes to store the model.  The first
+ * character is coded as if it followed a 0.  Codes are limited to
+ * `max_len` bits as by huffman_lengths.  Returns the number of bits or -1
+ * if there is an error.
+ *
+ * A model with a single table is plain order-0 coding, and its number of
+ * bits is that of a BLOCK_CANONICAL payload (see block.c), so the caller
+ * can fall back to it.
+ */
+int64_t context_build (const unsigned char *buf, size_t n, int max_len,
+                       ContextModel *model, ContextScratch *cs,
+                       HuffmanScratch *scratch);
+
+
+/**
+ * Returns the number of bits the ContextModel takes to store with
+ * context_write, including the code lengths.
+ */
+int64_t context_model_bits (const ContextModel *model);
+
+
+/**
+ * Writes the ContextModel in its packed form (see context.c).  Returns EOF
+ * if there was an error.
+ */
+int context_write (BitsIOFile *bfile, const ContextModel *model);
+
+
+/**
+ * Reads a ContextModel written by context_write.  Returns EOF if there was
+ * an error or the model is not valid.
+ */
+int context_read (BitsIOFile *bfile, ContextModel *model);
+
+#endif
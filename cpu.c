@@ -0,0 +1,61 @@
+/********************************************************************
+
+ The cpu module tells the kernels that have versions for x86 extensions
+ (BMI2 bit manipulation, AVX2 vectors) which of them they may use.  The
+ kernels are compiled for the extensions with target attributes and picked
+ each time they are called, so one binary runs everywhere and the portable
+ versions, which produce identical output, remain for other machines.
+
+ It also reads the cycle counter of the CPU, for timing (see huffbench.c).
+
+ *******************************************************************/
+
+#include "cpu.h"
+#ifdef CPU_X86
+#include <x86intrin.h>
+#endif
+
+/**
+ * The extensions the caller allows, all of them unless cpu_limit was
+ * called.
+ */
+static int allowed = CPU_BMI2 | CPU_AVX2;
+
+
+/**
+ * Returns the extensions the kernels may use, as a mask of CPU_ flags.
+ */
+int cpu_features (void)
+{
+    int found = 0;
+#ifdef CPU_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("bmi2"))
+        found |= CPU_BMI2;
+    if (__builtin_cpu_supports("avx2"))
+        found |= CPU_AVX2;
+#endif
+    return found & allowed;
+}
+
+
+/**
+ * Limits the extensions cpu_features reports to those in `mask`.
+ */
+void cpu_limit (int mask)
+{
+    allowed = mask;
+}
+
+
+/**
+ * Returns a count of CPU cycles, or 0 if there is no such counter.
+ */
+uint64_t cpu_cycles (void)
+{
+#ifdef CPU_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
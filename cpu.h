@@ -0,0 +1,45 @@
+#ifndef __CPU_H
+#define __CPU_H
+
+#include <stdint.h>
+
+/**
+ * CPU_X86 is defined when the compiler can build the x86 kernels: gcc or
+ * clang on x86, which accept per-function target attributes, so the rest
+ * of the program still runs on machines without the extensions.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_X86 1
+#endif
+
+/**
+ * Instruction set extensions the faster kernels use.
+ */
+#define CPU_BMI2 0x1
+#define CPU_AVX2 0x2
+
+
+/**
+ * Returns the extensions of the CPU the program runs on that the kernels
+ * may use, as a mask of CPU_ flags.  Always 0 without CPU_X86.
+ */
+int cpu_features (void);
+
+
+/**
+ * Limits the extensions cpu_features reports to those in `mask`, so the
+ * portable kernels can be used (mask 0) or compared with the faster ones.
+ * Must be called before any threads that code blocks are started.
+ */
+void cpu_limit (int mask);
+
+
+/**
+ * Returns a count of CPU cycles for timing code, or 0 if there is no such
+ * counter.  On x86 this is the time stamp counter, which ticks at a fixed
+ * rate close to the nominal clock rather than with the actual clock of
+ * the core, so only differences taken on one machine are meaningful.
+ */
+uint64_t cpu_cycles (void);
+
+#endif
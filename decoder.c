@@ -3,6 +3,21 @@
  The decoder module is the main API for the Huffman decoding
  functionality.
  
+ It reads both formats the encoder can write.  A framed file (see
+ frame.c) is recognized by its header; its blocks are decoded on a pool of
+ threads and written out in order.  Anything else is taken to be the
+ original format, one tree and one bitstream for the whole input.
+
+ decoder_decode_range decodes only part of the input.  In the framed
+ format it reads just the sizes of the blocks before the part and skips
+ their data, seeking first to the block the index at the end of the file
+ (if there is one) lists last before it, so only the blocks that overlap
+ the part are decoded.  The original format has nothing to skip by, so it
+ is decoded from the start and the characters before the part are dropped.
+ 
+ What is decoded is written out by an AioWriter (see aio.c), so writing
+ the output overlaps with decoding the next blocks.
+ 
  *******************************************************************/
 
 #include <stdlib.h>
@@ -10,23 +25,81 @@
 #include <assert.h>
 #include "tree.h"
 #include "bits-io.h"
+#include "dtable.h"
+#include "block.h"
+#include "frame.h"
+#include "pool.h"
+#include "aio.h"
+#include "stats.h"
+#include "probe.h"
 #include "decoder.h"
 
+// Number of decoded bytes collected before they are written out
+#define OUT_CHUNK (1<<16)
+
+// Size of the chunks the AioWriter writes
+#define OUT_WRITE_CHUNK (1<<20)
+
 /**
  * The Decoder structure is used to maintain all the information required to
  * decode an input file using the Huffman coding algorithm.
  */
 struct Decoder {
-    FILE       *outfp;
-    BitsIOFile *bfile;
-    TreeNode   *tree;
-    uint64_t    insize;
+    FILE        *outfp;
+    AioWriter   *writer;    // Writes to outfp behind us, or NULL
+    BitsIOFile  *bfile;
+    DecodeTable *dtab;      // Original format only
+    uint64_t     insize;    // Original format only
+    int          framed;    // 1 if the input is in the framed format
+    FrameHeader  hdr;       // Framed format only
+    ThreadPool  *pool;      // Framed format only
+    int          threads;   // Number of threads decoding blocks
+    uint64_t     written;   // Number of characters written out
+    uint64_t     created;   // When decoder_new ran, for the probes
+};
+
+/**
+ * A BlockJob is one block of the input on its way through the thread pool.
+ */
+typedef struct BlockJob BlockJob;
+struct BlockJob {
+    unsigned char       *in;      // Room for the encoded block
+    const unsigned char *src;     // The encoded block, in `in` or in place
+                                  // in a mapped input
+    size_t               len;     // Length of the encoded block
+    unsigned char       *out;     // The decoded characters
+    size_t               n;       // Number of characters in the block
+    int                  status;  // 0, or -1 if the block is corrupt
+    BlockCtx            *ctx;     // Memory reused by the blocks of this slot
 };
 
+
+/**
+ * Fills in the default DecoderOptions.
+ */
+void decoder_options_init (DecoderOptions *opts)
+{
+    opts->threads = 1;
+}
+
+
 /**
  * Returns a pointer to an Decoder object or NULL if there is an error.
  */
 Decoder *decoder_new (const char *infile, const char *outfile)
+{
+    DecoderOptions opts;
+    decoder_options_init(&opts);
+    return decoder_new_opts(infile, outfile, &opts);
+}
+
+
+/**
+ * Returns a pointer to an Decoder object using the given options or NULL if
+ * there is an error.
+ */
+Decoder *decoder_new_opts (const char *infile, const char *outfile,
+                           const DecoderOptions *opts)
 {
     assert (infile != NULL && outfile != NULL);
     
@@ -36,27 +109,56 @@ Decoder *decoder_new (const char *infile, const char *outfile)
         return NULL;
     
     // Open the output file:
-    FILE *outfp = fopen(outfile, "w");
+    FILE *outfp = fopen_stream(outfile, "w");
     if (outfp == NULL)
+    {
+        bits_io_close(bfile);
         return NULL;
+    }
     
     // Create the Decoder object:
-    Decoder *decoder = (Decoder *)(malloc(sizeof(Decoder)));
+    Decoder *decoder = (Decoder *)(calloc(1, sizeof(Decoder)));
     decoder->bfile   = bfile;
     decoder->outfp   = outfp;
+    decoder->threads = opts->threads;
+    decoder->writer  = aio_writer_new(outfp, OUT_WRITE_CHUNK, AIO_DEPTH);
+    decoder->created = probe_now();
+    
+    if (frame_detect(bfile))
+    {
+        decoder->framed = 1;
+        if (frame_read_header(bfile, &decoder->hdr) == EOF)
+        {
+            decoder_free(decoder);
+            return NULL;
+        }
+        decoder->pool = pool_new(opts->threads);
+        if (decoder->pool == NULL)
+        {
+            decoder_free(decoder);
+            return NULL;
+        }
+        return decoder;
+    }
     
     //first 8 bytes are size of uncompressed file
     decoder->insize = read_offset(decoder->bfile);
     
-    
-    // Read the tree:
-    TreeNode *tree = bits_io_read_tree(bfile);
-    if (tree == NULL)
+    // Read the tree straight into a flat one and build the lookup table used
+    // to decode several bits at once from it:
+    FlatTree flat;
+    if (bits_io_read_flat_tree(bfile, &flat) == 0 &&
+        (decoder->dtab = dtable_new()) != NULL &&
+        dtable_fill(decoder->dtab, &flat) == -1)
     {
-        bits_io_close(decoder->bfile);
+        dtable_free(decoder->dtab);
+        decoder->dtab = NULL;
+    }
+    if (decoder->dtab == NULL)
+    {
+        decoder_free(decoder);
         return NULL;
     }
-    decoder->tree = tree;
     return decoder;
 }
 
@@ -68,60 +170,339 @@ int decoder_free (Decoder *decoder)
 {
     assert(decoder != NULL);
     int status = 0;
+    uint64_t in = (bits_io_num_bits(decoder->bfile) + 7) >> 3;
+    stats_add(STATS_BYTES_IN, in);
+    PROBE3(decoder_free, in, decoder->written, probe_now() - decoder->created);
     status = bits_io_close(decoder->bfile);
-    tree_free(decoder->tree);
-    fclose(decoder->outfp);
+    if (decoder->dtab != NULL)
+        dtable_free(decoder->dtab);
+    pool_free(decoder->pool);
+    if (aio_writer_free(decoder->writer) == EOF)
+        status = -1;
+    if (fclose_stream(decoder->outfp) == EOF)
+        status = -1;
     free(decoder);
     return status;
 }
 
 
 /**
- * A utility function to decode a single character.
+ * Writes the `n` characters at `out` to the output file.  Returns -1 if
+ * there was an error.
  */
-static int decode_one (Decoder *decoder)
+static int write_out (Decoder *decoder, const unsigned char *out, size_t n)
 {
-    assert(decoder != NULL);
+    StatsTimer timer;
+    stats_start(&timer);
+    int res;
+    if (decoder->writer != NULL)
+        res = aio_writer_write(decoder->writer, out, n) == EOF ? -1 : 0;
+    else
+    {
+        stats_add(STATS_WRITE_CALLS, 1);
+        res = fwrite(out, 1, n, decoder->outfp) < n ? -1 : 0;
+    }
+    stats_stop(&timer, STATS_WRITE);
+    stats_add(STATS_BYTES_OUT, n);
+    decoder->written += n;
+    return res;
+}
+
+
+/**
+ * Decodes the block of `len` bytes at `src` into the `n` characters at
+ * `out` with block_decode, timing it while the stats are on and firing
+ * the block probes around it.
+ */
+static int decode_block (BlockCtx *ctx, const unsigned char *src, size_t len,
+                         unsigned char *out, size_t n)
+{
+    PROBE1(decode_block_start, len);
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = block_decode(ctx, src, len, out, n);
+    stats_stop(&timer, STATS_DECODE);
+    PROBE3(decode_block_end, len, n, probe_now() - started);
+    return res;
+}
+
+
+/**
+ * Decodes up to `n` characters of a legacy input into `out` with
+ * dtable_decode, timing it while the stats are on.
+ */
+static size_t decode_chunk (Decoder *decoder, unsigned char *out, size_t n)
+{
+    StatsTimer timer;
+    stats_start(&timer);
+    size_t got = dtable_decode(decoder->dtab, decoder->bfile, out, n);
+    stats_stop(&timer, STATS_DECODE);
+    return got;
+}
+
+
+/**
+ * Decodes one block; this is what runs on the thread pool.
+ */
+static void decode_job (void *arg)
+{
+    BlockJob *job = (BlockJob *)arg;
+    job->status = decode_block(job->ctx, job->src, job->len, job->out,
+                               job->n);
+}
+
+
+/**
+ * Frees the buffers of the first `njobs` jobs and the jobs themselves.
+ */
+static void free_jobs (BlockJob *jobs, int njobs)
+{
+    for (int i = 0; i < njobs; i++)
+    {
+        free(jobs[i].in);
+        free(jobs[i].out);
+        block_ctx_free(jobs[i].ctx);
+    }
+    free(jobs);
+}
+
+
+/**
+ * Points `src` at the next `len` bytes of the input: where they are if the
+ * input is in memory, otherwise at `in` after reading them there.  Returns
+ * EOF if the input ended.
+ */
+static int read_block (BitsIOFile *bfile, unsigned char *in, size_t len,
+                       const unsigned char **src)
+{
+    *src = bits_io_view_bytes(bfile, len);
+    if (*src != NULL)
+        return 0;
+    *src = in;
+    return bits_io_read_bytes(bfile, in, len);
+}
+
+
+/**
+ * Decodes a framed input.  Batches of blocks are read, handed to the thread
+ * pool, and written out in order once the whole batch is done.  Returns -1
+ * if the input is corrupt.
+ */
+static int decode_framed (Decoder *decoder)
+{
+    size_t bsize = decoder->hdr.block_size;
+    size_t bound = block_bound(bsize);
+    
+    int njobs = decoder->threads > 1 ? 2 * decoder->threads : 1;
+    BlockJob *jobs = (BlockJob *)(calloc(njobs, sizeof(BlockJob)));
+    if (jobs == NULL)
+        return -1;
+    for (int i = 0; i < njobs; i++)
+    {
+        jobs[i].in  = (unsigned char *)(malloc(bound));
+        jobs[i].out = (unsigned char *)(malloc(bsize));
+        jobs[i].ctx = block_ctx_new();
+        if (jobs[i].in == NULL || jobs[i].out == NULL || jobs[i].ctx == NULL)
+        {
+            free_jobs(jobs, njobs);
+            return -1;
+        }
+    }
     
+    int status = 0;
+    int done   = 0;
+    while (!done && status == 0)
+    {
+        // Read and submit a batch of blocks:
+        int batch = 0;
+        while (batch < njobs)
+        {
+            BlockJob *job = &jobs[batch];
+            uint32_t raw_size;
+            uint32_t len;
+            int r = frame_read_block(decoder->bfile, &raw_size, &len);
+            if (r == 1)
+            {
+                done = 1;
+                break;
+            }
+            if (r == EOF || raw_size > bsize || len > bound ||
+                read_block(decoder->bfile, job->in, len, &job->src) == EOF)
+            {
+                status = -1;
+                break;
+            }
+            job->n   = raw_size;
+            job->len = len;
+            if (pool_submit(decoder->pool, decode_job, job) == -1)
+                job->status = -1;
+            batch++;
+        }
+        pool_wait(decoder->pool);
+        
+        // Write them out in order:
+        for (int i = 0; i < batch && status == 0; i++)
+        {
+            BlockJob *job = &jobs[i];
+            if (job->status != 0 ||
+                write_out(decoder, job->out, job->n) == -1)
+                status = -1;
+        }
+    }
+    free_jobs(jobs, njobs);
+    return status;
+}
+
+
+/**
+ * Writes the characters of `out`, which start after `at` characters of the
+ * whole output, that are between `start` and `end`.  Returns -1 if there was
+ * an error.
+ */
+static int write_part (Decoder *decoder, const unsigned char *out, size_t n,
+                       uint64_t at, uint64_t start, uint64_t end)
+{
+    uint64_t from = start > at ? start - at : 0;
+    uint64_t to   = end - at < n ? end - at : n;
+    if (from >= to)
+        return 0;
+    size_t count = (size_t)(to - from);
+    return write_out(decoder, out + from, count);
+}
+
+
+/**
+ * Decodes the characters from `start` to `end` of a framed input.  Returns
+ * -1 if the input is corrupt or the output could not be written.
+ */
+static int decode_framed_range (Decoder *decoder, uint64_t start,
+                                uint64_t end)
+{
     BitsIOFile *bfile = decoder->bfile;
-    TreeNode   *tree  = decoder->tree;
+    int seekable = bits_io_size(bfile) >= 0;
+    uint64_t at = 0;   // Characters before the next block
     
-    TreeNode *p = tree;
-    while (!tree_is_leaf(p))
+    // Go to the last block the index lists at or before start:
+    if ((decoder->hdr.flags & FRAME_FLAG_INDEX) && seekable)
     {
-        int bit = bits_io_read_bit(bfile);
+        FrameIndex index;
+        frame_index_init(&index);
+        uint64_t pos = FRAME_HEADER_SIZE;
+        int status = frame_read_index(bfile, &index);
+        long i = status == EOF ? -1 : frame_index_find(&index, start);
+        if (i >= 0)
+        {
+            at  = index.raw[i];
+            pos = index.file[i];
+        }
+        frame_index_free(&index);
+        if (status == EOF || bits_io_seek(bfile, pos) == EOF)
+            return -1;
+    }
+    
+    size_t bsize = decoder->hdr.block_size;
+    size_t bound = block_bound(bsize);
+    unsigned char *in  = (unsigned char *)(malloc(bound));
+    unsigned char *out = (unsigned char *)(malloc(bsize));
+    BlockCtx *ctx = block_ctx_new();
+    int status = in == NULL || out == NULL || ctx == NULL ? -1 : 0;
+    while (status == 0 && at < end)
+    {
+        uint32_t raw_size;
+        uint32_t len;
+        int r = frame_read_block(bfile, &raw_size, &len);
+        if (r == 1)
+            break;
+        if (r == EOF || raw_size > bsize || len > bound)
+        {
+            status = -1;
+            break;
+        }
         
-        if (bit == EOF)
-            return EOF;
-        else if (bit == 1)
-            p = p->left;
-        else
-            p = p->right;
+        // A block before start only needs to be stepped over:
+        if (at + raw_size <= start)
+        {
+            uint64_t next = (bits_io_num_bits(bfile) >> 3) + len;
+            if ((!seekable || bits_io_seek(bfile, next) == EOF) &&
+                bits_io_read_bytes(bfile, in, len) == EOF)
+            {
+                status = -1;
+            }
+            at += raw_size;
+            continue;
+        }
         
-        if (p == NULL)
-            return EOF;
+        const unsigned char *src;
+        if (read_block(bfile, in, len, &src) == EOF ||
+            decode_block(ctx, src, len, out, raw_size) != 0 ||
+            write_part(decoder, out, raw_size, at, start, end) == -1)
+        {
+            status = -1;
+        }
+        at += raw_size;
     }
-    
-    return p->freq.c;
+    free(in);
+    free(out);
+    block_ctx_free(ctx);
+    return status;
 }
 
 
 /**
- * Decodes the input file to the output file.
+ * Decodes the input file to the output file.  Returns -1 if the input is
+ * corrupt or the output could not be written.
  */
 
-void decoder_decode (Decoder *decoder) {
+int decoder_decode (Decoder *decoder) {
     
     assert(decoder != NULL);
     
-    // Read characters:
-    for (uint64_t i = 0; i < decoder->insize; i++)
+    if (decoder->framed)
+        return decode_framed(decoder);
+    
+    unsigned char out[OUT_CHUNK];
+    
+    // Decode a chunk of characters at a time and write them out:
+    for (uint64_t left = decoder->insize; left > 0; )
     {
-        int ch = decode_one(decoder);
-        if(ch == EOF)
-            return;
-        
-        fputc(ch, decoder->outfp);
+        size_t want = left < OUT_CHUNK ? (size_t)left : OUT_CHUNK;
+        size_t got = decode_chunk(decoder, out, want);
+        if (write_out(decoder, out, got) == -1)
+            return -1;
+        if (got < want)
+            return -1;
+        left -= got;
+    }
+    return 0;
+}
+
+
+/**
+ * Decodes the `len` characters from character `start` on to the output
+ * file.  Returns -1 if the input is corrupt or the output could not be
+ * written.
+ */
+int decoder_decode_range (Decoder *decoder, uint64_t start, uint64_t len)
+{
+    assert(decoder != NULL);
+    
+    uint64_t end = len > UINT64_MAX - start ? UINT64_MAX : start + len;
+    if (decoder->framed)
+        return decode_framed_range(decoder, start, end);
+    
+    unsigned char out[OUT_CHUNK];
+    if (end > decoder->insize)
+        end = decoder->insize;
+    
+    // Decode up to the end of the range, keeping only what is in it:
+    for (uint64_t at = 0; at < end; )
+    {
+        size_t want = end - at < OUT_CHUNK ? (size_t)(end - at) : OUT_CHUNK;
+        size_t got = decode_chunk(decoder, out, want);
+        if (got < want || write_part(decoder, out, got, at, start, end) == -1)
+            return -1;
+        at += got;
     }
-    return;
+    return 0;
 }
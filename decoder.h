@@ -1,6 +1,8 @@
 #ifndef __DECODER_H
 #define __DECODER_H
 
+#include <stdint.h>
+
 /**
  * The Decoder structure is used to maintain all the information
  * required to decode an input file using the huffman coding
@@ -8,20 +10,53 @@
  */
 typedef struct Decoder Decoder;
 
+/**
+ * The DecoderOptions structure holds the settings that control how a
+ * Decoder works.  Use decoder_options_init to get the defaults.
+ */
+typedef struct DecoderOptions DecoderOptions;
+struct DecoderOptions {
+    // Number of threads decoding blocks of the framed format in parallel.
+    int threads;
+};
+
+/**
+ * Fills in the default DecoderOptions.
+ */
+void decoder_options_init (DecoderOptions *opts);
+
 /**
  * Returns a pointer to an Decoder object or NULL if there is an
  * error.
  */
 Decoder *decoder_new (const char *infile, const char *outfile);
 
+/**
+ * Returns a pointer to an Decoder object using the given options or
+ * NULL if there is an error.
+ */
+Decoder *decoder_new_opts (const char *infile, const char *outfile,
+                           const DecoderOptions *opts);
+
 /**
  * Deallocates an Decoder object. Returns -1 if there is an error.
  */
 int decoder_free (Decoder *decoder);
 
 /**
- * Decodes the input file to the output file.
+ * Decodes the input file to the output file.  Returns -1 if the input
+ * is corrupt or the output could not be written.
+ */
+int decoder_decode (Decoder *decoder);
+
+/**
+ * Decodes only the `len` characters from character `start` on to the output
+ * file, or as many of them as there are.  A framed input written with a
+ * block index (see EncoderOptions) that can seek goes straight to the block
+ * holding `start`; otherwise the blocks before it are skipped without being
+ * decoded, and an input in the original format is decoded from the start.
+ * Returns -1 if the input is corrupt or the output could not be written.
  */
-void decoder_decode (Decoder *decoder);
+int decoder_decode_range (Decoder *decoder, uint64_t start, uint64_t len);
 
 #endif
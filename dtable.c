@@ -0,0 +1,638 @@
+/********************************************************************
+
+ The dtable module turns a Huffman tree into a lookup table for the decoder.
+ Instead of reading one bit at a time and following the left/right pointers
+ of the tree, the decoder peeks at the next DTABLE_BITS bits of the input
+ and uses them as an index into the table.  Each entry tells the decoder:
+
+ - which symbols those bits start with (up to two, when two short codes fit
+   into the window together),
+
+ - how many bits those symbols used up, so the decoder can consume exactly
+   that many bits and peek again.
+
+ Codes longer than DTABLE_BITS cannot be resolved by a single lookup.  For
+ those the entry remembers the tree node reached after DTABLE_BITS bits and
+ the decoder finishes the code by walking the tree from there.  Such codes
+ belong to the rarest characters, so the slow path is taken rarely.  The
+ tree walked is a flat copy (see tree.h) kept inside the table, so the
+ walk stays within one small array and the table does not depend on the
+ tree it was built from.
+
+ A single bitstream is decoded one code after the other, and each lookup
+ has to wait for the one before it to know where its code starts.  When a
+ block is split into several streams, dtable_decode_streams decodes them
+ side by side, each with its own small bit reader kept in registers, so
+ the processor can work on the lookups of all the streams at once.  On CPUs
+ with AVX2 (see cpu.c) groups of four streams are decoded with vector
+ gathers instead, one gather doing the lookups of all four.
+
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include "cpu.h"
+#include "dtable.h"
+#include "stats.h"
+#include "probe.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#define DTABLE_SIZE (1 << DTABLE_BITS)
+
+
+/**
+ * A DecodeEntry describes what the decoder should do for one value of the
+ * next DTABLE_BITS bits of input.
+ */
+typedef struct DecodeEntry DecodeEntry;
+struct DecodeEntry {
+    unsigned char sym[2];  // The decoded symbols
+    unsigned char nsyms;   // Number of symbols in sym, 0 for a long code
+    unsigned char len;     // Length of the code for sym[0]
+    unsigned char nbits;   // Total length of all the codes in sym
+    NodeRef       node;    // Where to continue walking for a long code
+};
+
+struct DecodeTable {
+    DecodeEntry entry[DTABLE_SIZE];
+    FlatTree    tree;      // Walked for codes longer than DTABLE_BITS
+};
+
+
+/**
+ * Fills in the entries for all inputs starting with the `depth` bits of
+ * `code`, which lead from the root to `node` (a 1 bit goes left and a 0 bit
+ * goes right, see table.c).  A leaf within DTABLE_BITS covers a whole run of
+ * entries at once; anything deeper is left to the tree walk.
+ */
+static void fill_node (DecodeTable *dtab, NodeRef node,
+                       unsigned int code, int depth)
+{
+    const FlatTree *tree = &dtab->tree;
+    if (node != FLAT_NONE && !FLAT_IS_LEAF(node) && depth < DTABLE_BITS)
+    {
+        fill_node(dtab, tree->kid[node][1], (code << 1) | 1, depth + 1);
+        fill_node(dtab, tree->kid[node][0], code << 1,       depth + 1);
+        return;
+    }
+
+    unsigned int first = code << (DTABLE_BITS - depth);
+    unsigned int count = 1u << (DTABLE_BITS - depth);
+    for (unsigned int i = first; i < first + count; i++)
+    {
+        DecodeEntry *e = &dtab->entry[i];
+        if (FLAT_IS_LEAF(node))
+        {
+            e->sym[0] = FLAT_CHAR(node);
+            e->nsyms  = 1;
+            e->len    = depth;
+            e->nbits  = depth;
+            e->node   = FLAT_NONE;
+        } else
+        {
+            // The code is longer than the table width (or invalid, if node
+            // is FLAT_NONE):
+            e->nsyms = 0;
+            e->len   = DTABLE_BITS;
+            e->nbits = DTABLE_BITS;
+            e->node  = node;
+        }
+    }
+}
+
+
+/**
+ * Returns a decoding table built from the given Huffman tree or NULL if
+ * there is an error.
+ */
+DecodeTable *dtable_build (TreeNode *root)
+{
+    if (root == NULL)
+        return NULL;
+
+    DecodeTable *dtab = dtable_new();
+    if (dtab == NULL)
+        return NULL;
+    if (tree_flatten(root, &dtab->tree) == -1 ||
+        dtable_fill(dtab, &dtab->tree) == -1)
+    {
+        dtable_free(dtab);
+        return NULL;
+    }
+    return dtab;
+}
+
+
+/**
+ * Returns a new decoding table that decodes nothing until it is filled in
+ * with dtable_fill, or NULL if there is an error.
+ */
+DecodeTable *dtable_new (void)
+{
+    DecodeTable *dtab = (DecodeTable *)(calloc(1, sizeof(DecodeTable)));
+    if (dtab == NULL)
+        return NULL;
+    flat_init(&dtab->tree);
+    for (unsigned int i = 0; i < DTABLE_SIZE; i++)
+        dtab->entry[i].node = FLAT_NONE;
+    return dtab;
+}
+
+
+/**
+ * Fills in the decoding table for the given flat Huffman tree, replacing
+ * what it held before.  Returns -1 if there is an error.
+ */
+int dtable_fill (DecodeTable *dtab, const FlatTree *flat)
+{
+    if (flat == NULL || flat->root == FLAT_NONE)
+        return -1;
+
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    if (flat != &dtab->tree)
+    {
+        dtab->tree.root  = flat->root;
+        dtab->tree.count = flat->count;
+        memcpy(dtab->tree.kid, flat->kid, flat->count * sizeof(flat->kid[0]));
+    }
+    fill_node(dtab, dtab->tree.root, 0, 0);
+
+    // See whether the next code also fits in the bits left over by the first
+    // one.  Those bits are the start of the entry we get by shifting them to
+    // the top, and the code there fits if it is no longer than they are.
+    for (unsigned int i = 0; i < DTABLE_SIZE; i++)
+    {
+        DecodeEntry *e = &dtab->entry[i];
+        if (e->nsyms == 0)
+            continue;
+        int rest = DTABLE_BITS - e->len;
+        const DecodeEntry *next =
+            &dtab->entry[(i << e->len) & (DTABLE_SIZE - 1)];
+        if (rest > 0 && next->nsyms > 0 && next->len <= rest)
+        {
+            e->sym[1] = next->sym[0];
+            e->nsyms  = 2;
+            e->nbits  = e->len + next->len;
+        }
+    }
+    stats_stop(&timer, STATS_TABLE);
+    PROBE2(table, dtab->tree.count + 1, probe_now() - started);
+    return 0;
+}
+
+
+/**
+ * Frees the decoding table.
+ */
+void dtable_free (DecodeTable *dtab)
+{
+    free(dtab);
+}
+
+
+/**
+ * Finishes decoding a code longer than DTABLE_BITS from entry `e`.  Returns
+ * the symbol or EOF if the input ran out or the code is invalid.
+ */
+static int decode_long (const DecodeTable *dtab, const DecodeEntry *e,
+                        BitsIOFile *bfile)
+{
+    // Consume the bits of the lookup and walk the rest:
+    NodeRef p = e->node;
+    if (p == FLAT_NONE || bits_io_skip_bits(bfile, DTABLE_BITS) == EOF)
+        return EOF;
+
+    while (p != FLAT_NONE && !FLAT_IS_LEAF(p))
+    {
+        int bit = bits_io_read_bit(bfile);
+        if (bit == EOF)
+            return EOF;
+        p = dtab->tree.kid[p][bit];
+    }
+    return p == FLAT_NONE ? EOF : FLAT_CHAR(p);
+}
+
+
+/**
+ * Decodes a single symbol from the BitsIOFile.  Returns the symbol or EOF
+ * if the input ran out or contained an invalid code.
+ */
+int dtable_decode_symbol (const DecodeTable *dtab, BitsIOFile *bfile)
+{
+    const DecodeEntry *e = &dtab->entry[bits_io_peek_bits(bfile, DTABLE_BITS)];
+    if (e->nsyms == 0)
+        return decode_long(dtab, e, bfile);
+    if (bits_io_skip_bits(bfile, e->len) == EOF)
+        return EOF;
+    return e->sym[0];
+}
+
+
+/**
+ * Decodes up to `n` symbols from the BitsIOFile into `out`.  Returns the
+ * number of symbols decoded.
+ */
+size_t dtable_decode (DecodeTable *dtab, BitsIOFile *bfile,
+                      unsigned char *out, size_t n)
+{
+    assert(dtab != NULL && bfile != NULL);
+
+    size_t i = 0;
+    while (i < n)
+    {
+        const DecodeEntry *e =
+            &dtab->entry[bits_io_peek_bits(bfile, DTABLE_BITS)];
+
+        // Common case: two symbols from one lookup.
+        if (e->nsyms == 2 && i + 1 < n)
+        {
+            if (bits_io_skip_bits(bfile, e->nbits) == EOF)
+                break;
+            out[i++] = e->sym[0];
+            out[i++] = e->sym[1];
+        } else if (e->nsyms > 0)
+        {
+            if (bits_io_skip_bits(bfile, e->len) == EOF)
+                break;
+            out[i++] = e->sym[0];
+        } else
+        {
+            int c = decode_long(dtab, e, bfile);
+            if (c == EOF)
+                break;
+            out[i++] = (unsigned char)c;
+        }
+    }
+    return i;
+}
+
+
+/**
+ * A StreamReader reads one of the streams of dtable_decode_streams.
+ */
+typedef struct StreamReader StreamReader;
+struct StreamReader {
+    const unsigned char *p;       // The next byte to read
+    const unsigned char *end;     // The end of the stream
+    uint64_t             window;  // Bits read ahead, left aligned
+    int                  avail;   // Number of valid bits in window; below
+                                  // 0 once the stream has been overrun
+};
+
+
+/**
+ * Fills the window of the StreamReader with as many whole bytes as fit.
+ */
+static void reader_refill (StreamReader *r)
+{
+    while (r->avail <= 56 && r->p < r->end)
+    {
+        r->window |= (uint64_t)*r->p++ << (56 - r->avail);
+        r->avail  += 8;
+    }
+}
+
+
+/**
+ * Decodes the next symbols of the StreamReader into `out`, two of them only
+ * if `room` allows.  Returns the number of symbols decoded, 0 if the code
+ * is invalid or the stream ran out.
+ */
+static int reader_decode (const DecodeTable *dtab, StreamReader *r,
+                          unsigned char *out, size_t room)
+{
+    if (r->avail < DTABLE_BITS)
+        reader_refill(r);
+
+    const DecodeEntry *e = &dtab->entry[r->window >> (64 - DTABLE_BITS)];
+    if (e->nsyms == 2 && room >= 2)
+    {
+        out[0] = e->sym[0];
+        out[1] = e->sym[1];
+        r->window <<= e->nbits;
+        r->avail   -= e->nbits;
+        return 2;
+    }
+    if (e->nsyms > 0)
+    {
+        out[0] = e->sym[0];
+        r->window <<= e->len;
+        r->avail   -= e->len;
+        return 1;
+    }
+
+    // Long code: consume the bits of the lookup and walk the rest.
+    NodeRef p = e->node;
+    if (p == FLAT_NONE)
+        return 0;
+    r->window <<= DTABLE_BITS;
+    r->avail   -= DTABLE_BITS;
+    while (!FLAT_IS_LEAF(p))
+    {
+        if (r->avail <= 0)
+        {
+            reader_refill(r);
+            if (r->avail <= 0)
+                return 0;
+        }
+        int bit = (int)(r->window >> 63);
+        r->window <<= 1;
+        r->avail--;
+        if ((p = dtab->tree.kid[p][bit]) == FLAT_NONE)
+            return 0;
+    }
+    out[0] = FLAT_CHAR(p);
+    return 1;
+}
+
+
+/**
+ * Decodes four of the streams side by side while each has a few symbols
+ * left, falling back to reader_decode for long codes.  The readers are
+ * copied into locals for the duration, so they stay in registers.  Returns
+ * -1 if a code is invalid.
+ */
+static int decode_four (const DecodeTable *dtab, StreamReader *r,
+                        unsigned char *const *out, size_t *done,
+                        const size_t *n)
+{
+    StreamReader r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];
+    unsigned char *o0 = out[0] + done[0], *o1 = out[1] + done[1];
+    unsigned char *o2 = out[2] + done[2], *o3 = out[3] + done[3];
+    unsigned char *end0 = out[0] + n[0], *end1 = out[1] + n[1];
+    unsigned char *end2 = out[2] + n[2], *end3 = out[3] + n[3];
+    int res = 0;
+
+    // One lookup of a stream; a single symbol writes a spare second one,
+    // which there is room for and which the next lookup overwrites:
+#define STEP(rd, o)                                                     \
+    {                                                                   \
+        const DecodeEntry *e =                                          \
+            &dtab->entry[rd.window >> (64 - DTABLE_BITS)];              \
+        if (e->nsyms == 0)                                              \
+        {                                                               \
+            int got = reader_decode(dtab, &rd, o, 2);                   \
+            if (got == 0)                                               \
+            {                                                           \
+                res = -1;                                               \
+                break;                                                  \
+            }                                                           \
+            o += got;                                                   \
+        } else                                                          \
+        {                                                               \
+            o[0] = e->sym[0];                                           \
+            o[1] = e->sym[1];                                           \
+            o += e->nsyms;                                              \
+            rd.window <<= e->nbits;                                     \
+            rd.avail   -= e->nbits;                                     \
+        }                                                               \
+    }
+
+    while (end0 - o0 >= 8 && end1 - o1 >= 8 &&
+           end2 - o2 >= 8 && end3 - o3 >= 8)
+    {
+        // After a refill there are bits for four lookups of each:
+        reader_refill(&r0);
+        reader_refill(&r1);
+        reader_refill(&r2);
+        reader_refill(&r3);
+        for (int j = 0; j < 4; j++)
+        {
+            STEP(r0, o0);
+            STEP(r1, o1);
+            STEP(r2, o2);
+            STEP(r3, o3);
+        }
+        if (res == -1)
+            break;
+    }
+#undef STEP
+
+    r[0] = r0; r[1] = r1; r[2] = r2; r[3] = r3;
+    done[0] = (size_t)(o0 - out[0]);
+    done[1] = (size_t)(o1 - out[1]);
+    done[2] = (size_t)(o2 - out[2]);
+    done[3] = (size_t)(o3 - out[3]);
+    return res;
+}
+
+
+#ifdef CPU_X86
+/**
+ * The AVX2 decoder gathers each DecodeEntry as one little endian 64 bit
+ * lane and takes its fields out with shifts of ENTRY_SHIFT bits.
+ */
+_Static_assert(sizeof(DecodeEntry) == 8,
+               "a DecodeEntry must fill one 64 bit lane of the gather");
+#define ENTRY_SHIFT(field) (8 * (int)offsetof(DecodeEntry, field))
+
+
+/**
+ * Does what decode_four does with AVX2: the four windows live in one
+ * vector, a gather does the four lookups at once and another one refills
+ * all four windows with the next eight bytes of each stream, without
+ * branches.  Whatever a refill loads past the valid bits is the data that
+ * follows them, so the scalar reader can take over at any time.  It only
+ * runs while every stream has eight bytes left to load.
+ */
+__attribute__((target("avx2,bmi2")))
+static int decode_four_avx2 (const DecodeTable *dtab, StreamReader *r,
+                             unsigned char *const *out, size_t *done,
+                             const size_t *n)
+{
+    const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                                          15, 14, 13, 12, 11, 10, 9, 8,
+                                          7, 6, 5, 4, 3, 2, 1, 0,
+                                          15, 14, 13, 12, 11, 10, 9, 8);
+    const __m256i byte = _mm256_set1_epi64x(0xFF);
+    const long long *table = (const long long *)dtab->entry;
+    unsigned char *o[4], *end[4];
+    for (int s = 0; s < 4; s++)
+    {
+        o[s]   = out[s] + done[s];
+        end[s] = out[s] + n[s];
+    }
+
+    // The windows, valid bit counts and read positions of the streams, and
+    // the last positions that still have eight bytes to load:
+    __m256i win, avail, ptr, last;
+#define LOAD()                                                              \
+    win   = _mm256_setr_epi64x((long long)r[0].window,                      \
+                               (long long)r[1].window,                      \
+                               (long long)r[2].window,                      \
+                               (long long)r[3].window);                     \
+    avail = _mm256_setr_epi64x(r[0].avail, r[1].avail,                      \
+                               r[2].avail, r[3].avail);                     \
+    ptr   = _mm256_setr_epi64x((long long)(uintptr_t)r[0].p,                \
+                               (long long)(uintptr_t)r[1].p,                \
+                               (long long)(uintptr_t)r[2].p,                \
+                               (long long)(uintptr_t)r[3].p)
+#define STORE()                                                             \
+    {                                                                       \
+        uint64_t w[4], a[4], q[4];                                          \
+        _mm256_storeu_si256((__m256i *)w, win);                             \
+        _mm256_storeu_si256((__m256i *)a, avail);                           \
+        _mm256_storeu_si256((__m256i *)q, ptr);                             \
+        for (int s = 0; s < 4; s++)                                         \
+        {                                                                   \
+            r[s].window = w[s];                                             \
+            r[s].avail  = (int)a[s];                                        \
+            r[s].p      = (const unsigned char *)(uintptr_t)q[s];           \
+        }                                                                   \
+    }
+
+    last = _mm256_setr_epi64x((long long)(uintptr_t)(r[0].end - 8),
+                              (long long)(uintptr_t)(r[1].end - 8),
+                              (long long)(uintptr_t)(r[2].end - 8),
+                              (long long)(uintptr_t)(r[3].end - 8));
+    LOAD();
+    for (;;)
+    {
+        int room = _mm256_movemask_epi8(_mm256_cmpgt_epi64(ptr, last)) == 0;
+        for (int s = 0; s < 4; s++)
+            room &= end[s] - o[s] >= 8;
+        if (!room)
+            break;
+
+        // Refill: load eight bytes at each p, big endian, below the valid
+        // bits, and move p past the whole bytes that fit:
+        __m256i next = _mm256_i64gather_epi64(NULL, ptr, 1);
+        next  = _mm256_shuffle_epi8(next, swap);
+        win   = _mm256_or_si256(win, _mm256_srlv_epi64(next, avail));
+        ptr   = _mm256_add_epi64(ptr, _mm256_srli_epi64(
+                    _mm256_sub_epi64(_mm256_set1_epi64x(63), avail), 3));
+        avail = _mm256_or_si256(avail, _mm256_set1_epi64x(56));
+
+        for (int j = 0; j < 4; j++)
+        {
+            __m256i idx = _mm256_srli_epi64(win, 64 - DTABLE_BITS);
+            __m256i e = _mm256_i64gather_epi64(table, idx, 8);
+            __m256i nsyms = _mm256_and_si256(
+                _mm256_srli_epi64(e, ENTRY_SHIFT(nsyms)), byte);
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(
+                    nsyms, _mm256_setzero_si256())) != 0)
+            {
+                // A long code: one lookup of each stream the slow way, then
+                // refill again before the next:
+                STORE();
+                for (int s = 0; s < 4; s++)
+                {
+                    int got = reader_decode(dtab, &r[s], o[s], 2);
+                    if (got == 0)
+                        return -1;
+                    o[s] += got;
+                }
+                LOAD();
+                break;
+            }
+
+            __m256i nbits = _mm256_and_si256(
+                _mm256_srli_epi64(e, ENTRY_SHIFT(nbits)), byte);
+            win   = _mm256_sllv_epi64(win, nbits);
+            avail = _mm256_sub_epi64(avail, nbits);
+
+            uint64_t ent[4];
+            _mm256_storeu_si256((__m256i *)ent, e);
+            for (int s = 0; s < 4; s++)
+            {
+                o[s][0] = (unsigned char)(ent[s] >> ENTRY_SHIFT(sym));
+                o[s][1] = (unsigned char)(ent[s] >> (ENTRY_SHIFT(sym) + 8));
+                o[s] += (ent[s] >> ENTRY_SHIFT(nsyms)) & 0xFF;
+            }
+        }
+    }
+    STORE();
+#undef LOAD
+#undef STORE
+
+    for (int s = 0; s < 4; s++)
+        done[s] = (size_t)(o[s] - out[s]);
+    return 0;
+}
+#endif
+
+
+/**
+ * Decodes `k` separate bitstreams coded with the same table.  Returns 0, or
+ * -1 if a stream ran out or contained an invalid code.
+ */
+int dtable_decode_streams (const DecodeTable *dtab, int k,
+                           const unsigned char *const *src,
+                           const size_t *len, unsigned char *const *out,
+                           const size_t *n)
+{
+    if (k < 1 || k > DTABLE_STREAMS_MAX)
+        return -1;
+
+    StreamReader r[DTABLE_STREAMS_MAX];
+    size_t done[DTABLE_STREAMS_MAX];
+    for (int s = 0; s < k; s++)
+    {
+        r[s].p      = src[s];
+        r[s].end    = src[s] + len[s];
+        r[s].window = 0;
+        r[s].avail  = 0;
+        done[s]     = 0;
+    }
+
+    // While every stream has a few symbols left, take turns decoding one
+    // lookup of each, so the lookups of the streams overlap.  Groups of four
+    // go first, then whatever streams are left:
+#ifdef CPU_X86
+    int avx2 = (cpu_features() & CPU_AVX2) != 0;
+#endif
+    for (int s = 0; s + 4 <= k; s += 4)
+    {
+#ifdef CPU_X86
+        if (avx2 &&
+            decode_four_avx2(dtab, r + s, out + s, done + s, n + s) == -1)
+        {
+            return -1;
+        }
+#endif
+        if (decode_four(dtab, r + s, out + s, done + s, n + s) == -1)
+            return -1;
+    }
+    for (;;)
+    {
+        int room = 1;
+        for (int s = 0; s < k; s++)
+            room &= n[s] - done[s] >= 8;
+        if (!room)
+            break;
+
+        for (int j = 0; j < 4; j++)
+        {
+            for (int s = 0; s < k; s++)
+            {
+                int got = reader_decode(dtab, &r[s], out[s] + done[s], 2);
+                if (got == 0)
+                    return -1;
+                done[s] += got;
+            }
+        }
+    }
+
+    // Then finish each stream on its own:
+    for (int s = 0; s < k; s++)
+    {
+        while (done[s] < n[s])
+        {
+            int got = reader_decode(dtab, &r[s], out[s] + done[s],
+                                    n[s] - done[s]);
+            if (got == 0)
+                return -1;
+            done[s] += got;
+        }
+        if (r[s].avail < 0)
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef __DTABLE_H
+#define __DTABLE_H
+
+#include <stddef.h>
+#include "tree.h"
+#include "bits-io.h"
+
+/**
+ * Number of bits resolved by a single lookup in the decode table.
+ */
+#define DTABLE_BITS 11
+
+typedef struct DecodeTable DecodeTable;
+
+
+/**
+ * Returns a decoding table built from the given Huffman tree or NULL if
+ * there is an error.  The table keeps a flat copy of the tree for codes
+ * longer than DTABLE_BITS, so the tree may be freed right away.
+ */
+DecodeTable *dtable_build (TreeNode *root);
+
+
+/**
+ * Returns a new decoding table that decodes nothing until it is filled in
+ * with dtable_fill, or NULL if there is an error.
+ */
+DecodeTable *dtable_new (void);
+
+
+/**
+ * Fills in the decoding table for the given flat Huffman tree (see tree.h),
+ * replacing what it held before, so one table can be reused for many trees
+ * without allocating.  The table keeps its own copy of the tree.  Returns -1
+ * if there is an error.
+ */
+int dtable_fill (DecodeTable *dtab, const FlatTree *flat);
+
+
+/**
+ * Frees the decoding table.
+ */
+void dtable_free (DecodeTable *dtab);
+
+
+/**
+ * Most streams dtable_decode_streams decodes at once.
+ */
+#define DTABLE_STREAMS_MAX 16
+
+
+/**
+ * Decodes a single symbol from the BitsIOFile.  Returns the symbol or EOF
+ * if the input ran out or contained an invalid code.  Use this rather than
+ * dtable_decode when the table may change from one symbol to the next.
+ */
+int dtable_decode_symbol (const DecodeTable *dtab, BitsIOFile *bfile);
+
+
+/**
+ * Decodes up to `n` symbols from the BitsIOFile into `out`.  Returns the
+ * number of symbols decoded, which is less than `n` only if the input ran
+ * out or contained an invalid code.
+ */
+size_t dtable_decode (DecodeTable *dtab, BitsIOFile *bfile,
+                      unsigned char *out, size_t n);
+
+/**
+ * Decodes `k` separate bitstreams that were coded with the same table:
+ * stream `s` is the `len[s]` bytes at `src[s]` and holds `n[s]` symbols,
+ * which are stored at `out[s]`.  The streams are decoded side by side,
+ * so the lookups of one do not wait for those of the others.  Returns 0,
+ * or -1 if a stream ran out or contained an invalid code.
+ */
+int dtable_decode_streams (const DecodeTable *dtab, int k,
+                           const unsigned char *const *src,
+                           const size_t *len, unsigned char *const *out,
+                           const size_t *n);
+
+#endif
@@ -2,29 +2,138 @@
  
  The encoder module is the main API for the Huffman encoding functionality.
  
+ It writes one of two formats.  The framed format (see frame.c) splits the
+ input into blocks that are encoded independently on a pool of threads and
+ written out in order.  The original format, one tree and one bitstream for
+ the whole input, is still available through EncoderOptions.framed.
+ 
+ With adaptive blocks (see block.c) nothing needs to be known about a block
+ before coding it, so the encoder also works on live streams: a block ends
+ as soon as the input stops delivering, rather than when it is full, and is
+ written out and flushed right away.  The delay between a character coming
+ in and its code going out is then bounded by how often the input pauses,
+ or by the block size for a steady stream.
+ 
+ Otherwise the blocks of the framed format are read ahead by an AioReader
+ (see aio.c), a whole batch beyond the one being coded, so reading the
+ input takes no time of its own unless it is slower than the coding.
+ 
  *******************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <limits.h>
 #include "table.h"
 #include "tree.h"
 #include "huffman.h"
 #include "bits-io.h"
+#include "block.h"
+#include "lz77.h"
+#include "dtable.h"
+#include "frame.h"
+#include "pool.h"
+#include "aio.h"
+#include "stats.h"
+#include "probe.h"
 #include "encoder.h"
 #include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
 
 /**
  * The Encoder structure is used to maintain all the information required to
  * encode an input file using the Huffman coding algorithm.
  */
 struct Encoder {
-    FILE        *infile;    // The file we are reading in
-    TreeNode    *tree;      // The Huffman tree
-    EncodeTable *etab;      // The encoding table
-    BitsIOFile  *bfile;     // The bits-io file we are writing to
-    uint64_t    insize;     // The byte size of input file
+    FILE          *infile;  // The file we are reading in
+    unsigned char *data;    // The whole input, if it fit the memory budget
+    TreeNode      *tree;    // The Huffman tree (original format only)
+    EncodeTable   *etab;    // The encoding table (original format only)
+    BitsIOFile    *bfile;   // The bits-io file we are writing to
+    uint64_t      insize;   // The byte size of input file (original format)
+    EncoderOptions opts;    // The options the encoder was created with
+    ThreadPool    *pool;    // Workers for the blocks or the frequencies
+};
+
+/**
+ * A BlockJob is one block of the input on its way through the thread pool.
+ */
+typedef struct BlockJob BlockJob;
+struct BlockJob {
+    unsigned char *in;      // Room for the characters of a live block
+    const unsigned char *src; // The characters of the block, in `in` or in
+                            // a chunk of the reader
+    size_t         n;       // Number of characters in the block
+    unsigned char *out;     // The encoded block
+    size_t         cap;     // Room in out
+    long           len;     // Length of the encoded block, -1 on error
+    const BlockOptions *opts; // How to encode the block
+    BlockCtx      *ctx;     // Memory reused by the blocks of this slot
 };
 
+// Size of the chunks the input is streamed in when it is not in memory
+#define IN_CHUNK (1<<16)
+
+
+/**
+ * Fills in the default EncoderOptions.
+ */
+void encoder_options_init (EncoderOptions *opts)
+{
+    opts->memory_budget  = DEFAULT_MEMORY_BUDGET;
+    opts->framed         = 1;
+    opts->threads        = 1;
+    opts->block_size     = DEFAULT_BLOCK_SIZE;
+    opts->index_interval = 0;
+    opts->map_output     = 0;
+    block_options_init(&opts->block);
+}
+
+
+/**
+ * Returns the most bytes the output for `size` bytes of input can take.
+ */
+static uint64_t out_bound (uint64_t size, const EncoderOptions *opts)
+{
+    // The original format is about the size of the input at most unless
+    // the codes are very long; the room grows if it was too little:
+    if (!opts->framed)
+        return 8 + 2048 + size;
+    
+    // A block never takes more than block_bound:
+    uint64_t blocks = (size + opts->block_size - 1) / opts->block_size;
+    return FRAME_HEADER_SIZE + FRAME_END_SIZE + size +
+           blocks * (FRAME_BLOCK_SIZE + block_bound(0));
+}
+
+
+/**
+ * Reads the remaining `size` bytes of fp into a new buffer.  Returns NULL if
+ * the memory could not be allocated or the file did not have `size` bytes.
+ */
+static unsigned char *read_all (FILE *fp, uint64_t size)
+{
+    // malloc(0) may return NULL, so always ask for at least one byte:
+    unsigned char *data = (unsigned char *)(malloc(size > 0 ? size : 1));
+    if (data == NULL)
+        return NULL;
+    
+    StatsTimer timer;
+    stats_start(&timer);
+    stats_add(STATS_READ_CALLS, 1);
+    size_t got = fread(data, 1, size, fp);
+    stats_stop(&timer, STATS_READ);
+    if (got != size)
+    {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
 /**
  * Returns a pointer to an Encoder object or NULL if there is an error.
  *
@@ -34,36 +143,222 @@ struct Encoder {
  */
 Encoder *encoder_new (const char *infile, const char *outfile)
 {
-    FILE *infp = fopen(infile, "r");
-    if (infp == NULL)
+    EncoderOptions opts;
+    encoder_options_init(&opts);
+    return encoder_new_opts(infile, outfile, &opts, NULL);
+}
+
+
+#define STR_(x) #x
+#define STR(x)  STR_(x)
+
+/**
+ * Returns why the options cannot be used to encode `infile`, or NULL if
+ * they can.
+ */
+static const char *check_options (const char *infile,
+                                  const EncoderOptions *opts)
+{
+    const BlockOptions *block = &opts->block;
+    int maxlen   = block->max_code_len;
+    int symbits  = block->symbol_bits;
+    int interval = block->adapt_interval;
+    int level    = block->lz_level;
+    
+    if (opts->framed && (opts->block_size < FRAME_MIN_BLOCK ||
+                         opts->block_size > FRAME_MAX_BLOCK))
     {
-        return NULL;
+        return "the block size is out of range";
+    }
+    if (symbits != 8 && symbits != 16)
+        return "symbols are 8 or 16 bits";
+    if (maxlen != 0 && (maxlen < HUFFMAN_LIMIT_MIN ||
+                        maxlen > HUFFMAN_LIMIT_MAX))
+    {
+        return "codes can be limited to " STR(HUFFMAN_LIMIT_MIN) " to "
+               STR(HUFFMAN_LIMIT_MAX) " bits";
+    }
+    if (block->order != 0 && block->order != 1)
+        return "the order is 0 or 1";
+    if (block->coder != BLOCK_CODER_HUFF && block->coder != BLOCK_CODER_ANS)
+        return "there is no such coder";
+    if (interval != 0 && (interval < BLOCK_ADAPT_MIN ||
+                          interval > BLOCK_ADAPT_MAX ||
+                          (interval & (interval - 1)) != 0))
+    {
+        return "the adaptive interval is not a power of two in range";
+    }
+    if (level != 0 && (level < 1 || level > LZ77_LEVEL_MAX))
+        return "the LZ77 level is 1 to " STR(LZ77_LEVEL_MAX);
+    if (level != 0 && (block->lz_window < LZ77_WINDOW_MIN ||
+                       block->lz_window > LZ77_WINDOW_MAX))
+    {
+        return "the LZ77 window is " STR(LZ77_WINDOW_MIN) " to "
+               STR(LZ77_WINDOW_MAX) " bits";
+    }
+    if (block->streams < 1 || block->streams > DTABLE_STREAMS_MAX)
+    {
+        return "blocks are split into 1 to " STR(DTABLE_STREAMS_MAX)
+               " streams";
     }
     
-    TreeNode *tree = huffman_build_tree(infile);
-    if (tree == NULL)
+    // The original format stores the tree itself, which cannot be limited
+    // and only holds characters, and it starts with the size of the input,
+    // which is not known in advance for a stream:
+    if (!opts->framed)
     {
+        if (strcmp(infile, "-") == 0)
+            return "the original format cannot read the standard input";
+        if (maxlen != 0 || symbits != 8 || block->order != 0 ||
+            interval != 0 || block->coder != BLOCK_CODER_HUFF ||
+            level != 0 || block->streams > 1 || opts->index_interval != 0)
+        {
+            return "the original format takes no block or index options";
+        }
         return NULL;
     }
     
-    EncodeTable *etab = table_build(tree);
-    if (etab == NULL)
+    // Words are not limited, coded in order-1, adaptive, tANS or LZ77:
+    if (symbits == 16)
     {
-        return NULL;
+        if (maxlen != 0)
+            return "16 bit words cannot have limited codes";
+        if (block->order != 0)
+            return "16 bit words cannot be coded in order-1";
+        if (interval != 0)
+            return "16 bit words cannot be adaptive";
+        if (block->coder != BLOCK_CODER_HUFF)
+            return "16 bit words cannot be coded with tANS";
+        if (level != 0)
+            return "16 bit words cannot go through LZ77";
     }
+    if (block->order != 0)
+    {
+        if (interval != 0)
+            return "order-1 blocks cannot be adaptive";
+        if (block->coder != BLOCK_CODER_HUFF)
+            return "order-1 blocks cannot be coded with tANS";
+        if (level != 0)
+            return "order-1 blocks cannot go through LZ77";
+    }
+    // tANS has no codes to limit:
+    if (block->coder != BLOCK_CODER_HUFF)
+    {
+        if (maxlen != 0)
+            return "tANS blocks cannot have limited codes";
+        if (interval != 0)
+            return "adaptive blocks cannot be coded with tANS";
+        if (level != 0)
+            return "LZ77 blocks cannot be coded with tANS";
+    }
+    if (interval != 0 && level != 0)
+        return "adaptive blocks cannot go through LZ77";
     
-    BitsIOFile *bfile = bits_io_open(outfile, "w");
-    if (bfile == NULL)
+    // Only blocks with a single code for 8 bit characters are split into
+    // streams, which LZ77 blocks are not either:
+    if (block->streams > 1 &&
+        (symbits != 8 || block->order != 0 || interval != 0 ||
+         block->coder != BLOCK_CODER_HUFF || level != 0))
+    {
+        return "only plain Huffman blocks are split into streams";
+    }
+    return NULL;
+}
+
+
+/**
+ * Returns a pointer to an Encoder object using the given options or NULL if
+ * there is an error.  If `why` is not NULL it is set to why the options
+ * cannot be used together, or to NULL if the error is elsewhere.
+ *
+ * For the framed format each block is read into memory once and encoded
+ * from there, so the input is only ever read once.  It may be a pipe ("-"
+ * for the standard input) whose length is not known in advance: only a
+ * batch of blocks is held in memory at a time, and the end marker is
+ * written when the input runs out.
+ *
+ * For the original format, if the input fits into the memory budget we read
+ * it into memory here and never touch the file again: the frequencies are
+ * computed from the buffer and encoder_encode encodes from the same buffer.
+ * Otherwise the file is read once by huffman_build_tree and a second time by
+ * encoder_encode.
+ */
+Encoder *encoder_new_opts (const char *infile, const char *outfile,
+                           const EncoderOptions *opts, const char **why)
+{
+    uint64_t started = probe_now();
+    const char *problem = check_options(infile, opts);
+    if (why != NULL)
+        *why = problem;
+    if (problem != NULL)
+        return NULL;
+    
+    FILE *infp = fopen_stream(infile, "r");
+    if (infp == NULL)
     {
         return NULL;
     }
     
-    Encoder *encoder = (Encoder *)(malloc(sizeof(Encoder)));
+    Encoder *encoder = (Encoder *)(calloc(1, sizeof(Encoder)));
     encoder->infile = infp;
-    encoder->tree   = tree;
-    encoder->etab   = etab;
-    encoder->bfile  = bfile;
-    encoder->insize = fsize(infile);
+    encoder->opts   = *opts;
+    encoder->insize = opts->framed ? 0 : fsize(infile);
+    
+    encoder->pool = pool_new(opts->threads);
+    if (encoder->pool == NULL)
+    {
+        encoder_free(encoder);
+        return NULL;
+    }
+    
+    if (!opts->framed)
+    {
+        if (encoder->insize <= opts->memory_budget)
+        {
+            encoder->data = read_all(infp, encoder->insize);
+            if (encoder->data == NULL)
+            {
+                encoder_free(encoder);
+                return NULL;
+            }
+            encoder->tree = huffman_build_tree_pool(encoder->data,
+                                                    encoder->insize,
+                                                    encoder->pool);
+        } else
+        {
+            encoder->tree = huffman_build_tree(infile);
+        }
+        if (encoder->tree == NULL)
+        {
+            encoder_free(encoder);
+            return NULL;
+        }
+        
+        encoder->etab = table_build(encoder->tree);
+        if (encoder->etab == NULL)
+        {
+            encoder_free(encoder);
+            return NULL;
+        }
+    }
+    
+    // Map the output with room for the most it can take, if the size of
+    // the input is known and nothing has to reach a reader early:
+    uint64_t room = 0;
+    uint64_t size = strcmp(infile, "-") == 0 ? (uint64_t)-1 : fsize(infile);
+    if (opts->map_output && size != (uint64_t)-1 &&
+        opts->block.adapt_interval == 0)
+    {
+        room = out_bound(size, opts);
+    }
+    encoder->bfile = bits_io_open_sized(outfile, "w", room);
+    if (encoder->bfile == NULL)
+    {
+        encoder_free(encoder);
+        return NULL;
+    }
+    PROBE4(encoder_new, encoder->insize, opts->framed, opts->threads,
+           probe_now() - started);
     return encoder;
 }
 
@@ -74,20 +369,252 @@ Encoder *encoder_new (const char *infile, const char *outfile)
 int encoder_free (Encoder *encoder)
 {
     assert(encoder != NULL);
-    fclose(encoder->infile);
+    fclose_stream(encoder->infile);
+    free(encoder->data);
     tree_free(encoder->tree);
-    table_free(encoder->etab);
-    int res = bits_io_close(encoder->bfile);
+    if (encoder->etab != NULL)
+        table_free(encoder->etab);
+    pool_free(encoder->pool);
+    int res = 0;
+    if (encoder->bfile != NULL)
+    {
+        stats_add(STATS_BYTES_OUT, (bits_io_num_bits(encoder->bfile) + 7) >> 3);
+        res = bits_io_close(encoder->bfile);
+    }
     free(encoder);
     return res;
 }
 
+
+/**
+ * Encodes one block; this is what runs on the thread pool.
+ */
+static void encode_job (void *arg)
+{
+    BlockJob *job = (BlockJob *)arg;
+    PROBE1(encode_block_start, job->n);
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    job->len = block_encode(job->ctx, job->src, job->n, job->out, job->cap,
+                            job->opts);
+    stats_stop(&timer, STATS_ENCODE);
+    PROBE3(encode_block_end, job->n, job->len, probe_now() - started);
+}
+
+
+/**
+ * Frees the buffers of the first `njobs` jobs and the jobs themselves.
+ */
+static void free_jobs (BlockJob *jobs, int njobs)
+{
+    for (int i = 0; i < njobs; i++)
+    {
+        free(jobs[i].in);
+        free(jobs[i].out);
+        block_ctx_free(jobs[i].ctx);
+    }
+    free(jobs);
+}
+
+
+/**
+ * Reads the next block of up to `bsize` characters into `buf`.  With
+ * `live` set the block ends early, with `*partial` set, as soon as the
+ * input has nothing more to deliver for now.  Returns the number of
+ * characters read, 0 at the end of the input.
+ */
+static size_t read_block (FILE *fp, unsigned char *buf, size_t bsize,
+                          int live, int *partial)
+{
+    *partial = 0;
+    if (!live)
+    {
+        stats_add(STATS_READ_CALLS, 1);
+        return fread(buf, 1, bsize, fp);
+    }
+    
+    // Read the descriptor directly: a read returns what is there and only
+    // waits when there is nothing at all.  A short read followed by nothing
+    // to read straight away means the input has paused.
+    int fd = fileno(fp);
+    size_t n = 0;
+    while (n < bsize)
+    {
+        stats_add(STATS_READ_CALLS, 1);
+        ssize_t got = read(fd, buf + n, bsize - n);
+        if (got <= 0)
+            break;
+        n += (size_t)got;
+        
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (n < bsize && poll(&pfd, 1, 0) == 0)
+        {
+            *partial = 1;
+            break;
+        }
+    }
+    return n;
+}
+
+
+/**
+ * Returns the number of bytes encoded as encoder_encode reports it, which
+ * stops at INT_MAX for inputs of 2 GiB and more.
+ */
+static int clamp_count (uint64_t count)
+{
+    return count > INT_MAX ? INT_MAX : (int)count;
+}
+
+
+/**
+ * Encodes the input in the framed format.  Batches of blocks are read,
+ * handed to the thread pool, and written out in order once the whole batch
+ * is done.  With adaptive blocks a batch also ends, and is flushed, when
+ * the input pauses.  Returns the number of bytes encoded or -1 if there was
+ * an error.
+ */
+static int encode_framed (Encoder *encoder)
+{
+    size_t bsize = encoder->opts.block_size;
+    int live = encoder->opts.block.adapt_interval != 0;
+    
+    // Twice as many blocks as threads keeps the workers busy while the
+    // slowest block of a batch finishes.
+    int njobs = encoder->opts.threads > 1 ? 2 * encoder->opts.threads : 1;
+    BlockJob *jobs = (BlockJob *)(calloc(njobs, sizeof(BlockJob)));
+    if (jobs == NULL)
+        return -1;
+    
+    // The reader holds the batch being coded and reads the next one; a
+    // live block has to end when the input pauses, so it is read here:
+    AioReader *reader = NULL;
+    if (!live)
+        reader = aio_reader_new(encoder->infile, bsize, 2 * njobs);
+    for (int i = 0; i < njobs; i++)
+    {
+        if (reader == NULL)
+            jobs[i].in = (unsigned char *)(malloc(bsize));
+        jobs[i].cap  = block_bound(bsize);
+        jobs[i].opts = &encoder->opts.block;
+        jobs[i].out  = (unsigned char *)(malloc(jobs[i].cap));
+        jobs[i].ctx  = block_ctx_new();
+        if ((reader == NULL && jobs[i].in == NULL) || jobs[i].out == NULL ||
+            jobs[i].ctx == NULL)
+        {
+            aio_reader_free(reader);
+            free_jobs(jobs, njobs);
+            return -1;
+        }
+    }
+    
+    uint64_t interval = encoder->opts.index_interval;
+    FrameIndex index;
+    frame_index_init(&index);
+    
+    FrameHeader hdr;
+    hdr.block_size = (uint32_t)bsize;
+    hdr.flags      = interval != 0 ? FRAME_FLAG_INDEX : 0;
+    if (frame_write_header(encoder->bfile, &hdr) == EOF)
+    {
+        aio_reader_free(reader);
+        free_jobs(jobs, njobs);
+        return -1;
+    }
+    
+    uint64_t raw  = 0;   // Characters written so far
+    uint64_t mark = 0;   // List the next block that starts from here on
+    int done  = 0;
+    int status = 0;
+    while (!done && status == 0)
+    {
+        // Read and submit a batch of blocks:
+        int batch = 0;
+        int partial = 0;
+        while (batch < njobs && !done && !partial)
+        {
+            BlockJob *job = &jobs[batch];
+            StatsTimer timer;
+            stats_start(&timer);
+            if (reader != NULL)
+            {
+                long got = aio_reader_next(reader, &job->src);
+                if (got < 0)
+                    status = -1;
+                job->n = got > 0 ? (size_t)got : 0;
+            } else
+            {
+                job->src = job->in;
+                job->n = read_block(encoder->infile, job->in, bsize, live,
+                                    &partial);
+            }
+            stats_stop(&timer, STATS_READ);
+            if (job->n < bsize && !partial)
+                done = 1;
+            if (job->n == 0)
+                break;
+            if (pool_submit(encoder->pool, encode_job, job) == -1)
+                job->len = -1;
+            batch++;
+        }
+        pool_wait(encoder->pool);
+        
+        // Write them out in order:
+        for (int i = 0; i < batch; i++)
+        {
+            BlockJob *job = &jobs[i];
+            int listed = 0;
+            if (interval != 0 && raw >= mark)
+            {
+                uint64_t at = bits_io_num_bits(encoder->bfile) >> 3;
+                listed = frame_index_add(&index, raw, at) == 0 ? 1 : -1;
+                mark = raw + interval;
+            }
+            if (job->len < 0 || listed == -1 ||
+                frame_write_block(encoder->bfile, (uint32_t)job->n,
+                                  job->out, (uint32_t)job->len) == EOF)
+            {
+                status = -1;
+                break;
+            }
+            raw += job->n;
+        }
+        
+        // The chunks of the batch can be read into again:
+        for (int i = 0; reader != NULL && i < batch; i++)
+            aio_reader_release(reader);
+        if (status == 0 && live && batch > 0 &&
+            bits_io_sync(encoder->bfile) == EOF)
+        {
+            status = -1;
+        }
+    }
+    aio_reader_free(reader);
+    free_jobs(jobs, njobs);
+    if (status == -1)
+    {
+        frame_index_free(&index);
+        return -1;
+    }
+    
+    stats_add(STATS_BYTES_IN, raw);
+    status = frame_write_end(encoder->bfile);
+    if (status != EOF && interval != 0)
+        status = frame_write_index(encoder->bfile, &index);
+    frame_index_free(&index);
+    return status == EOF ? -1 : clamp_count(raw);
+}
+
 /**
  * Encodes the input file into the output file. Returns the number of bytes
- * encoded or -1 if there was an error.
+ * encoded, at most INT_MAX, or -1 if there was an error.
  */
 int encoder_encode (Encoder *encoder)
 {
+    if (encoder->opts.framed)
+        return encode_framed(encoder);
+    
     //First, write the size of the original uncompressed file
     write_offset(encoder->bfile, encoder->insize);
     
@@ -97,28 +624,43 @@ int encoder_encode (Encoder *encoder)
         return -1;
     
     // Now, we encode each of the characters from the input
-    // file to the output file:
-    int count = 0;
-    for (int ch; (ch = fgetc(encoder->infile)) != EOF; )
+    // file to the output file, one whole code at a time:
+    const BitCode *codes = table_codes(encoder->etab);
+    BitsIOFile *bfile = encoder->bfile;
+    uint64_t count = 0;
+    StatsTimer timer;
+    
+    // The input is already in memory:
+    if (encoder->data != NULL)
     {
-        ++count;
-        // Lookup the encoding for the character:
-        char *estr = table_bit_encode(encoder->etab, ch);
-        
-        // Loop over the encoding writing the correct bits
-        // to the output file:
-        for (char c, *p = estr; (c = *p++); )
-        {
-            if (bits_io_write_bit(encoder->bfile, c - '0') == EOF)
-            {
-                return -1;
-            }
-        }
+        stats_start(&timer);
+        r = bits_io_write_codes(bfile, encoder->data, encoder->insize, codes);
+        stats_stop(&timer, STATS_ENCODE);
+        if (r == EOF)
+            return -1;
+        stats_add(STATS_BYTES_IN, encoder->insize);
+        return clamp_count(encoder->insize);
+    }
+    
+    // Otherwise read it in chunks:
+    unsigned char buf[IN_CHUNK];
+    for (;;)
+    {
+        stats_start(&timer);
+        stats_add(STATS_READ_CALLS, 1);
+        size_t n = fread(buf, 1, IN_CHUNK, encoder->infile);
+        stats_stop(&timer, STATS_READ);
+        if (n == 0)
+            break;
         
-        // We need to free the encoding string that is
-        // returned from the table:
-        free(estr);
+        stats_start(&timer);
+        r = bits_io_write_codes(bfile, buf, n, codes);
+        stats_stop(&timer, STATS_ENCODE);
+        if (r == EOF)
+            return -1;
+        count += n;
     }
     
-    return count;
+    stats_add(STATS_BYTES_IN, count);
+    return clamp_count(count);
 }
@@ -1,6 +1,9 @@
 #ifndef __ENCODER_H
 #define __ENCODER_H
 
+#include <stdint.h>
+#include "block.h"
+
 /**
  * The Encoder structure is used to maintain all the information required to
  * encode an input file using the Huffman coding algorithm.
@@ -8,12 +11,72 @@
 typedef struct Encoder Encoder;
 
 
+/**
+ * Inputs up to this many bytes are read into memory only once by default.
+ */
+#define DEFAULT_MEMORY_BUDGET ((uint64_t)256 << 20)
+
+
+/**
+ * The EncoderOptions structure holds the settings that control how an
+ * Encoder works.  Use encoder_options_init to get the defaults.
+ */
+typedef struct EncoderOptions EncoderOptions;
+struct EncoderOptions {
+    // Inputs of at most this many bytes are read into memory once and the
+    // same buffer is used to compute the frequencies and to encode.  Larger
+    // inputs are streamed from disk twice instead.  Only used for the
+    // original format.
+    uint64_t memory_budget;
+    
+    // 1 to write the framed format (see frame.c), 0 for the original format
+    // with one tree and one bitstream for the whole input.
+    int framed;
+    
+    // Number of threads encoding blocks of the framed format in parallel.
+    int threads;
+    
+    // Number of characters per block of the framed format, between
+    // FRAME_MIN_BLOCK and FRAME_MAX_BLOCK.
+    uint32_t block_size;
+    
+    // If not 0, a block index is written after the end of the framed format
+    // (see frame.c), listing a block at least every this many characters,
+    // so readers can decode part of the file without the blocks before it.
+    uint64_t index_interval;
+    
+    // 1 to write an output file through a memory mapping sized for the
+    // largest output the input can give, instead of through stdio.  Not
+    // done for the standard output or when blocks have to reach a reader
+    // as they are written.
+    int map_output;
+    
+    // How the blocks of the framed format are encoded.
+    BlockOptions block;
+};
+
+
+/**
+ * Fills in the default EncoderOptions.
+ */
+void encoder_options_init (EncoderOptions *opts);
+
+
 /**
  * Returns a pointer to an Encoder object or NULL if there is an error.
  */
 Encoder *encoder_new (const char *infile, const char *outfile);
 
 
+/**
+ * Returns a pointer to an Encoder object using the given options or NULL if
+ * there is an error.  If `why` is not NULL it is set to why the options
+ * cannot be used together, or to NULL if the error is elsewhere.
+ */
+Encoder *encoder_new_opts (const char *infile, const char *outfile,
+                           const EncoderOptions *opts, const char **why);
+
+
 /**
  * Deallocates an Encoder object. Returns -1 if there is an error.
  */
@@ -22,7 +85,8 @@ int encoder_free (Encoder *encoder);
 
 /**
  * Encodes the input file into the output file. Returns the number of bytes
- * encoded or -1 if there was an error.
+ * encoded, which stops at INT_MAX for inputs of 2 GiB and more, or -1 if
+ * there was an error.
  */
 int encoder_encode (Encoder *encoder);
 
@@ -0,0 +1,373 @@
+/********************************************************************
+
+ The frame module reads and writes the framed container format.  Instead of
+ one tree and one bitstream for the whole input, the input is split into
+ blocks that are encoded independently (see block.c), so the encoder and the
+ decoder can work on several blocks at once.  The layout is:
+
+   HEADER  = MAGIC VERSION FLAGS BLOCK_SIZE
+   BLOCK   = RAW_SIZE LEN DATA
+   END     = 0
+
+   FILE    = HEADER BLOCK* END
+
+ MAGIC is the four characters "HUFZ", VERSION and FLAGS are one byte each,
+ and BLOCK_SIZE, RAW_SIZE and LEN are 4 byte big endian numbers.  RAW_SIZE is
+ the number of characters in the block and LEN the number of bytes of DATA,
+ the encoded block.  A RAW_SIZE of 0 marks the end.
+
+ With FRAME_FLAG_INDEX set in FLAGS, an index of the blocks follows END:
+
+   INDEX   = ENTRY* COUNT "HUFI"
+   ENTRY   = RAW_OFFSET FILE_OFFSET
+
+ Each ENTRY gives the number of characters before one of the blocks and
+ the offset of its RAW_SIZE in the file, both 8 byte big endian numbers, in
+ the order of the file; COUNT is the number of entries (4 bytes).  A reader
+ that wants the characters from some place on finds the INDEX from the end
+ of the file, seeks to the last block listed before that place and decodes
+ from there.  Not every block needs to be listed: the blocks in between are
+ skipped by their LEN.  Readers that do not know the index stop at END and
+ never see it.
+
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+
+
+/**
+ * Stores `v` at `p` in big endian byte order.
+ */
+static void put_u32 (unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+
+/**
+ * Returns the big endian number at `p`.
+ */
+static uint32_t get_u32 (const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+
+
+/**
+ * Stores the header of a framed file in the FRAME_HEADER_SIZE bytes at
+ * `dst`.
+ */
+void frame_put_header (unsigned char *dst, const FrameHeader *hdr)
+{
+    memcpy(dst, FRAME_MAGIC, 4);
+    dst[4] = FRAME_VERSION;
+    dst[5] = hdr->flags;
+    put_u32(dst + 6, hdr->block_size);
+}
+
+
+/**
+ * Stores `v` at `p` in big endian byte order.
+ */
+static void put_u64 (unsigned char *p, uint64_t v)
+{
+    put_u32(p, (uint32_t)(v >> 32));
+    put_u32(p + 4, (uint32_t)v);
+}
+
+
+/**
+ * Returns the 8 byte big endian number at `p`.
+ */
+static uint64_t get_u64 (const unsigned char *p)
+{
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+
+/**
+ * Reads the header from the FRAME_HEADER_SIZE bytes at `src`.  Returns EOF
+ * if the header is not valid.
+ */
+int frame_get_header (const unsigned char *src, FrameHeader *hdr)
+{
+    if (memcmp(src, FRAME_MAGIC, 4) != 0 || src[4] != FRAME_VERSION)
+        return EOF;
+
+    hdr->flags      = src[5];
+    hdr->block_size = get_u32(src + 6);
+    if (hdr->block_size == 0 || hdr->block_size > FRAME_MAX_BLOCK)
+        return EOF;
+    return 0;
+}
+
+
+/**
+ * Stores the sizes in front of a block in the FRAME_BLOCK_SIZE bytes at
+ * `dst`.
+ */
+void frame_put_block (unsigned char *dst, uint32_t raw_size, uint32_t len)
+{
+    put_u32(dst, raw_size);
+    if (raw_size != 0)
+        put_u32(dst + 4, len);
+}
+
+
+/**
+ * Reads the sizes in front of a block from the `n` bytes at `src`.  Returns
+ * 0 for a block, 1 at the end marker, or EOF if `n` is too small.
+ */
+int frame_get_block (const unsigned char *src, size_t n,
+                     uint32_t *raw_size, uint32_t *len)
+{
+    if (n < FRAME_END_SIZE)
+        return EOF;
+    *raw_size = get_u32(src);
+    if (*raw_size == 0)
+        return 1;
+
+    if (n < FRAME_BLOCK_SIZE)
+        return EOF;
+    *len = get_u32(src + 4);
+    return 0;
+}
+
+
+/**
+ * Returns 1 if the BitsIOFile starts with a framed header, 0 otherwise.
+ */
+int frame_detect (BitsIOFile *bfile)
+{
+    unsigned char magic[4];
+    if (bits_io_peek_bytes(bfile, magic, 4) < 4)
+        return 0;
+    return memcmp(magic, FRAME_MAGIC, 4) == 0;
+}
+
+
+/**
+ * Writes the header of a framed file. Returns EOF if there was an error.
+ */
+int frame_write_header (BitsIOFile *bfile, const FrameHeader *hdr)
+{
+    unsigned char bytes[FRAME_HEADER_SIZE];
+    frame_put_header(bytes, hdr);
+    return bits_io_write_bytes(bfile, bytes, sizeof(bytes));
+}
+
+
+/**
+ * Reads the header of a framed file. Returns EOF if there was an error or
+ * the header is not valid.
+ */
+int frame_read_header (BitsIOFile *bfile, FrameHeader *hdr)
+{
+    unsigned char bytes[FRAME_HEADER_SIZE];
+    if (bits_io_read_bytes(bfile, bytes, sizeof(bytes)) == EOF)
+        return EOF;
+    return frame_get_header(bytes, hdr);
+}
+
+
+/**
+ * Writes one block holding `raw_size` characters whose encoding is the `len`
+ * bytes at `data`. Returns EOF if there was an error.
+ */
+int frame_write_block (BitsIOFile *bfile, uint32_t raw_size,
+                       const unsigned char *data, uint32_t len)
+{
+    unsigned char sizes[FRAME_BLOCK_SIZE];
+    frame_put_block(sizes, raw_size, len);
+    if (bits_io_write_bytes(bfile, sizes, sizeof(sizes)) == EOF)
+        return EOF;
+    return bits_io_write_bytes(bfile, data, len);
+}
+
+
+/**
+ * Writes the marker that ends the blocks. Returns EOF if there was an error.
+ */
+int frame_write_end (BitsIOFile *bfile)
+{
+    unsigned char zero[FRAME_END_SIZE] = { 0 };
+    return bits_io_write_bytes(bfile, zero, sizeof(zero));
+}
+
+
+/**
+ * Reads the sizes in front of the next block.  Returns 0 for a block, 1 at
+ * the end marker, or EOF if there was an error.
+ */
+int frame_read_block (BitsIOFile *bfile, uint32_t *raw_size, uint32_t *len)
+{
+    unsigned char sizes[FRAME_BLOCK_SIZE];
+    if (bits_io_read_bytes(bfile, sizes, 4) == EOF)
+        return EOF;
+    *raw_size = get_u32(sizes);
+    if (*raw_size == 0)
+        return 1;
+
+    if (bits_io_read_bytes(bfile, sizes + 4, 4) == EOF)
+        return EOF;
+    *len = get_u32(sizes + 4);
+    return 0;
+}
+
+
+/**
+ * Makes the FrameIndex empty.
+ */
+void frame_index_init (FrameIndex *index)
+{
+    index->raw   = NULL;
+    index->file  = NULL;
+    index->count = 0;
+    index->cap   = 0;
+}
+
+
+/**
+ * Frees the entries of the FrameIndex and makes it empty.
+ */
+void frame_index_free (FrameIndex *index)
+{
+    free(index->raw);
+    free(index->file);
+    frame_index_init(index);
+}
+
+
+/**
+ * Makes room for `count` entries in the FrameIndex.  Returns -1 if there is
+ * an error.
+ */
+static int index_reserve (FrameIndex *index, uint32_t count)
+{
+    if (count <= index->cap)
+        return 0;
+    uint32_t cap = index->cap < 64 ? 64 : index->cap;
+    while (cap < count)
+        cap *= 2;
+    uint64_t *raw = (uint64_t *)(realloc(index->raw, cap * sizeof(uint64_t)));
+    if (raw != NULL)
+        index->raw = raw;
+    uint64_t *file = (uint64_t *)(realloc(index->file,
+                                          cap * sizeof(uint64_t)));
+    if (file != NULL)
+        index->file = file;
+    if (raw == NULL || file == NULL)
+        return -1;
+    index->cap = cap;
+    return 0;
+}
+
+
+/**
+ * Adds the block that starts after `raw` characters at byte `file` of the
+ * file to the FrameIndex.  Returns -1 if there is an error.
+ */
+int frame_index_add (FrameIndex *index, uint64_t raw, uint64_t file)
+{
+    if (index->count == UINT32_MAX || index_reserve(index, index->count + 1))
+        return -1;
+    index->raw[index->count]  = raw;
+    index->file[index->count] = file;
+    index->count++;
+    return 0;
+}
+
+
+/**
+ * Returns the position in the FrameIndex of the last block that starts at
+ * or before character `raw`, or -1 if there is none.
+ */
+long frame_index_find (const FrameIndex *index, uint64_t raw)
+{
+    // Binary search for the first block that starts after raw:
+    uint32_t lo = 0, hi = index->count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index->raw[mid] <= raw)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (long)lo - 1;
+}
+
+
+/**
+ * Writes the FrameIndex after the end marker.  Returns EOF if there was an
+ * error.
+ */
+int frame_write_index (BitsIOFile *bfile, const FrameIndex *index)
+{
+    unsigned char bytes[FRAME_INDEX_ENTRY];
+    for (uint32_t i = 0; i < index->count; i++)
+    {
+        put_u64(bytes, index->raw[i]);
+        put_u64(bytes + 8, index->file[i]);
+        if (bits_io_write_bytes(bfile, bytes, FRAME_INDEX_ENTRY) == EOF)
+            return EOF;
+    }
+    put_u32(bytes, index->count);
+    memcpy(bytes + 4, FRAME_INDEX_MAGIC, 4);
+    return bits_io_write_bytes(bfile, bytes, FRAME_INDEX_TAIL);
+}
+
+
+/**
+ * Reads the FrameIndex from the end of a framed file, seeking there.
+ * Returns EOF if the file cannot seek or the index is not valid.
+ */
+int frame_read_index (BitsIOFile *bfile, FrameIndex *index)
+{
+    int64_t size = bits_io_size(bfile);
+    unsigned char bytes[FRAME_INDEX_ENTRY];
+    if (size < FRAME_HEADER_SIZE + FRAME_END_SIZE + FRAME_INDEX_TAIL ||
+        bits_io_seek(bfile, (uint64_t)size - FRAME_INDEX_TAIL) == EOF ||
+        bits_io_read_bytes(bfile, bytes, FRAME_INDEX_TAIL) == EOF ||
+        memcmp(bytes + 4, FRAME_INDEX_MAGIC, 4) != 0)
+    {
+        return EOF;
+    }
+
+    // The entries sit right in front of the tail and every one of them
+    // points at a block between the header and the end marker:
+    uint32_t count = get_u32(bytes);
+    uint64_t room = (uint64_t)size - FRAME_HEADER_SIZE - FRAME_END_SIZE -
+                    FRAME_INDEX_TAIL;
+    if (count > room / FRAME_INDEX_ENTRY)
+        return EOF;
+    uint64_t start = (uint64_t)size - FRAME_INDEX_TAIL -
+                     (uint64_t)count * FRAME_INDEX_ENTRY;
+    if (bits_io_seek(bfile, start) == EOF || index_reserve(index, count))
+        return EOF;
+
+    index->count = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (bits_io_read_bytes(bfile, bytes, FRAME_INDEX_ENTRY) == EOF)
+            return EOF;
+        uint64_t raw  = get_u64(bytes);
+        uint64_t file = get_u64(bytes + 8);
+        if (file < FRAME_HEADER_SIZE || file >= start ||
+            (i > 0 && (raw < index->raw[i - 1] ||
+                       file <= index->file[i - 1])))
+        {
+            return EOF;
+        }
+        index->raw[i]  = raw;
+        index->file[i] = file;
+        index->count++;
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#include <stdint.h>
+#include "bits-io.h"
+
+/**
+ * The framed format starts with these four bytes.  A file in the original
+ * format starts with the big endian size of the input instead, whose first
+ * byte is 0 for any input smaller than 2^56 bytes.
+ */
+#define FRAME_MAGIC       "HUFZ"
+#define FRAME_VERSION     1
+
+/**
+ * Bits of the FLAGS byte of the header.  FRAME_FLAG_INDEX means an index of
+ * the blocks follows the end marker.
+ */
+#define FRAME_FLAG_INDEX  0x01
+
+/**
+ * Inputs are split into blocks of this many bytes by default, and a block
+ * may not be larger than FRAME_MAX_BLOCK.
+ */
+#define DEFAULT_BLOCK_SIZE (1<<20)
+#define FRAME_MIN_BLOCK    (1<<10)
+#define FRAME_MAX_BLOCK    (16<<20)
+
+/**
+ * Sizes of the header, of the sizes in front of each block, and of the end
+ * marker.
+ */
+#define FRAME_HEADER_SIZE 10
+#define FRAME_BLOCK_SIZE  8
+#define FRAME_END_SIZE    4
+
+/**
+ * The index ends with its number of entries and these four bytes; each
+ * entry takes FRAME_INDEX_ENTRY bytes.
+ */
+#define FRAME_INDEX_MAGIC "HUFI"
+#define FRAME_INDEX_ENTRY 16
+#define FRAME_INDEX_TAIL  8
+
+
+/**
+ * The FrameHeader holds the information at the start of a framed file.
+ */
+typedef struct FrameHeader FrameHeader;
+struct FrameHeader {
+    uint32_t block_size;  // No block holds more characters than this
+    uint8_t  flags;       // FRAME_FLAG_ bits
+};
+
+
+/**
+ * A FrameIndex lists where some of the blocks of a framed file start, so a
+ * reader can seek to the one holding a given character instead of decoding
+ * everything before it.  Use frame_index_init before anything else.
+ */
+typedef struct FrameIndex FrameIndex;
+struct FrameIndex {
+    uint64_t *raw;    // Number of characters before each listed block
+    uint64_t *file;   // Offset in the file of the sizes in front of it
+    uint32_t  count;  // Number of blocks listed, in the order of the file
+    uint32_t  cap;    // Number raw and file have room for
+};
+
+
+/**
+ * Stores the header of a framed file in the FRAME_HEADER_SIZE bytes at
+ * `dst`.
+ */
+void frame_put_header (unsigned char *dst, const FrameHeader *hdr);
+
+/**
+ * Reads the header from the FRAME_HEADER_SIZE bytes at `src`.  Returns EOF
+ * if the header is not valid.
+ */
+int frame_get_header (const unsigned char *src, FrameHeader *hdr);
+
+/**
+ * Stores the sizes in front of a block in the FRAME_BLOCK_SIZE bytes at
+ * `dst`.  A `raw_size` of 0 with no `len` is the end marker, which only
+ * takes the first FRAME_END_SIZE bytes.
+ */
+void frame_put_block (unsigned char *dst, uint32_t raw_size, uint32_t len);
+
+/**
+ * Reads the sizes in front of a block from the `n` bytes at `src`, like
+ * frame_read_block.  Returns 0 for a block, 1 at the end marker, or EOF if
+ * `n` is too small.
+ */
+int frame_get_block (const unsigned char *src, size_t n,
+                     uint32_t *raw_size, uint32_t *len);
+
+/**
+ * Returns 1 if the BitsIOFile starts with a framed header, 0 otherwise.
+ * Nothing is consumed.
+ */
+int frame_detect (BitsIOFile *bfile);
+
+/**
+ * Writes the header of a framed file. Returns EOF if there was an error.
+ */
+int frame_write_header (BitsIOFile *bfile, const FrameHeader *hdr);
+
+/**
+ * Reads the header of a framed file. Returns EOF if there was an error or
+ * the header is not valid.
+ */
+int frame_read_header (BitsIOFile *bfile, FrameHeader *hdr);
+
+/**
+ * Writes one block holding `raw_size` characters whose encoding is the `len`
+ * bytes at `data`. Returns EOF if there was an error.
+ */
+int frame_write_block (BitsIOFile *bfile, uint32_t raw_size,
+                       const unsigned char *data, uint32_t len);
+
+/**
+ * Writes the marker that ends the blocks. Returns EOF if there was an error.
+ */
+int frame_write_end (BitsIOFile *bfile);
+
+/**
+ * Reads the sizes in front of the next block: the number of characters it
+ * holds and the length of its encoding, which follows next in the file.
+ * Returns 0 for a block, 1 at the end marker, or EOF if there was an error.
+ */
+int frame_read_block (BitsIOFile *bfile, uint32_t *raw_size, uint32_t *len);
+
+/**
+ * Makes the FrameIndex empty.
+ */
+void frame_index_init (FrameIndex *index);
+
+/**
+ * Frees the entries of the FrameIndex and makes it empty.
+ */
+void frame_index_free (FrameIndex *index);
+
+/**
+ * Adds the block that starts after `raw` characters at byte `file` of the
+ * file to the FrameIndex.  Returns -1 if there is an error.
+ */
+int frame_index_add (FrameIndex *index, uint64_t raw, uint64_t file);
+
+/**
+ * Returns the position in the FrameIndex of the last block that starts at
+ * or before character `raw`, or -1 if there is none.
+ */
+long frame_index_find (const FrameIndex *index, uint64_t raw);
+
+/**
+ * Writes the FrameIndex after the end marker.  Returns EOF if there was an
+ * error.
+ */
+int frame_write_index (BitsIOFile *bfile, const FrameIndex *index);
+
+/**
+ * Reads the FrameIndex from the end of a framed file whose header has
+ * FRAME_FLAG_INDEX set, seeking there.  The file is left wherever the index
+ * ended.  Returns EOF if the file cannot seek or the index is not valid.
+ */
+int frame_read_index (BitsIOFile *bfile, FrameIndex *index);
+
+#endif
@@ -0,0 +1,198 @@
+/********************************************************************
+ 
+ The histogram module counts how often each character occurs in a buffer.
+ 
+ The obvious loop, counts[buf[i]]++, runs at about one character per cycle
+ at best: when the same character comes up twice in a row the second
+ increment has to wait for the first one to be stored and loaded again.
+ Text repeats characters all the time, so this is the common case.
+ 
+ Instead we keep HIST_BANKS separate tables of 32-bit counters and send
+ consecutive characters to different tables, so neighbouring increments
+ never touch the same counter.  The characters are loaded eight at a time as
+ one 64-bit word and picked apart with shifts.  The 32-bit tables are added
+ into the caller's 64-bit counts every HIST_FLUSH characters, before any of
+ them could overflow, and once more at the end.
+ 
+ Large inputs are also split into one slice per thread (see
+ histogram_count_pool); each slice is counted into its own tables and the
+ results are added up afterwards.
+
+ Counting 16 bit words (histogram_count16) is kept to the plain loop: four
+ banks of 65536 counters would not fit in the cache, which costs more than
+ the repeated increments do.
+ 
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+
+// Number of interleaved counter tables:
+#define HIST_BANKS 4
+
+// Characters counted before the 32-bit tables are added into the totals:
+#define HIST_FLUSH ((size_t)1 << 30)
+
+
+/**
+ * Adds the counter tables to `counts`.
+ */
+static void flush_banks (uint32_t banks[HIST_BANKS][HIST_SYMBOLS],
+                         uint64_t counts[HIST_SYMBOLS])
+{
+    for (int c = 0; c < HIST_SYMBOLS; c++)
+    {
+        uint64_t sum = 0;
+        for (int b = 0; b < HIST_BANKS; b++)
+            sum += banks[b][c];
+        counts[c] += sum;
+    }
+}
+
+
+/**
+ * Counts the `n` characters at `buf`, which is at most HIST_FLUSH, into the
+ * counter tables.
+ */
+static void count_banks (const unsigned char *buf, size_t n,
+                         uint32_t banks[HIST_BANKS][HIST_SYMBOLS])
+{
+    size_t i = 0;
+    
+    // Two words per iteration, each character going to the next table:
+    for (; i + 16 <= n; i += 16)
+    {
+        uint64_t w0, w1;
+        memcpy(&w0, buf + i, 8);
+        memcpy(&w1, buf + i + 8, 8);
+        
+        banks[0][(unsigned char)(w0)]++;
+        banks[1][(unsigned char)(w0 >> 8)]++;
+        banks[2][(unsigned char)(w0 >> 16)]++;
+        banks[3][(unsigned char)(w0 >> 24)]++;
+        banks[0][(unsigned char)(w0 >> 32)]++;
+        banks[1][(unsigned char)(w0 >> 40)]++;
+        banks[2][(unsigned char)(w0 >> 48)]++;
+        banks[3][(unsigned char)(w0 >> 56)]++;
+        
+        banks[0][(unsigned char)(w1)]++;
+        banks[1][(unsigned char)(w1 >> 8)]++;
+        banks[2][(unsigned char)(w1 >> 16)]++;
+        banks[3][(unsigned char)(w1 >> 24)]++;
+        banks[0][(unsigned char)(w1 >> 32)]++;
+        banks[1][(unsigned char)(w1 >> 40)]++;
+        banks[2][(unsigned char)(w1 >> 48)]++;
+        banks[3][(unsigned char)(w1 >> 56)]++;
+    }
+    
+    // The last few characters:
+    for (; i < n; i++)
+        banks[i % HIST_BANKS][buf[i]]++;
+}
+
+
+/**
+ * Adds the number of times each character occurs in the `n` characters at
+ * `buf` to `counts`.
+ */
+void histogram_count (const unsigned char *buf, size_t n,
+                      uint64_t counts[HIST_SYMBOLS])
+{
+    uint32_t banks[HIST_BANKS][HIST_SYMBOLS];
+    
+    while (n > 0)
+    {
+        size_t len = n < HIST_FLUSH ? n : HIST_FLUSH;
+        memset(banks, 0, sizeof(banks));
+        count_banks(buf, len, banks);
+        flush_banks(banks, counts);
+        buf += len;
+        n   -= len;
+    }
+}
+
+
+/**
+ * Adds the number of times each 16 bit little endian word occurs in the
+ * `n` characters at `buf` to `counts`.
+ */
+void histogram_count16 (const unsigned char *buf, size_t n,
+                        uint64_t counts[HIST_WORDS])
+{
+    for (size_t i = 0; i + 1 < n; i += 2)
+        counts[buf[i] | (buf[i + 1] << 8)]++;
+}
+
+
+/**
+ * A HistJob is one slice of the input counted on the thread pool.
+ */
+typedef struct HistJob HistJob;
+struct HistJob {
+    const unsigned char *buf;                  // The slice
+    size_t               n;                    // Length of the slice
+    uint64_t             counts[HIST_SYMBOLS]; // The counts of the slice
+};
+
+
+/**
+ * Counts one slice; this is what runs on the thread pool.
+ */
+static void count_job (void *arg)
+{
+    HistJob *job = (HistJob *)arg;
+    histogram_count(job->buf, job->n, job->counts);
+}
+
+
+/**
+ * Same as histogram_count, but large inputs are split into one slice per
+ * worker of `pool` and the slices are counted in parallel.  Returns -1 if
+ * there is an error, in which case `counts` is unchanged.
+ */
+int histogram_count_pool (const unsigned char *buf, size_t n,
+                          uint64_t counts[HIST_SYMBOLS], ThreadPool *pool)
+{
+    size_t nslices = pool != NULL ? (size_t)pool_size(pool) : 1;
+    if (nslices > n / HIST_MIN_SPLIT)
+        nslices = n / HIST_MIN_SPLIT;
+    if (nslices <= 1)
+    {
+        histogram_count(buf, n, counts);
+        return 0;
+    }
+    
+    HistJob *jobs = (HistJob *)(calloc(nslices, sizeof(HistJob)));
+    if (jobs == NULL)
+        return -1;
+    
+    // Give every slice the same share, the last one takes the remainder:
+    size_t share = n / nslices;
+    for (size_t s = 0; s < nslices; s++)
+    {
+        jobs[s].buf = buf + s * share;
+        jobs[s].n   = s + 1 < nslices ? share : n - s * share;
+    }
+    
+    size_t submitted = 0;
+    int res = 0;
+    for (; submitted < nslices; submitted++)
+    {
+        if (pool_submit(pool, count_job, &jobs[submitted]) == -1)
+        {
+            res = -1;
+            break;
+        }
+    }
+    pool_wait(pool);
+    
+    if (res == 0)
+    {
+        for (size_t s = 0; s < nslices; s++)
+            for (int c = 0; c < HIST_SYMBOLS; c++)
+                counts[c] += jobs[s].counts[c];
+    }
+    free(jobs);
+    return res;
+}
@@ -0,0 +1,47 @@
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pool.h"
+
+#define HIST_SYMBOLS 256
+
+/**
+ * Number of different 16 bit words counted by histogram_count16.
+ */
+#define HIST_WORDS (1 << 16)
+
+/**
+ * Inputs smaller than this are never split across threads; the cost of
+ * handing out the work would outweigh the gain.
+ */
+#define HIST_MIN_SPLIT (1<<20)
+
+
+/**
+ * Adds the number of times each character occurs in the `n` characters at
+ * `buf` to `counts`.
+ */
+void histogram_count (const unsigned char *buf, size_t n,
+                      uint64_t counts[HIST_SYMBOLS]);
+
+
+/**
+ * Adds the number of times each 16 bit little endian word occurs in the
+ * `n` characters at `buf` to `counts`.  Only the n / 2 whole words are
+ * counted; an odd last character is left out.
+ */
+void histogram_count16 (const unsigned char *buf, size_t n,
+                        uint64_t counts[HIST_WORDS]);
+
+
+/**
+ * Same as histogram_count, but large inputs are split into one slice per
+ * worker of `pool` and the slices are counted in parallel.  Returns -1 if
+ * there is an error, in which case `counts` is unchanged.
+ */
+int histogram_count_pool (const unsigned char *buf, size_t n,
+                          uint64_t counts[HIST_SYMBOLS], ThreadPool *pool);
+
+#endif
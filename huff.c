@@ -0,0 +1,257 @@
+/********************************************************************
+ 
+ The huff module compresses and decompresses buffers in memory, without
+ going through files.  It produces and reads the same framed format as the
+ encoder and decoder (see frame.c): the header, the blocks, and the end
+ marker are all written straight into the caller's buffer, and the blocks
+ are decoded straight into the caller's buffer, so nothing is copied on the
+ way and no buffer is allocated for the data.
+ 
+ Everything runs on the calling thread.  Callers that want to compress
+ several buffers at once can call these functions from several threads.
+ 
+ huff_compress and huff_decompress allocate what they need to code the
+ blocks once per call, and free it before they return.  Callers with many
+ small buffers should keep a HuffCtx instead, which holds that memory (see
+ BlockCtx in block.c) from one call to the next.  Nothing is left over
+ from the previous input that would have to be cleared, so there is no
+ reset: every call simply starts over in the same memory.
+ 
+ *******************************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "block.h"
+#include "frame.h"
+#include "huff.h"
+
+
+/**
+ * Returns the largest number of bytes huff_compress can produce for `n`
+ * bytes of input.
+ */
+size_t huff_compress_bound (size_t n)
+{
+    size_t nblocks = (n + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE;
+    return FRAME_HEADER_SIZE + nblocks * FRAME_BLOCK_SIZE +
+           (n + nblocks) + FRAME_END_SIZE;
+}
+
+
+/**
+ * A HuffCtx keeps the memory for coding blocks and the options of the
+ * blocks between calls.
+ */
+struct HuffCtx {
+    BlockCtx    *block;
+    BlockOptions opts;
+};
+
+
+/**
+ * Returns a new HuffCtx encoding blocks with the given options, or the
+ * defaults if `opts` is NULL.  Returns NULL if there is an error.
+ */
+HuffCtx *huff_ctx_new (const BlockOptions *opts)
+{
+    HuffCtx *ctx = (HuffCtx *)(malloc(sizeof(HuffCtx)));
+    if (ctx == NULL)
+        return NULL;
+    ctx->block = block_ctx_new();
+    if (ctx->block == NULL)
+    {
+        free(ctx);
+        return NULL;
+    }
+    if (opts != NULL)
+        ctx->opts = *opts;
+    else
+        block_options_init(&ctx->opts);
+    return ctx;
+}
+
+
+/**
+ * Frees a HuffCtx.
+ */
+void huff_ctx_free (HuffCtx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    block_ctx_free(ctx->block);
+    free(ctx);
+}
+
+
+/**
+ * Compresses the `n` bytes at `src` into the `cap` bytes at `dst`, coding
+ * the blocks in `bctx` with the options `opts`.
+ */
+static long compress (BlockCtx *bctx, const BlockOptions *opts,
+                      const unsigned char *in, size_t n,
+                      unsigned char *out, size_t cap)
+{
+    FrameHeader hdr;
+    hdr.block_size = DEFAULT_BLOCK_SIZE;
+    hdr.flags      = 0;
+    if (cap < FRAME_HEADER_SIZE)
+        return -1;
+    frame_put_header(out, &hdr);
+    size_t pos = FRAME_HEADER_SIZE;
+    
+    while (n > 0)
+    {
+        size_t bn = n < DEFAULT_BLOCK_SIZE ? n : DEFAULT_BLOCK_SIZE;
+        if (cap - pos < FRAME_BLOCK_SIZE)
+            return -1;
+        
+        // The block goes right after its sizes, which are filled in after:
+        long len = block_encode(bctx, in, bn, out + pos + FRAME_BLOCK_SIZE,
+                                cap - pos - FRAME_BLOCK_SIZE, opts);
+        if (len < 0)
+            return -1;
+        frame_put_block(out + pos, (uint32_t)bn, (uint32_t)len);
+        pos += FRAME_BLOCK_SIZE + len;
+        in  += bn;
+        n   -= bn;
+    }
+    
+    if (cap - pos < FRAME_END_SIZE)
+        return -1;
+    frame_put_block(out + pos, 0, 0);
+    return (long)(pos + FRAME_END_SIZE);
+}
+
+
+/**
+ * Compresses the `n` bytes at `src` into the `cap` bytes at `dst`.  Returns
+ * the number of bytes written or -1 if there is an error.
+ */
+long huff_compress (const void *src, size_t n, void *dst, size_t cap)
+{
+    BlockCtx *bctx = block_ctx_new();
+    if (bctx == NULL)
+        return -1;
+    BlockOptions opts;
+    block_options_init(&opts);
+    long res = compress(bctx, &opts, (const unsigned char *)src, n,
+                        (unsigned char *)dst, cap);
+    block_ctx_free(bctx);
+    return res;
+}
+
+
+/**
+ * Same as huff_compress, but the memory for the blocks and their options
+ * come from `ctx`.
+ */
+long huff_compress_ctx (HuffCtx *ctx, const void *src, size_t n,
+                        void *dst, size_t cap)
+{
+    return compress(ctx->block, &ctx->opts, (const unsigned char *)src, n,
+                    (unsigned char *)dst, cap);
+}
+
+
+/**
+ * Checks the header of the `n` bytes at `src` and returns the offset of the
+ * first block, or -1 if the header is not valid.
+ */
+static long check_header (const unsigned char *src, size_t n, FrameHeader *hdr)
+{
+    if (n < FRAME_HEADER_SIZE || frame_get_header(src, hdr) == EOF)
+        return -1;
+    return FRAME_HEADER_SIZE;
+}
+
+
+/**
+ * Returns the number of bytes the compressed data in the `n` bytes at `src`
+ * decompresses to, or -1 if it is not valid.
+ */
+long huff_decompressed_size (const void *src, size_t n)
+{
+    const unsigned char *in = (const unsigned char *)src;
+    FrameHeader hdr;
+    long pos = check_header(in, n, &hdr);
+    if (pos < 0)
+        return -1;
+    
+    long total = 0;
+    for (;;)
+    {
+        uint32_t raw, len;
+        int res = frame_get_block(in + pos, n - pos, &raw, &len);
+        if (res == 1)
+            return total;
+        if (res == EOF || raw > hdr.block_size ||
+            len > n - pos - FRAME_BLOCK_SIZE)
+        {
+            return -1;
+        }
+        total += raw;
+        pos += FRAME_BLOCK_SIZE + len;
+    }
+}
+
+
+/**
+ * Decompresses the `n` bytes at `in` into the `cap` bytes at `out`, decoding
+ * the blocks in `bctx`.
+ */
+static long decompress (BlockCtx *bctx, const unsigned char *in, size_t n,
+                        unsigned char *out, size_t cap)
+{
+    FrameHeader hdr;
+    long pos = check_header(in, n, &hdr);
+    if (pos < 0)
+        return -1;
+    
+    size_t total = 0;
+    for (;;)
+    {
+        uint32_t raw, len;
+        int res = frame_get_block(in + pos, n - pos, &raw, &len);
+        if (res == 1)
+            return (long)total;
+        if (res == EOF || raw > hdr.block_size ||
+            len > n - pos - FRAME_BLOCK_SIZE || raw > cap - total)
+        {
+            return -1;
+        }
+        if (block_decode(bctx, in + pos + FRAME_BLOCK_SIZE, len,
+                         out + total, raw) == -1)
+        {
+            return -1;
+        }
+        total += raw;
+        pos += FRAME_BLOCK_SIZE + len;
+    }
+}
+
+
+/**
+ * Decompresses the `n` bytes at `src` into the `cap` bytes at `dst`.
+ * Returns the number of bytes written or -1 if there is an error.
+ */
+long huff_decompress (const void *src, size_t n, void *dst, size_t cap)
+{
+    BlockCtx *bctx = block_ctx_new();
+    if (bctx == NULL)
+        return -1;
+    long res = decompress(bctx, (const unsigned char *)src, n,
+                          (unsigned char *)dst, cap);
+    block_ctx_free(bctx);
+    return res;
+}
+
+
+/**
+ * Same as huff_decompress, but the memory for the blocks comes from `ctx`.
+ */
+long huff_decompress_ctx (HuffCtx *ctx, const void *src, size_t n,
+                          void *dst, size_t cap)
+{
+    return decompress(ctx->block, (const unsigned char *)src, n,
+                      (unsigned char *)dst, cap);
+}
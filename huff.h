@@ -0,0 +1,82 @@
+#ifndef __HUFF_H
+#define __HUFF_H
+
+#include <stddef.h>
+#include "block.h"
+
+/**
+ * Returns the largest number of bytes huff_compress can produce for `n`
+ * bytes of input.
+ */
+size_t huff_compress_bound (size_t n);
+
+
+/**
+ * Compresses the `n` bytes at `src` into the `cap` bytes at `dst`, in the
+ * same framed format huffc writes.  Returns the number of bytes written or
+ * -1 if there is an error, including `dst` being too small.
+ *
+ * Each block is encoded straight into `dst`, so there must be room for the
+ * worst case of every block: a `cap` of huff_compress_bound(n) is always
+ * enough, anything less may fail even if the output would have fit.
+ *
+ * The memory for coding the blocks is allocated and freed on every call;
+ * callers with many small buffers should use huff_compress_ctx instead.
+ */
+long huff_compress (const void *src, size_t n, void *dst, size_t cap);
+
+
+/**
+ * Returns the number of bytes the compressed data in the `n` bytes at `src`
+ * decompresses to, or -1 if it is not valid.  Only the block headers are
+ * read, nothing is decoded.
+ */
+long huff_decompressed_size (const void *src, size_t n);
+
+
+/**
+ * Decompresses the `n` bytes at `src`, as written by huff_compress or huffc,
+ * into the `cap` bytes at `dst`.  Returns the number of bytes written or -1
+ * if there is an error, including `dst` being too small.  Like
+ * huff_compress, it allocates the memory for the blocks on every call (see
+ * huff_decompress_ctx).
+ */
+long huff_decompress (const void *src, size_t n, void *dst, size_t cap);
+
+
+/**
+ * A HuffCtx holds the memory used to compress and decompress, and the
+ * options blocks are encoded with, so they can be reused from one buffer
+ * to the next.  With a HuffCtx, coding a buffer allocates nothing.  A
+ * HuffCtx must not be used by two threads at the same time.
+ */
+typedef struct HuffCtx HuffCtx;
+
+
+/**
+ * Returns a new HuffCtx encoding blocks with the given options, or the
+ * defaults if `opts` is NULL.  Returns NULL if there is an error.
+ */
+HuffCtx *huff_ctx_new (const BlockOptions *opts);
+
+
+/**
+ * Frees a HuffCtx.
+ */
+void huff_ctx_free (HuffCtx *ctx);
+
+
+/**
+ * Same as huff_compress, but using the memory and options of `ctx`.
+ */
+long huff_compress_ctx (HuffCtx *ctx, const void *src, size_t n,
+                        void *dst, size_t cap);
+
+
+/**
+ * Same as huff_decompress, but using the memory of `ctx`.
+ */
+long huff_decompress_ctx (HuffCtx *ctx, const void *src, size_t n,
+                          void *dst, size_t cap);
+
+#endif
@@ -0,0 +1,510 @@
+/********************************************************************
+
+ huffbench measures how fast each phase of coding a block runs, calling
+ the library directly so that neither starting a process nor reading
+ files is part of what is timed.
+
+ Every input, the files named on the command line and a few made up here,
+ is read into memory and split into blocks as the encoder splits it.  The
+ phases run over all the blocks of an input in turn:
+
+   histogram  counting the characters of each block
+   tree       the code lengths from the counts (huffman_lengths)
+   table      the codes and the decoding table from the lengths
+   encode     block_encode, everything above plus writing the bits
+   decode     block_decode
+
+ Each phase runs once to warm the caches and the branch predictors up and
+ then for a number of timed iterations, of which the fastest counts.  The
+ results are printed as a table, and written as JSON with --json so runs
+ on different machines or of different versions can be compared.  MB/s is
+ millions of input bytes a second; the ratio is the size of the encoded
+ blocks over the size of the input.
+
+ *******************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hzip.h"
+#include "dtable.h"
+
+// Size of the made up inputs
+#define SYNTH_SIZE (4 << 20)
+
+// Number of timed iterations unless -i says otherwise
+#define DEFAULT_ITERATIONS 10
+
+enum { PHASE_HISTOGRAM, PHASE_TREE, PHASE_TABLE, PHASE_ENCODE, PHASE_DECODE,
+       PHASES };
+
+static const char *phase_names[PHASES] = {
+    "histogram", "tree", "table", "encode", "decode"
+};
+
+/**
+ * An Input is one input with everything its phases work on.
+ */
+typedef struct Input Input;
+struct Input {
+    const char    *name;
+    unsigned char *data;      // The characters
+    size_t         n;         // Number of characters
+    size_t         nblocks;   // Number of blocks they are split into
+    uint64_t     (*counts)[HIST_SYMBOLS]; // The counts of each block
+    unsigned char (*lens)[CANON_SYMBOLS]; // The code lengths of each block
+    unsigned char **packed;   // The encoded blocks
+    long          *plen;      // Length of each encoded block
+    size_t         total;     // Length of all encoded blocks
+    double         ns[PHASES];     // Fastest time of each phase
+    uint64_t       cycles[PHASES]; // Cycles of each phase in that time
+};
+
+/**
+ * The Bench structure holds what the phases share.
+ */
+typedef struct Bench Bench;
+struct Bench {
+    BlockOptions    opts;
+    size_t          bsize;
+    BlockCtx       *ctx;
+    HuffmanScratch *scratch;
+    DecodeTable    *dtab;
+    unsigned char  *out;      // Room for a decoded block
+    volatile uint64_t sink;   // Keeps results from being optimized out
+};
+
+
+static void usage()
+{
+    printf("huffbench [options] [<file> ...]\n");
+    printf("  Times each phase of coding the files and some made up inputs.\n");
+    printf("  -i <iterations>        timed runs of each phase, the fastest counts\n");
+    printf("  -B <megabytes>         size of the blocks, 1 to 16\n");
+    printf("  --max-code-len <bits>  limit codes to 11 to 15 bits\n");
+    printf("  --streams <n>          split blocks into 1 to 16 streams\n");
+    printf("  --json <file>          also write the results as JSON, - for the\n");
+    printf("                         standard output\n");
+}
+
+
+/**
+ * Returns the time in nanoseconds from some fixed point.
+ */
+static double now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/**
+ * Returns the next number of a xorshift generator, so the made up inputs
+ * are the same on every run.
+ */
+static uint64_t next_random (uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+
+/**
+ * Fills `n` characters at `buf` with the made up input `kind`: every
+ * character equally likely, each one half as likely as the one before, or
+ * a single character.
+ */
+static void synthesize (const char *kind, unsigned char *buf, size_t n)
+{
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t r = next_random(&state);
+        if (strcmp(kind, "random") == 0)
+            buf[i] = (unsigned char)r;
+        else if (strcmp(kind, "skewed") == 0)
+            buf[i] = (unsigned char)('a' + (r == 0 ? 63 : __builtin_ctzll(r)));
+        else
+            buf[i] = 'a';
+    }
+}
+
+
+/**
+ * Reads the file `name` into memory.  Returns NULL if there is an error.
+ */
+static unsigned char *read_file (const char *name, size_t *n)
+{
+    FILE *fp = fopen(name, "rb");
+    if (fp == NULL)
+        return NULL;
+    uint64_t size = fsize(name);
+    unsigned char *data = (unsigned char *)(malloc(size > 0 ? size : 1));
+    if (data == NULL || size == (uint64_t)-1 ||
+        fread(data, 1, size, fp) != size)
+    {
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *n = (size_t)size;
+    return data;
+}
+
+
+/**
+ * Returns the length of block `b` of an Input.
+ */
+static size_t block_len (const Bench *bench, const Input *in, size_t b)
+{
+    size_t left = in->n - b * bench->bsize;
+    return left < bench->bsize ? left : bench->bsize;
+}
+
+
+/**
+ * Runs phase `phase` over all the blocks of an Input once.  Returns -1 if
+ * there is an error.
+ */
+static int run_phase (Bench *bench, Input *in, int phase)
+{
+    int limit = bench->opts.max_code_len;
+    for (size_t b = 0; b < in->nblocks; b++)
+    {
+        const unsigned char *src = in->data + b * bench->bsize;
+        size_t n = block_len(bench, in, b);
+        switch (phase)
+        {
+        case PHASE_HISTOGRAM:
+            memset(in->counts[b], 0, sizeof(in->counts[b]));
+            histogram_count(src, n, in->counts[b]);
+            bench->sink += in->counts[b][src[0]];
+            break;
+        case PHASE_TREE:
+            if (huffman_lengths(in->counts[b], CANON_SYMBOLS, limit,
+                                in->lens[b], bench->scratch) == -1)
+                return -1;
+            bench->sink += in->lens[b][src[0]];
+            break;
+        case PHASE_TABLE:
+        {
+            BitCode codes[CANON_SYMBOLS];
+            FlatTree flat;
+            if (canon_codes(in->lens[b], codes) == -1 ||
+                canon_tree(in->lens[b], &flat) == -1 ||
+                dtable_fill(bench->dtab, &flat) == -1)
+                return -1;
+            bench->sink += codes[src[0]].bits;
+            break;
+        }
+        case PHASE_ENCODE:
+            in->plen[b] = block_encode(bench->ctx, src, n, in->packed[b],
+                                       block_bound(bench->bsize),
+                                       &bench->opts);
+            if (in->plen[b] < 0)
+                return -1;
+            break;
+        case PHASE_DECODE:
+            if (block_decode(bench->ctx, in->packed[b], (size_t)in->plen[b],
+                             bench->out, n) == -1)
+                return -1;
+            bench->sink += bench->out[0];
+            break;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Sets up an Input for the `n` characters at `data`.  Returns -1 if there
+ * is an error.
+ */
+static int input_init (Bench *bench, Input *in, const char *name,
+                       unsigned char *data, size_t n)
+{
+    memset(in, 0, sizeof(Input));
+    in->name    = name;
+    in->data    = data;
+    in->n       = n;
+    in->nblocks = (n + bench->bsize - 1) / bench->bsize;
+    if (in->nblocks == 0)
+        return -1;
+    in->counts = calloc(in->nblocks, sizeof(in->counts[0]));
+    in->lens   = calloc(in->nblocks, sizeof(in->lens[0]));
+    in->packed = (unsigned char **)(calloc(in->nblocks,
+                                           sizeof(unsigned char *)));
+    in->plen   = (long *)(calloc(in->nblocks, sizeof(long)));
+    if (in->counts == NULL || in->lens == NULL || in->packed == NULL ||
+        in->plen == NULL)
+        return -1;
+    for (size_t b = 0; b < in->nblocks; b++)
+    {
+        in->packed[b] = (unsigned char *)(malloc(block_bound(bench->bsize)));
+        if (in->packed[b] == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Frees what input_init allocated, and the characters, keeping the
+ * results.
+ */
+static void input_free (Input *in)
+{
+    for (size_t b = 0; in->packed != NULL && b < in->nblocks; b++)
+        free(in->packed[b]);
+    free(in->packed);
+    free(in->plen);
+    free(in->counts);
+    free(in->lens);
+    free(in->data);
+}
+
+
+/**
+ * Runs every phase over an Input, once to warm up and then `iterations`
+ * times, keeping the fastest time of each.  Checks that the blocks decode
+ * to what was encoded.  Returns -1 if there is an error.
+ */
+static int bench_input (Bench *bench, Input *in, int iterations)
+{
+    for (int p = 0; p < PHASES; p++)
+    {
+        if (run_phase(bench, in, p) == -1)
+            return -1;
+        in->ns[p] = -1;
+        for (int i = 0; i < iterations; i++)
+        {
+            uint64_t c0 = cpu_cycles();
+            double t0 = now_ns();
+            run_phase(bench, in, p);
+            double t = now_ns() - t0;
+            uint64_t c = cpu_cycles() - c0;
+            if (in->ns[p] < 0 || t < in->ns[p])
+            {
+                in->ns[p] = t;
+                in->cycles[p] = c;
+            }
+        }
+    }
+
+    in->total = 0;
+    for (size_t b = 0; b < in->nblocks; b++)
+    {
+        size_t n = block_len(bench, in, b);
+        if (block_decode(bench->ctx, in->packed[b], (size_t)in->plen[b],
+                         bench->out, n) == -1 ||
+            memcmp(bench->out, in->data + b * bench->bsize, n) != 0)
+            return -1;
+        in->total += (size_t)in->plen[b];
+    }
+    return 0;
+}
+
+
+/**
+ * Prints the results of an Input as rows of the table.
+ */
+static void print_rows (const Input *in)
+{
+    for (int p = 0; p < PHASES; p++)
+    {
+        double nsb = in->ns[p] / in->n;
+        printf("%-24s %-10s %10.1f %9.3f", in->name, phase_names[p],
+               1e3 / nsb, nsb);
+        if (in->cycles[p] != 0)
+            printf(" %9.3f", (double)in->cycles[p] / in->n);
+        else
+            printf(" %9s", "-");
+        if (p >= PHASE_ENCODE)
+            printf(" %7.4f\n", (double)in->total / in->n);
+        else
+            printf(" %7s\n", "-");
+    }
+}
+
+
+/**
+ * Writes `s` as a JSON string.
+ */
+static void json_string (FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != 0; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%04x", *s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+
+/**
+ * Writes the results of all `count` inputs as JSON.
+ */
+static void print_json (FILE *fp, const Bench *bench, const Input *inputs,
+                        int count, int iterations)
+{
+    int features = cpu_features();
+    fprintf(fp, "{\n  \"iterations\": %d,\n  \"block_size\": %zu,\n",
+            iterations, bench->bsize);
+    fprintf(fp, "  \"max_code_len\": %d,\n  \"streams\": %d,\n",
+            bench->opts.max_code_len, bench->opts.streams);
+    fprintf(fp, "  \"cpu_features\": [%s%s%s],\n",
+            features & CPU_BMI2 ? "\"bmi2\"" : "",
+            (features & CPU_BMI2) && (features & CPU_AVX2) ? ", " : "",
+            features & CPU_AVX2 ? "\"avx2\"" : "");
+    fprintf(fp, "  \"inputs\": [");
+    for (int i = 0; i < count; i++)
+    {
+        const Input *in = &inputs[i];
+        fprintf(fp, "%s\n    {\"name\": ", i > 0 ? "," : "");
+        json_string(fp, in->name);
+        fprintf(fp, ", \"bytes\": %zu, \"encoded_bytes\": %zu, "
+                "\"ratio\": %.6f,\n     \"phases\": {", in->n, in->total,
+                (double)in->total / in->n);
+        for (int p = 0; p < PHASES; p++)
+        {
+            double nsb = in->ns[p] / in->n;
+            fprintf(fp, "%s\n       \"%s\": {\"mb_per_s\": %.3f, "
+                    "\"ns_per_byte\": %.6f, \"cycles_per_byte\": ",
+                    p > 0 ? "," : "", phase_names[p], 1e3 / nsb, nsb);
+            if (in->cycles[p] != 0)
+                fprintf(fp, "%.6f}", (double)in->cycles[p] / in->n);
+            else
+                fprintf(fp, "null}");
+        }
+        fprintf(fp, "}}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+
+int main (int argc, char *argv[])
+{
+    Bench bench;
+    memset(&bench, 0, sizeof(Bench));
+    block_options_init(&bench.opts);
+    bench.bsize = DEFAULT_BLOCK_SIZE;
+    int iterations = DEFAULT_ITERATIONS;
+    const char *json = NULL;
+
+    // Parse the options in front of the file names:
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != 0)
+    {
+        if (strcmp(argv[argi], "-i") == 0 && argi + 1 < argc)
+        {
+            iterations = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "-B") == 0 && argi + 1 < argc)
+        {
+            bench.bsize = (size_t)atoi(argv[argi + 1]) << 20;
+            argi += 2;
+        } else if (strcmp(argv[argi], "--max-code-len") == 0 && argi + 1 < argc)
+        {
+            bench.opts.max_code_len = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--streams") == 0 && argi + 1 < argc)
+        {
+            bench.opts.streams = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--json") == 0 && argi + 1 < argc)
+        {
+            json = argv[argi + 1];
+            argi += 2;
+        } else
+        {
+            usage();
+            exit(1);
+        }
+    }
+    if (iterations < 1 || bench.bsize < (1 << 20) ||
+        bench.bsize > FRAME_MAX_BLOCK ||
+        (bench.opts.max_code_len != 0 &&
+         (bench.opts.max_code_len < HUFFMAN_LIMIT_MIN ||
+          bench.opts.max_code_len > HUFFMAN_LIMIT_MAX)) ||
+        bench.opts.streams < 1 || bench.opts.streams > DTABLE_STREAMS_MAX)
+    {
+        usage();
+        exit(1);
+    }
+
+    bench.ctx     = block_ctx_new();
+    bench.scratch = huffman_scratch_new();
+    bench.dtab    = dtable_new();
+    bench.out     = (unsigned char *)(malloc(bench.bsize));
+    static const char *synth[] = { "random", "skewed", "single" };
+    int nsynth = sizeof(synth) / sizeof(synth[0]);
+    int count = argc - argi + nsynth;
+    Input *inputs = (Input *)(calloc(count, sizeof(Input)));
+    if (bench.ctx == NULL || bench.scratch == NULL || bench.dtab == NULL ||
+        bench.out == NULL || inputs == NULL)
+    {
+        printf("Out of memory.\n");
+        exit(1);
+    }
+
+    printf("%-24s %-10s %10s %9s %9s %7s\n", "input", "phase", "MB/s",
+           "ns/byte", "cyc/byte", "ratio");
+    for (int i = 0; i < count; i++)
+    {
+        const char *name;
+        unsigned char *data;
+        size_t n = SYNTH_SIZE;
+        if (i < count - nsynth)
+        {
+            name = argv[argi + i];
+            data = read_file(name, &n);
+        } else
+        {
+            name = synth[i - (count - nsynth)];
+            data = (unsigned char *)(malloc(n));
+            if (data != NULL)
+                synthesize(name, data, n);
+        }
+        if (data == NULL ||
+            input_init(&bench, &inputs[i], name, data, n) == -1 ||
+            bench_input(&bench, &inputs[i], iterations) == -1)
+        {
+            printf("Could not benchmark %s!\n", name);
+            exit(1);
+        }
+        print_rows(&inputs[i]);
+        input_free(&inputs[i]);
+    }
+
+    if (json != NULL)
+    {
+        FILE *fp = fopen_stream(json, "w");
+        if (fp == NULL)
+        {
+            printf("Could not write %s!\n", json);
+            exit(1);
+        }
+        print_json(fp, &bench, inputs, count, iterations);
+        fclose_stream(fp);
+    }
+
+    free(inputs);
+    free(bench.out);
+    dtable_free(bench.dtab);
+    huffman_scratch_free(bench.scratch);
+    block_ctx_free(bench.ctx);
+    return 0;
+}
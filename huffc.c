@@ -6,42 +6,170 @@
 
 static void usage()
 {
-    printf("huffc <file.txt> <file.he>\n");
+    printf("huffc [options] <file.txt> <file.he>\n");
+    printf("  Either file may be - for the standard input or output.\n");
+    printf("  -T <threads>           number of threads encoding blocks in parallel\n");
+    printf("  -B <megabytes>         size of the blocks, 1 to 16\n");
+    printf("  --max-code-len <bits>  limit codes to 11 to 15 bits\n");
+    printf("  -W <bits>              code symbols of 8 bits, or of 16 bits\n");
+    printf("                         for streams of little endian words\n");
+    printf("  --order <n>            0 for one code table per block, 1 for a\n");
+    printf("                         table per preceding character\n");
+    printf("  --adaptive <kilobytes> store no code tables, rebuilding the code\n");
+    printf("                         at least this often (a power of two);\n");
+    printf("                         blocks are written as the input arrives\n");
+    printf("  --coder=huff|ans       code blocks with Huffman codes or tANS\n");
+    printf("  --lz <level>           replace repeated strings first, level 1\n");
+    printf("                         (fastest) to 9 (smallest)\n");
+    printf("  --lz-window <bits>     matches reach back 2^bits, 10 to 22\n");
+    printf("  --streams <n>          split blocks into 1 to 16 streams that\n");
+    printf("                         are decoded side by side\n");
+    printf("  --index <kilobytes>    append a block index with an entry at\n");
+    printf("                         least this often, for huffd --range\n");
+    printf("  --mmap                 write the output file through a memory\n");
+    printf("                         mapping instead of stdio\n");
+    printf("  --stats                print where the time went to stderr, as\n");
+    printf("                         does HUFF_STATS=1 in the environment\n");
+    printf("  -L                     write the original single stream format\n");
+    printf("  -m <megabytes>         with -L, inputs up to this size are read\n");
+    printf("                         from disk only once\n");
 }
 
 
 int main (int argc, char *argv[])
 {
-    if (argc != 3)
+    EncoderOptions opts;
+    encoder_options_init(&opts);
+    const char *env = getenv("HUFF_STATS");
+    int stats = env != NULL && *env != 0 && strcmp(env, "0") != 0;
+    
+    // Parse the options in front of the file names:
+    int argi = 1, budget = 0;
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != 0)
+    {
+        if (strcmp(argv[argi], "-m") == 0 && argi + 1 < argc)
+        {
+            opts.memory_budget = strtoull(argv[argi + 1], NULL, 10) << 20;
+            budget = 1;
+            argi += 2;
+        } else if (strcmp(argv[argi], "-T") == 0 && argi + 1 < argc)
+        {
+            opts.threads = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "-B") == 0 && argi + 1 < argc)
+        {
+            opts.block_size = (uint32_t)atoi(argv[argi + 1]) << 20;
+            argi += 2;
+        } else if (strcmp(argv[argi], "--max-code-len") == 0 && argi + 1 < argc)
+        {
+            opts.block.max_code_len = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "-W") == 0 && argi + 1 < argc)
+        {
+            opts.block.symbol_bits = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--order") == 0 && argi + 1 < argc)
+        {
+            opts.block.order = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--adaptive") == 0 && argi + 1 < argc)
+        {
+            opts.block.adapt_interval = atoi(argv[argi + 1]) << 10;
+            argi += 2;
+        } else if (strcmp(argv[argi], "--coder=huff") == 0)
+        {
+            opts.block.coder = BLOCK_CODER_HUFF;
+            argi += 1;
+        } else if (strcmp(argv[argi], "--coder=ans") == 0)
+        {
+            opts.block.coder = BLOCK_CODER_ANS;
+            argi += 1;
+        } else if (strcmp(argv[argi], "--lz") == 0 && argi + 1 < argc)
+        {
+            opts.block.lz_level = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--lz-window") == 0 && argi + 1 < argc)
+        {
+            opts.block.lz_window = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--streams") == 0 && argi + 1 < argc)
+        {
+            opts.block.streams = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--index") == 0 && argi + 1 < argc)
+        {
+            opts.index_interval = strtoull(argv[argi + 1], NULL, 10) << 10;
+            if (opts.index_interval == 0)
+            {
+                usage();
+                exit(1);
+            }
+            argi += 2;
+        } else if (strcmp(argv[argi], "--mmap") == 0)
+        {
+            opts.map_output = 1;
+            argi += 1;
+        } else if (strcmp(argv[argi], "--stats") == 0)
+        {
+            stats = 1;
+            argi += 1;
+        } else if (strcmp(argv[argi], "-L") == 0)
+        {
+            opts.framed = 0;
+            argi += 1;
+        } else
+        {
+            usage();
+            exit(1);
+        }
+    }
+    
+    if (argc - argi != 2)
     {
         usage();
         exit(1);
     }
     
-    char *infile  = argv[1];
-    char *outfile = argv[2];
+    // Framed output always streams its input, so the budget would be ignored:
+    if (budget && opts.framed)
+    {
+        fprintf(stderr, "huffc: -m only applies with -L.\n");
+        exit(1);
+    }
+    
+    char *infile  = argv[argi];
+    char *outfile = argv[argi + 1];
     
     int result;
     
-    Encoder *encoder = encoder_new(infile, outfile);
+    stats_enable(stats);
+    const char *why;
+    Encoder *encoder = encoder_new_opts(infile, outfile, &opts, &why);
+    if (encoder == NULL && why != NULL)
+    {
+        fprintf(stderr, "huffc: %s.\n", why);
+        exit(1);
+    }
     if (encoder == NULL)
     {
-        printf("Encoder failed to initialize.");
+        fprintf(stderr, "Encoder failed to initialize.\n");
         exit(1);
     }
     
     result = encoder_encode(encoder);
     if (result == -1)
     {
-        printf("Problem occurred during encoding.");
+        fprintf(stderr, "Problem occurred during encoding.\n");
         exit(1);
     }
     
     result = encoder_free(encoder);
     if (result == -1)
     {
-        printf("Encoder failed to free properly.");
+        fprintf(stderr, "Encoder failed to free properly.\n");
     }
+    if (stats)
+        stats_print(stderr);
     
     return 0;
 }
@@ -5,36 +5,97 @@
 #include "hzip.h"
 
 void usage() {
-    printf("huffd <file.he> <file.txt>\n");
+    printf("huffd [-T <threads>] [--range START:LEN] [--stats] <file.he> <file.txt>\n");
+    printf("  Either file may be - for the standard input or output.\n");
+    printf("  -T       number of threads decoding blocks in parallel\n");
+    printf("  --range  decode only the LEN bytes from byte START on\n");
+    printf("  --stats  print where the time went to stderr, as does\n");
+    printf("           HUFF_STATS=1 in the environment\n");
+}
+
+
+/**
+ * Parses a range given as START:LEN.  Returns -1 if it is not one.
+ */
+static int parse_range (const char *arg, uint64_t *start, uint64_t *len)
+{
+    char *end;
+    *start = strtoull(arg, &end, 10);
+    if (end == arg || *end != ':')
+        return -1;
+    arg = end + 1;
+    *len = strtoull(arg, &end, 10);
+    return end == arg || *end != 0 ? -1 : 0;
 }
 
 
 int main (int argc, char *argv[])
 {
-    if (argc != 3)
+    DecoderOptions opts;
+    decoder_options_init(&opts);
+    int ranged = 0;
+    uint64_t start = 0, len = 0;
+    const char *env = getenv("HUFF_STATS");
+    int stats = env != NULL && *env != 0 && strcmp(env, "0") != 0;
+    
+    // Parse the options in front of the file names:
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != 0)
+    {
+        if (strcmp(argv[argi], "-T") == 0 && argi + 1 < argc)
+        {
+            opts.threads = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--range") == 0 && argi + 1 < argc &&
+                   parse_range(argv[argi + 1], &start, &len) == 0)
+        {
+            ranged = 1;
+            argi += 2;
+        } else if (strcmp(argv[argi], "--stats") == 0)
+        {
+            stats = 1;
+            argi += 1;
+        } else
+        {
+            usage();
+            exit(1);
+        }
+    }
+    
+    if (argc - argi != 2)
     {
         usage();
         exit(1);
     }
     
     // Get a reference to the input and output files:
-    char *infile  = argv[1];
-    char *outfile = argv[2];
+    char *infile  = argv[argi];
+    char *outfile = argv[argi + 1];
     
     // Create a new decoder:
-    Decoder *decoder = decoder_new(infile, outfile);
+    stats_enable(stats);
+    Decoder *decoder = decoder_new_opts(infile, outfile, &opts);
     if (decoder == NULL)
     {
-        printf("decoder was null\n");
+        fprintf(stderr, "decoder was null\n");
         usage();
         exit(1);
     }
     
     // Decode the file:
-    decoder_decode(decoder);
+    int result = ranged ? decoder_decode_range(decoder, start, len)
+                        : decoder_decode(decoder);
     
     // Free up resources:
     decoder_free(decoder);
+    if (stats)
+        stats_print(stderr);
+    
+    if (result == -1)
+    {
+        fprintf(stderr, "Problem occurred during decoding.\n");
+        exit(1);
+    }
     
     return 0;
 }
@@ -6,25 +6,42 @@
  (1) Compute Frequencies
  
  This phase works by reading each character from the input and updating
- its frequency in a table of Frequency objects (see tree.h).
+ its frequency in a table of Frequency objects (see tree.h).  The counting
+ itself is done by the histogram module (see histogram.c), which can also
+ split a large input across the threads of a pool.
  
  (2) TreeNode Creation
  
  After the frequency of each character in the input have been found we
- create a new TreeNode object for each character and add it to a
- priority queue. These initial TreeNode objects do not have child
- nodes. We figure out the children in part (3).
+ make a leaf TreeNode for each character.  All the nodes of a tree, leaves
+ and inner nodes, sit in one block of memory, so the whole tree is freed at
+ once.  The leaves do not have child nodes. We figure out the children in
+ part (3).  The decoders skip the nodes altogether and build the FlatTree of
+ tree.h right away (see huffman_merge_flat).
  
  (3) Huffman Tree Construction
  
- The third phase dequeues TreeNode objects from the priority queue until
- the priority queue contains only a single TreeNode object - this
- represents the root of the tree. With each iteration we dequeue the
- next two TreeNode objects L and R, create a new internal TreeNode X
- with its frequency being the addition of the two TreeNode objects we
- dequeued. We then assign the left child of X to be L and right child of
- X to be R. We then enqueue X into the priority queue.
+ The third phase repeatedly takes the next two TreeNode objects L and R of
+ lowest frequency until a single TreeNode object is left - this
+ represents the root of the tree. With each iteration we create a new
+ internal TreeNode X with its frequency being the addition of L and R. We
+ then assign the left child of X to be L and right child of X to be R, and
+ put X back with the others.
  
+ Taking the two lowest nodes is what the priority queue of pqueue.c is
+ for, but since the nodes we make come out in order of frequency, sorting
+ the leaves once and keeping two plain queues does the same in linear time
+ (see twoqueue.c).  The priority queue is still used whenever two waiting
+ nodes have the same frequency and character, since it may take those in
+ any order and the decoder has to rebuild the very same tree.
+ 
+ The shape of the tree only matters through the code lengths it gives each
+ character, and huffman_build_lengths returns just those.  It can also limit
+ them: a Huffman tree of skewed input may be very deep, and codes longer
+ than the decode table is wide need a slow path.  With a limit, the lengths
+ are computed with the package-merge algorithm instead (see
+ limited_lengths), which finds the best code whose codes are all at most
+ that long.
  
  *******************************************************************/
 
@@ -35,21 +52,79 @@
 #include "huffman.h"
 #include "tree.h"
 #include "pqueue.h"
+#include "twoqueue.h"
+#include "histogram.h"
+#include "stats.h"
+#include "probe.h"
 
 #define NUMBER_OF_CHARS 256
 
 
 /**
  * The Context object is used to pass information between each of the Huffman
- * phases.  It contains the table of frequencies of the characters and a
- * pointer to the priority queue.
+ * phases.  It contains the table of frequencies of the characters and the
+ * leaves made from them.
  */
 typedef struct Context Context;
 struct Context {
     Frequency table[NUMBER_OF_CHARS];
-    PriorityQueue *pq;
+    Frequency leaves[NUMBER_OF_CHARS];
+    int       nleaves;
+};
+
+/**
+ * A NodePool hands out the nodes of a tree from one block of memory.
+ */
+typedef struct NodePool NodePool;
+struct NodePool {
+    TreeNode *nodes;
+    int       count;   // Number of nodes handed out
 };
 
+static TreeNode *build_from_freq(Context *ctx);
+static TreeNode *merge_with(PriorityQueue *pq, TreeNode *(*new_node)(void *),
+                            void *arg);
+
+
+/**
+ * Initializes the frequency table in the Context object: each entry gets a
+ * frequency of 0 and its position in the table as its character.
+ */
+static void init_freq(Context *ctx)
+{
+    Frequency *arr = ctx->table;
+    
+    //properly initialize the table
+    for(int i = 0; i < NUMBER_OF_CHARS; i ++)
+    {
+        arr[i].c = i;
+        arr[i].v = 0;
+    }
+}
+
+
+/**
+ * Adds the counts of a histogram to the frequencies in the Context object.
+ */
+static void add_counts(const uint64_t counts[HIST_SYMBOLS], Context *ctx)
+{
+    Frequency *arr = ctx->table;
+    
+    for(int i = 0; i < NUMBER_OF_CHARS; i ++)
+        arr[i].v += (int)counts[i];
+}
+
+
+/**
+ * Adds the characters in buf to the frequencies in the Context object.
+ */
+static void count_freq(const unsigned char *buf, size_t n, Context *ctx)
+{
+    uint64_t counts[HIST_SYMBOLS] = { 0 };
+    histogram_count(buf, n, counts);
+    add_counts(counts, ctx);
+}
+
 
 /**
  * (1) Compute Frequencies
@@ -69,28 +144,22 @@ static void compute_freq(FILE *fp, Context *ctx)
     // character from a file is `fgetc`.  You should look at its man page for
     // more details.  Update the input character's entry in the frequency
     // table by incrementing its frequency.
-    Frequency *arr = ctx->table;
-
-    //properly initialize the table
-    for(int i = 0; i < NUMBER_OF_CHARS; i ++)
-    {
-        arr[i].c = i;
-        arr[i].v = 0;
-    }
+    init_freq(ctx);
     
     //create a buffer on stack!
     unsigned char buf[1024*1024];
     
     //number of bytes read
     size_t read = 0;
+    uint64_t total = 0, started = probe_now();
     
     //read one chunck at a time
     while((read = fread(buf, 1, sizeof(buf), fp)))
     {
-        //increment the corresponding frequency
-        for(int i = 0; i < read; i ++)
-            arr[buf[i]].v++;
+        count_freq(buf, read, ctx);
+        total += read;
     }
+    PROBE2(freq, total, probe_now() - started);
     return;
 }
 
@@ -100,7 +169,7 @@ static void compute_freq(FILE *fp, Context *ctx)
  *
  * This phase iterates over the frequency table we constructed in Phase (1)
  * and creates a new TreeNode object for each character found in the frequency
- * table.  Each new TreeNode object is enqueued into the priority queue.
+ * table.  Each new TreeNode object is added to the leaves of the Context.
  */
 static void create_tree_nodes(Context *ctx)
 {
@@ -113,20 +182,18 @@ static void create_tree_nodes(Context *ctx)
     // object must be initialized properly.  In particular, it should be a LEAF
     // node, it should receive the Frequency object in the frequency table, and
     // its left and right children should be NULL.  We worry about constructing
-    // the tree in Phase (3).  Lastly, enqueue the new TreeNode in the priority
-    // queue.
+    // the tree in Phase (3).  Lastly, add the new TreeNode to the leaves.
+    //
+    // The leaves are kept as plain Frequency objects: phase (3) puts them
+    // in the block of memory that holds the whole tree.
     Frequency *arr = ctx->table;
-    PriorityQueue *pq = ctx->pq;
+    ctx->nleaves = 0;
         
     for(int i = 0; i < NUMBER_OF_CHARS; i ++)
     {
         //positive frequency means we encountered this char in the input file
         if(arr[i].v > 0)
-        {
-            TreeNode *node = tree_new();
-            node->freq = arr[i];
-            pqueue_enqueue(pq, node);
-        }
+            ctx->leaves[ctx->nleaves++] = arr[i];
     }
     return;
 }
@@ -136,7 +203,7 @@ static void create_tree_nodes(Context *ctx)
  * (3) Huffman Tree Construction
  *
  * This is the third and final phase that constructs the Huffman tree from the
- * priority queue populated in Phase (2).  This function returns the final
+ * leaves made in Phase (2).  This function returns the final
  * tree that can be used to encode/decode characters and binary encoding
  * respectively.
  */
@@ -153,15 +220,180 @@ static TreeNode *build_tree(Context *ctx)
     // break out of this loop, your priority queue will have a single TreeNode
     // object which represents the root of the tree.  Dequeue the remaining
     // TreeNode and return it.
-    return merge_nodes(ctx->pq);
+    return huffman_merge_freqs(ctx->leaves, ctx->nleaves);
 }
 
+/**
+ * Allocates a new node for merge_with.
+ */
+static TreeNode *heap_node(void *arg)
+{
+    (void)arg;
+    return tree_new();
+}
+
+
 TreeNode *merge_nodes(PriorityQueue *pq)
+{
+    return merge_with(pq, heap_node, NULL);
+}
+
+
+/**
+ * Hands out the next node of the NodePool for merge_with.
+ */
+static TreeNode *pool_node(void *arg)
+{
+    NodePool *pool = (NodePool *)arg;
+    return &pool->nodes[pool->count++];
+}
+
+
+/**
+ * Returns a TwoQueue that has merged the `n` leaves in `leaves`, or NULL if
+ * there are too few of them or ties that only the priority queue can
+ * resolve the way it always has.
+ */
+static TwoQueue *merge_twoqueue(const Frequency *leaves, int n)
+{
+    TwoQueue *tq = n >= 2 ? twoqueue_new(n) : NULL;
+    if (tq == NULL)
+        return NULL;
+    for (int i = 0; i < n; i++)
+        twoqueue_add(tq, leaves[i].v, leaves[i].c);
+    if (twoqueue_merge(tq, 1) == -1)
+    {
+        twoqueue_free(tq);
+        return NULL;
+    }
+    return tq;
+}
+
+
+/**
+ * Returns the Huffman tree over the `n` leaves in `leaves`, the same tree
+ * as enqueueing them in this order and calling merge_nodes, or NULL if
+ * there is an error.
+ *
+ * All the nodes come from one block of memory with the root first, and the
+ * root records how many there are, so tree_free frees the tree at once and
+ * tree_size need not walk it.
+ */
+TreeNode *huffman_merge_freqs(const Frequency *leaves, int n)
+{
+    if (n < 1)
+        return NULL;
+    
+    // The root, the leaves, the internal nodes and the node merge_with adds
+    // to a single leaf:
+    NodePool pool = { calloc(2 * n + 2, sizeof(TreeNode)), 1 };
+    if (pool.nodes == NULL)
+        return NULL;
+    for (int i = 0; i < n; i++)
+        pool_node(&pool)->freq = leaves[i];
+    
+    TreeNode *root;
+    TwoQueue *tq = merge_twoqueue(leaves, n);
+    if (tq != NULL)
+    {
+        // The node numbered `ref` by the TwoQueue (see twoqueue.h) is at
+        // 1 + ref, since the internal nodes follow the leaves in order:
+        for (int k = 0; k < n - 1; k++)
+        {
+            TreeNode *parent = pool_node(&pool);
+            parent->left  = &pool.nodes[1 + tq->kids[k][0]];
+            parent->right = &pool.nodes[1 + tq->kids[k][1]];
+            parent->freq.v = parent->left->freq.v + parent->right->freq.v;
+        }
+        root = &pool.nodes[pool.count - 1];
+        twoqueue_free(tq);
+    } else
+    {
+        PriorityQueue *pq = pqueue_new();
+        if (pq == NULL)
+        {
+            free(pool.nodes);
+            return NULL;
+        }
+        for (int i = 0; i < n; i++)
+            pqueue_enqueue(pq, &pool.nodes[1 + i]);
+        root = merge_with(pq, pool_node, &pool);
+        pqueue_free(pq);
+    }
+    
+    // Nothing points at the root, so it can move to the front:
+    pool.nodes[0] = *root;
+    pool.nodes[0].nodes = pool.count - 1;
+    return pool.nodes;
+}
+
+
+/**
+ * Builds the Huffman tree over the `n` leaves in `leaves` in the FlatTree,
+ * the same tree huffman_merge_freqs returns.  Returns -1 if there is an
+ * error.
+ */
+int huffman_merge_flat(const Frequency *leaves, int n, FlatTree *flat)
+{
+    TwoQueue *tq = merge_twoqueue(leaves, n);
+    if (tq == NULL)
+    {
+        TreeNode *root = huffman_merge_freqs(leaves, n);
+        int res = root == NULL ? -1 : tree_flatten(root, flat);
+        tree_free(root);
+        return res;
+    }
+    
+    // Internal node k of the TwoQueue is node k of the FlatTree:
+    flat_init(flat);
+    for (int k = 0; k < n - 1; k++)
+    {
+        NodeRef r = flat_add(flat);
+        for (int i = 0; i < 2; i++)
+        {
+            int ref = tq->kids[k][i];
+            flat->kid[r][1 - i] = ref < n
+                                ? (NodeRef)(FLAT_LEAF |
+                                            (unsigned char)leaves[ref].c)
+                                : (NodeRef)(ref - n);
+        }
+    }
+    flat->root = (NodeRef)(n - 2);
+    twoqueue_free(tq);
+    return 0;
+}
+
+
+/**
+ * Returns the Huffman tree over the `n` leaves in `leaves`, which it takes
+ * over, as huffman_merge_freqs does for their frequencies.
+ */
+TreeNode *huffman_merge_leaves(TreeNode **leaves, int n)
+{
+    Frequency *freqs = malloc((n > 0 ? n : 1) * sizeof(Frequency));
+    if (freqs == NULL)
+        return NULL;
+    for (int i = 0; i < n; i++)
+    {
+        freqs[i] = leaves[i]->freq;
+        tree_free(leaves[i]);
+    }
+    TreeNode *root = huffman_merge_freqs(freqs, n);
+    free(freqs);
+    return root;
+}
+
+
+/**
+ * This is merge_nodes, except that new nodes come from `new_node(arg)`.
+ */
+static TreeNode *merge_with(PriorityQueue *pq, TreeNode *(*new_node)(void *),
+                            void *arg)
 {
     //Single character with non-zero frequency
     if(pqueue_size(pq) == 1)
     {
-        TreeNode *node = tree_new();
+        TreeNode *node = new_node(arg);
         //-1 is guarenteed to be smaller than any other character's frequency
         node->freq.v = -1;
         
@@ -175,7 +407,7 @@ TreeNode *merge_nodes(PriorityQueue *pq)
         TreeNode *r = pqueue_dequeue(pq);
         
         //merge them into one node
-        TreeNode *parent = tree_new();
+        TreeNode *parent = new_node(arg);
         parent->freq.v = l->freq.v + r->freq.v;
         parent->left = l;
         parent->right = r;
@@ -199,34 +431,377 @@ TreeNode* huffman_build_tree(const char *filename)
     // Define a Context object:
     Context *ctx = malloc(sizeof(Context));
     
-    // Create a priority queue:
-    ctx->pq = pqueue_new();
-    
-    // If the priority queue is NULL there was a problem!
-    if (ctx->pq == NULL)
-        return NULL;
-    
     // (1) Compute the frequencies:
     FILE *fp = fopen(filename, "r");
     if (fp == NULL)
+    {
+        free(ctx);
         return NULL;
+    }
     
+    StatsTimer timer;
+    stats_start(&timer);
     compute_freq(fp, ctx);
+    stats_stop(&timer, STATS_HISTOGRAM);
     fclose(fp);
     
+    // (2) and (3):
+    return build_from_freq(ctx);
+}
+
+
+/**
+ * Returns a pointer to a TreeNode object or NULL if there is an error.
+ *
+ * This is the same as huffman_build_tree, except that the frequencies are
+ * computed from the `n` characters in `buf` instead of from a file.  This
+ * lets the encoder read its input only once and use the same buffer to
+ * compute the frequencies and to encode the characters.
+ */
+TreeNode *huffman_build_tree_from_buffer(const unsigned char *buf, size_t n)
+{
+    return huffman_build_tree_pool(buf, n, NULL);
+}
+
+
+/**
+ * Returns a pointer to a TreeNode object or NULL if there is an error.
+ *
+ * This is the same as huffman_build_tree_from_buffer, except that a large
+ * buffer is split across the threads of `pool` to compute the frequencies.
+ * The pool may be NULL, in which case everything runs on this thread.
+ */
+TreeNode *huffman_build_tree_pool(const unsigned char *buf, size_t n,
+                                  ThreadPool *pool)
+{
+    // Define a Context object:
+    Context *ctx = malloc(sizeof(Context));
+    if (ctx == NULL)
+        return NULL;
+    
+    // (1) Compute the frequencies:
+    uint64_t counts[HIST_SYMBOLS] = { 0 };
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    int res = histogram_count_pool(buf, n, counts, pool);
+    stats_stop(&timer, STATS_HISTOGRAM);
+    PROBE2(freq, n, probe_now() - started);
+    if (res == -1)
+    {
+        free(ctx);
+        return NULL;
+    }
+    init_freq(ctx);
+    add_counts(counts, ctx);
+    
+    // (2) and (3):
+    return build_from_freq(ctx);
+}
+
+
+/**
+ * Runs phases (2) and (3) of the algorithm on a Context object whose
+ * frequency table has been computed, and frees the Context object.
+ */
+static TreeNode *build_from_freq(Context *ctx)
+{
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    
     // (2) Create the tree nodes:
     create_tree_nodes(ctx);
+    int nleaves = ctx->nleaves;
     
     // (3) Build Huffman tree:
     TreeNode *root = build_tree(ctx);
     
-    // Free the priority queue - it is no longer needed.
-    free(ctx->pq);
     free(ctx);
+    stats_stop(&timer, STATS_TREE);
+    PROBE2(tree, nleaves, probe_now() - started);
     return root;
 }
 
 
+/**
+ * An Item in one of the lists of the package-merge algorithm: either a
+ * character (`sym` >= 0) or a package of two items of the list below
+ * (`sym` < 0).
+ */
+typedef struct Item Item;
+struct Item {
+    uint64_t weight;
+    int      sym;
+};
+
+
+/**
+ * The HuffmanScratch holds all the memory huffman_lengths works in.
+ * Everything in it is overwritten by the next call.  The TwoQueue starts
+ * out large enough for bytes and grows the first time a larger alphabet
+ * comes along.
+ */
+struct HuffmanScratch {
+    TwoQueue      *tq;     // Merges the symbols into a tree
+    int           *sym;    // The symbol of each leaf of tq
+    unsigned char *depth;  // The depth of each leaf of tq
+    Item           lists[HUFFMAN_LIMIT_MAX][2 * HUFFMAN_LIMIT_SYMBOLS];
+};
+
+
+/**
+ * Makes room in the HuffmanScratch for alphabets of `nsyms` symbols.
+ * Returns -1 if there is an error.
+ */
+static int scratch_reserve(HuffmanScratch *scratch, int nsyms)
+{
+    if (scratch->tq != NULL && scratch->tq->cap >= nsyms)
+        return 0;
+    
+    twoqueue_free(scratch->tq);
+    free(scratch->sym);
+    free(scratch->depth);
+    scratch->tq    = twoqueue_new(nsyms);
+    scratch->sym   = malloc(nsyms * sizeof(int));
+    scratch->depth = malloc(nsyms);
+    if (scratch->tq == NULL || scratch->sym == NULL || scratch->depth == NULL)
+    {
+        twoqueue_free(scratch->tq);
+        scratch->tq = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Returns a new HuffmanScratch or NULL if there is an error.
+ */
+HuffmanScratch *huffman_scratch_new(void)
+{
+    HuffmanScratch *scratch = calloc(1, sizeof(HuffmanScratch));
+    if (scratch == NULL)
+        return NULL;
+    if (scratch_reserve(scratch, NUMBER_OF_CHARS) == -1)
+    {
+        huffman_scratch_free(scratch);
+        return NULL;
+    }
+    return scratch;
+}
+
+
+/**
+ * Frees a HuffmanScratch.
+ */
+void huffman_scratch_free(HuffmanScratch *scratch)
+{
+    if (scratch == NULL)
+        return;
+    twoqueue_free(scratch->tq);
+    free(scratch->sym);
+    free(scratch->depth);
+    free(scratch);
+}
+
+
+/**
+ * Computes the code lengths of the Huffman tree for the `nsyms` symbols
+ * counted in `counts` and stores them in `lens`.  This runs the same phases
+ * (2) and (3) as huffman_build_tree, but only the shape of the tree is
+ * built, in the TwoQueue of the HuffmanScratch.  Nodes that compare equal
+ * are merged in a fixed order rather than the one the priority queue would
+ * take; the lengths are stored with the block, so any Huffman tree will do.
+ * Returns -1 if no symbol occurs.
+ */
+static int tree_lengths_from_counts(const uint64_t *counts, int nsyms,
+                                    unsigned char *lens,
+                                    HuffmanScratch *scratch)
+{
+    if (scratch_reserve(scratch, nsyms) == -1)
+        return -1;
+    
+    TwoQueue *tq = scratch->tq;
+    int *sym = scratch->sym;
+    twoqueue_init(tq);
+    memset(lens, 0, nsyms);
+    for (int c = 0; c < nsyms; c++)
+    {
+        if (counts[c] == 0)
+            continue;
+        sym[tq->n] = c;
+        
+        // Characters break ties as the signed chars they used to be:
+        twoqueue_add(tq, (int64_t)counts[c],
+                     nsyms <= NUMBER_OF_CHARS ? (signed char)c : c);
+    }
+    
+    // A single symbol still needs a code of one bit:
+    if (tq->n < 2)
+    {
+        if (tq->n == 1)
+            lens[sym[0]] = 1;
+        return tq->n == 1 ? 0 : -1;
+    }
+    
+    twoqueue_merge(tq, 0);
+    twoqueue_depths(tq, scratch->depth);
+    for (int i = 0; i < tq->n; i++)
+        lens[sym[i]] = scratch->depth[i];
+    return 0;
+}
+
+
+/**
+ * Computes the code lengths of at most `max_len` bits that minimize the
+ * encoded size for the characters counted in `counts` and stores them in
+ * `lens`.  `max_len` must be large enough to give every character a code.
+ * Returns -1 if there is an error.
+ *
+ * Package-merge works on `max_len` lists of items.  The bottom list holds
+ * the characters sorted by count.  Each list above holds the same
+ * characters merged, in order of weight, with packages made of neighbouring
+ * pairs of the list below.  Taking the 2n - 2 lightest items of the top list
+ * (for n characters) picks the best code: every time a character is picked,
+ * on its own or inside a package, its code gets one bit longer.
+ *
+ * Since packages are made of neighbouring pairs in order, the items picked
+ * inside the first p packages of a list are exactly the first 2p items of
+ * the list below, so we only ever need to count.
+ */
+static int limited_lengths(const uint64_t *counts, int nsyms, int max_len,
+                           unsigned char *lens,
+                           Item lists[][2 * HUFFMAN_LIMIT_SYMBOLS])
+{
+    // The characters that occur, sorted by count and then by character:
+    Item leaves[HUFFMAN_LIMIT_SYMBOLS];
+    int order[HUFFMAN_LIMIT_SYMBOLS], tmp[HUFFMAN_LIMIT_SYMBOLS];
+    int n = 0;
+    for (int c = 0; c < nsyms; c++)
+    {
+        lens[c] = 0;
+        if (counts[c] != 0)
+            order[n++] = c;
+    }
+    twoqueue_sort(counts, order, tmp, n);
+    for (int i = 0; i < n; i++)
+    {
+        leaves[i].weight = counts[order[i]];
+        leaves[i].sym    = order[i];
+    }
+    
+    // A single character still needs a code of one bit:
+    if (n < 2)
+    {
+        if (n == 1)
+            lens[leaves[0].sym] = 1;
+        return 0;
+    }
+    
+    // Build the lists from the bottom up.  No list holds more than 2n items.
+    int size[HUFFMAN_LIMIT_MAX];
+    memcpy(lists[0], leaves, n * sizeof(Item));
+    size[0] = n;
+    for (int l = 1; l < max_len; l++)
+    {
+        int npkg = size[l - 1] / 2, i = 0, p = 0, k = 0;
+        while (i < n || p < npkg)
+        {
+            uint64_t pw = p < npkg ? lists[l - 1][2 * p].weight +
+                                     lists[l - 1][2 * p + 1].weight : 0;
+            if (p >= npkg || (i < n && leaves[i].weight <= pw))
+            {
+                lists[l][k++] = leaves[i++];
+            } else
+            {
+                lists[l][k].weight = pw;
+                lists[l][k].sym    = -1;
+                k++, p++;
+            }
+        }
+        size[l] = k;
+    }
+    
+    // Pick the 2n - 2 lightest items of the top list and follow the
+    // packages down:
+    int take = 2 * n - 2;
+    for (int l = max_len - 1; l >= 0 && take > 0; l--)
+    {
+        int npkg = 0;
+        for (int k = 0; k < take; k++)
+        {
+            if (lists[l][k].sym >= 0)
+                lens[lists[l][k].sym]++;
+            else
+                npkg++;
+        }
+        take = 2 * npkg;
+    }
+    return 0;
+}
+
+
+/**
+ * Computes the code lengths for the `nsyms` symbols counted in `counts` and
+ * stores them in `lens`, indexed by symbol; symbols that do not occur get a
+ * length of 0.  With a `max_len` of 0 the lengths are those of the Huffman
+ * tree, otherwise no code is longer than `max_len` bits, which must be
+ * between HUFFMAN_LIMIT_MIN and HUFFMAN_LIMIT_MAX and only works for
+ * alphabets of up to HUFFMAN_LIMIT_SYMBOLS symbols.  The work is done in `scratch`, or in
+ * memory allocated for the call if it is NULL.  Returns -1 if there is an
+ * error.
+ */
+int huffman_lengths(const uint64_t *counts, int nsyms, int max_len,
+                    unsigned char *lens, HuffmanScratch *scratch)
+{
+    if (nsyms < 1 || nsyms > HUFFMAN_MAX_SYMBOLS)
+        return -1;
+    if (max_len != 0 &&
+        (max_len < HUFFMAN_LIMIT_MIN || max_len > HUFFMAN_LIMIT_MAX ||
+         nsyms > HUFFMAN_LIMIT_SYMBOLS))
+    {
+        return -1;
+    }
+    
+    HuffmanScratch *own = NULL;
+    if (scratch == NULL && (scratch = own = huffman_scratch_new()) == NULL)
+        return -1;
+    
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
+    int res;
+    if (max_len == 0)
+        res = tree_lengths_from_counts(counts, nsyms, lens, scratch);
+    else
+        res = limited_lengths(counts, nsyms, max_len, lens, scratch->lists);
+    stats_stop(&timer, STATS_TREE);
+    PROBE2(tree, nsyms, probe_now() - started);
+    
+    huffman_scratch_free(own);
+    return res;
+}
+
+
+/**
+ * Computes the code lengths for the `n` characters at `buf` and stores them
+ * in `lens`, indexed by character, as huffman_lengths does for their
+ * counts.  Returns -1 if there is an error.
+ */
+int huffman_build_lengths(const unsigned char *buf, size_t n, int max_len,
+                          unsigned char lens[NUMBER_OF_CHARS],
+                          HuffmanScratch *scratch)
+{
+    uint64_t counts[HIST_SYMBOLS] = { 0 };
+    StatsTimer timer;
+    stats_start(&timer);
+    histogram_count(buf, n, counts);
+    stats_stop(&timer, STATS_HISTOGRAM);
+    return huffman_lengths(counts, NUMBER_OF_CHARS, max_len, lens, scratch);
+}
+
+
 /**
  * Returns the character for the given encoding string or -1 on error.
  *
@@ -258,3 +833,21 @@ int huffman_find(TreeNode *tree, char *encoding)
     assert (tree_is_leaf(t));
     return t->freq.c;
 }
+
+
+/**
+ * Returns the character for the given encoding string in the flat tree or
+ * -1 on error.  Works like huffman_find, except that reaching anything
+ * but a leaf at the end of the string is an error rather than an assertion.
+ */
+int huffman_find_flat (const FlatTree *flat, const char *encoding)
+{
+    NodeRef r = flat->root;
+    for (const char *ch = encoding; *ch && r != FLAT_NONE; ++ch)
+    {
+        if (FLAT_IS_LEAF(r))
+            return -1;
+        r = flat->kid[r][*ch == '1'];
+    }
+    return FLAT_IS_LEAF(r) ? (int)(char)FLAT_CHAR(r) : -1;
+}
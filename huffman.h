@@ -1,7 +1,10 @@
 #ifndef __HUFFMAN_H
 #define __HUFFMAN_H
+#include <stddef.h>
+#include <stdint.h>
 #include "tree.h"
 #include "pqueue.h"
+#include "pool.h"
 
 /**
  * Returns a pointer to a TreeNode object or NULL if there is an error.
@@ -12,6 +15,84 @@
  */
 TreeNode *huffman_build_tree (const char *filename);
 
+/**
+ * Returns a pointer to a TreeNode object or NULL if there is an error.
+ *
+ * Same as huffman_build_tree, but the frequencies are computed from the `n`
+ * characters in `buf` rather than from a file.
+ */
+TreeNode *huffman_build_tree_from_buffer (const unsigned char *buf, size_t n);
+
+/**
+ * Returns a pointer to a TreeNode object or NULL if there is an error.
+ *
+ * Same as huffman_build_tree_from_buffer, but a large buffer is split across
+ * the threads of `pool` to compute the frequencies.  `pool` may be NULL.
+ */
+TreeNode *huffman_build_tree_pool (const unsigned char *buf, size_t n,
+                                   ThreadPool *pool);
+
+/**
+ * The range of limits huffman_lengths accepts for the code lengths.
+ */
+#define HUFFMAN_LIMIT_MIN 11
+#define HUFFMAN_LIMIT_MAX 15
+
+/**
+ * Code lengths can be limited for alphabets of up to this many symbols,
+ * enough for the literals and lengths of LZ77 (see lz77.h).
+ */
+#define HUFFMAN_LIMIT_SYMBOLS 512
+
+/**
+ * A HuffmanScratch holds the memory huffman_lengths needs: the queues
+ * that merge the tree and the lists of package-merge.  Keeping one around
+ * saves allocating all of it on every call.
+ */
+typedef struct HuffmanScratch HuffmanScratch;
+
+/**
+ * Returns a new HuffmanScratch or NULL if there is an error.
+ */
+HuffmanScratch *huffman_scratch_new (void);
+
+/**
+ * Frees a HuffmanScratch.
+ */
+void huffman_scratch_free (HuffmanScratch *scratch);
+
+/**
+ * Alphabets may have up to this many symbols, so a symbol can be a 16 bit
+ * word rather than a byte.
+ */
+#define HUFFMAN_MAX_SYMBOLS (1 << 16)
+
+/**
+ * Computes the code lengths for the `nsyms` symbols counted in `counts` and
+ * stores them in `lens`, indexed by symbol; symbols that do not occur get a
+ * length of 0.  Returns -1 if there is an error.
+ *
+ * With a `max_len` of 0 these are the lengths of the Huffman tree, which
+ * works for any alphabet of up to HUFFMAN_MAX_SYMBOLS symbols.  Otherwise
+ * they are the best lengths of at most `max_len` bits (between
+ * HUFFMAN_LIMIT_MIN and HUFFMAN_LIMIT_MAX), found with package-merge, which
+ * only takes alphabets of up to HUFFMAN_LIMIT_SYMBOLS symbols.
+ *
+ * The work is done in `scratch`, which may be NULL to allocate the memory
+ * just for this call.  A HuffmanScratch must not be used by two threads at
+ * the same time.
+ */
+int huffman_lengths (const uint64_t *counts, int nsyms, int max_len,
+                     unsigned char *lens, HuffmanScratch *scratch);
+
+/**
+ * Computes the code lengths for the `n` characters at `buf` and stores them
+ * in `lens`, indexed by character, as huffman_lengths does for their
+ * counts.  Returns -1 if there is an error.
+ */
+int huffman_build_lengths (const unsigned char *buf, size_t n, int max_len,
+                           unsigned char lens[256], HuffmanScratch *scratch);
+
 /**
  * Returns the character for the given encoding string or -1 on error.
  *
@@ -20,7 +101,33 @@ TreeNode *huffman_build_tree (const char *filename);
  */
 int huffman_find (TreeNode *root, char *encoding);
 
+/**
+ * Returns the character for the given encoding string in the flat tree (see
+ * tree.h) or -1 on error.
+ */
+int huffman_find_flat (const FlatTree *flat, const char *encoding);
+
 //This is publically available because the decoder need this as well
 TreeNode *merge_nodes(PriorityQueue *pq);
 
+/**
+ * Returns the Huffman tree over the `n` leaves in `leaves` or NULL if there
+ * is an error.  The tree is the same as the one merge_nodes gives after the
+ * leaves are enqueued in this order, but it is built in linear time once the
+ * leaves are sorted (see twoqueue.h), in one block of memory.
+ */
+TreeNode *huffman_merge_freqs(const Frequency *leaves, int n);
+
+/**
+ * Builds the same tree as huffman_merge_freqs in the FlatTree, without
+ * making its nodes.  Returns -1 if there is an error.
+ */
+int huffman_merge_flat(const Frequency *leaves, int n, FlatTree *flat);
+
+/**
+ * Same as huffman_merge_freqs for the frequencies of the leaves, which are
+ * freed.
+ */
+TreeNode *huffman_merge_leaves(TreeNode **leaves, int n);
+
 #endif
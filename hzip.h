@@ -6,6 +6,17 @@
 #include "pqueue.h"
 #include "tree.h"
 #include "table.h"
+#include "histogram.h"
+#include "canon.h"
+#include "ans.h"
+#include "lz77.h"
+#include "cpu.h"
+#include "aio.h"
+#include "stats.h"
+#include "probe.h"
+#include "block.h"
+#include "frame.h"
+#include "huff.h"
 #include "decoder.h"
 #include "encoder.h"
 
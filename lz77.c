@@ -0,0 +1,284 @@
+/********************************************************************
+
+ The lz77 module finds the repeated strings of a block, so they can be
+ coded as references to their earlier copies instead of character by
+ character.  The block becomes a list of tokens, each either a character
+ or a match: a length and how far back the copy starts (the distance).
+
+ Matches are found with hash chains.  The three characters at every place
+ are hashed, `head` holds the last place each hash was seen and `prev` the
+ place before that with the same hash, so following `prev` from `head`
+ visits the earlier places that may start with the same three characters,
+ newest first.  The level limits how many of them are looked at, and from
+ level LAZY_LEVEL on a match is put off by one character when the next
+ place has a longer one, as deflate does.
+
+ Lengths and distances are coded as a symbol and some extra bits, as in
+ deflate: numbers below 4 have a symbol of their own, and each larger power
+ of two is split into two symbols followed by the bits below the top two.
+
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "lz77.h"
+
+#define HASH_BITS 16
+#define HASH_SIZE (1 << HASH_BITS)
+#define NO_POS    (-1)
+
+/**
+ * The first level that puts off matches.
+ */
+#define LAZY_LEVEL 4
+
+
+/**
+ * How hard each level looks: how many earlier places are tried, and the
+ * length that is good enough to stop looking.
+ */
+static const struct {
+    int chain;
+    int nice;
+} levels[LZ77_LEVEL_MAX + 1] = {
+    { 0, 0 },   { 4, 16 },   { 8, 32 },    { 16, 64 },   { 16, 64 },
+    { 32, 128 }, { 64, 258 }, { 128, 258 }, { 512, 258 }, { 4096, 258 },
+};
+
+
+/**
+ * The Lz77 structure holds the hash chains and the tokens of a block.
+ */
+struct Lz77 {
+    int32_t   *head;    // Last place of each hash
+    int32_t   *prev;    // The place before each place with the same hash
+    Lz77Token *tokens;  // The tokens of the block
+    size_t     cap;     // Places prev and tokens have room for
+};
+
+
+/**
+ * Returns a new Lz77 or NULL if there is an error.
+ */
+Lz77 *lz77_new (void)
+{
+    Lz77 *lz = (Lz77 *)(calloc(1, sizeof(Lz77)));
+    if (lz == NULL)
+        return NULL;
+    lz->head = (int32_t *)(malloc(HASH_SIZE * sizeof(int32_t)));
+    if (lz->head == NULL)
+    {
+        free(lz);
+        return NULL;
+    }
+    return lz;
+}
+
+
+/**
+ * Frees an Lz77.
+ */
+void lz77_free (Lz77 *lz)
+{
+    if (lz == NULL)
+        return;
+    free(lz->head);
+    free(lz->prev);
+    free(lz->tokens);
+    free(lz);
+}
+
+
+/**
+ * Returns the hash of the three characters at `p`.
+ */
+static uint32_t hash3 (const unsigned char *p)
+{
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+/**
+ * The Parse structure holds what the parser of one block needs.
+ */
+typedef struct Parse Parse;
+struct Parse {
+    Lz77                *lz;
+    const unsigned char *src;
+    size_t               n;
+    size_t               next;    // The next place to add to the chains
+    uint32_t             window;  // Longest distance
+    int                  chain;   // Places to try
+    int                  nice;    // Length to stop at
+};
+
+
+/**
+ * Adds the places up to `end` to the hash chains.
+ */
+static void insert_upto (Parse *p, size_t end)
+{
+    for (; p->next < end; p->next++)
+    {
+        if (p->next + LZ77_MIN_MATCH > p->n)
+            continue;
+        uint32_t h = hash3(p->src + p->next);
+        p->lz->prev[p->next] = p->lz->head[h];
+        p->lz->head[h] = (int32_t)p->next;
+    }
+}
+
+
+/**
+ * Finds the longest match at place `i` and adds `i` to the hash chains.
+ * Returns its length, less than LZ77_MIN_MATCH if there is none, and
+ * stores its distance in `dist`.
+ */
+static int find_match (Parse *p, size_t i, uint32_t *dist)
+{
+    insert_upto(p, i);
+    int best = 0;
+    size_t max = p->n - i < LZ77_MAX_MATCH ? p->n - i : LZ77_MAX_MATCH;
+    if (max < LZ77_MIN_MATCH)
+    {
+        insert_upto(p, i + 1);
+        return 0;
+    }
+
+    const unsigned char *cur = p->src + i;
+    int32_t cand = p->lz->head[hash3(cur)];
+    for (int tries = p->chain; cand != NO_POS && tries > 0; tries--)
+    {
+        if (i - (size_t)cand > p->window)
+            break;
+        const unsigned char *old = p->src + cand;
+        if (old[best] == cur[best] && old[0] == cur[0])
+        {
+            int len = 1;
+            while ((size_t)len < max && old[len] == cur[len])
+                len++;
+            if (len > best)
+            {
+                best  = len;
+                *dist = (uint32_t)(i - (size_t)cand);
+                if (len >= p->nice || (size_t)len == max)
+                    break;
+            }
+        }
+        cand = p->lz->prev[cand];
+    }
+    insert_upto(p, i + 1);
+    return best;
+}
+
+
+/**
+ * Returns the token of a match.
+ */
+static Lz77Token match_token (int len, uint32_t dist)
+{
+    return (1u << 31) | ((uint32_t)(len - LZ77_MIN_MATCH) << 22) |
+           (dist - 1);
+}
+
+
+/**
+ * Splits the `n` characters at `src` into tokens.  Returns the number of
+ * tokens or -1 if there is an error.
+ */
+long lz77_parse (Lz77 *lz, const unsigned char *src, size_t n, int level,
+                 int window, const Lz77Token **tokens)
+{
+    if (level < 1 || level > LZ77_LEVEL_MAX ||
+        window < LZ77_WINDOW_MIN || window > LZ77_WINDOW_MAX ||
+        n > INT32_MAX)
+    {
+        return -1;
+    }
+    if (n > lz->cap)
+    {
+        int32_t *prev = (int32_t *)(realloc(lz->prev, n * sizeof(int32_t)));
+        if (prev != NULL)
+            lz->prev = prev;
+        Lz77Token *toks = (Lz77Token *)(realloc(lz->tokens,
+                                                n * sizeof(Lz77Token)));
+        if (toks != NULL)
+            lz->tokens = toks;
+        if (prev == NULL || toks == NULL)
+            return -1;
+        lz->cap = n;
+    }
+    for (int h = 0; h < HASH_SIZE; h++)
+        lz->head[h] = NO_POS;
+
+    Parse p = { lz, src, n, 0, (uint32_t)1 << window,
+                levels[level].chain, levels[level].nice };
+    int lazy = level >= LAZY_LEVEL;
+    long count = 0;
+    size_t i = 0;
+    while (i < n)
+    {
+        uint32_t dist = 0;
+        int len = find_match(&p, i, &dist);
+        if (len < LZ77_MIN_MATCH)
+        {
+            lz->tokens[count++] = src[i++];
+            continue;
+        }
+
+        // A longer match one character on is worth a character:
+        while (lazy && len < p.nice && i + 1 < n)
+        {
+            uint32_t dist2 = 0;
+            int len2 = find_match(&p, i + 1, &dist2);
+            if (len2 <= len)
+                break;
+            lz->tokens[count++] = src[i++];
+            len  = len2;
+            dist = dist2;
+        }
+        lz->tokens[count++] = match_token(len, dist);
+        i += len;
+    }
+    insert_upto(&p, n);
+
+    *tokens = lz->tokens;
+    return count;
+}
+
+
+/**
+ * Returns the symbol that codes the number `v` and stores the number of
+ * extra bits that follow it in `extra`.
+ */
+int lz77_symbol (uint32_t v, int *extra)
+{
+    if (v < 4)
+    {
+        *extra = 0;
+        return (int)v;
+    }
+    int k = 0;
+    while ((v >> (k + 1)) != 0)
+        k++;
+    *extra = k - 1;
+    return 4 + 2 * (k - 2) + (int)((v >> (k - 1)) & 1);
+}
+
+
+/**
+ * Returns the smallest number coded by `sym` and stores the number of extra
+ * bits that follow it in `extra`.
+ */
+uint32_t lz77_base (int sym, int *extra)
+{
+    if (sym < 4)
+    {
+        *extra = 0;
+        return (uint32_t)sym;
+    }
+    int k = (sym - 4) / 2 + 2;
+    *extra = k - 1;
+    return (uint32_t)(2 | ((sym - 4) & 1)) << (k - 1);
+}
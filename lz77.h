@@ -0,0 +1,92 @@
+#ifndef __LZ77_H
+#define __LZ77_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The shortest and longest matches the parser emits.
+ */
+#define LZ77_MIN_MATCH 3
+#define LZ77_MAX_MATCH 258
+
+/**
+ * The range of window sizes, as base 2 logarithms, and the default.
+ */
+#define LZ77_WINDOW_MIN     10
+#define LZ77_WINDOW_MAX     22
+#define LZ77_DEFAULT_WINDOW 20
+
+/**
+ * Levels go from 1 (fastest) to LZ77_LEVEL_MAX (smallest output).
+ */
+#define LZ77_LEVEL_MAX     9
+#define LZ77_DEFAULT_LEVEL 6
+
+/**
+ * Sizes of the two alphabets the tokens are coded with: the characters
+ * plus the length symbols, and the distance symbols.
+ */
+#define LZ77_LENGTHS        16
+#define LZ77_LITLEN_SYMBOLS (256 + LZ77_LENGTHS)
+#define LZ77_DIST_SYMBOLS   44
+
+/**
+ * A token is either a character or a match of LZ77_LEN(t) characters that
+ * repeat those LZ77_DIST(t) characters back.
+ */
+typedef uint32_t Lz77Token;
+
+#define LZ77_IS_MATCH(t) (((t) >> 31) != 0)
+#define LZ77_LITERAL(t)  ((unsigned char)(t))
+#define LZ77_LEN(t)      ((int)(((t) >> 22) & 0xFF) + LZ77_MIN_MATCH)
+#define LZ77_DIST(t)     ((uint32_t)((t) & 0x3FFFFF) + 1)
+
+
+/**
+ * An Lz77 finds the matches of a block with hash chains: for every three
+ * characters, a list of the earlier places they occurred.  It keeps its
+ * memory from one block to the next.  An Lz77 must not be used by two
+ * threads at the same time.
+ */
+typedef struct Lz77 Lz77;
+
+
+/**
+ * Returns a new Lz77 or NULL if there is an error.
+ */
+Lz77 *lz77_new (void);
+
+
+/**
+ * Frees an Lz77.
+ */
+void lz77_free (Lz77 *lz);
+
+
+/**
+ * Splits the `n` characters at `src` into tokens, looking for matches up
+ * to 2^`window` characters back with the effort of the given level, and
+ * points `tokens` at them.  The tokens belong to the Lz77 and stay valid
+ * until the next call.  Returns the number of tokens or -1 if there is an
+ * error.
+ */
+long lz77_parse (Lz77 *lz, const unsigned char *src, size_t n, int level,
+                 int window, const Lz77Token **tokens);
+
+
+/**
+ * Returns the symbol that codes the number `v` and stores the number of
+ * extra bits that follow it in `extra`.  Lengths are coded as the length
+ * less LZ77_MIN_MATCH and distances as the distance less 1.
+ */
+int lz77_symbol (uint32_t v, int *extra);
+
+
+/**
+ * Returns the smallest number coded by `sym` and stores the number of extra
+ * bits that follow it, which are added to it, in `extra`.
+ */
+uint32_t lz77_base (int sym, int *extra);
+
+#endif
@@ -0,0 +1,200 @@
+/********************************************************************
+
+ The pool module implements a small thread pool.  Jobs are kept in a linked
+ list in the order they were submitted and each worker repeatedly takes the
+ job at the head of the list and runs it.  The caller only ever needs to
+ wait for all jobs submitted so far (pool_wait), which is how the encoder and
+ decoder use it: submit a batch of blocks, wait, write out the results in
+ order, repeat.
+
+ *******************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+
+/**
+ * A Job is one function call waiting in the queue.
+ */
+typedef struct Job Job;
+struct Job {
+    void (*fn)(void *);
+    void  *arg;
+    Job   *next;
+};
+
+struct ThreadPool {
+    pthread_t      *threads;   // The workers, NULL if jobs run inline
+    int             nthreads;  // Number of workers
+    pthread_mutex_t lock;      // Protects everything below
+    pthread_cond_t  work;      // Signalled when a job is queued or on quit
+    pthread_cond_t  idle;      // Signalled when the last pending job is done
+    Job            *head;      // Next job to run
+    Job            *tail;      // Last job queued
+    int             pending;   // Jobs queued or running
+    int             quit;      // Set when the workers should exit
+};
+
+
+/**
+ * The main loop of a worker thread.
+ */
+static void *worker (void *arg)
+{
+    ThreadPool *pool = (ThreadPool *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->head == NULL && !pool->quit)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->head == NULL)
+            break;
+
+        // Take the job at the head and run it without holding the lock:
+        Job *job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->fn(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+/**
+ * Returns a new ThreadPool with `nthreads` workers or NULL if there is an
+ * error.
+ */
+ThreadPool *pool_new (int nthreads)
+{
+    ThreadPool *pool = (ThreadPool *)(calloc(1, sizeof(ThreadPool)));
+    if (pool == NULL)
+        return NULL;
+
+    // Everything runs inline with a single thread:
+    if (nthreads <= 1)
+        return pool;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    pool->threads = (pthread_t *)(malloc(nthreads * sizeof(pthread_t)));
+    if (pool->threads == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0)
+        {
+            // Make do with the workers we have:
+            if (i == 0)
+            {
+                free(pool->threads);
+                pool->threads = NULL;
+            }
+            break;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+
+/**
+ * Returns the number of workers in the pool, 1 if jobs run inline.
+ */
+int pool_size (ThreadPool *pool)
+{
+    return pool->threads != NULL ? pool->nthreads : 1;
+}
+
+
+/**
+ * Queues `fn(arg)` to run on one of the workers.  Returns -1 if there is an
+ * error.
+ */
+int pool_submit (ThreadPool *pool, void (*fn)(void *), void *arg)
+{
+    if (pool->threads == NULL)
+    {
+        fn(arg);
+        return 0;
+    }
+
+    Job *job = (Job *)(malloc(sizeof(Job)));
+    if (job == NULL)
+        return -1;
+    job->fn   = fn;
+    job->arg  = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL)
+        pool->tail->next = job;
+    else
+        pool->head = job;
+    pool->tail = job;
+    pool->pending++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+
+/**
+ * Waits until all the jobs submitted so far have finished.
+ */
+void pool_wait (ThreadPool *pool)
+{
+    if (pool->threads == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * Waits for the submitted jobs, stops the workers and frees the pool.
+ */
+void pool_free (ThreadPool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    if (pool->threads != NULL)
+    {
+        pool_wait(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->quit = 1;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < pool->nthreads; i++)
+            pthread_join(pool->threads[i], NULL);
+
+        free(pool->threads);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->work);
+        pthread_cond_destroy(&pool->idle);
+    }
+    free(pool);
+}
@@ -0,0 +1,42 @@
+#ifndef __POOL_H
+#define __POOL_H
+
+/**
+ * A ThreadPool runs jobs on a fixed number of worker threads.
+ */
+typedef struct ThreadPool ThreadPool;
+
+
+/**
+ * Returns a new ThreadPool with `nthreads` workers or NULL if there is an
+ * error.  With `nthreads` of 1 or less no threads are started and every job
+ * runs right away in pool_submit.
+ */
+ThreadPool *pool_new (int nthreads);
+
+
+/**
+ * Returns the number of workers in the pool, 1 if jobs run inline.
+ */
+int pool_size (ThreadPool *pool);
+
+
+/**
+ * Queues `fn(arg)` to run on one of the workers.  Returns -1 if there is an
+ * error.
+ */
+int pool_submit (ThreadPool *pool, void (*fn)(void *), void *arg);
+
+
+/**
+ * Waits until all the jobs submitted so far have finished.
+ */
+void pool_wait (ThreadPool *pool);
+
+
+/**
+ * Waits for the submitted jobs, stops the workers and frees the pool.
+ */
+void pool_free (ThreadPool *pool);
+
+#endif
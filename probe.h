@@ -0,0 +1,61 @@
+#ifndef __PROBE_H
+#define __PROBE_H
+
+#include <stdint.h>
+
+/**
+ * HUFF_PROBES is defined when the static tracepoints of the program are
+ * built in: when <sys/sdt.h> (from systemtap) is there and HUFF_NO_PROBES
+ * is not defined.  Each tracepoint is then a single nop in the code plus a
+ * note in the binary that perf, bpftrace and the like attach to, as
+ * hzip:<name>:
+ *
+ *   encoder_new         (input bytes or 0, framed, threads, ns)
+ *   decoder_free        (input bytes, output bytes, ns since decoder_new)
+ *   freq                (bytes, ns)     a whole input was counted
+ *   tree                (symbols, ns)   a tree or code lengths were built
+ *   table               (symbols, ns)   a coding or decoding table was built
+ *   fill_buf            (bytes, ns)     bits-io read its next buffer in
+ *   flush_buf           (bytes, ns)     bits-io wrote a full buffer out
+ *   encode_block_start  (bytes)
+ *   encode_block_end    (bytes in, bytes out, ns)
+ *   decode_block_start  (bytes)
+ *   decode_block_end    (bytes in, bytes out, ns)
+ *
+ * Without HUFF_PROBES the PROBE macros and probe_now compile to nothing.
+ */
+#if !defined(HUFF_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HUFF_PROBES 1
+#endif
+#endif
+
+#ifdef HUFF_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)             DTRACE_PROBE1(hzip, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(hzip, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(hzip, name, a, b, c)
+#define PROBE4(name, a, b, c, d)    DTRACE_PROBE4(hzip, name, a, b, c, d)
+
+/**
+ * Returns the time in nanoseconds, for the durations the probes report.
+ */
+uint64_t probe_now (void);
+
+#else
+
+#define PROBE1(name, a)             ((void)(a))
+#define PROBE2(name, a, b)          ((void)(a), (void)(b))
+#define PROBE3(name, a, b, c)       ((void)(a), (void)(b), (void)(c))
+#define PROBE4(name, a, b, c, d)    ((void)(a), (void)(b), (void)(c), (void)(d))
+
+static inline uint64_t probe_now (void)
+{
+    return 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+/********************************************************************
+
+ The stats module records where the time of coding goes, for huffc and
+ huffd --stats (or HUFF_STATS in the environment) and for callers of the
+ library that want to know.
+
+ The time of each phase is taken with two clocks, the wall clock and the
+ CPU clock of the thread, when it starts and when it stops.  Phases run
+ inside each other (the histogram of a block is taken inside encoding
+ it), so every thread keeps the time of the phases that stopped on it so
+ far, and a phase that stops takes out what was added to that since it
+ started.  The totals are shared by all threads and kept under a lock;
+ that is cheap enough, since nothing is recorded more than a few times a
+ block.
+
+ *******************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+#ifndef HUFF_NO_STATS
+int stats_active = 0;
+#endif
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static HuffStats totals;      // Everything recorded, under lock
+
+// Time of the phases that stopped on this thread so far
+static __thread double inner_wall;
+static __thread double inner_cpu;
+
+static const char *phase_names[STATS_PHASES] = {
+    "read", "histogram", "tree", "table", "header", "encode", "decode",
+    "write"
+};
+
+
+/**
+ * Returns the time of `clock` in seconds.
+ */
+static double now (clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/**
+ * Turns recording on or off.
+ */
+void stats_enable (int on)
+{
+#ifndef HUFF_NO_STATS
+    stats_active = on;
+#endif
+}
+
+
+/**
+ * Clears everything recorded so far.
+ */
+void stats_reset (void)
+{
+    pthread_mutex_lock(&lock);
+    memset(&totals, 0, sizeof(totals));
+    pthread_mutex_unlock(&lock);
+}
+
+
+/**
+ * Copies everything recorded so far into `stats`.
+ */
+void stats_get (HuffStats *stats)
+{
+    pthread_mutex_lock(&lock);
+    *stats = totals;
+    pthread_mutex_unlock(&lock);
+}
+
+
+/**
+ * Prints everything recorded so far to `fp`.
+ */
+void stats_print (FILE *fp)
+{
+    HuffStats s;
+    stats_get(&s);
+
+    double wall = 0, cpu = 0;
+    fprintf(fp, "%-12s %10s %10s\n", "phase", "wall ms", "cpu ms");
+    for (int p = 0; p < STATS_PHASES; p++)
+    {
+        fprintf(fp, "%-12s %10.3f %10.3f\n", phase_names[p],
+                s.wall[p] * 1e3, s.cpu[p] * 1e3);
+        wall += s.wall[p];
+        cpu  += s.cpu[p];
+    }
+    fprintf(fp, "%-12s %10.3f %10.3f\n", "total", wall * 1e3, cpu * 1e3);
+
+    uint64_t *c = s.count;
+    fprintf(fp, "bytes in        %llu\n",
+            (unsigned long long)c[STATS_BYTES_IN]);
+    fprintf(fp, "bytes out       %llu\n",
+            (unsigned long long)c[STATS_BYTES_OUT]);
+    if (c[STATS_SYMBOLS] > 0)
+        fprintf(fp, "bits/symbol     %.4f\n",
+                (double)c[STATS_CODE_BITS] / c[STATS_SYMBOLS]);
+    if (s.max_code_len > 0)
+        fprintf(fp, "max code len    %d\n", s.max_code_len);
+    fprintf(fp, "read calls      %llu\n",
+            (unsigned long long)c[STATS_READ_CALLS]);
+    fprintf(fp, "write calls     %llu\n",
+            (unsigned long long)c[STATS_WRITE_CALLS]);
+    fprintf(fp, "flushes         %llu\n",
+            (unsigned long long)c[STATS_FLUSHES]);
+}
+
+
+/**
+ * Starts timing a phase.
+ */
+void stats_timer_start (StatsTimer *timer)
+{
+    timer->wall       = now(CLOCK_MONOTONIC);
+    timer->cpu        = now(CLOCK_THREAD_CPUTIME_ID);
+    timer->inner_wall = inner_wall;
+    timer->inner_cpu  = inner_cpu;
+}
+
+
+/**
+ * Adds the time since stats_timer_start, less that of the phases that ran
+ * inside, to `phase`.
+ */
+void stats_timer_stop (StatsTimer *timer, int phase)
+{
+    double wall = now(CLOCK_MONOTONIC) - timer->wall;
+    double cpu  = now(CLOCK_THREAD_CPUTIME_ID) - timer->cpu;
+    double own_wall = wall - (inner_wall - timer->inner_wall);
+    double own_cpu  = cpu - (inner_cpu - timer->inner_cpu);
+
+    // To a phase around this one, all of this one ran inside it:
+    inner_wall = timer->inner_wall + wall;
+    inner_cpu  = timer->inner_cpu + cpu;
+
+    pthread_mutex_lock(&lock);
+    totals.wall[phase] += own_wall;
+    totals.cpu[phase]  += own_cpu;
+    pthread_mutex_unlock(&lock);
+}
+
+
+/**
+ * Adds `n` to `counter`.
+ */
+void stats_counter_add (int counter, uint64_t n)
+{
+    pthread_mutex_lock(&lock);
+    totals.count[counter] += n;
+    pthread_mutex_unlock(&lock);
+}
+
+
+/**
+ * Notes that a code of `len` bits was built.
+ */
+void stats_code_len (int len)
+{
+    pthread_mutex_lock(&lock);
+    if (len > totals.max_code_len)
+        totals.max_code_len = len;
+    pthread_mutex_unlock(&lock);
+}
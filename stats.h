@@ -0,0 +1,141 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * The phases the time of coding is split into.  Each phase gets only the
+ * time spent in it directly: a phase that runs inside another (the
+ * histogram of a block inside encoding it, say) is taken out of the outer
+ * one.
+ */
+enum {
+    STATS_READ,       // Waiting for input
+    STATS_HISTOGRAM,  // Counting the characters
+    STATS_TREE,       // Building the tree or the code lengths
+    STATS_TABLE,      // Building the coding and decoding tables
+    STATS_HEADER,     // Writing and reading the trees and code lengths
+    STATS_ENCODE,     // Encoding, apart from the phases above
+    STATS_DECODE,     // Decoding, apart from the phases above
+    STATS_WRITE,      // Writing out the output
+    STATS_PHASES
+};
+
+/**
+ * The things that are counted.
+ */
+enum {
+    STATS_BYTES_IN,    // Bytes of input coded
+    STATS_BYTES_OUT,   // Bytes of output produced
+    STATS_SYMBOLS,     // Characters written with bits_io_write_codes
+    STATS_CODE_BITS,   // Bits their codes took
+    STATS_READ_CALLS,  // Reads handed to the system (read, fread)
+    STATS_WRITE_CALLS, // Writes handed to the system (fwrite)
+    STATS_FLUSHES,     // Buffers of bits-io written out
+    STATS_COUNTERS
+};
+
+/**
+ * HuffStats holds what was recorded since the stats were last reset.  The
+ * times add up over all threads, so with several threads they may add up
+ * to more than the time the program ran.
+ */
+typedef struct HuffStats HuffStats;
+struct HuffStats {
+    double   wall[STATS_PHASES];      // Seconds spent in each phase
+    double   cpu[STATS_PHASES];       // CPU seconds of the threads in it
+    uint64_t count[STATS_COUNTERS];   // The counters
+    int      max_code_len;            // Longest code built
+};
+
+/**
+ * A StatsTimer times one run of a phase.
+ */
+typedef struct StatsTimer StatsTimer;
+struct StatsTimer {
+    double wall;        // When it started
+    double cpu;         // CPU time of the thread when it started
+    double inner_wall;  // Time of the phases run inside, when it started
+    double inner_cpu;
+};
+
+
+/**
+ * Recording is off unless stats_enable turns it on.  Building with
+ * HUFF_NO_STATS defined takes it out of the program altogether;
+ * otherwise, while it is off, each place that records costs a test of
+ * stats_active, and those places are only run once per block or buffer,
+ * never per character.
+ */
+#ifdef HUFF_NO_STATS
+#define stats_active 0
+#else
+extern int stats_active;
+#endif
+
+
+/**
+ * Turns recording on (1) or off (0).  Must be called while nothing is
+ * being coded.
+ */
+void stats_enable (int on);
+
+
+/**
+ * Clears everything recorded so far.
+ */
+void stats_reset (void);
+
+
+/**
+ * Copies everything recorded so far into `stats`.
+ */
+void stats_get (HuffStats *stats);
+
+
+/**
+ * Prints everything recorded so far to `fp`.
+ */
+void stats_print (FILE *fp);
+
+
+/**
+ * What the functions below call while recording is on.
+ */
+void stats_timer_start (StatsTimer *timer);
+void stats_timer_stop (StatsTimer *timer, int phase);
+void stats_counter_add (int counter, uint64_t n);
+void stats_code_len (int len);
+
+
+/**
+ * Starts timing a phase.
+ */
+static inline void stats_start (StatsTimer *timer)
+{
+    if (stats_active)
+        stats_timer_start(timer);
+}
+
+
+/**
+ * Adds the time since stats_start to `phase`.
+ */
+static inline void stats_stop (StatsTimer *timer, int phase)
+{
+    if (stats_active)
+        stats_timer_stop(timer, phase);
+}
+
+
+/**
+ * Adds `n` to `counter`.
+ */
+static inline void stats_add (int counter, uint64_t n)
+{
+    if (stats_active)
+        stats_counter_add(counter, n);
+}
+
+#endif
@@ -7,6 +7,8 @@
  EncodeTable *table_build (TreeNode *root);
  
  - Returns an encoding table from a properly constructed Huffman tree.
+ table_build_flat does the same for the flat form of the tree (see tree.h),
+ which is what table_build works on internally.
  
  void table_free (EncodeTable *etab);
  
@@ -18,7 +20,13 @@
  encoding table. The format of the array of characters that are returned
  is a sequence of '1' and '0' characters terminated by a null ('\0').
  Each '1' and '0' in the encoding string represents a path to a character
- in the tree.  We use this encoding to write bits to the compressed file.
+ in the tree.
+ 
+ const BitCode *table_codes (EncodeTable *etab);
+ 
+ - Returns the same encodings packed into integers, indexed by character.
+ This is what the encoder uses to write bits to the compressed file, since
+ a whole code can then be written with a single call.
  
  *******************************************************************/
 
@@ -27,74 +35,20 @@
 #include <string.h>
 #include <assert.h>
 #include "table.h"
+#include "stats.h"
+#include "probe.h"
 
 #define NUMBER_OF_CHARS 256
 
 
 /**
- * A BitArray represents the encoding of a particular character.  It is used
- * by this module to map a character `c` to an array of characters which will
- * be either a '1' or a '0'.  The `bits` string is terminated by a null
- * character.  The length `len` is the length of the bit array (excluding the
- * null).
- */
-typedef struct BitArray BitArray;
-struct BitArray {
-    int  len;
-    char *bits;
-};
-
-
-/**
- * The `bit_array_new` function returns a new bit array with no bits (suitable
- * for use at the root of the tree).
- */
-static BitArray *bit_array_new ()
-{
-    BitArray *b = (BitArray *)(malloc(sizeof(BitArray)));
-    b->len = 0;
-    b->bits = (char *)(malloc(1));
-    b->bits[0] = 0;
-    return b;
-}
-
-
-/**
- * The `bit_array_new_with` function returns a new bit array from the given
- * bit array, appending one new bit.  It is the responsibility of the caller
- * to manage any deallocation.
- */
-static BitArray *bit_array_new_with (BitArray *b, int bit)
-{
-    assert((bit & 1) == bit);  // check that it fits in a bit
-    BitArray *nb = (BitArray *)(malloc(sizeof(BitArray)));
-    nb->len = b->len;
-    nb->bits = (char *)(malloc(nb->len+2));
-    memcpy(nb->bits, b->bits, b->len);
-    nb->bits[(nb->len)++] = ('0' + bit);
-    nb->bits[nb->len] = 0;
-    return nb;
-}
-
-
-/**
- * The `bit_array_free` function deallocates the bit array object.
- */
-static void bit_array_free (BitArray *b)
-{
-    assert(b != NULL && b->bits != NULL);
-    free(b->bits);
-    free(b);
-}
-
-
-/**
- * An EncodeTable holds a mapping from characters to bit arrays.  It is used
+ * An EncodeTable holds a mapping from characters to their codes.  It is used
  * during the encoding process to retrieve the bit representation of a
- * character for the Huffman coding.
+ * character for the Huffman coding.  A code with length 0 means that the
+ * character does not appear in the tree.
  */
 struct EncodeTable {
-    BitArray *table[NUMBER_OF_CHARS];
+    BitCode table[NUMBER_OF_CHARS];
 };
 
 
@@ -103,45 +57,69 @@ struct EncodeTable {
  * node in the tree generating the encoding.  If the tree node is an INTERNAL
  * node we assign a 1 bit to the left child of the tree and a 0 bit to the
  * right child of a tree.  If the tree is a LEAF node we add the mapping to
- * the encode table.  We create new bit arrays as we descend into the tree.
+ * the encode table.  The code so far is passed down as an integer holding
+ * `len` bits, so no memory is allocated while we descend into the tree.
  */
-static void rec_gen_table (EncodeTable *etab, TreeNode *node, BitArray *b)
+static void rec_gen_table (EncodeTable *etab, const FlatTree *flat,
+                           NodeRef node, uint64_t bits, int len)
 {
     
     // If we have an internal node we recursively descend into the tree.
-    if (!tree_is_leaf(node))
+    if (!FLAT_IS_LEAF(node))
     {
-        TreeNode *left  = node->left;
-        TreeNode *right = node->right;
+        NodeRef left  = flat->kid[node][1];
+        NodeRef right = flat->kid[node][0];
+        
+        // Codes are limited to the 64 bits of a BitCode:
+        assert(len < 64);
         
-        // If the left child is not NULL we create a new bit array from the old
-        // one, appending a 1 bit, and recursively follow the left branch.
-        if (left != NULL)
+        // If the left child is not missing we append a 1 bit and
+        // recursively follow the left branch.
+        if (left != FLAT_NONE)
         {
-            BitArray *lb = bit_array_new_with(b, 1);
-            rec_gen_table(etab, left, lb);
+            rec_gen_table(etab, flat, left, (bits << 1) | 1, len + 1);
         }
         
-        // If the right child is not NULL we create a new bit array from the old
-        // one, append a 0 bit, and recursively follow the right branch.
-        if (right != NULL)
+        // If the right child is not missing we append a 0 bit and
+        // recursively follow the right branch.
+        if (right != FLAT_NONE)
         {
-            BitArray *rb = bit_array_new_with(b, 0);
-            rec_gen_table(etab, right, rb);
+            rec_gen_table(etab, flat, right, bits << 1, len + 1);
         }
         
-        // We need to make sure to deallocate the intermediate bit array.
-        bit_array_free(b);
-        
     } else
     {
         // Leaf Node Case:
         
         // We finally reached a leaf node so we add its mapping into the encode
-        // table.  Note that in the leaf case we do NOT free the BitArray.
-        unsigned char ch = node->freq.c;
-        etab->table[ch] = b;
+        // table.
+        unsigned char ch = FLAT_CHAR(node);
+        etab->table[ch].bits = bits;
+        etab->table[ch].len  = len;
+    }
+}
+
+
+/**
+ * Returns the codes of all characters in the table, indexed by character.
+ */
+const BitCode *table_codes (EncodeTable *etab)
+{
+    return etab->table;
+}
+
+
+/**
+ * Writes the code `b` as a string of '1' and '0' characters into `e`, which
+ * must have room for b->len + 1 characters.
+ */
+static void code_to_string (const BitCode *b, char *e)
+{
+    for (int i = 0; i < b->len; i++)
+    {
+        e[i] = '0' + (int)((b->bits >> (b->len - 1 - i)) & 1);
     }
+    e[b->len] = 0;
 }
 
 
@@ -157,11 +135,11 @@ static void rec_gen_table (EncodeTable *etab, TreeNode *node, BitArray *b)
 char *table_bit_encode (EncodeTable *etab, unsigned char c)
 {
     // Retrieve the encoding for the character:
-    BitArray *b = etab->table[c];
+    BitCode *b = &etab->table[c];
     
-    // Make a copy of the encoding:
+    // Spell out the encoding:
     char *e = (char *)(malloc(b->len+1));
-    strcpy(e, b->bits);
+    code_to_string(b, e);
     
     // Note that it is the responsibility of the caller to deallocate
     // the array of characters that we return.
@@ -178,31 +156,65 @@ void table_print (EncodeTable *etab)
     for (int i = 0; i < NUMBER_OF_CHARS; i++)
     {
         unsigned char c = (unsigned char)i;
-        BitArray *b = etab->table[c];
-        if (b != NULL)
+        BitCode *b = &etab->table[c];
+        if (b->len > 0)
         {
-            printf("%d '%c' = %s\n", c, c, b->bits);
+            char e[64+1];
+            code_to_string(b, e);
+            printf("%d '%c' = %s\n", c, c, e);
         }
     }
 }
 
 
 /**
- * Returns an encoding table given the Huffman tree.
+ * Returns an encoding table given the Huffman tree.  The tree is flattened
+ * first (see tree.h) and the table built from the flat copy.
  */
 EncodeTable *table_build (TreeNode *root)
+{
+    FlatTree flat;
+    if (tree_flatten(root, &flat) == -1)
+        return NULL;
+    return table_build_flat(&flat);
+}
+
+
+/**
+ * Returns an encoding table given the flat Huffman tree.
+ */
+EncodeTable *table_build_flat (const FlatTree *flat)
 {
     // Allocate a new encoding table:
     EncodeTable *etab = (EncodeTable *)(malloc(sizeof(EncodeTable)));
+    if (etab == NULL)
+        return NULL;
+    
+    uint64_t started = probe_now();
+    StatsTimer timer;
+    stats_start(&timer);
     
-    // Initialize each entry to NULL:
+    // Initialize each entry to an empty code:
     for (int i = 0; i < NUMBER_OF_CHARS; i++)
     {
-        etab->table[i] = NULL;
+        etab->table[i].bits = 0;
+        etab->table[i].len  = 0;
     }
     
     // Recursively construct the encoding table:
-    rec_gen_table(etab, root, bit_array_new());
+    if (flat->root != FLAT_NONE)
+        rec_gen_table(etab, flat, flat->root, 0, 0);
+    stats_stop(&timer, STATS_TABLE);
+    PROBE2(table, NUMBER_OF_CHARS, probe_now() - started);
+    
+    if (stats_active)
+    {
+        int maxlen = 0;
+        for (int i = 0; i < NUMBER_OF_CHARS; i++)
+            if (etab->table[i].len > maxlen)
+                maxlen = etab->table[i].len;
+        stats_code_len(maxlen);
+    }
     
     // Return the constructed table:
     return etab;
@@ -214,16 +226,5 @@ EncodeTable *table_build (TreeNode *root)
  */
 void table_free (EncodeTable *etab)
 {
-    
-    // First free each of the bit arrays in the table.
-    for (int i = 0; i < NUMBER_OF_CHARS; i++)
-    {
-        BitArray *b = etab->table[i];
-        if (b != NULL)
-        {
-            bit_array_free(b);
-        }
-    }
-    
     free(etab);
 }
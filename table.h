@@ -1,9 +1,21 @@
 #ifndef __TABLE_H
 #define __TABLE_H
+#include <stdint.h>
 #include "tree.h"
 
 typedef struct EncodeTable EncodeTable;
 
+/**
+ * A BitCode is the Huffman encoding of a character packed into an integer.
+ * The low `len` bits of `bits` hold the encoding, with the first bit of the
+ * encoding in the most significant of them.
+ */
+typedef struct BitCode BitCode;
+struct BitCode {
+    uint64_t bits;
+    int      len;
+};
+
 
 /**
  * Returns an encoding table given the huffman tree.
@@ -11,6 +23,12 @@ typedef struct EncodeTable EncodeTable;
 EncodeTable *table_build (TreeNode *root);
 
 
+/**
+ * Returns an encoding table given the flat huffman tree.
+ */
+EncodeTable *table_build_flat (const FlatTree *flat);
+
+
 /**
  * Frees the encoding table.
  */
@@ -28,6 +46,14 @@ void table_free(EncodeTable* etab);
 char *table_bit_encode (EncodeTable *etab, unsigned char c);
 
 
+/**
+ * Returns the encodings of all characters packed into BitCode objects,
+ * indexed by character.  A length of 0 means the character is not in the
+ * table.  The array belongs to the table.
+ */
+const BitCode *table_codes (EncodeTable *etab);
+
+
 /**
  * This function is useful for debugging. It prints out the mapping from
  * characters to their huffman encoding.
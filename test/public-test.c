@@ -2,11 +2,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 // Include the check header file:
 #include <check.h>
 
-// Include assignment header file:
+// Include assignment header file, with the probes left out whether or not
+// the library has them, for test_probes_off:
+#define HUFF_NO_PROBES
 #include "../hzip.h"
+#include "../dtable.h"
 
 #define BIT_ITERATIONS 1000000
 
@@ -127,6 +131,121 @@ START_TEST(test_bits_io_read_bit)
 }
 END_TEST
 
+START_TEST(test_bits_io_write_bits)
+{
+    remove("test/test-bits.hf");
+    
+    // Write codes of all lengths, the longest ones spanning two words:
+    BitsIOFile *bfile = bits_io_open("test/test-bits.hf", "w");
+    int total = 0;
+    for (int len = 1; len <= 64; len++)
+    {
+        uint64_t code = 0x5555555555555555ULL;
+        if (len < 64)
+            code &= (1ULL << len) - 1;
+        ck_assert_int_eq(bits_io_write_bits(bfile, code, len), 0);
+        total += len;
+    }
+    ck_assert_int_eq(bits_io_num_bytes(bfile), total/8);
+    int result = bits_io_close(bfile);
+    ck_assert_msg(result != EOF, "closing the file should not be EOF.");
+    
+    // Each code alternates between 0 and 1 and ends with a 1 bit:
+    bfile = bits_io_open("test/test-bits.hf", "r");
+    for (int len = 1; len <= 64; len++)
+    {
+        for (int i = 0; i < len; i++)
+        {
+            ck_assert_int_eq(bits_io_read_bit(bfile), (len - i) % 2);
+        }
+    }
+    bits_io_close(bfile);
+    
+    // Peeking does not consume, skipping does:
+    bfile = bits_io_open("test/test-bits.hf", "r");
+    ck_assert_int_eq(bits_io_peek_bits(bfile, 3), 0x5);
+    ck_assert_int_eq(bits_io_peek_bits(bfile, 3), 0x5);
+    ck_assert_int_eq(bits_io_skip_bits(bfile, 1), 0);
+    ck_assert_int_eq(bits_io_peek_bits(bfile, 2), 0x1);
+    bits_io_close(bfile);
+    
+    remove("test/test-bits.hf");
+}
+END_TEST
+
+START_TEST(test_bits_io_mapped)
+{
+    remove("test/test-map.hf");
+    
+    // Far more than the room asked for, so the mapping has to grow:
+    BitsIOFile *bfile = bits_io_open_sized("test/test-map.hf", "w", 16);
+    ck_assert_msg(bfile != NULL, "bfile should not be null.");
+    unsigned char bytes[1000];
+    for (int i = 0; i < 1000; i++)
+        bytes[i] = (unsigned char)(i * 7);
+    ck_assert_int_eq(bits_io_write_bits(bfile, 0xABC, 12), 0);
+    ck_assert_int_eq(bits_io_write_bits(bfile, 0xD, 4), 0);
+    ck_assert_int_eq(bits_io_write_bytes(bfile, bytes, 1000), 0);
+    int result = bits_io_close(bfile);
+    ck_assert_msg(result != EOF, "closing the file should not be EOF.");
+    ck_assert_int_eq(fsize("test/test-map.hf"), 1002);
+    
+    // Read back, the bytes straight from the mapping:
+    bfile = bits_io_open("test/test-map.hf", "r");
+    ck_assert_int_eq(bits_io_size(bfile), 1002);
+    ck_assert_int_eq(bits_io_peek_bits(bfile, 16), 0xABCD);
+    ck_assert_int_eq(bits_io_skip_bits(bfile, 16), 0);
+    const unsigned char *view = bits_io_view_bytes(bfile, 1000);
+    ck_assert_msg(view != NULL, "the bytes should be in memory.");
+    ck_assert_msg(memcmp(view, bytes, 1000) == 0, "bytes should match.");
+    ck_assert_msg(bits_io_view_bytes(bfile, 1) == NULL, "file should end.");
+    bits_io_close(bfile);
+    
+    remove("test/test-map.hf");
+}
+END_TEST
+
+START_TEST(test_aio)
+{
+    unsigned char bytes[1000];
+    for (int i = 0; i < 1000; i++)
+        bytes[i] = (unsigned char)(i * 13);
+    
+    // More chunks than the ring holds, one of them filled by hand:
+    FILE *fp = fopen("test/test-aio.hf", "w");
+    AioWriter *writer = aio_writer_new(fp, 64, 2);
+    ck_assert_msg(writer != NULL, "writer should not be null.");
+    ck_assert_int_eq(aio_writer_write(writer, bytes, 500), 0);
+    ck_assert_int_eq(aio_writer_drain(writer), 0);
+    memcpy(aio_writer_buffer(writer), bytes + 500, 64);
+    ck_assert_int_eq(aio_writer_submit(writer, 64), 0);
+    ck_assert_int_eq(aio_writer_write(writer, bytes + 564, 436), 0);
+    ck_assert_int_eq(aio_writer_free(writer), 0);
+    fclose(fp);
+    ck_assert_int_eq(fsize("test/test-aio.hf"), 1000);
+    
+    // Full chunks up to the last one, then the end, again and again:
+    fp = fopen("test/test-aio.hf", "r");
+    AioReader *reader = aio_reader_new(fp, 300, 2);
+    ck_assert_msg(reader != NULL, "reader should not be null.");
+    const unsigned char *data;
+    for (int i = 0; i < 4; i++)
+    {
+        long len = aio_reader_next(reader, &data);
+        ck_assert_int_eq(len, i < 3 ? 300 : 100);
+        ck_assert_msg(memcmp(data, bytes + 300 * i, len) == 0,
+                      "bytes should match.");
+        aio_reader_release(reader);
+    }
+    ck_assert_int_eq(aio_reader_next(reader, &data), 0);
+    ck_assert_int_eq(aio_reader_next(reader, &data), 0);
+    aio_reader_free(reader);
+    fclose(fp);
+    
+    remove("test/test-aio.hf");
+}
+END_TEST
+
 //////////////////////////////////////////////////////////////////////
 ///////////// tree unit tests
 //////////////////////////////////////////////////////////////////////
@@ -157,6 +276,35 @@ START_TEST(test_tree_size)
 }
 END_TEST
 
+START_TEST(test_tree_flatten)
+{
+    // 'a' = 1, 'b' = 01, 'c' = 00:
+    TreeNode *t = tree_new();
+    t->left = tree_new();
+    t->left->freq.c = 'a';
+    t->right = tree_new();
+    t->right->left = tree_new();
+    t->right->left->freq.c = 'b';
+    t->right->right = tree_new();
+    t->right->right->freq.c = 'c';
+    
+    FlatTree flat;
+    ck_assert_int_eq(tree_flatten(t, &flat), 0);
+    ck_assert_int_eq(flat.count, 2);
+    ck_assert_int_eq(huffman_find_flat(&flat, "1"), 'a');
+    ck_assert_int_eq(huffman_find_flat(&flat, "01"), 'b');
+    ck_assert_int_eq(huffman_find_flat(&flat, "00"), 'c');
+    ck_assert_int_eq(huffman_find_flat(&flat, "0"), -1);
+    
+    EncodeTable *etab = table_build_flat(&flat);
+    char *e = table_bit_encode(etab, 'b');
+    ck_assert_msg(strcmp(e, "01") == 0, "Encoding of 'b' should be 01.");
+    free(e);
+    table_free(etab);
+    tree_free(t);
+}
+END_TEST
+
 //////////////////////////////////////////////////////////////////////
 ///////////// pqueue unit tests
 //////////////////////////////////////////////////////////////////////
@@ -333,6 +481,94 @@ START_TEST(test_huffman_find)
 }
 END_TEST
 
+START_TEST(test_huffman_merge_leaves)
+{
+    // Distinct frequencies, then many ties between leaves and internal
+    // nodes, the latter including the character 0:
+    for (int round = 0; round < 2; round++)
+    {
+        TreeNode *heap[64], *fifo[64];
+        PriorityQueue *pq = pqueue_new();
+        for (int i = 0; i < 64; i++)
+        {
+            heap[i] = tree_new();
+            heap[i]->freq.v = round == 0 ? 3 * i + 1 : 1 + i % 3;
+            heap[i]->freq.c = (char)(i * 5);
+            fifo[i] = tree_new();
+            *fifo[i] = *heap[i];
+            pqueue_enqueue(pq, heap[i]);
+        }
+        
+        TreeNode *ta = merge_nodes(pq);
+        TreeNode *tb = huffman_merge_leaves(fifo, 64);
+        EncodeTable *a = table_build(ta);
+        EncodeTable *b = table_build(tb);
+        for (int c = 0; c < 256; c++)
+        {
+            ck_assert_int_eq(table_codes(a)[c].len, table_codes(b)[c].len);
+            ck_assert_msg(table_codes(a)[c].bits == table_codes(b)[c].bits,
+                          "Trees should be the same.");
+        }
+        table_free(a);
+        table_free(b);
+        tree_free(ta);
+        tree_free(tb);
+        pqueue_free(pq);
+    }
+}
+END_TEST
+
+START_TEST(test_huffman_build_lengths)
+{
+    // Counts growing like the Fibonacci numbers give the deepest tree:
+    size_t n = 0;
+    unsigned char *buf = malloc(1 << 20);
+    int a = 1, b = 1;
+    for (int c = 0; c < 24; c++)
+    {
+        for (int i = 0; i < a; i++)
+            buf[n++] = (unsigned char)c;
+        int t = a + b;
+        a = b;
+        b = t;
+    }
+    
+    unsigned char lens[256], limited[256];
+    ck_assert_int_eq(huffman_build_lengths(buf, n, 0, lens, NULL), 0);
+    ck_assert_int_eq(huffman_build_lengths(buf, n, 11, limited, NULL), 0);
+    ck_assert_int_eq(lens[0], 23);
+    
+    // The limited code is complete, respects the limit, and costs more:
+    uint64_t kraft = 0, cost = 0, limited_cost = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        cost += lens[buf[i]];
+        limited_cost += limited[buf[i]];
+    }
+    for (int c = 0; c < 256; c++)
+    {
+        ck_assert_msg(limited[c] <= 11, "Code should not exceed the limit.");
+        if (limited[c] > 0)
+            kraft += 1u << (11 - limited[c]);
+    }
+    ck_assert_int_eq(kraft, 1u << 11);
+    ck_assert_msg(limited_cost > cost, "Limited code should cost more.");
+    
+    // A limit the tree already respects costs nothing:
+    buf[n++] = 200;
+    ck_assert_int_eq(huffman_build_lengths(buf, 1000, 0, lens, NULL), 0);
+    ck_assert_int_eq(huffman_build_lengths(buf, 1000, 15, limited, NULL), 0);
+    cost = limited_cost = 0;
+    for (size_t i = 0; i < 1000; i++)
+    {
+        cost += lens[buf[i]];
+        limited_cost += limited[buf[i]];
+    }
+    ck_assert_int_eq(limited_cost, cost);
+    free(buf);
+}
+END_TEST
+
 //////////////////////////////////////////////////////////////////////
 ///////////// table unit tests
 //////////////////////////////////////////////////////////////////////
@@ -389,6 +625,863 @@ START_TEST(test_table_encode)
 }
 END_TEST
 
+//////////////////////////////////////////////////////////////////////
+///////////// histogram unit tests
+//////////////////////////////////////////////////////////////////////
+
+START_TEST(test_histogram_count)
+{
+    size_t n = 3 * HIST_MIN_SPLIT + 5;
+    unsigned char *buf = malloc(n);
+    uint64_t expect[HIST_SYMBOLS] = { 0 };
+    unsigned int x = 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        // Long runs of the same character and some noise:
+        x = x * 1103515245 + 12345;
+        buf[i] = (i / 64) % 3 == 0 ? 'e' : (unsigned char)(x >> 24);
+        expect[buf[i]]++;
+    }
+    
+    // Unaligned starts and odd lengths count the same:
+    uint64_t counts[HIST_SYMBOLS] = { 0 };
+    histogram_count(buf, 3, counts);
+    histogram_count(buf + 3, n - 3, counts);
+    for (int c = 0; c < HIST_SYMBOLS; c++)
+        ck_assert_int_eq(counts[c], expect[c]);
+    
+    // So do slices counted on several threads:
+    ThreadPool *pool = pool_new(4);
+    memset(counts, 0, sizeof(counts));
+    ck_assert_int_eq(histogram_count_pool(buf, n, counts, pool), 0);
+    for (int c = 0; c < HIST_SYMBOLS; c++)
+        ck_assert_int_eq(counts[c], expect[c]);
+    pool_free(pool);
+    free(buf);
+}
+END_TEST
+
+//////////////////////////////////////////////////////////////////////
+///////////// canon unit tests
+//////////////////////////////////////////////////////////////////////
+
+START_TEST(test_canon_codes)
+{
+    unsigned char lens[CANON_SYMBOLS] = { 0 };
+    lens['d'] = 3;
+    lens['c'] = 3;
+    lens['b'] = 2;
+    lens['a'] = 1;
+    
+    // Shorter codes come first, then character order:
+    BitCode codes[CANON_SYMBOLS];
+    ck_assert_int_eq(canon_codes(lens, codes), 0);
+    ck_assert_int_eq(codes['a'].bits, 0x0);
+    ck_assert_int_eq(codes['b'].bits, 0x2);
+    ck_assert_int_eq(codes['c'].bits, 0x6);
+    ck_assert_int_eq(codes['d'].bits, 0x7);
+    ck_assert_int_eq(codes['e'].len, 0);
+    
+    // The lengths survive being packed:
+    unsigned char packed[64], back[CANON_SYMBOLS];
+    BitsIOFile *bfile = bits_io_open_mem(packed, sizeof(packed), "w");
+    ck_assert_int_eq(canon_write_lengths(bfile, lens), 0);
+    ck_assert_int_eq(bits_io_close(bfile), 0);
+    bfile = bits_io_open_mem(packed, sizeof(packed), "r");
+    ck_assert_int_eq(canon_read_lengths(bfile, back), 0);
+    bits_io_close(bfile);
+    ck_assert_msg(memcmp(lens, back, CANON_SYMBOLS) == 0,
+                  "Lengths should round trip.");
+    
+    // Too many short codes do not make a prefix code:
+    lens['e'] = 1;
+    ck_assert_int_eq(canon_codes(lens, codes), -1);
+    FlatTree flat;
+    ck_assert_int_eq(canon_tree(lens, &flat), -1);
+}
+END_TEST
+
+//////////////////////////////////////////////////////////////////////
+///////////// dtable unit tests
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * Codes the `n` characters at `text` with the canonical codes of `lens`
+ * and checks that dtable_decode, dtable_decode_symbol and
+ * dtable_decode_streams all give them back.
+ */
+static void dtable_trip (const unsigned char lens[CANON_SYMBOLS],
+                         const unsigned char *text, size_t n)
+{
+    BitCode codes[CANON_SYMBOLS];
+    FlatTree flat;
+    DecodeTable *dtab = dtable_new();
+    ck_assert_int_eq(canon_codes(lens, codes), 0);
+    ck_assert_int_eq(canon_tree(lens, &flat), 0);
+    ck_assert_int_eq(dtable_fill(dtab, &flat), 0);
+    
+    size_t cap = 4 * n + 8;
+    unsigned char *coded = malloc(cap), *back = malloc(n);
+    BitsIOFile *bfile = bits_io_open_mem(coded, cap, "w");
+    ck_assert_int_eq(bits_io_write_codes(bfile, text, n, codes), 0);
+    size_t len = (size_t)((bits_io_num_bits(bfile) + 7) >> 3);
+    ck_assert_int_eq(bits_io_close(bfile), 0);
+    
+    bfile = bits_io_open_mem(coded, len, "r");
+    ck_assert_int_eq(dtable_decode(dtab, bfile, back, n), n);
+    bits_io_close(bfile);
+    ck_assert_msg(memcmp(text, back, n) == 0, "Table should decode.");
+    
+    bfile = bits_io_open_mem(coded, len, "r");
+    for (size_t i = 0; i < n; i++)
+        ck_assert_int_eq(dtable_decode_symbol(dtab, bfile), text[i]);
+    bits_io_close(bfile);
+    
+    const unsigned char *src = coded;
+    unsigned char *out = back;
+    memset(back, 0, n);
+    ck_assert_int_eq(dtable_decode_streams(dtab, 1, &src, &len, &out, &n), 0);
+    ck_assert_msg(memcmp(text, back, n) == 0, "Streams should decode.");
+    
+    dtable_free(dtab);
+    free(coded);
+    free(back);
+}
+
+START_TEST(test_dtable_decode)
+{
+    // Codes of 1 to 19 bits, so the longest ones go past the table and
+    // are finished in the tree:
+    unsigned char lens[CANON_SYMBOLS] = { 0 };
+    for (int c = 0; c < 19; c++)
+        lens['a' + c] = (unsigned char)(c + 1);
+    lens['a' + 19] = 19;
+    ck_assert_msg(19 > DTABLE_BITS, "Codes should outgrow the table.");
+    
+    size_t n = 5000;
+    unsigned char *text = malloc(n);
+    for (size_t i = 0; i < n; i++)
+        text[i] = (unsigned char)('a' + (i % 3 == 0 ? 19 - i % 11 : i % 5));
+    dtable_trip(lens, text, n);
+    
+    // A single character still takes a bit per copy:
+    memset(lens, 0, CANON_SYMBOLS);
+    lens['q'] = 1;
+    memset(text, 'q', n);
+    dtable_trip(lens, text, n);
+    
+    free(text);
+}
+END_TEST
+
+//////////////////////////////////////////////////////////////////////
+///////////// block unit tests
+//////////////////////////////////////////////////////////////////////
+
+START_TEST(test_block_round_trip)
+{
+    unsigned char text[4096], coded[4097], back[4096];
+    BlockOptions opts;
+    block_options_init(&opts);
+    for (int i = 0; i < 4096; i++)
+        text[i] = "abracadabra"[i % 11];
+    
+    // Skewed text is Huffman coded:
+    long len = block_encode(NULL, text, 4096, coded, block_bound(4096), &opts);
+    ck_assert_msg(len > 0 && len < 4096, "Text should compress.");
+    ck_assert_int_eq(coded[0], BLOCK_CANONICAL);
+    ck_assert_int_eq(block_decode(NULL, coded, len, back, 4096), 0);
+    ck_assert_msg(memcmp(text, back, 4096) == 0, "Block should round trip.");
+    
+    // Text that does not compress is stored:
+    for (int i = 0; i < 4096; i++)
+        text[i] = (unsigned char)(i * 7);
+    len = block_encode(NULL, text, 256, coded, block_bound(256), &opts);
+    ck_assert_int_eq(len, 257);
+    ck_assert_int_eq(coded[0], BLOCK_STORED);
+    ck_assert_int_eq(block_decode(NULL, coded, len, back, 256), 0);
+    ck_assert_msg(memcmp(text, back, 256) == 0, "Block should round trip.");
+    
+    // A truncated block is an error:
+    ck_assert_int_eq(block_decode(NULL, coded, len - 1, back, 256), -1);
+}
+END_TEST
+
+/**
+ * Encodes the `n` characters at `text` as one block with `opts`, checks
+ * that it has type `type` and round trips, and that a truncated copy does
+ * not decode.  Returns the length of the block and sets `*order0` to that
+ * of the block with the default options.  If `block` is not NULL the block
+ * is handed back in it, for the caller to free.
+ */
+static long block_trip (const unsigned char *text, size_t n,
+                        const BlockOptions *opts, int type, long *order0,
+                        unsigned char **block)
+{
+    unsigned char *coded = malloc(block_bound(n)), *back = malloc(n);
+    BlockCtx *ctx = block_ctx_new();
+    ck_assert_msg(coded != NULL && back != NULL && ctx != NULL,
+                  "Memory should be there.");
+    
+    BlockOptions plain;
+    block_options_init(&plain);
+    *order0 = block_encode(ctx, text, n, coded, block_bound(n), &plain);
+    long len = block_encode(ctx, text, n, coded, block_bound(n), opts);
+    ck_assert_msg(len > 0, "Block should encode.");
+    ck_assert_int_eq(coded[0], type);
+    ck_assert_int_eq(block_decode(ctx, coded, len, back, n), 0);
+    ck_assert_msg(memcmp(text, back, n) == 0, "Block should round trip.");
+    ck_assert_int_eq(block_decode(ctx, coded, len - 1, back, n), -1);
+    
+    block_ctx_free(ctx);
+    free(back);
+    if (block != NULL)
+        *block = coded;
+    else
+        free(coded);
+    return len;
+}
+
+START_TEST(test_block_words)
+{
+    // 16 bit samples spread over a wide range, and an odd last character:
+    size_t n = 8191;
+    unsigned char *samples = malloc(n);
+    for (size_t i = 0; i + 1 < n; i += 2)
+    {
+        int v = 1000 * (int)(i % 40) + (int)(i % 3);
+        samples[i]     = (unsigned char)v;
+        samples[i + 1] = (unsigned char)(v >> 8);
+    }
+    samples[n - 1] = 'x';
+    
+    BlockOptions opts;
+    block_options_init(&opts);
+    opts.symbol_bits = 16;
+    long bytes;
+    long len = block_trip(samples, n, &opts, BLOCK_WORDS, &bytes, NULL);
+    ck_assert_msg(len < (long)n / 2, "Words should compress.");
+    
+    // Each sample is one symbol, where bytes see two unrelated halves:
+    ck_assert_msg(len < bytes * 2 / 3, "Words should beat bytes.");
+    
+    // Even an odd number of characters gets the last one back alone:
+    len = block_trip(samples, 3, &opts, BLOCK_STORED, &bytes, NULL);
+    ck_assert_int_eq(len, 4);
+    
+    free(samples);
+}
+END_TEST
+
+START_TEST(test_block_order1)
+{
+    // Letters that are each followed by one of just two others:
+    size_t n = 20000;
+    unsigned char *text = malloc(n);
+    unsigned int seed = 1, c = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        c = (c * 7 + ((seed >> 16) & 1)) % 26;
+        text[i] = (unsigned char)('a' + c);
+    }
+    
+    BlockOptions opts;
+    block_options_init(&opts);
+    opts.order = 1;
+    long order0;
+    long len = block_trip(text, n, &opts, BLOCK_ORDER1, &order0, NULL);
+    ck_assert_msg(len < order0 / 3, "Order-1 should beat one table.");
+    
+    // Letters that do not depend on the one before are better off with a
+    // single table, and get one:
+    for (size_t i = 0; i < n; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        text[i] = (unsigned char)('a' + (seed >> 16) % 26);
+    }
+    len = block_trip(text, n, &opts, BLOCK_CANONICAL, &order0, NULL);
+    ck_assert_int_eq(len, order0);
+    
+    free(text);
+}
+END_TEST
+
+START_TEST(test_block_adaptive)
+{
+    // Text whose characters change halfway through, for the code to follow:
+    size_t n = 30000;
+    unsigned char *text = malloc(n), *coded;
+    for (size_t i = 0; i < n; i++)
+        text[i] = i < n / 2 ? "aab"[i % 3] : "xyzzy"[i % 5];
+    
+    BlockOptions opts;
+    block_options_init(&opts);
+    opts.adapt_interval = BLOCK_ADAPT_MIN;
+    long order0;
+    long len = block_trip(text, n, &opts, BLOCK_ADAPTIVE, &order0, &coded);
+    ck_assert_msg(len < (long)n / 3, "Adaptive should compress.");
+    
+    // The block starts with the interval as a power of two and the limit
+    // of the codes, which both sides rebuild the same way:
+    ck_assert_int_eq(coded[1] >> 3, 10);
+    ck_assert_int_eq(((coded[1] & 7) << 1) | (coded[2] >> 7),
+                     HUFFMAN_LIMIT_MAX);
+    free(coded);
+    
+    // An interval that is not a power of two is rounded up to one:
+    opts.adapt_interval = 3 * BLOCK_ADAPT_MIN;
+    opts.max_code_len = HUFFMAN_LIMIT_MIN;
+    block_trip(text, n, &opts, BLOCK_ADAPTIVE, &order0, &coded);
+    ck_assert_int_eq(coded[1] >> 3, 12);
+    ck_assert_int_eq(((coded[1] & 7) << 1) | (coded[2] >> 7),
+                     HUFFMAN_LIMIT_MIN);
+    
+    free(text);
+    free(coded);
+}
+END_TEST
+
+START_TEST(test_block_ans)
+{
+    // One character far likelier than the rest, where Huffman codes waste
+    // most of a bit on each:
+    size_t n = 50000;
+    unsigned char *text = malloc(n);
+    for (size_t i = 0; i < n; i++)
+        text[i] = i % 17 == 0 ? (unsigned char)('b' + i % 3) : 'a';
+    
+    uint64_t counts[256] = { 0 };
+    uint16_t norm[256];
+    histogram_count(text, n, counts);
+    ck_assert_int_eq(ans_normalize(counts, 11, norm), 0);
+    ck_assert_msg(norm['b'] >= 1 && norm['a'] > norm['b'],
+                  "Counts should keep their order.");
+    ck_assert_int_eq(norm['a'] + norm['b'] + norm['c'] + norm['d'], 2048);
+    
+    BlockOptions opts;
+    block_options_init(&opts);
+    opts.coder = BLOCK_CODER_ANS;
+    long huff;
+    long len = block_trip(text, n, &opts, BLOCK_ANS, &huff, NULL);
+    ck_assert_msg(len < huff / 2, "tANS should beat Huffman.");
+    
+    // Every character as likely as the others gains nothing, and is stored:
+    for (size_t i = 0; i < n; i++)
+        text[i] = (unsigned char)(i * 7);
+    len = block_trip(text, n, &opts, BLOCK_STORED, &huff, NULL);
+    ck_assert_int_eq(len, (long)n + 1);
+    
+    // tANS has no codes to limit:
+    EncoderOptions eopts;
+    encoder_options_init(&eopts);
+    eopts.block.coder = BLOCK_CODER_ANS;
+    eopts.block.max_code_len = HUFFMAN_LIMIT_MIN;
+    const char *why = NULL;
+    ck_assert_msg(encoder_new_opts("books/simple.txt", "test/test.he",
+                                   &eopts, &why) == NULL && why != NULL,
+                  "tANS with limited codes should be refused.");
+    
+    free(text);
+}
+END_TEST
+
+START_TEST(test_block_lz77)
+{
+    // Every symbol gives back the numbers it codes:
+    for (uint32_t v = 0; v < (1u << 22); v = v * 3 / 2 + 1)
+    {
+        int extra, extra2;
+        int sym = lz77_symbol(v, &extra);
+        uint32_t base = lz77_base(sym, &extra2);
+        ck_assert_int_eq(extra, extra2);
+        ck_assert_msg(base <= v && v - base < (1u << extra),
+                      "Symbol %d should code %u.", sym, v);
+    }
+    
+    // Repeated lines, some with runs that overlap their own copy:
+    size_t n = 40000;
+    unsigned char *text = malloc(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *line = (i / 64) % 3 == 0 ? "aaaaaaaaaaaaaaaa"
+                                             : "the quick brown fox jumps ";
+        text[i] = (unsigned char)line[i % strlen(line)];
+    }
+    
+    BlockOptions opts;
+    block_options_init(&opts);
+    opts.lz_level = 1;
+    long huff;
+    long fast = block_trip(text, n, &opts, BLOCK_LZ77, &huff, NULL);
+    opts.lz_level = LZ77_LEVEL_MAX;
+    long len = block_trip(text, n, &opts, BLOCK_LZ77, &huff, NULL);
+    ck_assert_msg(len < huff / 10, "LZ77 should find matches.");
+    ck_assert_msg(len <= fast, "Higher levels should not do worse.");
+    
+    // The literal and length codes can be limited like those of bytes:
+    uint64_t counts[LZ77_LITLEN_SYMBOLS];
+    unsigned char lens[LZ77_LITLEN_SYMBOLS];
+    for (int s = 0; s < LZ77_LITLEN_SYMBOLS; s++)
+        counts[s] = ((uint64_t)1 << (s % 40)) + s;
+    ck_assert_int_eq(huffman_lengths(counts, LZ77_LITLEN_SYMBOLS,
+                                     HUFFMAN_LIMIT_MIN, lens, NULL), 0);
+    for (int s = 0; s < LZ77_LITLEN_SYMBOLS; s++)
+        ck_assert_msg(lens[s] >= 1 && lens[s] <= HUFFMAN_LIMIT_MIN,
+                      "Symbol %d should have a limited code.", s);
+    opts.max_code_len = HUFFMAN_LIMIT_MIN;
+    block_trip(text, n, &opts, BLOCK_LZ77, &huff, NULL);
+    
+    free(text);
+}
+END_TEST
+
+START_TEST(test_block_streams)
+{
+    // Six streams, so a group of four and two more, of skewed characters:
+    size_t n = 30001;
+    unsigned char *text = malloc(n), *back = malloc(n), *coded;
+    for (size_t i = 0; i < n; i++)
+        text[i] = (unsigned char)('a' + (i * i + i / 7) % 23 % 13);
+    
+    BlockOptions opts;
+    block_options_init(&opts);
+    opts.streams = 6;
+    long order0;
+    long len = block_trip(text, n, &opts, BLOCK_STREAMS, &order0, &coded);
+    
+    // The jump table follows the lengths and the count of streams.  Each
+    // jump covers a sixth of the characters, so it is no more than their
+    // codes can take, and the last stream gets the rest of the block:
+    BitsIOFile *bits = bits_io_open_mem(coded + 1, len - 1, "r");
+    unsigned char lens[CANON_SYMBOLS];
+    ck_assert_int_eq(canon_read_lengths(bits, lens), 0);
+    ck_assert_int_eq(bits_io_peek_bits(bits, 4), 5);
+    bits_io_skip_bits(bits, 4);
+    size_t pos = 1 + (size_t)((bits_io_num_bits(bits) + 7) >> 3);
+    bits_io_close(bits);
+    int longest = 0;
+    for (int c = 0; c < CANON_SYMBOLS; c++)
+        longest = lens[c] > longest ? lens[c] : longest;
+    size_t seg = (n + 5) / 6, streams = pos + 4 * 5;
+    for (int s = 0; s < 5; s++)
+    {
+        const unsigned char *p = coded + pos + 4 * s;
+        size_t jump = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) |
+                      ((size_t)p[2] << 8) | p[3];
+        ck_assert_msg(jump > 0 && jump <= (seg * longest + 7) / 8,
+                      "Stream %d should fit its characters.", s);
+        streams += jump;
+    }
+    ck_assert_msg(streams < (size_t)len, "The last stream should be left.");
+    
+    // A jump past the end of the block is an error:
+    coded[pos] = 0xff;
+    ck_assert_int_eq(block_decode(NULL, coded, len, back, n), -1);
+    
+    // The encoder turns down streams for blocks that are never split:
+    EncoderOptions eopts;
+    encoder_options_init(&eopts);
+    eopts.block.streams = 4;
+    for (int i = 0; i < 5; i++)
+    {
+        EncoderOptions bad = eopts;
+        if (i == 0)
+            bad.block.symbol_bits = 16;
+        else if (i == 1)
+            bad.block.coder = BLOCK_CODER_ANS;
+        else if (i == 2)
+            bad.block.adapt_interval = BLOCK_ADAPT_MIN;
+        else if (i == 3)
+            bad.block.order = 1;
+        else
+            bad.block.lz_level = 5;
+        const char *why = NULL;
+        ck_assert_msg(encoder_new_opts("books/simple.txt", "test/test.he",
+                                       &bad, &why) == NULL && why != NULL,
+                      "Streams should be refused in mode %d.", i);
+    }
+    const char *why = "";
+    Encoder *encoder = encoder_new_opts("books/simple.txt", "test/test.he",
+                                        &eopts, &why);
+    ck_assert_msg(encoder != NULL && why == NULL,
+                  "Streams should be accepted.");
+    encoder_free(encoder);
+    remove("test/test.he");
+    
+    free(text);
+    free(coded);
+    free(back);
+}
+END_TEST
+
+START_TEST(test_cpu_kernels)
+{
+    // The portable kernels and the ones for this CPU agree on every byte,
+    // with codes long enough to take the slow paths too:
+    size_t n = 50000;
+    unsigned char *text = malloc(n), *coded[2], *back = malloc(n);
+    long len[2];
+    for (size_t i = 0; i < n; i++)
+        text[i] = (unsigned char)(i % 97 == 0 ? i / 97 % 251 : 'a' + i % 5);
+    
+    BlockOptions opts;
+    block_options_init(&opts);
+    opts.streams = 4;
+    BlockCtx *ctx = block_ctx_new();
+    for (int k = 0; k < 2; k++)
+    {
+        cpu_limit(k == 0 ? 0 : CPU_BMI2 | CPU_AVX2);
+        coded[k] = malloc(block_bound(n));
+        len[k] = block_encode(ctx, text, n, coded[k], block_bound(n), &opts);
+        ck_assert_msg(len[k] > 0, "Block should encode.");
+        ck_assert_int_eq(block_decode(ctx, coded[k], len[k], back, n), 0);
+        ck_assert_msg(memcmp(text, back, n) == 0, "Block should round trip.");
+    }
+    ck_assert_int_eq(len[0], len[1]);
+    ck_assert_msg(memcmp(coded[0], coded[1], len[0]) == 0,
+                  "Kernels should write the same bits.");
+    
+    block_ctx_free(ctx);
+    free(text);
+    free(coded[0]);
+    free(coded[1]);
+    free(back);
+}
+END_TEST
+
+START_TEST(test_decoder_range)
+{
+    // Small blocks, with every other one in the index:
+    EncoderOptions opts;
+    encoder_options_init(&opts);
+    opts.block_size = 1 << 16;
+    opts.index_interval = 1 << 17;
+    Encoder *encoder = encoder_new_opts("books/iliad.txt", "test/test.he",
+                                        &opts, NULL);
+    ck_assert_msg(encoder != NULL, "encoder should not be null.");
+    ck_assert_msg(encoder_encode(encoder) > 0, "encoding should work.");
+    encoder_free(encoder);
+    
+    FILE *fp = fopen("books/iliad.txt", "rb");
+    unsigned char *text = malloc(1 << 20), *part = malloc(1 << 20);
+    size_t n = fread(text, 1, 1 << 20, fp);
+    fclose(fp);
+    
+    // A range across two blocks, one at the very end and one past it:
+    uint64_t ranges[3][2] = { { 400000, 100000 }, { n - 10, 10 },
+                              { n + 5, 10 } };
+    for (int i = 0; i < 3; i++)
+    {
+        Decoder *decoder = decoder_new("test/test.he", "test/test.txt");
+        ck_assert_msg(decoder != NULL, "decoder should not be null.");
+        ck_assert_int_eq(decoder_decode_range(decoder, ranges[i][0],
+                                              ranges[i][1]), 0);
+        decoder_free(decoder);
+        
+        fp = fopen("test/test.txt", "rb");
+        size_t got = fread(part, 1, 1 << 20, fp);
+        fclose(fp);
+        size_t want = ranges[i][0] >= n ? 0 : ranges[i][1];
+        ck_assert_int_eq(got, want);
+        ck_assert_msg(memcmp(part, text + ranges[i][0], got) == 0,
+                      "Range %d should match the input.", i);
+    }
+    
+    free(text);
+    free(part);
+    remove("test/test.he");
+    remove("test/test.txt");
+}
+END_TEST
+
+START_TEST(test_decoder_legacy)
+{
+    // A file smaller than the longest tree the original format can hold:
+    EncoderOptions opts;
+    encoder_options_init(&opts);
+    opts.framed = 0;
+    Encoder *encoder = encoder_new_opts("books/simple.txt", "test/test.he",
+                                        &opts, NULL);
+    ck_assert_msg(encoder != NULL, "encoder should not be null.");
+    ck_assert_msg(encoder_encode(encoder) > 0, "encoding should work.");
+    encoder_free(encoder);
+    ck_assert_msg(fsize("test/test.he") < TREE_TEXT_MAX,
+                  "the encoded file should be small.");
+    
+    Decoder *decoder = decoder_new("test/test.he", "test/test.txt");
+    ck_assert_msg(decoder != NULL, "decoder should not be null.");
+    ck_assert_int_eq(decoder_decode(decoder), 0);
+    decoder_free(decoder);
+    
+    FILE *fp = fopen("books/simple.txt", "rb");
+    unsigned char *text = malloc(1 << 16), *back = malloc(1 << 16);
+    size_t n = fread(text, 1, 1 << 16, fp);
+    fclose(fp);
+    fp = fopen("test/test.txt", "rb");
+    size_t got = fread(back, 1, 1 << 16, fp);
+    fclose(fp);
+    ck_assert_int_eq(got, n);
+    ck_assert_msg(memcmp(text, back, n) == 0, "the text should come back.");
+    
+    free(text);
+    free(back);
+    remove("test/test.he");
+    remove("test/test.txt");
+}
+END_TEST
+
+/**
+ * Returns 1 if the two files hold the same bytes, 0 otherwise.
+ */
+static int same_file (const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+    while (same)
+    {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        same = ca == cb;
+        if (ca == EOF)
+            break;
+    }
+    if (fa != NULL)
+        fclose(fa);
+    if (fb != NULL)
+        fclose(fb);
+    return same;
+}
+
+START_TEST(test_encoder_budget)
+{
+    // An input within the memory budget is read in one go, one beyond it
+    // in chunks, twice; either way it comes back the same:
+    uint64_t reads[2];
+    for (int k = 0; k < 2; k++)
+    {
+        EncoderOptions opts;
+        encoder_options_init(&opts);
+        opts.framed = 0;
+        if (k == 1)
+            opts.memory_budget = fsize("books/iliad.txt") / 4;
+        
+        stats_enable(1);
+        stats_reset();
+        Encoder *encoder = encoder_new_opts("books/iliad.txt", "test/test.he",
+                                            &opts, NULL);
+        ck_assert_msg(encoder != NULL, "encoder should not be null.");
+        ck_assert_msg(encoder_encode(encoder) > 0, "encoding should work.");
+        encoder_free(encoder);
+        HuffStats st;
+        stats_get(&st);
+        reads[k] = st.count[STATS_READ_CALLS];
+        stats_enable(0);
+        
+        Decoder *decoder = decoder_new("test/test.he", "test/test.txt");
+        ck_assert_msg(decoder != NULL, "decoder should not be null.");
+        ck_assert_int_eq(decoder_decode(decoder), 0);
+        decoder_free(decoder);
+        ck_assert_msg(same_file("books/iliad.txt", "test/test.txt"),
+                      "the text should come back.");
+    }
+    ck_assert_int_eq(reads[0], 1);
+    ck_assert_msg(reads[1] > 4, "the input should be read in chunks.");
+    
+    remove("test/test.he");
+    remove("test/test.txt");
+}
+END_TEST
+
+/**
+ * Points the descriptor `fd` at `to` and returns a copy of the old one.
+ */
+static int redirect (int fd, int to)
+{
+    int old = dup(fd);
+    ck_assert_msg(old >= 0 && dup2(to, fd) == fd, "fd should redirect.");
+    close(to);
+    return old;
+}
+
+START_TEST(test_encoder_stdio)
+{
+    // Encode from a pipe on the standard input to the standard output,
+    // then decode that back the same way, all through the names "-":
+    FILE *fp = fopen("books/aladdin.txt", "rb");
+    ck_assert_msg(fp != NULL, "the book should open.");
+    static char text[16384];
+    size_t n = fread(text, 1, sizeof(text), fp);
+    fclose(fp);
+    ck_assert_msg(n > 0 && n < sizeof(text), "the book should fit a pipe.");
+    
+    int fds[2];
+    ck_assert_int_eq(pipe(fds), 0);
+    ck_assert_int_eq(write(fds[1], text, n), (ssize_t)n);
+    close(fds[1]);
+    fflush(stdout);
+    int in = redirect(0, fds[0]);
+    int out = redirect(1, open("test/test.he",
+                               O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    
+    EncoderOptions opts;
+    encoder_options_init(&opts);
+    Encoder *encoder = encoder_new_opts("-", "-", &opts, NULL);
+    int count = encoder == NULL ? -1 : encoder_encode(encoder);
+    if (encoder != NULL)
+        encoder_free(encoder);
+    fflush(stdout);
+    clearerr(stdin);
+    
+    redirect(0, open("test/test.he", O_RDONLY));
+    redirect(1, open("test/test.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    Decoder *decoder = decoder_new("-", "-");
+    int result = decoder == NULL ? -1 : decoder_decode(decoder);
+    if (decoder != NULL)
+        decoder_free(decoder);
+    fflush(stdout);
+    clearerr(stdin);
+    
+    redirect(0, in);
+    redirect(1, out);
+    ck_assert_int_eq(count, (int)n);
+    ck_assert_int_eq(result, 0);
+    
+    static char back[16384];
+    fp = fopen("test/test.txt", "rb");
+    ck_assert_msg(fp != NULL, "the output should exist.");
+    ck_assert_int_eq(fread(back, 1, sizeof(back), fp), n);
+    fclose(fp);
+    ck_assert_msg(memcmp(text, back, n) == 0, "the text should come back.");
+    
+    remove("test/test.he");
+    remove("test/test.txt");
+}
+END_TEST
+
+START_TEST(test_probes_off)
+{
+#ifdef HUFF_PROBES
+    ck_assert_msg(0, "HUFF_NO_PROBES should leave the probes out.");
+#endif
+    // Without the probes, probe_now is a constant and each PROBE macro is
+    // an expression that evaluates its arguments once and nothing else;
+    // the probe names are not even looked up:
+    int calls = 0;
+    ck_assert_int_eq(probe_now(), 0);
+    PROBE1(no_such_probe, calls++);
+    PROBE2(no_such_probe, calls++, calls++);
+    PROBE3(no_such_probe, calls++, calls++, probe_now());
+    PROBE4(no_such_probe, calls++, calls++, calls++, probe_now() - 1);
+    ck_assert_int_eq(calls, 8);
+}
+END_TEST
+
+START_TEST(test_stats)
+{
+    stats_enable(1);
+    stats_reset();
+    Encoder *encoder = encoder_new("books/iliad.txt", "test/test.he");
+    ck_assert_msg(encoder != NULL, "encoder should not be null.");
+    ck_assert_msg(encoder_encode(encoder) > 0, "encoding should work.");
+    encoder_free(encoder);
+    
+    HuffStats st;
+    stats_get(&st);
+    ck_assert_int_eq(st.count[STATS_BYTES_IN], fsize("books/iliad.txt"));
+    ck_assert_int_eq(st.count[STATS_BYTES_OUT], fsize("test/test.he"));
+    ck_assert_msg(st.count[STATS_SYMBOLS] > 0, "symbols should be counted.");
+    ck_assert_msg(st.count[STATS_CODE_BITS] > st.count[STATS_SYMBOLS],
+                  "code bits should be counted.");
+    ck_assert_msg(st.max_code_len > 0 && st.max_code_len <= 32,
+                  "max code len should be noted.");
+    ck_assert_msg(st.wall[STATS_ENCODE] > 0, "encoding should be timed.");
+    
+    // Decoding adds to what is there:
+    stats_reset();
+    Decoder *decoder = decoder_new("test/test.he", "test/test.txt");
+    ck_assert_msg(decoder != NULL, "decoder should not be null.");
+    ck_assert_int_eq(decoder_decode(decoder), 0);
+    decoder_free(decoder);
+    stats_get(&st);
+    ck_assert_int_eq(st.count[STATS_BYTES_IN], fsize("test/test.he"));
+    ck_assert_int_eq(st.count[STATS_BYTES_OUT], fsize("books/iliad.txt"));
+    ck_assert_msg(st.wall[STATS_DECODE] > 0, "decoding should be timed.");
+    
+    // Nothing is recorded while the stats are off:
+    stats_enable(0);
+    stats_reset();
+    encoder = encoder_new("books/iliad.txt", "test/test.he");
+    encoder_encode(encoder);
+    encoder_free(encoder);
+    stats_get(&st);
+    ck_assert_int_eq(st.count[STATS_BYTES_IN], 0);
+    ck_assert_msg(st.wall[STATS_ENCODE] == 0, "nothing should be timed.");
+    
+    remove("test/test.he");
+    remove("test/test.txt");
+}
+END_TEST
+
+//////////////////////////////////////////////////////////////////////
+///////////// huff unit tests
+//////////////////////////////////////////////////////////////////////
+
+START_TEST(test_huff_compress)
+{
+    // Enough text for more than one block:
+    size_t n = DEFAULT_BLOCK_SIZE + 1000;
+    char *text = malloc(n);
+    for (size_t i = 0; i < n; i++)
+        text[i] = "the quick brown fox jumps over the lazy dog\n"[i % 44];
+    
+    size_t cap = huff_compress_bound(n);
+    char *packed = malloc(cap);
+    char *back = malloc(n);
+    long len = huff_compress(text, n, packed, cap);
+    ck_assert_msg(len > 0 && len < (long)n * 2 / 3, "Text should compress.");
+    ck_assert_int_eq(huff_decompressed_size(packed, len), n);
+    ck_assert_int_eq(huff_decompress(packed, len, back, n), n);
+    ck_assert_msg(memcmp(text, back, n) == 0, "Text should round trip.");
+    
+    // Buffers that are too small and truncated input are errors:
+    ck_assert_int_eq(huff_decompress(packed, len, back, n - 1), -1);
+    ck_assert_int_eq(huff_decompress(packed, len - 1, back, n), -1);
+    ck_assert_int_eq(huff_compress(text, n, packed, 20), -1);
+    
+    // Empty input still makes a valid file:
+    len = huff_compress(text, 0, packed, huff_compress_bound(0));
+    ck_assert_int_eq(len, huff_compress_bound(0));
+    ck_assert_int_eq(huff_decompress(packed, len, back, 0), 0);
+    
+    free(text);
+    free(packed);
+    free(back);
+}
+END_TEST
+
+START_TEST(test_huff_ctx)
+{
+    HuffCtx *ctx = huff_ctx_new(NULL);
+    ck_assert_msg(ctx != NULL, "Context should not be NULL.");
+    
+    // One context serves inputs of all sizes, one after the other, and
+    // gives the same output as the calls without a context:
+    char text[5000], packed[6000], expect[6000], back[5000];
+    for (size_t n = 0; n <= sizeof(text); n += 250)
+    {
+        for (size_t i = 0; i < n; i++)
+            text[i] = "abcdefgh"[(i * i + n) % (n % 7 + 2)];
+        long len = huff_compress_ctx(ctx, text, n, packed, sizeof(packed));
+        ck_assert_int_eq(huff_compress(text, n, expect, sizeof(expect)), len);
+        ck_assert_msg(memcmp(packed, expect, len) == 0,
+                      "Output should not depend on the context.");
+        ck_assert_int_eq(huff_decompress_ctx(ctx, packed, len, back, n), n);
+        ck_assert_msg(memcmp(text, back, n) == 0, "Text should round trip.");
+    }
+    huff_ctx_free(ctx);
+}
+END_TEST
+
 //////////////////////////////////////////////////////////////////////
 ///////////// Test Suite
 //////////////////////////////////////////////////////////////////////
@@ -406,6 +1499,9 @@ Suite* tester_suite() {
     tcase_add_test(tc_inc, test_bits_io_close);
     tcase_add_test(tc_inc, test_bits_io_write_bit);
     tcase_add_test(tc_inc, test_bits_io_read_bit);
+    tcase_add_test(tc_inc, test_bits_io_write_bits);
+    tcase_add_test(tc_inc, test_bits_io_mapped);
+    tcase_add_test(tc_inc, test_aio);
     
     tcase_add_test(tc_inc, test_pqueue_new);
     tcase_add_test(tc_inc, test_pqueue_free);
@@ -415,13 +1511,39 @@ Suite* tester_suite() {
     tcase_add_test(tc_inc, test_tree_new);
     tcase_add_test(tc_inc, test_tree_free);
     tcase_add_test(tc_inc, test_tree_size);
+    tcase_add_test(tc_inc, test_tree_flatten);
     
     tcase_add_test(tc_inc, test_huffman_build_tree);
     tcase_add_test(tc_inc, test_huffman_find);
+    tcase_add_test(tc_inc, test_huffman_merge_leaves);
+    tcase_add_test(tc_inc, test_huffman_build_lengths);
     
     tcase_add_test(tc_inc, test_table_build);
     tcase_add_test(tc_inc, test_table_free);
     tcase_add_test(tc_inc, test_table_encode);
+    
+    tcase_add_test(tc_inc, test_histogram_count);
+    
+    tcase_add_test(tc_inc, test_canon_codes);
+    tcase_add_test(tc_inc, test_dtable_decode);
+    
+    tcase_add_test(tc_inc, test_block_round_trip);
+    tcase_add_test(tc_inc, test_block_words);
+    tcase_add_test(tc_inc, test_block_order1);
+    tcase_add_test(tc_inc, test_block_adaptive);
+    tcase_add_test(tc_inc, test_block_ans);
+    tcase_add_test(tc_inc, test_block_lz77);
+    tcase_add_test(tc_inc, test_block_streams);
+    tcase_add_test(tc_inc, test_cpu_kernels);
+    tcase_add_test(tc_inc, test_decoder_range);
+    tcase_add_test(tc_inc, test_decoder_legacy);
+    tcase_add_test(tc_inc, test_encoder_budget);
+    tcase_add_test(tc_inc, test_encoder_stdio);
+    tcase_add_test(tc_inc, test_probes_off);
+    tcase_add_test(tc_inc, test_stats);
+    
+    tcase_add_test(tc_inc, test_huff_compress);
+    tcase_add_test(tc_inc, test_huff_ctx);
     // Add unit tests to test suite:
     suite_add_tcase(s, tc_inc);
     /**** END UNIT TESTS   ****/
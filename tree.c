@@ -13,7 +13,6 @@
 #include <string.h>
 #include <assert.h>
 #include "tree.h"
-#include "pqueue.h"
 #include "huffman.h"
 
 // This is used to give each node in the tree a unique identifier:
@@ -38,18 +37,27 @@ int tree_size (TreeNode *tree)
 {
     if (tree == NULL)
         return 0;
+    else if (tree->nodes > 0)
+        return tree->nodes;
     else
         return tree_size(tree->left) + tree_size(tree->right) + 1;
 }
 
 /**
- * Deallocates a TreeNode object.
+ * Deallocates a TreeNode object and the tree below it.
  */
 void tree_free (TreeNode *tree)
 {
     if (tree == NULL)
         return;
     
+    // A tree built in one block of memory goes with its root:
+    if (tree->nodes > 0)
+    {
+        free(tree);
+        return;
+    }
+    
     tree_free(tree->left);
     tree_free(tree->right);
     free(tree);
@@ -96,21 +104,20 @@ void tree_print(TreeNode* tree)
 
 /**
  * This is a private function that recursively serializes the give tree to the
- * provided FILE. The format of the serialized tree node is:
+ * text buffer `dst` of `cap` bytes, starting at `*pos`. The format of the
+ * serialized tree node is:
  *
- *   TYPE ID FREQUENCY CHARACTER LEFT_ID RIGHT_ID
+ *   FREQUENCY CHARACTER,
  *
- * Where the TYPE is INTERNAL/LEAF, ID is the id given to the tree node when
- * it is created, FREQUENCY is the frequency of the character found in the
- * input text, LEFT_ID is the id of the left child, and RIGHT_ID is the id of
- * the right child.
+ * Where FREQUENCY is the frequency of the character found in the input text
+ * and CHARACTER is the character as a (signed) number.  Only the leaves are
+ * serialized: the decoder rebuilds the internal nodes with the same algorithm
+ * the encoder used (see merge_nodes in huffman.c).
  *
- * The order of how the tree nodes are serialized is important.  We serialize
- * the child nodes first so when we read the serialized form back in
- * (deserialization) we know that we have already deserialized its children so
- * we can easily assign the correct child TreeNode objects.
+ * Returns a negative value if the buffer is too small.
  */
-static int tree_serialize_rec (TreeNode *tree, FILE *fp)
+static int tree_serialize_rec (TreeNode *tree, char *dst, size_t cap,
+                               size_t *pos)
 {
     int result = 0;
     
@@ -120,20 +127,21 @@ static int tree_serialize_rec (TreeNode *tree, FILE *fp)
     {
         //Only write the leaf nodes, and only store frequency information
         //Decoders can use the same algorithm to reconstruct the tree.
-        result = fprintf(fp, "%d %d,",
-//                         tree->type,
-//                         tree->id,
-                         tree->freq.v,
-                         tree->freq.c);
-//                         tree->left  == NULL ? 0 : tree->left ->id,
-//                         tree->right == NULL ? 0 : tree->right->id);
+        result = snprintf(dst + *pos, cap - *pos, "%d %d,",
+                          tree->freq.v,
+                          tree->freq.c);
+        if (result < 0 || (size_t)result >= cap - *pos)
+        {
+            return -1;
+        }
+        *pos += result;
     } else
     {
         // If the tree is an INTERNAL node then recursively serialize the left
         // subtree and right subtree.
         if (tree->left != NULL)
         {
-            result = tree_serialize_rec(tree->left, fp);
+            result = tree_serialize_rec(tree->left, dst, cap, pos);
             if (result < 0)
             {
                 return result;
@@ -141,25 +149,40 @@ static int tree_serialize_rec (TreeNode *tree, FILE *fp)
         }
         if (tree->right != NULL)
         {
-            result = tree_serialize_rec(tree->right, fp);
+            result = tree_serialize_rec(tree->right, dst, cap, pos);
             if (result < 0)
             {
                 return result;
             }
         }
-        // Lastly, serialize the internal node:
-        //        result = fprintf(fp, "%d %d %d %d %d %d,",
-        //                         tree->type,
-        //                         tree->id,
-        //                         tree->freq.v,
-        //                         tree->freq.c,
-        //                         tree->left  == NULL ? 0 : tree->left ->id,
-        //                         tree->right == NULL ? 0 : tree->right->id);
     }
     return result;
 }
 
 
+/**
+ * Serializes the given tree into the buffer `dst` of `cap` bytes, in the
+ * same format as tree_serialize.  TREE_TEXT_MAX bytes are always enough.
+ * Returns the number of bytes written (without a terminating null) or a
+ * negative value if the buffer is too small.
+ */
+int tree_serialize_mem (TreeNode *tree, char *dst, size_t cap)
+{
+    if (cap < 2)
+    {
+        return -1;
+    }
+    size_t pos = 0;
+    dst[pos++] = '#';
+    if (tree_serialize_rec(tree, dst, cap - 1, &pos) < 0)
+    {
+        return -1;
+    }
+    dst[pos++] = '#';
+    return (int)pos;
+}
+
+
 /**
  * Serializes the given tree to the file fp.  The starting format of the
  * serialized tree is the character '#' and the ending format is also the
@@ -168,106 +191,247 @@ static int tree_serialize_rec (TreeNode *tree, FILE *fp)
  */
 int tree_serialize (TreeNode *tree, FILE *fp)
 {
-    int result;
-    result = fprintf(fp, "#");
-    if (result < 0)
+    char text[TREE_TEXT_MAX];
+    int len = tree_serialize_mem(tree, text, sizeof(text));
+    if (len < 0)
     {
-        return result;
+        return len;
     }
-    result = tree_serialize_rec(tree, fp);
-    if (result < 0)
+    if (fwrite(text, 1, len, fp) < (size_t)len)
     {
-        return result;
+        return -1;
     }
-    result = fprintf(fp, "#");
-    return result;
+    return len;
 }
 
 
 /**
- * Returns a TreeNode object deserialized from the file fp or NULL if an error
- * was encountered in the format.
+ * Parses an optionally negative decimal number at `*p`, before `end`, into
+ * `val` and advances `*p` past it.  Returns false if there is no number.
  */
-TreeNode *tree_deserialize (FILE *fp)
+static bool parse_int (const char **p, const char *end, int *val)
+{
+    const char *q = *p;
+    bool negative = false;
+    if (q < end && *q == '-')
+    {
+        negative = true;
+        q++;
+    }
+    if (q >= end || *q < '0' || *q > '9')
+    {
+        return false;
+    }
+    long v = 0;
+    while (q < end && *q >= '0' && *q <= '9')
+    {
+        v = v * 10 + (*q++ - '0');
+        if (v > 2147483648L)
+        {
+            return false;
+        }
+    }
+    *val = (int)(negative ? -v : v);
+    *p = q;
+    return true;
+}
+
+
+/**
+ * Reads the leaves serialized in the `n` bytes of text at `src` into
+ * `merge`, in the order they are to be merged in, and returns how many
+ * there are, or -1 if an error was encountered in the format.  The number
+ * of bytes the serialized tree took up is stored in `used`.
+ */
+static int read_leaves (const char *src, size_t n, size_t *used,
+                        Frequency merge[256])
 {
-    // First, declare all the important fields we need for a TreeNode:
-//    int type;
-//    int id;
-    int fval;
-    int fch;
-//    int left;
-//    int right;
-    char delim;
+    const char *p   = src;
+    const char *end = src + n;
     
     // Read in the starting delimiter character.  If it is not the
     // correct delimiter (#) then we return NULL.
-    if (getc(fp) != '#')
+    if (p >= end || *p++ != '#')
     {
-        return NULL;
+        return -1;
     }
     
-    // Initialize the delimiter to something other than '#'.
-    delim = ',';
-    
-    // This is the head of a list of TreeNode objects.
-    TreeNode *head = NULL;
+    // The leaves are collected by character first and only merged once all
+    // of them have been read.  That way they are merged in the same order as
+    // in the encoder (see create_tree_nodes in huffman.c), and nodes with
+    // equal frequencies get merged exactly as they were there.
+    Frequency leaves[256];
+    bool have[256] = { false };
+    int nmerge = 0;
     
     // This is the main loop where we keep reading in serialized records of
     // TreeNodes. We keep looping until we see the ending terminal character
     // '#'.
-    PriorityQueue *pq = pqueue_new();
-    while (delim != '#')
+    for (;;)
     {
-        // Read in a record.
-        int count = fscanf(fp, "%d %d,",
-                           &fval,
-                           &fch);
-        
-        // If fscanf reaches the EOF then there is an error in the
-        // file format and we return NULL.
-        if (count == EOF)
+        // Read in a record.  If it is cut short or not in the right format
+        // there is an error in the file format, so we return NULL.
+        int fval;
+        int fch;
+        if (!parse_int(&p, end, &fval) || p >= end || *p++ != ' ' ||
+            !parse_int(&p, end, &fch) || p >= end || *p++ != ',')
         {
-            pqueue_free(pq);
-            return NULL;
+            return -1;
         }
         
-        // If fscanf did not read in all of the values then there is
-        // an error in the file format, so we return NULL.
-        if (count < 2)
-        {
-            pqueue_free(pq);
-            return NULL;
-        }
-        
-        // Construct a new TreeNode object from the values that we read in from
-        // the serialized file. Since we only store leaf nodes, all we read in are
-        // leaf nodes as well
-        TreeNode *n = tree_new();
-//        n->id = id;
-//        n->type = LEAF;
-        n->freq.v = fval;
-        n->freq.c = fch;
+        // Since we only store leaf nodes, all we read in are leaf nodes as
+        // well:
+        Frequency f;
+        f.v = fval;
+        f.c = fch;
         
-        pqueue_enqueue(pq, n);
+        // Only the placeholder node added by merge_nodes for single
+        // character inputs can share a slot with a real character.  It goes
+        // first, like it went into the priority queue of the encoder.
+        unsigned char slot = (unsigned char)fch;
+        if (!have[slot])
+        {
+            leaves[slot] = f;
+            have[slot] = true;
+        } else if (nmerge < 256)
+            merge[nmerge++] = f;
         
-        // This is the delimiter check.  We grab the next character from the file
-        // and check to see if it is the end of the input. The end is marked with
-        // a '#' character. If it is not a '#' character we push the character
-        // back into the file stream and continue with the loop.
-        delim = fgetc(fp);
-        if (delim != '#')
+        // This is the delimiter check.  The end is marked with a '#'
+        // character.
+        if (p < end && *p == '#')
         {
-            ungetc(delim, fp);
+            p++;
+            break;
         }
     }
     
-    //The reconstruct the tree using these leaf nodes
-    head = merge_nodes(pq);
-    pqueue_free(pq);
-    return head;
+    for (int i = 0; i < 256; i++)
+    {
+        if (have[i] && nmerge < 256)
+            merge[nmerge++] = leaves[i];
+    }
+    *used = p - src;
+    return nmerge;
+}
+
+
+/**
+ * Returns a TreeNode object deserialized from the `n` bytes of text at `src`
+ * or NULL if an error was encountered in the format.  The number of bytes
+ * the serialized tree took up is stored in `used`.
+ */
+TreeNode *tree_deserialize_mem (const char *src, size_t n, size_t *used)
+{
+    //The reconstruct the tree using the leaf nodes
+    Frequency merge[256];
+    int nmerge = read_leaves(src, n, used, merge);
+    return nmerge < 0 ? NULL : huffman_merge_freqs(merge, nmerge);
+}
+
+
+/**
+ * Builds the tree serialized in the `n` bytes at `src` in the FlatTree.
+ * Returns -1 if an error was encountered in the format.
+ */
+int tree_deserialize_flat (const char *src, size_t n, size_t *used,
+                           FlatTree *flat)
+{
+    Frequency merge[256];
+    int nmerge = read_leaves(src, n, used, merge);
+    return nmerge < 0 ? -1 : huffman_merge_flat(merge, nmerge, flat);
+}
+
+
+/**
+ * Returns a TreeNode object deserialized from the file fp or NULL if an error
+ * was encountered in the format.
+ */
+TreeNode *tree_deserialize (FILE *fp)
+{
+    // Read in the text up to and including the ending delimiter and parse it
+    // from memory.
+    char text[TREE_TEXT_MAX];
+    size_t n = 0;
+    int hashes = 0;
+    while (hashes < 2 && n < sizeof(text))
+    {
+        int ch = getc(fp);
+        if (ch == EOF)
+        {
+            return NULL;
+        }
+        text[n++] = (char)ch;
+        if (ch == '#')
+        {
+            hashes++;
+        }
+    }
+    size_t used;
+    return tree_deserialize_mem(text, n, &used);
 }
 
 bool tree_is_leaf(TreeNode *node)
 {
     return node->left == NULL && node->right == NULL;
 }
+
+
+/**
+ * Empties the FlatTree.
+ */
+void flat_init (FlatTree *flat)
+{
+    flat->root  = FLAT_NONE;
+    flat->count = 0;
+}
+
+
+/**
+ * Adds an internal node with no children to the FlatTree and returns its
+ * reference, or FLAT_NONE if all FLAT_NODES are taken.
+ */
+NodeRef flat_add (FlatTree *flat)
+{
+    if (flat->count == FLAT_NODES)
+        return FLAT_NONE;
+    NodeRef r = (NodeRef)flat->count++;
+    flat->kid[r][0] = FLAT_NONE;
+    flat->kid[r][1] = FLAT_NONE;
+    return r;
+}
+
+
+/**
+ * Copies `node` and everything below it into the FlatTree and returns its
+ * reference.  `*err` is set if the FlatTree runs out of nodes.
+ */
+static NodeRef flatten_node (TreeNode *node, FlatTree *flat, int *err)
+{
+    if (node == NULL)
+        return FLAT_NONE;
+    if (tree_is_leaf(node))
+        return FLAT_LEAF | (unsigned char)node->freq.c;
+
+    NodeRef r = flat_add(flat);
+    if (r == FLAT_NONE)
+    {
+        *err = 1;
+        return FLAT_NONE;
+    }
+    flat->kid[r][1] = flatten_node(node->left,  flat, err);
+    flat->kid[r][0] = flatten_node(node->right, flat, err);
+    return r;
+}
+
+
+/**
+ * Copies the tree at `root` into the FlatTree.  Returns -1 if it has more
+ * internal nodes than a FlatTree can hold.
+ */
+int tree_flatten (TreeNode *root, FlatTree *flat)
+{
+    int err = 0;
+    flat_init(flat);
+    flat->root = flatten_node(root, flat, &err);
+    return err ? -1 : 0;
+}
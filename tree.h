@@ -2,6 +2,7 @@
 #define __TREE_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 /**
@@ -33,6 +34,9 @@ struct TreeNode {
     Frequency  freq;
     TreeNode  *left;
     TreeNode  *right;
+    int        nodes;   // In the root of a tree built in one block of
+                        // memory (see huffman_merge_freqs), the number of
+                        // nodes in it; 0 otherwise
 };
 
 
@@ -44,7 +48,7 @@ TreeNode *tree_new ();
 
 
 /**
- * Deallocates a TreeNode object.
+ * Deallocates a TreeNode object and the tree below it.
  */
 void tree_free (TreeNode *root);
 
@@ -75,6 +79,84 @@ int tree_serialize (TreeNode *root, FILE *fp);
  */
 TreeNode* tree_deserialize (FILE *fp);
 
+/**
+ * The serialized form of a tree of byte characters never takes more than
+ * this many bytes (up to 257 leaves of "FREQUENCY CHARACTER," plus the two
+ * delimiters).
+ */
+#define TREE_TEXT_MAX (257 * 17 + 2)
+
+/**
+ * Serializes the given tree into the buffer `dst` of `cap` bytes, in the
+ * same format as tree_serialize.  Returns the number of bytes written or a
+ * negative value if the buffer is too small.
+ */
+int tree_serialize_mem (TreeNode *root, char *dst, size_t cap);
+
+/**
+ * Returns a TreeNode object deserialized from the `n` bytes at `src` or NULL
+ * if an error was encountered in the format.  The number of bytes the
+ * serialized tree took up is stored in `used`.
+ */
+TreeNode* tree_deserialize_mem (const char *src, size_t n, size_t *used);
+
 bool tree_is_leaf(TreeNode *node);
 
+
+/**
+ * A FlatTree holds the shape of a Huffman tree in one flat array instead of
+ * nodes linked by pointers, which is what the coding tables are built from
+ * and what the decoder walks for long codes.  Nodes are referred to by a
+ * 16 bit NodeRef: an internal node by its index into `kid`, a leaf by
+ * FLAT_LEAF plus its character, and a missing child by FLAT_NONE.  A
+ * FlatTree needs no freeing of its own, it goes away with the memory that
+ * holds it.
+ */
+typedef uint16_t NodeRef;
+
+#define FLAT_LEAF  0x8000
+#define FLAT_NONE  0xFFFF
+#define FLAT_NODES 512
+
+#define FLAT_IS_LEAF(r) (((r) & FLAT_LEAF) && (r) != FLAT_NONE)
+#define FLAT_CHAR(r)    ((unsigned char)((r) & 0xFF))
+
+typedef struct FlatTree FlatTree;
+struct FlatTree {
+    NodeRef root;               // FLAT_NONE for an empty tree
+    int     count;              // Number of internal nodes in use
+    NodeRef kid[FLAT_NODES][2]; // Children of each internal node: [1] is
+                                // reached with a 1 bit (left), [0] with a
+                                // 0 bit (right)
+};
+
+
+/**
+ * Empties the FlatTree.
+ */
+void flat_init (FlatTree *flat);
+
+
+/**
+ * Adds an internal node with no children to the FlatTree and returns its
+ * reference, or FLAT_NONE if all FLAT_NODES are taken.
+ */
+NodeRef flat_add (FlatTree *flat);
+
+
+/**
+ * Copies the tree at `root` into the FlatTree.  Returns -1 if it has more
+ * internal nodes than a FlatTree can hold.
+ */
+int tree_flatten (TreeNode *root, FlatTree *flat);
+
+
+/**
+ * Builds the tree serialized in the `n` bytes at `src` in the FlatTree,
+ * without making its nodes, and stores the number of bytes it took up in
+ * `used`.  Returns -1 if an error was encountered in the format.
+ */
+int tree_deserialize_flat (const char *src, size_t n, size_t *used,
+                           FlatTree *flat);
+
 #endif
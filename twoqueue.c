@@ -0,0 +1,220 @@
+/********************************************************************
+
+ The twoqueue module builds the shape of a Huffman tree in linear time once
+ the leaves are sorted, instead of going through the priority queue of
+ pqueue.c for every node.  The idea is that the internal nodes are made in
+ order of weight: each one weighs the sum of the two lightest nodes left,
+ which is never less than the one made before it.  So two plain FIFO queues
+ are enough, one holding the sorted leaves and one the internal nodes as
+ they are made, and the lightest node left is always at the head of one of
+ them.
+
+ The leaves are sorted once with a radix sort, a byte of the key at a time
+ from the lowest one up.  Bytes that are the same in every key are skipped,
+ so small counts take only a few passes over the leaves.
+
+ *******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "twoqueue.h"
+
+
+/**
+ * Returns a new TwoQueue for up to `cap` leaves or NULL if there is an
+ * error.  The arrays follow the structure in the same allocation, the 8 byte
+ * ones first so that all of them are aligned.
+ */
+TwoQueue *twoqueue_new (int cap)
+{
+    size_t size = sizeof(TwoQueue) +
+                  (size_t)cap * (3 * sizeof(uint64_t) + 2 * sizeof(int) +
+                                 3 * sizeof(int));
+    TwoQueue *tq = (TwoQueue *)(malloc(size));
+    if (tq == NULL)
+        return NULL;
+
+    tq->n      = 0;
+    tq->cap    = cap;
+    tq->key    = (uint64_t *)(tq + 1);
+    tq->weight = (int64_t *)(tq->key + cap);
+    tq->inner  = tq->weight + cap;
+    tq->kids   = (int (*)[2])(tq->inner + cap);
+    tq->tie    = (int *)(tq->kids + cap);
+    tq->order  = tq->tie + cap;
+    tq->tmp    = tq->order + cap;
+    return tq;
+}
+
+
+/**
+ * Frees a TwoQueue.
+ */
+void twoqueue_free (TwoQueue *tq)
+{
+    free(tq);
+}
+
+
+/**
+ * Empties the TwoQueue.
+ */
+void twoqueue_init (TwoQueue *tq)
+{
+    tq->n = 0;
+}
+
+
+/**
+ * Adds a leaf of the given weight and tie breaker.  Returns -1 if the
+ * TwoQueue is full.
+ */
+int twoqueue_add (TwoQueue *tq, int64_t weight, int tie)
+{
+    if (tq->n == tq->cap)
+        return -1;
+
+    int i = tq->n++;
+    tq->weight[i] = weight;
+    tq->tie[i]    = tie;
+
+    // The weight comes first and the tie breaker last, both shifted so that
+    // the smallest one they can be is 0:
+    tq->key[i] = ((uint64_t)(weight + 1) << 17) |
+                 (uint64_t)(tie + TWOQUEUE_TIES);
+    return 0;
+}
+
+
+/**
+ * Sorts the `n` numbers in `order` by `key[order[i]]`, keeping numbers with
+ * equal keys in the order given.
+ */
+void twoqueue_sort (const uint64_t *key, int *order, int *tmp, int n)
+{
+    uint64_t diff = 0;
+    for (int i = 1; i < n; i++)
+        diff |= key[order[i]] ^ key[order[0]];
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        if (((diff >> shift) & 0xFF) == 0)
+            continue;
+
+        int start[256 + 1] = { 0 };
+        for (int i = 0; i < n; i++)
+            start[((key[order[i]] >> shift) & 0xFF) + 1]++;
+        for (int b = 0; b < 256; b++)
+            start[b + 1] += start[b];
+        for (int i = 0; i < n; i++)
+            tmp[start[(key[order[i]] >> shift) & 0xFF]++] = order[i];
+        memcpy(order, tmp, n * sizeof(int));
+    }
+}
+
+
+/**
+ * Returns the weight of node `ref`.
+ */
+static int64_t weight_of (const TwoQueue *tq, int ref)
+{
+    return ref < tq->n ? tq->weight[ref] : tq->inner[ref - tq->n];
+}
+
+
+/**
+ * Merges the leaves into a tree and fills in `kids`.  Returns -1 if `exact`
+ * is set and two waiting nodes compared equal, 0 otherwise.
+ */
+int twoqueue_merge (TwoQueue *tq, int exact)
+{
+    int n = tq->n;
+    if (n < 2)
+        return -1;
+
+    for (int i = 0; i < n; i++)
+        tq->order[i] = i;
+    twoqueue_sort(tq->key, tq->order, tq->tmp, n);
+
+    // Leaves that compare equal to each other, or to an internal node (a
+    // tie breaker of 0), are what the priority queue may take in any order:
+    int *zeros = tq->tmp, nzeros = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int leaf = tq->order[i];
+        if (exact && i > 0 && tq->key[leaf] == tq->key[tq->order[i - 1]])
+            return -1;
+        if (tq->tie[leaf] == 0)
+            zeros[nzeros++] = i;
+    }
+
+    int next = 0;            // Next leaf, as a position in `order`
+    int head = 0, tail = 0;  // The internal nodes still waiting
+    for (int k = 0; k < n - 1; k++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            int take_leaf;
+            if (next == n)
+                take_leaf = 0;
+            else if (head == tail)
+                take_leaf = 1;
+            else
+            {
+                int leaf = tq->order[next];
+                int64_t lw = tq->weight[leaf], iw = tq->inner[head];
+                if (lw != iw)
+                    take_leaf = lw < iw;
+                else if (tq->tie[leaf] != 0)
+                    take_leaf = tq->tie[leaf] < 0;
+                else if (exact)
+                    return -1;
+                else
+                    take_leaf = 1;
+            }
+            tq->kids[k][j] = take_leaf ? tq->order[next++] : n + head++;
+        }
+
+        int64_t w = weight_of(tq, tq->kids[k][0]) +
+                    weight_of(tq, tq->kids[k][1]);
+        if (exact)
+        {
+            // The internal nodes are made in order of weight, so a node
+            // waiting with the same weight is the one made just before:
+            if (head < tail && tq->inner[tail - 1] == w)
+                return -1;
+            for (int z = 0; z < nzeros; z++)
+            {
+                if (zeros[z] >= next && tq->weight[tq->order[zeros[z]]] == w)
+                    return -1;
+            }
+        }
+        tq->inner[tail++] = w;
+    }
+    return 0;
+}
+
+
+/**
+ * Stores the depth of each leaf in the merged tree in `depth`.
+ */
+void twoqueue_depths (const TwoQueue *tq, unsigned char *depth)
+{
+    int n = tq->n;
+    int *inner = tq->tmp;
+
+    // Every internal node is made after its children, so going backwards
+    // from the root reaches each node after its parent:
+    inner[n - 2] = 0;
+    for (int k = n - 2; k >= 0; k--)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            int ref = tq->kids[k][j];
+            if (ref < n)
+                depth[ref] = (unsigned char)(inner[k] + 1);
+            else
+                inner[ref - n] = inner[k] + 1;
+        }
+    }
+}
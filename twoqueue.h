@@ -0,0 +1,92 @@
+#ifndef __TWOQUEUE_H
+#define __TWOQUEUE_H
+
+#include <stdint.h>
+
+/**
+ * Tie breakers go from -TWOQUEUE_TIES to TWOQUEUE_TIES - 1, enough for
+ * alphabets of up to 2^16 symbols.
+ */
+#define TWOQUEUE_TIES (1 << 16)
+
+/**
+ * A TwoQueue builds the shape of a Huffman tree with the two-queue method,
+ * for up to the number of leaves it was made for.  All its memory comes
+ * from a single allocation.
+ *
+ * A node is referred to by a number: the leaves by the order they were
+ * added in (0 to n - 1), and the internal nodes by n plus the order they
+ * were made in, so the root is 2n - 2.
+ */
+typedef struct TwoQueue TwoQueue;
+struct TwoQueue {
+    int       n;         // Leaves added so far
+    int       cap;       // Most leaves that can be added
+    uint64_t *key;       // Sort key of each leaf
+    int64_t  *weight;    // Weight of each leaf
+    int64_t  *inner;     // Weight of each internal node
+    int     (*kids)[2];  // Children of each internal node, first dequeued
+                         // in [0]
+    int      *tie;       // Tie breaker of each leaf
+    int      *order;     // The leaves, lightest first
+    int      *tmp;       // Used while sorting and merging
+};
+
+
+/**
+ * Returns a new TwoQueue for up to `cap` leaves or NULL if there is an
+ * error.
+ */
+TwoQueue *twoqueue_new (int cap);
+
+
+/**
+ * Frees a TwoQueue.
+ */
+void twoqueue_free (TwoQueue *tq);
+
+
+/**
+ * Empties the TwoQueue.
+ */
+void twoqueue_init (TwoQueue *tq);
+
+
+/**
+ * Adds a leaf of the given weight, which must be at least -1 and less than
+ * 2^46.  Leaves of equal weight are ordered by `tie`, which must be between
+ * -TWOQUEUE_TIES and TWOQUEUE_TIES - 1: the characters of TreeNodes, as
+ * the comparator of pqueue.c orders them, or the symbols of a larger
+ * alphabet.  Internal nodes count as a `tie` of 0.  Returns -1 if the
+ * TwoQueue is full.
+ */
+int twoqueue_add (TwoQueue *tq, int64_t weight, int tie);
+
+
+/**
+ * Merges the leaves into a tree, which takes at least two leaves, and fills
+ * in `kids`.  Whenever two waiting nodes compare equal a leaf goes first and
+ * internal nodes go in the order they were made.
+ *
+ * With `exact` set, returns -1 instead as soon as two waiting nodes compare
+ * equal: the priority queue of pqueue.c may pick either of them, so only a
+ * merge without such ties is sure to give the same tree as merge_nodes.
+ * Returns 0 otherwise.
+ */
+int twoqueue_merge (TwoQueue *tq, int exact);
+
+
+/**
+ * Stores the depth of each leaf in the merged tree in `depth`, indexed by
+ * the order the leaves were added in.
+ */
+void twoqueue_depths (const TwoQueue *tq, unsigned char *depth);
+
+
+/**
+ * Sorts the `n` numbers in `order` by `key[order[i]]`, keeping numbers with
+ * equal keys in the order given.  `tmp` must have room for `n` numbers.
+ */
+void twoqueue_sort (const uint64_t *key, int *order, int *tmp, int n);
+
+#endif